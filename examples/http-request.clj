@@ -0,0 +1,8 @@
+; Fetch a few pages concurrently over pooled keep-alive connections.
+(def urls ["http://example.com/" "http://example.com/?a" "http://example.com/?b"])
+(def responses (doall (map (fn [u] (http/request-async {:url u :as :string :timeout 5000})) urls)))
+(doseq [r responses]
+  (let [res @r]
+    (if (:error res)
+      (println "failed:" (:error res))
+      (println (:status res) (get (:headers res) "content-type") (count (:body res))))))
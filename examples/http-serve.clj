@@ -0,0 +1,9 @@
+; Try: curl localhost:8080/hello/you   curl localhost:8080/count   curl -d hi localhost:8080/echo
+(def hits (atom 0))
+(http/serve
+  [[:get "/hello/(\\w+)" (fn [req] (str "hello " (first (:route-params req)) "\n"))]
+   [:get "/count" (fn [req] {:headers {"Content-Type" "text/plain"}
+                             :body (map (fn [i] (str i "\n")) (range 10))})]
+   [:post "/echo" (fn [req] {:body (:body req)})]
+   [:any ".*" (fn [req] (swap! hits inc) {:status 404 :body (str "no route for " (:uri req) "\n")})]]
+  {:port 8080 :workers 8})
@@ -0,0 +1,11 @@
+; Echo server on one reactor thread. Try it with: nc 127.0.0.1 12345
+(def reactor (net/reactor))
+(def listen (net/listen (net/bind (net/socket) "127.0.0.1" 12345) 1024))
+(net/watch-accept reactor listen
+  (fn [client]
+    (net/watch reactor client
+      (fn [fd data] (net/write reactor fd data))
+      (fn [fd] (println "closed" fd)))))
+(while true
+  (Thread/sleep 5000)
+  (println "connections:" (net/reactor-count reactor)))
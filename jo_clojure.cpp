@@ -110,7 +110,7 @@ enum {
 	NODE_STRING,
 	NODE_SYMBOL,
 	NODE_KEYWORD,
-	//NODE_REGEX,
+	NODE_REGEX,
 	NODE_LIST,
 	NODE_LAZY_LIST,
 	NODE_VECTOR,
@@ -137,6 +137,10 @@ enum {
 	NODE_MYSQL,
 #endif
 	NODE_RECORD,
+	NODE_TENSOR,
+	NODE_REACTOR,
+	NODE_STREAM,
+	NODE_HTTP_SERVER,
 
 	// node flags
 	NODE_FLAG_MACRO        = 1<<0,
@@ -217,6 +221,7 @@ static void node_let(env_ptr_t env, node_idx_t n1i, node_idx_t n2i);
 static node_idx_t eval_node(env_ptr_t env, node_idx_t root);
 static node_idx_t eval_node_list(env_ptr_t env, list_ptr_t list);
 static node_idx_t eval_list(env_ptr_t env, list_ptr_t list, int list_flags=0);
+static list_ptr_t parse_file_forms(env_ptr_t env, const char *path);
 #define list_va(...) new_list()->push_front_inplace(__VA_ARGS__)
 #define eval_va(env, ...) eval_list(env, list_va(__VA_ARGS__))
 
@@ -234,6 +239,9 @@ static void print_node_vector(vector_ptr_t nodes, int depth = 0);
 static void print_node_map(hash_map_ptr_t nodes, int depth = 0);
 static void print_node_set(hash_map_ptr_t nodes, int depth = 0);
 
+static jo_string tensor_as_string(const node_t *n);
+static node_idx_t new_node_regex(const jo_string &pattern, int flags);
+
 struct transaction_t {
 	struct tx_t {
 		node_idx_t old_val;
@@ -687,6 +695,7 @@ struct node_t {
 	inline bool is_future() const { return type == NODE_FUTURE; }
 	inline bool is_promise() const { return type == NODE_PROMISE; }
 	inline bool is_record() const { return type == NODE_RECORD; }
+	inline bool is_tensor() const { return type == NODE_TENSOR; }
 
 	inline bool is_seq() const { return is_list() || is_lazy_list() || is_hash_map() || is_hash_set() || is_vector() || is_string(); }
 	inline bool can_eval() const { return is_symbol() || is_keyword() || is_list() || is_vector() || is_hash_map() || is_hash_set() || is_func() || is_native_func(); }
@@ -906,8 +915,10 @@ struct node_t {
 			case NODE_LAZY_LIST:
 			case NODE_VECTOR:
 			case NODE_MATRIX:
+			case NODE_TENSOR:
 			case NODE_HASH_SET:
-			case NODE_HASH_MAP:    return true; // TODO
+			case NODE_HASH_MAP:
+			case NODE_REGEX:       return true; // TODO
 			case NODE_NIL:
 			default:
 				return false;
@@ -966,68 +977,106 @@ struct node_t {
 			} else {
 				return va("%g", t_float);
 			}
-		case NODE_LIST: 
+		case NODE_LIST:
+		case NODE_VECTOR:
+		case NODE_MATRIX:
+		case NODE_HASH_MAP:
+		case NODE_RECORD:
+		case NODE_HASH_SET:
+		case NODE_LAZY_LIST:
 			{
-				jo_string s;
-				s = '(';
-				if(t_list.ptr) for(list_t::iterator it(t_list); it;) {
-					s += get_node(*it)->as_string(3);
-					++it;
-					if(it) {
-						s += " ";
-					}
-				}
-				s += ')';
-				return s;
+				jo_text_writer_t out(NULL, 256);
+				write(out, pretty);
+				return out.str();
+			}
+		case NODE_TENSOR:
+			return tensor_as_string(this);
+		case NODE_FUTURE:
+			return get_node(deref())->as_string(pretty);
+		}
+		if(pretty >= 1 && type == NODE_KEYWORD) return ":" + t_string;
+		if(pretty >= 3 && type == NODE_STRING) return "\"" + t_string + "\"";
+		if(pretty >= 3 && type == NODE_REGEX) return "#\"" + t_string + "\"";
+		return t_string;
+	}
+
+	// Serializes into out, the same as as_string. Collections are only ever printed through here,
+	// so a big structure costs one pass rather than a string concatenation per element.
+	void write(jo_text_writer_t &out, int pretty = 0) const {
+		switch(type) {
+		case NODE_NIL:
+			out.put("nil", 3);
+			return;
+		case NODE_BOOL:
+			if(t_bool) out.put("true", 4);
+			else out.put("false", 5);
+			return;
+		case NODE_INT:
+			if(flags & NODE_FLAG_CHAR) break;
+			out.putf("%lld", t_int);
+			return;
+		case NODE_STRING:
+			if(pretty >= 3) out.put('"');
+			out.put(t_string.c_str(), t_string.length());
+			if(pretty >= 3) out.put('"');
+			return;
+		case NODE_KEYWORD:
+			if(pretty >= 1) out.put(':');
+			out.put(t_string.c_str(), t_string.length());
+			return;
+		case NODE_SYMBOL:
+			out.put(t_string.c_str(), t_string.length());
+			return;
+		case NODE_REGEX:
+			if(pretty >= 3) out.put("#\"", 2);
+			out.put(t_string.c_str(), t_string.length());
+			if(pretty >= 3) out.put('"');
+			return;
+		case NODE_LIST:
+			out.put('(');
+			if(t_list.ptr) for(list_t::iterator it(t_list); it;) {
+				get_node(*it)->write(out, 3);
+				++it;
+				if(it) out.put(' ');
 			}
+			out.put(')');
+			return;
 		case NODE_VECTOR:
-			{
-				jo_string s;
-				s = '[';
-				if(as_vector().ptr) for(auto it = as_vector()->begin(); it;) {
-					s += get_node(*it)->as_string(3);
-					++it;
-					if(it) {
-						s += " ";
-					}
-				}
-				s += ']';
-				return s;
+			out.put('[');
+			if(as_vector().ptr) for(auto it = as_vector()->begin(); it;) {
+				get_node(*it)->write(out, 3);
+				++it;
+				if(it) out.put(' ');
 			}
+			out.put(']');
+			return;
 		case NODE_MATRIX:
 			{
 				matrix_ptr_t M = as_matrix();
-				jo_string s;
-				s = va("(matrix %d %d [", M->width, M->height);
+				out.putf("(matrix %d %d [", M->width, M->height);
 				for(int j = 0; j < M->height; ++j) {
 					for(int i = 0; i < M->width; ++i) {
-						s += get_node(M->get(i,j))->as_string(3);
-						if(i < M->width - 1) s += " ";
+						get_node(M->get(i,j))->write(out, 3);
+						if(i < M->width - 1) out.put(' ');
 					}
-					if(j < M->height - 1) s += ", ";
+					if(j < M->height - 1) out.put(", ", 2);
 				}
-				s += "])";
-				return s;
+				out.put("])", 2);
+				return;
 			}
 		case NODE_HASH_MAP:
-			{
-				jo_string s;
-				s = '{';
-				if(as_hash_map().ptr) for(auto it = as_hash_map()->begin(); it;) {
-					s += get_node(it->first)->as_string(3);
-					s += " ";
-					s += get_node(it->second)->as_string(3);
-					++it;
-					if(it) {
-						s += ", ";
-					}
-				}
-				s += '}';
-				return s;
+			out.put('{');
+			if(as_hash_map().ptr) for(auto it = as_hash_map()->begin(); it;) {
+				get_node(it->first)->write(out, 3);
+				out.put(' ');
+				get_node(it->second)->write(out, 3);
+				++it;
+				if(it) out.put(", ", 2);
 			}
+			out.put('}');
+			return;
 		case NODE_RECORD:
 			{
-				jo_string s;
 				hash_map_ptr_t map = as_hash_map();
 
 				// Try to get the record type name
@@ -1037,8 +1086,10 @@ struct node_t {
 					record_name = get_node(type_it.second)->t_string;
 				}
 
-				s = "#" + record_name + "{";
-				
+				out.put('#');
+				out.put(record_name.c_str(), record_name.length());
+				out.put('{');
+
 				// Print the fields
 				int count = 0;
 				for(auto it = map->begin(); it;) {
@@ -1050,59 +1101,52 @@ struct node_t {
 					}
 					
 					if (count++ > 0) {
-						s += ", ";
+						out.put(", ", 2);
 					}
 					
 					// Always print field names with colon prefix for consistency in records
 					if (get_node_type(it->first) == NODE_KEYWORD || 
 						get_node_type(it->first) == NODE_SYMBOL) {
-						s += ":" + get_node(it->first)->t_string;
+						out.put(':');
+						get_node(it->first)->write(out, 0);
 					} else {
-						s += get_node(it->first)->as_string(3);
+						get_node(it->first)->write(out, 3);
 					}
-					s += " ";
-					s += get_node(it->second)->as_string(3);
+					out.put(' ');
+					get_node(it->second)->write(out, 3);
 					++it;
 				}
 				
-				s += '}';
-				return s;
+				out.put('}');
+				return;
 			}
 		case NODE_HASH_SET:
-			{
-				jo_string s;
-				s = "#{";
-				if(as_hash_set().ptr) for(auto it = as_hash_set()->begin(); it;) {
-					s += get_node(it->first)->as_string(3);
-					++it;
-					if(it) {
-						s += " ";
-					}
-				}
-				s += '}';
-				return s;
+			out.put("#{", 2);
+			if(as_hash_set().ptr) for(auto it = as_hash_set()->begin(); it;) {
+				get_node(it->first)->write(out, 3);
+				++it;
+				if(it) out.put(' ');
 			}
+			out.put('}');
+			return;
 		case NODE_LAZY_LIST:
 			{
 				int left = 2048;
-				jo_string s;
-				s = '(';
+				out.put('(');
 				for(lazy_list_iterator_t lit(this); !lit.done() && left; --left) {
-					s += get_node(eval_node(lit.env, lit.val))->as_string(3);
+					get_node(eval_node(lit.env, lit.val))->write(out, 3);
 					lit.next();
-					if(!lit.done()) {
-						s += " ";
-					}
+					if(!lit.done()) out.put(' ');
 				}
-				s += ')';
-				return s;
+				out.put(')');
+				return;
 			}
 		case NODE_FUTURE:
-			return get_node(deref())->as_string(pretty);
+			get_node(deref())->write(out, pretty);
+			return;
 		}
-		if(pretty >= 1 && type == NODE_KEYWORD) return ":" + t_string;
-		if(pretty >= 3 && type == NODE_STRING) return "\"" + t_string + "\"";
-		return t_string;
+		jo_string s = as_string(pretty);
+		out.put(s.c_str(), s.length());
 	}
 
 	node_idx_t deref() const {
@@ -1129,6 +1173,7 @@ struct node_t {
 		case NODE_LAZY_LIST: return "lazy-list";
 		case NODE_VECTOR:  return "vector";
 		case NODE_MATRIX:  return "matrix";
+		case NODE_TENSOR:  return "tensor";
 		case NODE_HASH_SET: return "set";
 		case NODE_HASH_MAP:     return "map";
 		case NODE_FUNC:	   return "function";
@@ -1136,6 +1181,7 @@ struct node_t {
 		case NODE_VAR:	   return "var";
 		case NODE_SYMBOL:  return "symbol";
 		case NODE_KEYWORD: return "keyword";
+		case NODE_REGEX:   return "regex";
 		case NODE_ATOM:	   return "atom";
 		case NODE_DELAY:   return "delay";
 		case NODE_FILE:	   return "file";
@@ -1143,6 +1189,9 @@ struct node_t {
 		case NODE_FUTURE:  return "future";
 		case NODE_PROMISE: return "promise";
 		case NODE_RECORD:  return "record";
+		case NODE_REACTOR: return "reactor";
+		case NODE_STREAM:  return "stream";
+		case NODE_HTTP_SERVER: return "http-server";
 		}
 		return "unknown";		
 	}
@@ -1194,7 +1243,7 @@ static inline void node_release(node_idx_unsafe_t idx) {
 static inline node_idx_t new_node(node_t &&n) {
 	// TODO: need try-pop really...
 	//int sector = thread_id & (num_free_sectors-1);
-	int sector = jo_pcg32(&jo_rnd_state) & (num_free_sectors-1);
+	int sector = jo_pcg32(&jo_alloc_rnd_state) & (num_free_sectors-1);
 	//for(int i = 0; i < 1; ++i) {
 		if(free_nodes[sector].size() > processor_count * 2) {
 			node_idx_unsafe_t ni = free_nodes[sector].pop();
@@ -1415,50 +1464,147 @@ enum jo_token_type_t {
 	TOK_SYMBOL,
 	TOK_KEYWORD,
 	TOK_SEPARATOR,
+	TOK_REGEX,
 };
 
+// Tokens are slices of the source (or of a static string for the reader shorthands), never copies.
 struct jo_token_t {
 	jo_token_type_t type;
-	jo_string str;
+	const char *str;
+	int len;
 	int line;
+	bool escaped; // string literal that still has escape sequences in it
+
+	bool is(const char *s) const { return (int)strlen(s) == len && !memcmp(str, s, len); }
+	bool has(char c) const { return memchr(str, c, len) != NULL; }
 };
 
+// Reads over a byte range: a mapped file, a bulk read of a stream, or a string.
 struct parse_state_t {
-	FILE *fp = 0;
 	const char *buf = 0;
 	const char *buf_end = 0;
-	char unget_buf[32];
-	int unget_cnt = 0;
 	int line_num = 1;
+	void *mapping = 0;
+	size_t mapping_size = 0;
+	char *owned = 0;
+
+	parse_state_t() {}
+	parse_state_t(const parse_state_t &) = delete;
+	~parse_state_t() {
+		jo_munmap_file(mapping, mapping_size);
+		free(owned);
+	}
+
+	bool open(const char *path) {
+		mapping = jo_mmap_file(path, &mapping_size);
+		if(mapping) {
+			buf = (const char *)mapping;
+			buf_end = buf + mapping_size;
+			return true;
+		}
+		// empty files can't be mapped
+		size_t size = 0;
+		owned = (char *)jo_slurp_file(path, &size);
+		buf = owned;
+		buf_end = owned + size;
+		return owned != 0;
+	}
+
+	// reads the rest of the stream up front
+	void read(FILE *fp) {
+		size_t size = 0, cap = 1 << 16;
+		owned = (char *)malloc(cap);
+		for(size_t n; (n = fread(owned + size, 1, cap - size, fp)) > 0;) {
+			size += n;
+			if(size == cap) owned = (char *)realloc(owned, cap *= 2);
+		}
+		buf = owned;
+		buf_end = owned + size;
+	}
+
 	int getc() {
-		int c;
-		if(unget_cnt) c = unget_buf[--unget_cnt];
-		else if(fp) c = fgetc(fp);
-		else if(buf && buf < buf_end) c = *buf++;
-		else c = EOF;
+		if(buf >= buf_end) return EOF;
+		int c = (unsigned char)*buf++;
 		if(c == '\n') {
 			line_num++;
 		}
 		return c;
 	}
+	// only ever the character just read
 	void ungetc(int c) {
 		if(c == EOF) return;
 		if(c == '\n') {
 			line_num--;
-		};
-		assert(unget_cnt < sizeof(unget_buf));
-		unget_buf[unget_cnt++] = (char)c;
+		}
+		buf--;
 	}
 };
 
+// The reader hands out one node per distinct symbol or keyword. Parsed nodes live forever, so the
+// table never needs to let go of them. Other readers make their own table with collectable nodes,
+// held only for the duration of a read, and may also intern strings (e.g. JSON object keys).
+struct parse_intern_t {
+	struct entry_t {
+		uint32_t hash = 0;
+		node_idx_t idx;
+	};
+	jo_vector<entry_t> table;
+	size_t count = 0;
+	int flags;
+
+	// size must be a power of two
+	parse_intern_t(int node_flags = NODE_FLAG_FOREVER, size_t size = 1024) : table(size), flags(node_flags) {}
+
+	node_idx_t get(int type, const char *str, int len) {
+		uint32_t h = 2166136261u ^ type;
+		for(int i = 0; i < len; ++i) h = (h ^ (unsigned char)str[i]) * 16777619u;
+		h |= 1; // 0 marks an empty slot
+		size_t mask = table.size() - 1;
+		for(size_t i = h & mask;; i = (i + 1) & mask) {
+			entry_t &e = table[i];
+			if(!e.hash) break;
+			if(e.hash == h) {
+				node_t *n = get_node(e.idx);
+				if(n->type == type && n->t_string.length() == (size_t)len && !memcmp(n->t_string.c_str(), str, len)) {
+					return e.idx;
+				}
+			}
+		}
+		node_idx_t idx = type == NODE_KEYWORD ? new_node_keyword(jo_string(str, len), flags)
+			: type == NODE_STRING ? new_node_string(jo_string(str, len), flags) : new_node_symbol(jo_string(str, len), flags);
+		if((count + 1) * 2 > table.size()) {
+			jo_vector<entry_t> old(std::move(table));
+			table = jo_vector<entry_t>(old.size() * 2);
+			mask = table.size() - 1;
+			for(size_t j = 0; j < old.size(); ++j) {
+				if(!old[j].hash) continue;
+				size_t i = old[j].hash & mask;
+				while(table[i].hash) i = (i + 1) & mask;
+				table[i] = old[j];
+			}
+		}
+		size_t i = h & mask;
+		while(table[i].hash) i = (i + 1) & mask;
+		table[i].hash = h;
+		table[i].idx = idx;
+		count++;
+		return idx;
+	}
+};
+static thread_local parse_intern_t parse_intern;
+
 static jo_token_t get_token(parse_state_t *state) {
+	jo_token_t tok;
+	tok.type = TOK_EOF;
+	tok.str = "";
+	tok.len = 0;
+	tok.escaped = false;
+
 	// skip leading whitepsace and comma
 	do {
 		int c = state->getc();
 		if(c == EOF) {
-			jo_token_t tok;
 			tok.line = state->line_num;
-			tok.type = TOK_EOF;
 			debugf("token: EOF\n");
 			return tok;
 		}
@@ -1468,17 +1614,10 @@ static jo_token_t get_token(parse_state_t *state) {
 		}
 	} while(true);
 
-	jo_token_t tok;
 	tok.line = state->line_num;
 
+	const char *start = state->buf;
 	int c = state->getc();
-	
-	// handle special case of end of file reached
-	if(c == EOF) {
-		tok.type = TOK_EOF;
-		debugf("token: EOF\n");
-		return tok;
-	}
  
 	/*
 	if(c == '\\') {
@@ -1490,7 +1629,8 @@ static jo_token_t get_token(parse_state_t *state) {
 	*/
 	if(c == '"') {
 		tok.type = TOK_STRING;
-		// string literal
+		// string literal, decoded later if it has escapes in it
+		tok.str = state->buf;
 		do {
 			int C = state->getc();
 			if (C == EOF) {
@@ -1499,30 +1639,17 @@ static jo_token_t get_token(parse_state_t *state) {
 			}
 			// escape next character
 			if(C == '\\') {
-				C = state->getc();
-				if(C == EOF) {
+				tok.escaped = true;
+				if(state->getc() == EOF) {
 					fprintf(stderr, "unterminated string on line %i\n", state->line_num);
 					exit(__LINE__);
 				}
-				switch(C) {
-				case 'n': C = '\n'; break;
-				case 't': C = '\t'; break;
-				case 'r': C = '\r'; break;
-				case 'b': C = '\b'; break;
-				case 'a': C = '\a'; break;
-				case '\\': C = '\\'; break;
-				case '"': C = '"'; break;
-				default:
-					fprintf(stderr, "unknown escape sequence \\%c on line %i\n", C, state->line_num);
-					exit(__LINE__);
-				}
-
 			} else if(C == '"') {
 				break;
 			}
-			tok.str += C;
 		} while (true);
-		debugf("token: %s\n", tok.str.c_str());
+		tok.len = (int)(state->buf - 1 - tok.str);
+		debugf("token: %.*s\n", tok.len, tok.str);
 		return tok;
 	}
 	if(c == '#') {
@@ -1531,7 +1658,29 @@ static jo_token_t get_token(parse_state_t *state) {
 			// shorthand for inline function
 			tok.type = TOK_SEPARATOR;
 			tok.str = "__fn";
-			debugf("token: %s\n", tok.str.c_str());
+			tok.len = 4;
+			return tok;
+		} else if(C == '"') {
+			// regex literal, kept raw: backslashes belong to the pattern and only stop \" ending it
+			tok.type = TOK_REGEX;
+			tok.str = state->buf;
+			do {
+				int C2 = state->getc();
+				if(C2 == EOF) {
+					fprintf(stderr, "unterminated regex on line %i\n", state->line_num);
+					exit(__LINE__);
+				}
+				if(C2 == '\\') {
+					if(state->getc() == EOF) {
+						fprintf(stderr, "unterminated regex on line %i\n", state->line_num);
+						exit(__LINE__);
+					}
+				} else if(C2 == '"') {
+					break;
+				}
+			} while(true);
+			tok.len = (int)(state->buf - 1 - tok.str);
+			debugf("token: #\"%.*s\"\n", tok.len, tok.str);
 			return tok;
 		} else {
 			state->ungetc(C);
@@ -1540,7 +1689,7 @@ static jo_token_t get_token(parse_state_t *state) {
 	if(c == '\'') {
 		tok.type = TOK_SEPARATOR;
 		tok.str = "quote";
-		debugf("token: %s\n", tok.str.c_str());
+		tok.len = 5;
 		return tok;
 	}
 	if(c == '#') {
@@ -1548,14 +1697,14 @@ static jo_token_t get_token(parse_state_t *state) {
 		if(C == '{') {
 			tok.type = TOK_SEPARATOR;
 			tok.str = "hash-set";
-			debugf("token: %s\n", tok.str.c_str());
+			tok.len = 8;
 			return tok;
 		}
 	}
 	if(c == '`') {
 		tok.type = TOK_SEPARATOR;
 		tok.str = "quasiquote";
-		debugf("token: %s\n", tok.str.c_str());
+		tok.len = 10;
 		return tok;
 	}
 	if(c == '~') {
@@ -1564,80 +1713,143 @@ static jo_token_t get_token(parse_state_t *state) {
 		if(C == '@') {
 			// shorthand for inline function
 			tok.str = "unquote-splice";
-			debugf("token: %s\n", tok.str.c_str());
+			tok.len = 14;
 			return tok;
 		} else {
 			state->ungetc(C);
 		}
 		tok.str = "unquote";
-		debugf("token: %s\n", tok.str.c_str());
+		tok.len = 7;
 		return tok;
 	}
 	if(c == '@') {
 		tok.type = TOK_SEPARATOR;
 		tok.str = "deref";
-		debugf("token: %s\n", tok.str.c_str());
+		tok.len = 5;
 		return tok;
 	}
 	if(c == ':') {
 		tok.type = TOK_KEYWORD;
 		// string literal of a keyword
-		int C = state->getc();
-		do {
-			if(is_whitespace(C) || is_separator(C) || C == EOF) {
-				state->ungetc(C);
-				break;
-			}
-			tok.str += C;
-			C = state->getc();
-		} while (true);
-		debugf("token: %s\n", tok.str.c_str());
+		tok.str = state->buf;
+		while(state->buf < state->buf_end && !is_whitespace(*state->buf) && !is_separator(*state->buf)) {
+			state->buf++;
+		}
+		tok.len = (int)(state->buf - tok.str);
+		debugf("token: %.*s\n", tok.len, tok.str);
 		return tok;
 	}
 	if(c == ';') {
 		// comment (skip)
-		do {
-			int C = state->getc();
-			if (C == EOF) {
-				fprintf(stderr, "unterminated comment\n");
-				exit(__LINE__);
-			}
-			if(C == '\n') break;
-		} while(true);
+		const char *eol = (const char *)memchr(state->buf, '\n', state->buf_end - state->buf);
+		if(!eol) {
+			fprintf(stderr, "unterminated comment\n");
+			exit(__LINE__);
+		}
+		state->buf = eol + 1;
+		state->line_num++;
 		return get_token(state); // recurse
 	}
 	if(is_separator(c)) {
 		tok.type = TOK_SEPARATOR;
 		// vector, list, map, set
-		tok.str += c;
-		debugf("token: %s\n", tok.str.c_str());
+		tok.str = start;
+		tok.len = 1;
+		debugf("token: %c\n", c);
 		return tok;
 	}
 
 	// while not whitespace, or separator, get characters
 	tok.type = TOK_SYMBOL;
-	do {
-		if(is_whitespace(c) || is_separator(c) || c == EOF) {
-			state->ungetc(c);
-			break;
-		}
-		tok.str += (char)c;
-		c = state->getc();
-	} while(true);
+	while(state->buf < state->buf_end && !is_whitespace(*state->buf) && !is_separator(*state->buf)) {
+		state->buf++;
+	}
+	tok.str = start;
+	tok.len = (int)(state->buf - start);
 	
-	if(tok.str.c_str()[0] == '\\') {
+	if(tok.str[0] == '\\') {
 		// escape sequence
-		if(tok.str == "\\space") tok.str = "32";
-		else tok.str = va("%i", tok.str.c_str()[1]);
-		debugf("token: %s\n", tok.str.c_str());
+		if(tok.is("\\space")) tok.str = "32";
+		else tok.str = va("%i", tok.len > 1 ? tok.str[1] : 0);
+		tok.len = (int)strlen(tok.str);
+		debugf("token: %s\n", tok.str);
 		return tok;
 	}
 	
-	debugf("token: %s\n", tok.str.c_str());
+	debugf("token: %.*s\n", tok.len, tok.str);
 
 	return tok;
 }
 
+static jo_string parse_string_literal(const jo_token_t &tok) {
+	if(!tok.escaped) {
+		return jo_string(tok.str, tok.len);
+	}
+	jo_string s(tok.str, tok.len);
+	char *out = s.str;
+	for(const char *p = tok.str, *end = tok.str + tok.len; p < end; ++p) {
+		char C = *p;
+		if(C == '\\') {
+			C = *++p;
+			switch(C) {
+			case 'n': C = '\n'; break;
+			case 't': C = '\t'; break;
+			case 'r': C = '\r'; break;
+			case 'b': C = '\b'; break;
+			case 'a': C = '\a'; break;
+			case '\\': C = '\\'; break;
+			case '"': C = '"'; break;
+			default:
+				fprintf(stderr, "unknown escape sequence \\%c on line %i\n", C, tok.line);
+				exit(__LINE__);
+			}
+		}
+		*out++ = C;
+	}
+	*out = 0;
+	s.size = out - s.str + 1;
+	return s;
+}
+
+// Parses a decimal float from a token, stopping at the first character that can't be part of one
+// like atof. Exact when the digits fit in 53 bits and the power of ten is exactly representable,
+// otherwise strtod does it.
+static double parse_float(const char *p, const char *end) {
+	static const double pow10[] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22};
+	const char *start = p;
+	bool neg = p < end && *p == '-';
+	if(neg || (p < end && *p == '+')) p++;
+	uint64_t mant = 0;
+	int digits = 0, exp10 = 0;
+	for(; p < end && is_num(*p); ++p, ++digits) mant = mant * 10 + (*p - '0');
+	if(p < end && *p == '.') {
+		for(++p; p < end && is_num(*p); ++p, ++digits, --exp10) mant = mant * 10 + (*p - '0');
+	}
+	if(p < end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		bool eneg = q < end && *q == '-';
+		if(eneg || (q < end && *q == '+')) q++;
+		if(q < end && is_num(*q)) {
+			int e = 0;
+			for(; q < end && is_num(*q); ++q) e = jo_min(e * 10 + (*q - '0'), 100000);
+			exp10 += eneg ? -e : e;
+			p = q;
+		}
+	}
+	if(digits <= 19 && mant <= (1ull << 53) && exp10 >= -22 && exp10 <= 22) {
+		double v = (double)mant;
+		v = exp10 < 0 ? v / pow10[-exp10] : v * pow10[exp10];
+		return neg ? -v : v;
+	}
+	char tmp[128];
+	if(p - start >= (ptrdiff_t)sizeof(tmp)) {
+		return strtod(jo_string(start, p - start).c_str(), NULL);
+	}
+	memcpy(tmp, start, p - start);
+	tmp[p - start] = 0;
+	return strtod(tmp, NULL);
+}
+
 static list_ptr_t get_symbols_list_r(list_ptr_t list);
 static list_ptr_t get_symbols_vector_r(vector_ptr_t list);
 
@@ -1697,17 +1909,17 @@ static list_ptr_t get_symbols_list_r(list_ptr_t list) {
 
 static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_sep) {
 	jo_token_t tok = get_token(state);
-	debugf("parse_next \"%s\", with '%c'\n", tok.str.c_str(), stop_on_sep);
+	debugf("parse_next \"%.*s\", with '%c'\n", tok.len, tok.str, stop_on_sep);
 
 	if(tok.type == TOK_EOF) {
 		// end of list
 		return INV_NODE;
 	}
 
-	const char *tok_ptr = tok.str.c_str();
-	const char *tok_ptr_end = tok_ptr + tok.str.length();
-	int c = tok_ptr[0];
-	int c2 = tok_ptr[1];
+	const char *tok_ptr = tok.str;
+	const char *tok_ptr_end = tok_ptr + tok.len;
+	int c = tok.len > 0 ? tok_ptr[0] : 0;
+	int c2 = tok.len > 1 ? tok_ptr[1] : 0;
 
 	if(c == stop_on_sep && tok.type != TOK_STRING) {
 		// end of list
@@ -1723,105 +1935,102 @@ static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_se
 	// literals
 	//
 
-	// container types
-	//if(c == '#' && c2 == '"') return parse_regex(state);
+	if(tok.type == TOK_REGEX) {
+		debugf("regex: %.*s\n", tok.len, tok.str);
+		return new_node_regex(jo_string(tok.str, tok.len), NODE_FLAG_FOREVER);
+	}
 	// parse number...
 	if(tok.type == TOK_STRING) {
-		debugf("string: %s\n", tok.str.c_str());
-		return new_node_string(tok.str.c_str(), NODE_FLAG_FOREVER);
+		debugf("string: %.*s\n", tok.len, tok.str);
+		return new_node_string(parse_string_literal(tok), NODE_FLAG_FOREVER);
 	} 
 	if(is_num(c) || (c == '-' && is_num(c2))) {
-		// floating point
-		if(tok.str.find('.') != jo_npos) {
-			double float_val = atof(tok_ptr);
+		// the radix prefix comes first, hex digits include 'e' and 'E'
+		bool neg = c == '-';
+		const char *digits = tok_ptr + neg;
+		int radix = 10;
+		if(digits[0] == '0' && tok_ptr_end - digits > 1) {
+			if(digits[1] == 'x' || digits[1] == 'X') radix = 16;
+			else if(digits[1] == 'b' || digits[1] == 'B') radix = 2;
+		}
+		// floating point, or scientific notation
+		if(radix == 10 && (tok.has('.') || tok.has('e') || tok.has('E'))) {
+			double float_val = parse_float(tok_ptr, tok_ptr_end);
 			debugf("float: %g\n", float_val);
 			return new_node_float(float_val, NODE_FLAG_FOREVER);
 		}
-
-		// Also check for scientific notation (e or E in the token)
-		if(tok.str.find('e') != jo_npos || tok.str.find('E') != jo_npos) {
-			double float_val = atof(tok_ptr);
-			debugf("float (scientific): %g\n", float_val);
-			return new_node_float(float_val, NODE_FLAG_FOREVER);
+		if(radix != 10) {
+			// 0x hexadecimal, 0b binary
+			digits += 2;
+		} else if(digits[0] == '0' && tok_ptr_end - digits > 1) {
+			// 0 octal
+			radix = 8;
+			digits += 1;
 		}
 
-		int int_val = 0;
-		// 0x hexadecimal
-		if(c == '0' && (c2 == 'x' || c2 == 'X')) {
-			tok_ptr += 2;
-			// parse hex from tok_ptr
-			while(is_alnum(*tok_ptr)) {
-				int_val <<= 4;
-				int_val += *tok_ptr - '0';
-				if(*tok_ptr >= 'a' && *tok_ptr <= 'f') int_val -= 'a' - '0' - 10; 
-				if(*tok_ptr >= 'A' && *tok_ptr <= 'F') int_val -= 'A' - '0' - 10;
-				tok_ptr++;
-			}
-		}
-		// 0b binary
-		else if(c == '0' && (c2 == 'b' || c2 == 'B')) {
-			tok_ptr += 2;
-			// parse binary from tok_ptr
-			while(is_alnum(*tok_ptr)) {
-				int_val <<= 1;
-				int_val += *tok_ptr - '0';
-				tok_ptr++;
+		// too big for 64 bits reads as a float rather than wrapping
+		uint64_t mag = 0, limit = neg ? 1ull << 63 : (1ull << 63) - 1;
+		for(const char *p = digits; p < tok_ptr_end && is_alnum(*p); ++p) {
+			unsigned d = *p >= 'a' ? *p - 'a' + 10 : *p >= 'A' ? *p - 'A' + 10 : *p - '0';
+			if(d >= (unsigned)radix) {
+				break;
 			}
-		}
-		// 0 octal
-		else if(c == '0' && tok.str.length() > 1) {
-			tok_ptr += 1;
-			// parse octal from tok_ptr
-			while(is_alnum(*tok_ptr)) {
-				int_val <<= 3;
-				int_val += *tok_ptr - '0';
-				tok_ptr++;
+			if(mag > (limit - d) / radix) {
+				if(radix == 10) {
+					return new_node_float(parse_float(tok.str, tok_ptr_end), NODE_FLAG_FOREVER);
+				}
+				double float_val = 0;
+				for(p = digits; p < tok_ptr_end && is_alnum(*p); ++p) {
+					d = *p >= 'a' ? *p - 'a' + 10 : *p >= 'A' ? *p - 'A' + 10 : *p - '0';
+					if(d >= (unsigned)radix) break;
+					float_val = float_val * radix + d;
+				}
+				return new_node_float(neg ? -float_val : float_val, NODE_FLAG_FOREVER);
 			}
+			mag = mag * radix + d;
 		}
-		else {
-			int_val = atoi(tok_ptr);
-		}
+		long long int_val = neg ? (long long)(0 - mag) : (long long)mag;
 		// Create a new number node
-		debugf("int: %d\n", int_val);
+		debugf("int: %lld\n", int_val);
 		return new_node_int(int_val, NODE_FLAG_FOREVER);
 	} 
 	if(tok.type == TOK_KEYWORD) {
-		debugf("keyword: %s\n", tok.str.c_str());
-		if(tok.str == "else") return K_ELSE_NODE;
-		if(tok.str == "when") return K_WHEN_NODE;
-		if(tok.str == "while") return K_WHILE_NODE;
-		if(tok.str == "let") return K_LET_NODE;
-		if(tok.str == "meta") return K_META_NODE;
-		if(tok.str == "validator") return K_VALIDATOR_NODE;
-		if(tok.str == "error-handler") return K_ERROR_HANDLER_NODE;
-		if(tok.str == "error-mode") return K_ERROR_MODE_NODE;
-		if(tok.str == "continue") return K_CONTINUE_NODE;
-		if(tok.str == "fail") return K_FAIL_NODE;
-		if(tok.str == "default") return K_DEFAULT_NODE;
-		if(tok.str == "__PC__") return K_PC_NODE;
-		if(tok.str == "__ALL__") return K_ALL_NODE;
-		if(tok.str == "__BY__") return K_BY_NODE;
-		if(tok.str == "__AUTO_DEREF__") return K_AUTO_DEREF_NODE;
-		return new_node_keyword(tok.str.c_str(), NODE_FLAG_FOREVER);
+		debugf("keyword: %.*s\n", tok.len, tok.str);
+		if(tok.is("else")) return K_ELSE_NODE;
+		if(tok.is("when")) return K_WHEN_NODE;
+		if(tok.is("while")) return K_WHILE_NODE;
+		if(tok.is("let")) return K_LET_NODE;
+		if(tok.is("meta")) return K_META_NODE;
+		if(tok.is("validator")) return K_VALIDATOR_NODE;
+		if(tok.is("error-handler")) return K_ERROR_HANDLER_NODE;
+		if(tok.is("error-mode")) return K_ERROR_MODE_NODE;
+		if(tok.is("continue")) return K_CONTINUE_NODE;
+		if(tok.is("fail")) return K_FAIL_NODE;
+		if(tok.is("default")) return K_DEFAULT_NODE;
+		if(tok.is("__PC__")) return K_PC_NODE;
+		if(tok.is("__ALL__")) return K_ALL_NODE;
+		if(tok.is("__BY__")) return K_BY_NODE;
+		if(tok.is("__AUTO_DEREF__")) return K_AUTO_DEREF_NODE;
+		return parse_intern.get(NODE_KEYWORD, tok.str, tok.len);
 	}
 	if(tok.type == TOK_SYMBOL) {
-		debugf("symbol: %s\n", tok.str.c_str());
+		debugf("symbol: %.*s\n", tok.len, tok.str);
 		// fixed symbols
-		if(tok.str == "%") return PCT_NODE;
-		if(tok.str == "%1") return PCT1_NODE;
-		if(tok.str == "%2") return PCT2_NODE;
-		if(tok.str == "%3") return PCT3_NODE;
-		if(tok.str == "%4") return PCT4_NODE;
-		if(tok.str == "%5") return PCT5_NODE;
-		if(tok.str == "%6") return PCT6_NODE;
-		if(tok.str == "%7") return PCT7_NODE;
-		if(tok.str == "%8") return PCT8_NODE;
-		if(tok.str == "&") return AMP_NODE;
-		node_idx_t ret = new_node_symbol(tok.str.c_str(), NODE_FLAG_FOREVER);
+		if(tok.is("%")) return PCT_NODE;
+		if(tok.is("%1")) return PCT1_NODE;
+		if(tok.is("%2")) return PCT2_NODE;
+		if(tok.is("%3")) return PCT3_NODE;
+		if(tok.is("%4")) return PCT4_NODE;
+		if(tok.is("%5")) return PCT5_NODE;
+		if(tok.is("%6")) return PCT6_NODE;
+		if(tok.is("%7")) return PCT7_NODE;
+		if(tok.is("%8")) return PCT8_NODE;
+		if(tok.is("&")) return AMP_NODE;
+		node_idx_t ret = parse_intern.get(NODE_SYMBOL, tok.str, tok.len);
 		/* // NOTE: This is broken... don't re-enable. 
 		node_idx_t node = env->get(ret);
 		if(node != INV_NODE && get_node_flags(node) & NODE_FLAG_PRERESOLVE) {
-			debugf("pre-resolve symbol: %s\n", tok.str.c_str());
+			debugf("pre-resolve symbol: %.*s\n", tok.len, tok.str);
 			return node;
 		}
 		*/
@@ -1829,7 +2038,7 @@ static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_se
 	} 
 
 	// parse quote shorthand
-	if(tok.type == TOK_SEPARATOR && tok.str == "quote") {
+	if(tok.type == TOK_SEPARATOR && tok.is("quote")) {
 		node_idx_t inner = parse_next(env, state, stop_on_sep);
 		if(inner == INV_NODE) {
 			return INV_NODE;
@@ -1847,7 +2056,7 @@ static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_se
 	}
 
 	// parse hash-set shorthand
-	if(tok.type == TOK_SEPARATOR && tok.str == "hash-set") {
+	if(tok.type == TOK_SEPARATOR && tok.is("hash-set")) {
 		debugf("hash-set begin\n");
 		node_idx_t next = parse_next(env, state, '}');
 		if(next == INV_NODE) {
@@ -1871,7 +2080,7 @@ static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_se
 	}
 
 	// parse unquote shorthand
-	if(tok.type == TOK_SEPARATOR && tok.str == "unquote") {
+	if(tok.type == TOK_SEPARATOR && tok.is("unquote")) {
 		node_idx_t inner = parse_next(env, state, stop_on_sep);
 		if(inner == INV_NODE) {
 			return INV_NODE;
@@ -1886,7 +2095,7 @@ static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_se
 	}
 
 	// parse unquote shorthand
-	if(tok.type == TOK_SEPARATOR && tok.str == "unquote-splice") {
+	if(tok.type == TOK_SEPARATOR && tok.is("unquote-splice")) {
 		node_idx_t inner = parse_next(env, state, stop_on_sep);
 		if(inner == INV_NODE) {
 			return INV_NODE;
@@ -1900,7 +2109,7 @@ static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_se
 		return new_node(std::move(n));
 	}
 
-	if(tok.type == TOK_SEPARATOR && tok.str == "quasiquote") {
+	if(tok.type == TOK_SEPARATOR && tok.is("quasiquote")) {
 		node_idx_t inner = parse_next(env, state, stop_on_sep);
 		if(inner == INV_NODE) {
 			return INV_NODE;
@@ -1914,7 +2123,7 @@ static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_se
 		return new_node(std::move(n));
 	}
 
-	if(tok.type == TOK_SEPARATOR && tok.str == "deref") {
+	if(tok.type == TOK_SEPARATOR && tok.is("deref")) {
 		node_idx_t inner = parse_next(env, state, stop_on_sep);
 		if(inner == INV_NODE) {
 			return INV_NODE;
@@ -1930,7 +2139,7 @@ static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_se
 
 	// anonymous function shorthand. 
 	// Note: Analyze the function tree at parse time? I think this is correct?
-	if(tok.type == TOK_SEPARATOR && tok.str == "__fn") {
+	if(tok.type == TOK_SEPARATOR && tok.is("__fn")) {
 		debugf("list begin\n");
 		node_idx_t next = parse_next(env, state, ')');
 		if(next == INV_NODE) {
@@ -3130,80 +3339,115 @@ static node_idx_t native_if_some(env_ptr_t env, list_ptr_t args) {
 }
 
 
-static node_idx_t native_print_str(env_ptr_t env, list_ptr_t args) {
-	jo_string s;
+// Per-thread buffered output behind *out* and *err*. Print calls serialize straight into the calling
+// thread's buffer. While *flush-on-newline* is true (the default) the buffer is handed to the FILE
+// whenever a call ends a line (println, prn, newline, a printf format with a newline), so output
+// interleaves with other threads and with C stdio a line at a time; print and pr on their own wait
+// for the line to finish. Set it to false and the buffer only goes out when it fills, on (flush),
+// or when the thread exits, which saves a locked write per line when printing reports.
+static thread_local jo_text_writer_t print_out_buffer(stdout), print_err_buffer(stderr);
+
+template<typename F>
+static void print_with(env_ptr_t env, bool newline, F write) {
+	static node_idx_t out_sym = new_node_symbol("*out*", NODE_FLAG_FOREVER);
+	static node_idx_t flush_sym = new_node_symbol("*flush-on-newline*", NODE_FLAG_FOREVER);
+	FILE *fp = stdout;
+	node_idx_t stream = env->get(out_sym);
+	if(stream != INV_NODE && get_node_type(stream) == NODE_FILE && get_node(stream)->t_file) {
+		fp = get_node(stream)->t_file;
+	}
+	if(fp != stdout && fp != stderr) {
+		// files opened from clojure can be closed at any time, so nothing is held back for them
+		jo_text_writer_t out(fp, 4096);
+		write(out);
+		out.flush();
+		return;
+	}
+	jo_text_writer_t &out = fp == stdout ? print_out_buffer : print_err_buffer;
+	write(out);
+	if(!newline) return;
+	node_idx_t flush = env->get(flush_sym);
+	if(flush == INV_NODE || get_node(flush)->as_bool()) {
+		out.flush();
+	}
+}
+
+static void print_args(jo_text_writer_t &out, list_ptr_t args, int pretty) {
 	for(list_t::iterator i(args); i;) {
-		node_idx_t n = *i++;
-		s += get_node(n)->as_string(2);
+		get_node(*i)->write(out, pretty);
+		++i;
 		if(i) {
-			s += " ";
+			out.put(' ');
 		}
 	}
-	return new_node_string(s);
+}
+
+static node_idx_t native_print_str(env_ptr_t env, list_ptr_t args) {
+	jo_text_writer_t out(NULL, 256);
+	print_args(out, args, 2);
+	return new_node_string(out.str());
 }
 
 static node_idx_t native_println_str(env_ptr_t env, list_ptr_t args) {
-	jo_string s;
-	for(list_t::iterator i(args); i;) {
-		node_idx_t n = *i++;
-		s += get_node(n)->as_string(2);
-		if(i) {
-			s += " ";
-		}
-	}
-	s += "\n";
-	return new_node_string(s);
+	jo_text_writer_t out(NULL, 256);
+	print_args(out, args, 2);
+	out.put('\n');
+	return new_node_string(out.str());
 }
 
 static node_idx_t native_print(env_ptr_t env, list_ptr_t args) {
-	node_idx_t s_idx = native_print_str(env, args);
-	printf("%s", get_node(s_idx)->as_string(2).c_str());
+	print_with(env, false, [&](jo_text_writer_t &out) { print_args(out, args, 2); });
 	return NIL_NODE;
 }
 
 static node_idx_t native_println(env_ptr_t env, list_ptr_t args) {
-	node_idx_t s_idx = native_print_str(env, args);
-	printf("%s\n", get_node(s_idx)->as_string(2).c_str());
+	print_with(env, true, [&](jo_text_writer_t &out) {
+		print_args(out, args, 2);
+		out.put('\n');
+	});
 	return NIL_NODE;	
 }
 
 static node_idx_t native_pr(env_ptr_t env, list_ptr_t args) {
-	for(list_t::iterator i(args); i;) {
-		node_idx_t n = *i;
-		printf("%s", get_node(n)->as_string(3).c_str());
-		++i;
-		if(i) {
-			printf(" ");
-		}
-	}
+	print_with(env, false, [&](jo_text_writer_t &out) { print_args(out, args, 3); });
 	return NIL_NODE;
 }
 
 static node_idx_t native_prn(env_ptr_t env, list_ptr_t args) {
-	native_pr(env, args);
-	printf("\n");
+	print_with(env, true, [&](jo_text_writer_t &out) {
+		print_args(out, args, 3);
+		out.put('\n');
+	});
 	return NIL_NODE;
 }
 
 static node_idx_t native_pr_str(env_ptr_t env, list_ptr_t args) {
-	jo_string s;
-	for(list_t::iterator i(args); i;) {
-		node_idx_t n = *i;
-		s += get_node(n)->as_string(3);
-		++i;
-		if(i) {
-			s += " ";
-		}
-	}
-	return new_node_string(s);
+	jo_text_writer_t out(NULL, 256);
+	print_args(out, args, 3);
+	return new_node_string(out.str());
 }
 
 static node_idx_t native_prn_str(env_ptr_t env, list_ptr_t args) {
-	jo_string s;
-	node_idx_t pr_str_result = native_pr_str(env, args);
-	s = get_node(pr_str_result)->as_string();
-	s += "\n";
-	return new_node_string(s);
+	jo_text_writer_t out(NULL, 256);
+	print_args(out, args, 3);
+	out.put('\n');
+	return new_node_string(out.str());
+}
+
+// (flush)
+// Writes out anything this thread has printed but not yet handed to *out* and *err*, and flushes
+// the file *out* is bound to.
+static node_idx_t native_flush(env_ptr_t env, list_ptr_t args) {
+	static node_idx_t out_sym = new_node_symbol("*out*", NODE_FLAG_FOREVER);
+	print_out_buffer.flush();
+	print_err_buffer.flush();
+	fflush(stdout);
+	fflush(stderr);
+	node_idx_t stream = env->get(out_sym);
+	if(stream != INV_NODE && get_node_type(stream) == NODE_FILE && get_node(stream)->t_file) {
+		fflush(get_node(stream)->t_file);
+	}
+	return NIL_NODE;
 }
 
 static node_idx_t native_printf(env_ptr_t env, list_ptr_t args) {
@@ -3230,59 +3474,59 @@ static node_idx_t native_printf(env_ptr_t env, list_ptr_t args) {
     }
     
     // Process format string
-    size_t pos = 0;
-    size_t arg_index = 0;
+    print_with(env, format_str.find('\n') != jo_npos, [&](jo_text_writer_t &out) {
+        size_t pos = 0;
+        size_t arg_index = 0;
     
-    while (pos < format_str.length()) {
-        if (format_str[pos] == '%' && pos + 1 < format_str.length()) {
-            if (format_str[pos + 1] == '%') {
-                // Escaped % character
-                printf("%%");
-                pos += 2;
-            } else {
-                // The next character is the format specifier (simplified approach)
-                char format_char = format_str[pos + 1];
+        while (pos < format_str.length()) {
+            if (format_str[pos] == '%' && pos + 1 < format_str.length()) {
+                if (format_str[pos + 1] == '%') {
+                    // Escaped % character
+                    out.put('%');
+                    pos += 2;
+                } else {
+                    // The next character is the format specifier (simplified approach)
+                    char format_char = format_str[pos + 1];
                 
-                if (arg_index >= arg_values.size()) {
-                    warnf("printf: not enough arguments for format string\n");
-                    return NIL_NODE;
-                }
+                    if (arg_index >= arg_values.size()) {
+                        warnf("printf: not enough arguments for format string\n");
+                        return;
+                    }
                 
-                node_idx_t arg = arg_values[arg_index++];
+                    node_idx_t arg = arg_values[arg_index++];
                 
-                switch (format_char) {
-                    case 'd':
-                    case 'i':
-                        printf("%lld", get_node_int(arg));
-                        break;
-                    case 'f':
-                    case 'g':
-                        printf("%g", get_node_float(arg));
-                        break;
-                    case 's':
-                        {
-                            node_t* str_node = get_node(arg);
-                            if (str_node->type == NODE_STRING) {
-                                printf("%s", str_node->t_string.c_str());
-                            } else {
-                                printf("%s", get_node_string(arg).c_str());
+                    switch (format_char) {
+                        case 'd':
+                        case 'i':
+                            out.putf("%lld", get_node_int(arg));
+                            break;
+                        case 'f':
+                        case 'g':
+                            out.putf("%g", get_node_float(arg));
+                            break;
+                        case 's':
+                            {
+                                node_t* str_node = get_node(arg);
+                                if (str_node->type == NODE_STRING) {
+                                    out.put(str_node->t_string.c_str(), str_node->t_string.length());
+                                } else {
+                                    out.put(get_node_string(arg).c_str());
+                                }
                             }
-                        }
-                        break;
-                    default:
-                        // Just add the argument's string representation
-                        printf("%s", get_node_string(arg).c_str());
-                        break;
+                            break;
+                        default:
+                            // Just add the argument's string representation
+                            out.put(get_node_string(arg).c_str());
+                            break;
+                    }
+                    pos += 2; // Move past the % and the format specifier
                 }
-                pos += 2; // Move past the % and the format specifier
+            } else {
+                // Regular character - print directly
+                out.put(format_str[pos++]);
             }
-        } else {
-            // Regular character - print directly
-            printf("%c", format_str[pos++]);
         }
-    }
-    
-    fflush(stdout);
+    });
     return NIL_NODE;
 }
 
@@ -3652,6 +3896,39 @@ static node_idx_t native_fn_internal(env_ptr_t env, list_ptr_t args, node_idx_t
 	return NIL_NODE;
 }
 
+// Multi-arity fn: dispatches on argument count to one of the single-arity fns in fn_list.
+// fn_list and the private name are also kept on the node so it can be rebuilt (see jo_clojure_image.h).
+static node_idx_t new_node_multi_fn(list_ptr_t fn_list, node_idx_t private_fn_name, bool macro) {
+	node_idx_t reti = new_node_native_function("fn_lambda", [=](env_ptr_t env, list_ptr_t args) -> node_idx_t {
+		long long num_args = args->size();
+		for(list_t::iterator i(fn_list); i; i++) {
+			node_idx_t fn_idx = *i;
+			node_t *fn = get_node(fn_idx);
+			if(fn->type != NODE_FUNC) {
+				continue;
+			}
+			// Check for exact match or matching varargs pattern
+			vector_ptr_t fn_args = fn->t_func.args;
+			size_t fixed_args_count = fn->t_func.fixed_args_count;
+			bool has_varargs = (fn->flags & NODE_FLAG_VARARGS) != 0;
+			
+			if((has_varargs && num_args >= fixed_args_count) || 
+			   (!has_varargs && fn_args->size() == num_args)) {
+				return eval_list(env, args->push_front(*i));
+			}
+		}
+		// No matching arity found, report an error
+		const char* fn_name = private_fn_name != NIL_NODE ? 
+			get_node(private_fn_name)->t_string.c_str() : "<anonymous>";
+		warnf("ArityException: Wrong number of args (%lld) passed to: %s\n", num_args, fn_name);
+		return NIL_NODE;
+	}, macro);
+	node_t *ret = get_node(reti);
+	ret->t_list = fn_list;
+	ret->t_extra = private_fn_name;
+	return reti;
+}
+
 static node_idx_t native_fn_macro(env_ptr_t env, list_ptr_t args, bool macro) {
 	list_t::iterator i(args);
 	int flags = macro ? NODE_FLAG_MACRO : 0;
@@ -3674,30 +3951,7 @@ static node_idx_t native_fn_macro(env_ptr_t env, list_ptr_t args, bool macro) {
 				fn_list = fn_list->push_front(native_fn_internal(env, get_node(arg)->t_list, private_fn_name, flags));
 			}
 		}
-		return new_node_native_function("fn_lambda", [=](env_ptr_t env, list_ptr_t args) -> node_idx_t {
-			long long num_args = args->size();
-			for(list_t::iterator i(fn_list); i; i++) {
-				node_idx_t fn_idx = *i;
-				node_t *fn = get_node(fn_idx);
-				if(fn->type != NODE_FUNC) {
-					continue;
-				}
-				// Check for exact match or matching varargs pattern
-				vector_ptr_t fn_args = fn->t_func.args;
-				size_t fixed_args_count = fn->t_func.fixed_args_count;
-				bool has_varargs = (fn->flags & NODE_FLAG_VARARGS) != 0;
-				
-				if((has_varargs && num_args >= fixed_args_count) || 
-				   (!has_varargs && fn_args->size() == num_args)) {
-					return eval_list(env, args->push_front(*i));
-				}
-			}
-			// No matching arity found, report an error
-			const char* fn_name = private_fn_name != NIL_NODE ? 
-				get_node(private_fn_name)->t_string.c_str() : "<anonymous>";
-			warnf("ArityException: Wrong number of args (%lld) passed to: %s\n", num_args, fn_name);
-			return NIL_NODE;
-		}, macro);
+		return new_node_multi_fn(fn_list, private_fn_name, macro);
 	}
 	return NIL_NODE;
 }
@@ -3731,6 +3985,15 @@ static node_idx_t native_defn(env_ptr_t env, list_ptr_t args) {
 	return sym_node_idx;
 }
 
+// Calls macro m and evaluates its expansion. m is also kept on the node so it can be rebuilt.
+static node_idx_t new_node_macro_expander(node_idx_t m) {
+	node_idx_t reti = new_node_native_function("defmacro__inner", [m](env_ptr_t env2, list_ptr_t args2) -> node_idx_t {
+		return eval_node(env2, eval_list(env2, args2->push_front(m)));
+	}, true);
+	get_node(reti)->t_extra = m;
+	return reti;
+}
+
 // (defmacro name doc-string? attr-map? [params*] body)
 // (defmacro name doc-string? attr-map? ([params*] body) + attr-map?)
 // Like defn, but the resulting function name is declared as a
@@ -3752,10 +4015,7 @@ static node_idx_t native_defmacro(env_ptr_t env, list_ptr_t args) {
 		return NIL_NODE;
 	}
 
-	node_idx_t m = native_macro(env, args->rest(i));
-	env->set(sym_node_idx, new_node_native_function("defmacro__inner", [m](env_ptr_t env2, list_ptr_t args2) -> node_idx_t {
-		return eval_node(env2, eval_list(env2, args2->push_front(m)));
-	}, true));
+	env->set(sym_node_idx, new_node_macro_expander(native_macro(env, args->rest(i))));
 	return NIL_NODE;
 }
 
@@ -4967,8 +5227,7 @@ static node_idx_t native_is(env_ptr_t env, list_ptr_t args) {
 			printf("%s\n", msg_node->t_string.c_str());
 		} else {
 			printf("Assertion failed\n");
-			native_print(env, list_va(form_idx));
-			printf("\n");
+			native_println(env, list_va(form_idx));
 		}
 	}
 	return NIL_NODE;
@@ -5857,22 +6116,10 @@ static node_idx_t native_load_file(env_ptr_t env, list_ptr_t args) {
 		warnf("(load-file) requires a string\n");
 		return NIL_NODE;
 	}
-	jo_string name = get_node_string(name_idx);
-	FILE *fp = fopen(name.c_str(), "r");
-	if(!fp) {
+	list_ptr_t main_list = parse_file_forms(env, get_node_string(name_idx).c_str());
+	if(!main_list) {
 		return NIL_NODE;
 	}
-
-	parse_state_t parse_state;
-	parse_state.fp = fp;
-
-	// parse the base list
-	list_ptr_t main_list = new_list();
-	for(node_idx_t next = parse_next(env, &parse_state, 0); next != INV_NODE; next = parse_next(env, &parse_state, 0)) {
-		main_list->push_back_inplace(next);
-	}
-	fclose(fp);
-
 	return eval_node_list(env, main_list);
 }
 
@@ -5886,11 +6133,12 @@ static node_idx_t native_load_reader(env_ptr_t env, list_ptr_t args) {
 		return NIL_NODE;
 	}
 
-	parse_state_t parse_state;
-	parse_state.fp = get_node(rdr_idx)->t_file;
-	if(!parse_state.fp) {
+	FILE *fp = get_node(rdr_idx)->t_file;
+	if(!fp) {
 		return NIL_NODE;
 	}
+	parse_state_t parse_state;
+	parse_state.read(fp);
 
 	// parse the base list
 	list_ptr_t main_list = new_list();
@@ -6178,7 +6426,10 @@ static node_idx_t native_namespace(env_ptr_t env, list_ptr_t args) {
 	return new_node_string(sym_node->t_string.substr(0, ns_pos));
 }
 
-static node_idx_t native_newline(env_ptr_t env, list_ptr_t args) { printf("\n"); return NIL_NODE; }
+static node_idx_t native_newline(env_ptr_t env, list_ptr_t args) {
+	print_with(env, true, [](jo_text_writer_t &out) { out.put('\n'); });
+	return NIL_NODE;
+}
 
 // (reduce-kv f init coll)
 // Reduces an associative collection. f should be a function of 3
@@ -6664,37 +6915,33 @@ static node_idx_t native_force(env_ptr_t env, list_ptr_t args) {
 
 static node_idx_t native_include(env_ptr_t env, list_ptr_t args) {
 	// parse and eval the file
-	FILE *fp = fopen(get_node_string(args->first_value()).c_str(), "r");
-	if(!fp) {
+	list_ptr_t expr_list = parse_file_forms(env, get_node_string(args->first_value()).c_str());
+	if(!expr_list) {
 		warnf("include: could not open file");
 		return NIL_NODE;
 	}
-
-	parse_state_t parse_state;
-	parse_state.fp = fp;
-
-	// parse the base list
-	list_ptr_t expr_list = new_list();
-	for(node_idx_t next = parse_next(env, &parse_state, 0); next != INV_NODE; next = parse_next(env, &parse_state, 0)) {
-		expr_list->push_back_inplace(next);
-	}
-	fclose(fp);
-
 	return eval_node_list(env, expr_list);
 }
 
 #include "jo_clojure_array.h"
 #include "jo_clojure_math.h"
+#include "jo_clojure_tensor.h"
+#include "jo_clojure_autodiff.h"
+#include "jo_clojure_regex.h"
 #include "jo_clojure_string.h"
 #include "jo_clojure_system.h"
 #include "jo_clojure_http.h"
+#include "jo_clojure_async.h"
 #include "jo_clojure_io.h"
 #include "jo_clojure_lazy.h"
-#include "jo_clojure_async.h"
 #include "jo_clojure_gif.h"
 #include "jo_clojure_b64.h"
+#include "jo_clojure_edn.h"
+#include "jo_clojure_json.h"
+#include "jo_clojure_csv.h"
 #include "jo_clojure_canvas.h"
 #include "jo_clojure_net.h"
+#include "jo_clojure_aio.h"
 #include "jo_clojure_protocol.h"
 #include "jo_clojure_nn.h"
 #ifndef NO_SOKOL
@@ -6705,6 +6952,7 @@ static node_idx_t native_include(env_ptr_t env, list_ptr_t args) {
 #endif
 #include "jo_clojure_record.h"
 #include "jo_clojure_struct.h"
+#include "jo_clojure_image.h"
 
 #ifdef _MSC_VER
 #pragma comment(lib,"AdvApi32.lib")
@@ -6870,6 +7118,8 @@ int main(int argc, char **argv) {
 	env->set("pr-str", new_node_native_function("pr-str", &native_pr_str, false, NODE_FLAG_PRERESOLVE));
 	env->set("prn-str", new_node_native_function("prn-str", &native_prn_str, false, NODE_FLAG_PRERESOLVE));
 	env->set("printf", new_node_native_function("printf", &native_printf, false, NODE_FLAG_PRERESOLVE));
+	env->set("flush", new_node_native_function("flush", &native_flush, false, NODE_FLAG_PRERESOLVE));
+	env->set("*flush-on-newline*", TRUE_NODE);
 	env->set("=", new_node_native_function("=", &native_eq, false, NODE_FLAG_PRERESOLVE));
 	env->set("==", new_node_native_function("==", &native_eq, false, NODE_FLAG_PRERESOLVE));
 	env->set("not=", new_node_native_function("not=", &native_neq, false, NODE_FLAG_PRERESOLVE));
@@ -7069,7 +7319,9 @@ int main(int argc, char **argv) {
 	jo_clojure_lazy_init(env);
 	jo_clojure_async_init(env);
 	jo_clojure_math_init(env);
+	jo_clojure_tensor_init(env);
 	jo_clojure_string_init(env);
+	jo_clojure_regex_init(env);
 	jo_clojure_http_init(env);
 	jo_clojure_io_init(env);
 	jo_clojure_system_init(env);
@@ -7077,8 +7329,12 @@ int main(int argc, char **argv) {
 	jo_clojure_struct_init(env);
 	jo_clojure_gif_init(env);
 	jo_clojure_b64_init(env);
+	jo_clojure_edn_init(env);
+	jo_clojure_json_init(env);
+	jo_clojure_csv_init(env);
 	jo_clojure_canvas_init(env);
 	jo_clojure_net_init(env);
+	jo_clojure_aio_init(env);
 	jo_clojure_nn_init(env);
 #ifndef NO_SOKOL
 	jo_clojure_sokol_init(env);
@@ -7088,19 +7344,42 @@ int main(int argc, char **argv) {
 #endif
 	jo_clojure_protocol_init(env);
 
+	// --save-image <file> / --load-image <file> come before the script and its arguments
+	const char *save_image = NULL, *load_image = NULL;
+	int argi = 1;
+	for(; argi + 1 < argc; argi += 2) {
+		if(!strcmp(argv[argi], "--save-image")) save_image = argv[argi+1];
+		else if(!strcmp(argv[argi], "--load-image")) load_image = argv[argi+1];
+		else break;
+	}
+
 	// setup *command-line-args*
 	{
 		list_ptr_t args = new_list();
-		for(int i = 0; i < argc; i++) {
+		args->push_back_inplace(new_node_string(argv[0]));
+		for(int i = argi; i < argc; i++) {
 			args->push_back_inplace(new_node_string(argv[i]));
 		}
 		env->set("*command-line-args*", new_node_list(args));
 	}
-	
-	if(argc >= 2) {
+
+	image_snapshot_builtins(env);
+	if(load_image && !image_load(env, load_image)) {
+		return 1;
+	}
+
+	if(save_image) {
+		// run the libraries, then write out what they defined
+		for(int i = argi; i < argc; i++) {
+			native_include(env, list_va(new_node_string(argv[i])));
+		}
+		if(!image_save(env, save_image)) {
+			return 1;
+		}
+	} else if(argi < argc) {
 		// Run a file
-		native_include(env, list_va(new_node_string(argv[1])));
-	} else if(argc == 1) {
+		native_include(env, list_va(new_node_string(argv[argi])));
+	} else {
 		// REPL
 		node_idx_t r2, r3;
 		while(!feof(stdin)) {
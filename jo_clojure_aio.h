@@ -0,0 +1,415 @@
+#pragma once
+
+// Asynchronous file I/O. io/read-async, io/write-async and io/fsync-async return promises.
+//
+// On Linux the reads, writes and fsyncs go through an io_uring set up with raw syscalls. A
+// single reaper thread waits on the completion queue and delivers the promises, so a
+// thousand reads in flight cost a thousand ring entries rather than a thousand threads.
+// Where io_uring is missing (old kernels, seccomp, other platforms) or the ring is full,
+// requests run on a dedicated pool of blocking I/O threads. That pool is separate from the
+// one behind future and pmap, so slow disks never stall compute.
+//
+// Files are opened on the calling thread. That is a metadata lookup, and almost always cached.
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define JO_AIO_URING
+#endif
+#endif
+
+enum aio_op_t {
+    AIO_READ,
+    AIO_WRITE,
+    AIO_FSYNC,
+};
+
+struct aio_request_t {
+    aio_op_t op;
+    int fd;
+    bool close_fd;
+    bool as_string;
+    env_ptr_t env;
+    node_idx_t promise;
+    jo_string path;
+    unsigned char *buf;
+    long long len;
+    long long done;
+    long long offset;
+#ifndef _WIN32
+    struct iovec iov;
+#endif
+
+    aio_request_t() : op(AIO_READ), fd(-1), close_fd(true), as_string(false), env(), promise(), path(), buf(0), len(0), done(0), offset(0) {}
+    ~aio_request_t() { free(buf); }
+};
+
+static void aio_submit(aio_request_t *r);
+
+static jo_threadpool *aio_pool() {
+    // blocking I/O threads spend their time waiting, so there are more of them than cores
+    static jo_threadpool *pool = new jo_threadpool(jo_max(processor_count * 2, 16));
+    return pool;
+}
+
+// Delivers the result of a finished request and frees it.
+static void aio_finish(aio_request_t *r, int err) {
+    node_idx_t val = NIL_NODE;
+    if(err) {
+        warnf("io/%s-async: %s: %s\n", r->op == AIO_READ ? "read" : r->op == AIO_WRITE ? "write" : "fsync", r->path.c_str(), strerror(err));
+    } else if(r->op == AIO_READ) {
+        if(r->as_string) {
+            val = new_node_string(jo_string((const char*)r->buf, r->done));
+        } else {
+            val = new_node_array(new_array(r->buf, r->done));
+        }
+    } else if(r->op == AIO_WRITE) {
+        val = new_node_int(r->done);
+    } else {
+        val = TRUE_NODE;
+    }
+    if(r->close_fd && r->fd >= 0) {
+        close(r->fd);
+    }
+    node_compare_and_set(r->env, r->promise, INV_NODE, val);
+    delete r;
+}
+
+// Accounts for res bytes (or -errno) of a completed read or write. Short transfers are
+// resubmitted for the remainder, a read that hits EOF ends early.
+static void aio_complete(aio_request_t *r, long long res) {
+    if(res < 0) {
+        aio_finish(r, (int)-res);
+        return;
+    }
+    if(r->op == AIO_FSYNC) {
+        aio_finish(r, 0);
+        return;
+    }
+    r->done += res;
+    if(res == 0 || r->done >= r->len) {
+        aio_finish(r, 0);
+        return;
+    }
+    aio_submit(r);
+}
+
+// Does the request with ordinary blocking calls, on an aio_pool thread.
+static void aio_blocking(aio_request_t *r) {
+    aio_pool()->add_task(jo_task_ptr_t(new jo_task_t([r]() -> node_idx_t {
+        long long res = 0;
+        if(r->op == AIO_FSYNC) {
+#ifdef _WIN32
+            res = _commit(r->fd) == 0 ? 0 : -errno;
+#else
+            res = fsync(r->fd) == 0 ? 0 : -errno;
+#endif
+            aio_complete(r, res);
+            return NIL_NODE;
+        }
+        while(r->done < r->len) {
+#ifdef _WIN32
+            _lseeki64(r->fd, r->offset + r->done, SEEK_SET);
+            res = r->op == AIO_READ ? _read(r->fd, r->buf + r->done, (unsigned)jo_min(r->len - r->done, 1ll << 30))
+                                    : _write(r->fd, r->buf + r->done, (unsigned)jo_min(r->len - r->done, 1ll << 30));
+#else
+            res = r->op == AIO_READ ? pread(r->fd, r->buf + r->done, r->len - r->done, r->offset + r->done)
+                                    : pwrite(r->fd, r->buf + r->done, r->len - r->done, r->offset + r->done);
+#endif
+            if(res < 0 && errno == EINTR) continue;
+            if(res <= 0) break;
+            r->done += res;
+        }
+        aio_finish(r, res < 0 ? errno : 0);
+        return NIL_NODE;
+    })));
+}
+
+#ifdef JO_AIO_URING
+struct aio_uring_t {
+    enum { ENTRIES = 256 };
+    int fd;
+    unsigned entries;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    std::mutex lock;
+    unsigned inflight;
+
+    aio_uring_t() : fd(-1), entries(0), inflight(0) {}
+
+    bool init() {
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd = (int)syscall(__NR_io_uring_setup, ENTRIES, &p);
+        if(fd < 0) {
+            return false;
+        }
+        size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if(single) {
+            sq_size = cq_size = jo_max(sq_size, cq_size);
+        }
+        char *sq = (char*)mmap(0, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        char *cq = single ? sq : (char*)mmap(0, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes = (struct io_uring_sqe*)mmap(0, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if(sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+            close(fd);
+            fd = -1;
+            return false;
+        }
+        entries = p.sq_entries;
+        sq_tail = (unsigned*)(sq + p.sq_off.tail);
+        sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq + p.sq_off.array);
+        cq_head = (unsigned*)(cq + p.cq_off.head);
+        cq_tail = (unsigned*)(cq + p.cq_off.tail);
+        cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+        std::thread([this] { reap(); }).detach();
+        return true;
+    }
+
+    // false when the ring is full, the caller falls back to the blocking pool
+    bool submit(aio_request_t *r) {
+        std::lock_guard<std::mutex> l(lock);
+        if(inflight >= entries) {
+            return false;
+        }
+        unsigned tail = *sq_tail;
+        unsigned idx = tail & *sq_mask;
+        struct io_uring_sqe *sqe = &sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = r->fd;
+        sqe->user_data = (unsigned long long)(uintptr_t)r;
+        if(r->op == AIO_FSYNC) {
+            sqe->opcode = IORING_OP_FSYNC;
+        } else {
+            r->iov.iov_base = r->buf + r->done;
+            r->iov.iov_len = r->len - r->done;
+            sqe->opcode = r->op == AIO_READ ? IORING_OP_READV : IORING_OP_WRITEV;
+            sqe->addr = (unsigned long long)(uintptr_t)&r->iov;
+            sqe->len = 1;
+            sqe->off = r->offset + r->done;
+        }
+        sq_array[idx] = idx;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++inflight;
+        while(syscall(__NR_io_uring_enter, fd, 1, 0, 0, NULL, 0) < 0 && errno == EINTR) {}
+        return true;
+    }
+
+    void reap() {
+        for(;;) {
+            if(syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+                warnf("io_uring_enter: %s\n", strerror(errno));
+                return;
+            }
+            unsigned head = *cq_head;
+            unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            while(head != tail) {
+                struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+                aio_request_t *r = (aio_request_t*)(uintptr_t)cqe->user_data;
+                long long res = cqe->res;
+                ++head;
+                __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+                {
+                    std::lock_guard<std::mutex> l(lock);
+                    --inflight;
+                }
+                aio_complete(r, res);
+            }
+        }
+    }
+};
+
+// Never destroyed, the reaper thread runs until exit.
+static aio_uring_t *aio_uring() {
+    static aio_uring_t *ring = [] {
+        aio_uring_t *u = new aio_uring_t();
+        if(!u->init()) {
+            delete u;
+            return (aio_uring_t*)0;
+        }
+        return u;
+    }();
+    return ring;
+}
+#endif
+
+static void aio_submit(aio_request_t *r) {
+#ifdef JO_AIO_URING
+    aio_uring_t *u = aio_uring();
+    if(u && u->submit(r)) {
+        return;
+    }
+#endif
+    aio_blocking(r);
+}
+
+static bool aio_open(aio_request_t *r, int flags) {
+#ifdef _WIN32
+    r->fd = _open(r->path.c_str(), flags | _O_BINARY, 0644);
+#else
+    r->fd = open(r->path.c_str(), flags | O_CLOEXEC, 0644);
+#endif
+    return r->fd >= 0;
+}
+
+static node_idx_t aio_new_promise(env_ptr_t env) {
+    node_idx_t p = new_node(NODE_PROMISE, 0);
+    node_reset(env, p, INV_NODE);
+    return p;
+}
+
+// (io/read-async path & options)
+// Returns a promise of the contents of path as a byte array. Options :offset and :length
+// read part of the file, :as :string delivers a string instead. The promise gets nil if
+// the read fails.
+static node_idx_t native_io_read_async(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    aio_request_t *r = new aio_request_t();
+    r->op = AIO_READ;
+    r->env = env;
+    r->path = get_node_string(*it++);
+    long long length = -1;
+    for(; it; ++it) {
+        node_t *k = get_node(*it++);
+        if(!it) break;
+        if(k->type != NODE_KEYWORD) continue;
+        if(k->t_string == "offset") r->offset = get_node_int(*it);
+        else if(k->t_string == "length") length = get_node_int(*it);
+        else if(k->t_string == "as") r->as_string = get_node(*it)->t_string == "string";
+    }
+    r->promise = aio_new_promise(env);
+    node_idx_t promise = r->promise;
+    if(!aio_open(r, O_RDONLY)) {
+        aio_finish(r, errno);
+        return promise;
+    }
+    if(length < 0) {
+        struct stat st;
+        length = fstat(r->fd, &st) == 0 ? jo_max(0ll, (long long)st.st_size - r->offset) : 0;
+    }
+    r->len = length;
+    r->buf = (unsigned char*)malloc(jo_max(length, 1ll));
+    if(length == 0) {
+        aio_finish(r, 0);
+        return promise;
+    }
+    aio_submit(r);
+    return promise;
+}
+
+// (io/write-async path data & options)
+// Writes data, a string or byte array, to path and returns a promise of the number of bytes
+// written (nil on failure). The file is truncated unless :append true or an :offset is given.
+static node_idx_t native_io_write_async(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    aio_request_t *r = new aio_request_t();
+    r->op = AIO_WRITE;
+    r->env = env;
+    r->path = get_node_string(*it++);
+    node_t *data = get_node(*it++);
+    bool append = false;
+    bool has_offset = false;
+    for(; it; ++it) {
+        node_t *k = get_node(*it++);
+        if(!it) break;
+        if(k->type != NODE_KEYWORD) continue;
+        if(k->t_string == "append") append = get_node_bool(*it);
+        else if(k->t_string == "offset") { r->offset = get_node_int(*it); has_offset = true; }
+    }
+    if(data->type == NODE_ARRAY) {
+        jo_clojure_array_ptr_t A = data->t_object.cast<jo_clojure_array_t>();
+        r->len = A->num_elements * A->element_size;
+        r->buf = (unsigned char*)malloc(jo_max(r->len, 1ll));
+        A->copy_bytes(0, r->len, r->buf);
+    } else {
+        jo_string s = data->type == NODE_STRING ? data->t_string : data->as_string(1);
+        r->len = s.length();
+        r->buf = (unsigned char*)malloc(jo_max(r->len, 1ll));
+        memcpy(r->buf, s.c_str(), r->len);
+    }
+    r->promise = aio_new_promise(env);
+    node_idx_t promise = r->promise;
+    if(!aio_open(r, O_WRONLY | O_CREAT | (append || has_offset ? 0 : O_TRUNC))) {
+        aio_finish(r, errno);
+        return promise;
+    }
+    if(append) {
+        // positioned writes ignore O_APPEND on Linux, so write at the current end instead
+        struct stat st;
+        r->offset = fstat(r->fd, &st) == 0 ? (long long)st.st_size : 0;
+    }
+    if(r->len == 0) {
+        aio_finish(r, 0);
+        return promise;
+    }
+    aio_submit(r);
+    return promise;
+}
+
+// (io/fsync-async f)
+// Flushes f, a path or open file, to disk. Returns a promise of true, or nil on failure.
+static node_idx_t native_io_fsync_async(env_ptr_t env, list_ptr_t args) {
+    node_t *f = get_node(args->first_value());
+    aio_request_t *r = new aio_request_t();
+    r->op = AIO_FSYNC;
+    r->env = env;
+    r->promise = aio_new_promise(env);
+    node_idx_t promise = r->promise;
+    if(f->type == NODE_FILE) {
+        r->path = "<file>";
+        if(!f->t_file) {
+            aio_finish(r, EBADF);
+            return promise;
+        }
+        fflush(f->t_file);
+#ifdef _WIN32
+        r->fd = _fileno(f->t_file);
+#else
+        r->fd = fileno(f->t_file);
+#endif
+        r->close_fd = false;
+    } else {
+        r->path = f->as_string(1);
+        if(!aio_open(r, O_RDONLY)) {
+            aio_finish(r, errno);
+            return promise;
+        }
+    }
+    aio_submit(r);
+    return promise;
+}
+
+// (io/async-backend)
+// :io-uring or :thread-pool, whichever the async file functions use.
+static node_idx_t native_io_async_backend(env_ptr_t env, list_ptr_t args) {
+#ifdef JO_AIO_URING
+    if(aio_uring()) {
+        return new_node_keyword("io-uring");
+    }
+#endif
+    return new_node_keyword("thread-pool");
+}
+
+void jo_clojure_aio_init(env_ptr_t env) {
+	env->set("io/read-async", new_node_native_function("io/read-async", &native_io_read_async, false, NODE_FLAG_PRERESOLVE));
+	env->set("io/write-async", new_node_native_function("io/write-async", &native_io_write_async, false, NODE_FLAG_PRERESOLVE));
+	env->set("io/fsync-async", new_node_native_function("io/fsync-async", &native_io_fsync_async, false, NODE_FLAG_PRERESOLVE));
+	env->set("io/async-backend", new_node_native_function("io/async-backend", &native_io_async_backend, false, NODE_FLAG_PRERESOLVE));
+}
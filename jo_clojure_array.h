@@ -27,12 +27,24 @@ enum array_type_t {
     TYPE_DOUBLE = 7,
 };
 
+// A file mapping shared by an array and every typed view of it, unmapped along with the last of them.
+struct array_mapping_t {
+    void *base;
+    size_t size;
+    bool writable;
+    array_mapping_t(void *b, size_t n, bool w) : base(b), size(n), writable(w) {}
+    ~array_mapping_t() { jo_munmap_file(base, size); }
+};
+typedef jo_shared_ptr<array_mapping_t> array_mapping_ptr_t;
+
 // simple wrapper so we can blop it into the t_object generic container
+// Arrays from io/mmap have no data, their bytes are read straight out of the mapping.
 struct jo_clojure_array_t : jo_object {
     long long num_elements;
     int element_size;
     array_type_t type;
     array_data_ptr_t data;
+    array_mapping_ptr_t mapping;
 
     jo_clojure_array_t(long long num, int size, array_type_t t) {
         num_elements = num;
@@ -46,18 +58,34 @@ struct jo_clojure_array_t : jo_object {
         element_size = other.element_size;
         type = other.type;
         data = other.data;
+        mapping = other.mapping;
+    }
+
+    jo_clojure_array_t(array_mapping_ptr_t m) {
+        num_elements = m->size;
+        element_size = 1;
+        type = TYPE_BYTE;
+        mapping = m;
     }
 
     jo_clojure_array_t(const unsigned char *s, long long len) {
         num_elements = len;
         element_size = 1;
         type = TYPE_BYTE;
-        data = new_array_data(num_elements*element_size);
-        poke(0, s, len);
+        // appending fills each leaf once, poking into a presized vector copies the path every byte
+        data = new_array_data();
+        data->append_inplace(s, (size_t)len);
     }
 
     jo_clojure_array_ptr_t clone() const {
         jo_clojure_array_ptr_t A = new_array(*this);
+        if(mapping.ptr) {
+            // a copy of a mapped array lives on the heap like any other
+            A->mapping = array_mapping_ptr_t();
+            A->data = new_array_data();
+            A->data->append_inplace((const unsigned char*)mapping->base, mapping->size);
+            return A;
+        }
         A->data = data->clone();
         return A;
     }
@@ -68,8 +96,18 @@ struct jo_clojure_array_t : jo_object {
 
     inline long long length() { return num_elements; }
 
+    inline long long byte_size() const { return mapping.ptr ? (long long)mapping->size : (long long)data->size(); }
+
     void poke(long long index, const void *value, int num) {
         const unsigned char *v = (const unsigned char *)value;
+        if(mapping.ptr) {
+            if(!mapping->writable) {
+                warnf("aset: array is a read-only mapping\n");
+                return;
+            }
+            memcpy((unsigned char*)mapping->base + index*element_size, v, num);
+            return;
+        }
         for (int i = 0; i < num; i++) {
             data->assoc_inplace(index*element_size+i, v[i]);
         }
@@ -103,14 +141,20 @@ struct jo_clojure_array_t : jo_object {
     inline void peek(long long index, void *value, int num) {
         // peek individual bytes and put them together
         unsigned char *v = (unsigned char *)value;
+        if(mapping.ptr) {
+            memcpy(v, (const unsigned char*)mapping->base + index*element_size, num);
+            return;
+        }
         for (int i = 0; i < num; i++) {
             v[i] = data->nth(index*element_size+i);
         }
     }
 
-    inline bool peek_bool(long long index) { return data->nth(index*element_size); }
-    inline unsigned char peek_byte(long long index) { return data->nth(index*element_size); }
-    inline char peek_char(long long index) { return data->nth(index*element_size); }
+    inline unsigned char byte_at(long long off) const { return mapping.ptr ? ((const unsigned char*)mapping->base)[off] : data->nth(off); }
+
+    inline bool peek_bool(long long index) { return byte_at(index*element_size); }
+    inline unsigned char peek_byte(long long index) { return byte_at(index*element_size); }
+    inline char peek_char(long long index) { return byte_at(index*element_size); }
     inline short peek_short(long long index) { short result; peek(index, &result, sizeof(short)); return result; }
     inline int peek_int(long long index) { int result; peek(index, &result, sizeof(int)); return result; }
     inline long long peek_long(long long index) { long long result; peek(index, &result, sizeof(long long)); return result; }
@@ -135,10 +179,28 @@ struct jo_clojure_array_t : jo_object {
         }
     }
 
+    // Copies n raw bytes starting at byte offset off, one leaf at a time.
+    void copy_bytes(long long off, long long n, unsigned char *out) const {
+        if(mapping.ptr) {
+            memcpy(out, (const unsigned char*)mapping->base + off, n);
+            return;
+        }
+        while(n > 0) {
+            long long run = jo_min(data->run_length(off), n);
+            memcpy(out, &data->nth(off), run);
+            out += run;
+            off += run;
+            n -= run;
+        }
+    }
+
     void write(FILE *fp) const {
-        // TODO: could be faster than fputc... but I don't care right now and this is simpler.
-        for(int i = 0; i < num_elements*element_size; i++) {
-            fputc(data->nth(i), fp);
+        unsigned char buf[4096];
+        long long total = num_elements*element_size;
+        for(long long off = 0; off < total; off += sizeof(buf)) {
+            long long n = jo_min(total - off, (long long)sizeof(buf));
+            copy_bytes(off, n, buf);
+            fwrite(buf, 1, n, fp);
         }
     }
 };
@@ -154,7 +216,7 @@ static node_idx_t native_boolean_array(env_ptr_t env, list_ptr_t args) {
         long long i = 0;
         seq_iterate(size_or_seq_idx, [&](node_idx_t idx) {
             node_t *n = get_node(idx);
-            array->data->assoc(i++, n->as_bool());
+            array->data->assoc_inplace(i++, n->as_bool());
             return true;
         });
         return new_node_array(array);
@@ -167,13 +229,13 @@ static node_idx_t native_boolean_array(env_ptr_t env, list_ptr_t args) {
             long long i = 0;
             seq_iterate(seq_idx, [&](node_idx_t idx) {
                 node_t *n = get_node(idx);
-                array->data->assoc(i++, n->as_bool());
+                array->data->assoc_inplace(i++, n->as_bool());
                 return true;
             });
         } else {
             bool init = init_or_seq->as_bool();
             for(int i=0; i<size; ++i) {
-                array->data->assoc(i, init);
+                array->data->assoc_inplace(i, init);
             }
         }
     }
@@ -191,7 +253,7 @@ static node_idx_t native_byte_array(env_ptr_t env, list_ptr_t args) {
         long long i = 0;
         seq_iterate(size_or_seq_idx, [&](node_idx_t idx) {
             node_t *n = get_node(idx);
-            array->data->assoc(i++, n->as_int() & 0xFF);
+            array->data->assoc_inplace(i++, n->as_int() & 0xFF);
             return true;
         });
         return new_node_array(array);
@@ -204,13 +266,13 @@ static node_idx_t native_byte_array(env_ptr_t env, list_ptr_t args) {
             long long i = 0;
             seq_iterate(seq_idx, [&](node_idx_t idx) {
                 node_t *n = get_node(idx);
-                array->data->assoc(i++, n->as_int() & 0xFF);
+                array->data->assoc_inplace(i++, n->as_int() & 0xFF);
                 return true;
             });
         } else {
             unsigned char init = init_or_seq->as_int() & 0xFF;
             for(int i=0; i<size; ++i) {
-                array->data->assoc(i, init);
+                array->data->assoc_inplace(i, init);
             }
         }
     }
@@ -228,7 +290,7 @@ static node_idx_t native_char_array(env_ptr_t env, list_ptr_t args) {
         long long i = 0;
         seq_iterate(size_or_seq_idx, [&](node_idx_t idx) {
             node_t *n = get_node(idx);
-            array->data->assoc(i++, n->as_int() & 0xFF);
+            array->data->assoc_inplace(i++, n->as_int() & 0xFF);
             return true;
         });
         return new_node_array(array);
@@ -241,13 +303,13 @@ static node_idx_t native_char_array(env_ptr_t env, list_ptr_t args) {
             long long i = 0;
             seq_iterate(seq_idx, [&](node_idx_t idx) {
                 node_t *n = get_node(idx);
-                array->data->assoc(i++, n->as_int() & 0xFF);
+                array->data->assoc_inplace(i++, n->as_int() & 0xFF);
                 return true;
             });
         } else {
             unsigned char init = init_or_seq->as_int() & 0xFF;
             for(int i=0; i<size; ++i) {
-                array->data->assoc(i, init);
+                array->data->assoc_inplace(i, init);
             }
         }
     }
@@ -436,7 +498,7 @@ static node_idx_t native_aset(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     node_idx_t array_idx = *it++;
     node_idx_t val_idx = args->last_value();
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     for(; it.has_next(); ++it) {
         A->poke_node(get_node_int(*it), val_idx);
     }
@@ -448,7 +510,7 @@ static node_idx_t native_aset_boolean(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     node_idx_t array_idx = *it++;
     node_idx_t val_idx = args->last_value();
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     for(; it.has_next(); ++it) {
         A->poke_bool(get_node_int(*it), get_node_bool(val_idx));
     }
@@ -460,7 +522,7 @@ static node_idx_t native_aset_byte(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     node_idx_t array_idx = *it++;
     node_idx_t val_idx = args->last_value();
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     for(; it.has_next(); ++it) {
         A->poke_byte(get_node_int(*it), get_node_int(val_idx));
     }
@@ -472,7 +534,7 @@ static node_idx_t native_aset_char(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     node_idx_t array_idx = *it++;
     node_idx_t val_idx = args->last_value();
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     for(; it.has_next(); ++it) {
         A->poke_char(get_node_int(*it), get_node_int(val_idx));
     }
@@ -484,7 +546,7 @@ static node_idx_t native_aset_short(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     node_idx_t array_idx = *it++;
     node_idx_t val_idx = args->last_value();
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     for(; it.has_next(); ++it) {
         A->poke_short(get_node_int(*it), get_node_int(val_idx));
     }
@@ -496,7 +558,7 @@ static node_idx_t native_aset_int(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     node_idx_t array_idx = *it++;
     node_idx_t val_idx = args->last_value();
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     for(; it.has_next(); ++it) {
         A->poke_int(get_node_int(*it), get_node_int(val_idx));
     }
@@ -508,7 +570,7 @@ static node_idx_t native_aset_long(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     node_idx_t array_idx = *it++;
     node_idx_t val_idx = args->last_value();
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     for(; it.has_next(); ++it) {
         A->poke_long(get_node_int(*it), get_node_int(val_idx));
     }
@@ -520,7 +582,7 @@ static node_idx_t native_aset_float(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     node_idx_t array_idx = *it++;
     node_idx_t val_idx = args->last_value();
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     for(; it.has_next(); ++it) {
         A->poke_float(get_node_int(*it), get_node_float(val_idx));
     }
@@ -532,7 +594,7 @@ static node_idx_t native_aset_double(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     node_idx_t array_idx = *it++;
     node_idx_t val_idx = args->last_value();
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     for(; it.has_next(); ++it) {
         A->poke_double(get_node_int(*it), get_node_float(val_idx));
     }
@@ -545,7 +607,7 @@ static node_idx_t native_aset_double(env_ptr_t env, list_ptr_t args) {
 static node_idx_t native_aget(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     node_idx_t array_idx = *it++;
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     node_idx_t idx = *it++;
     // TODO: multidimensional arrays
     return A->peek_node(get_node_int(idx));
@@ -554,14 +616,14 @@ static node_idx_t native_aget(env_ptr_t env, list_ptr_t args) {
 static node_idx_t native_alength(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     node_idx_t array_idx = *it++;
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     return new_node_int(A->length());
 }
 
 static node_idx_t native_aclone(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     node_idx_t array_idx = *it++;
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     return new_node_array(A->clone());
 }
 
@@ -576,7 +638,7 @@ static node_idx_t native_amap(env_ptr_t env, list_ptr_t args) {
     node_idx_t key_idx = *it++; 
     node_idx_t ret_idx = *it++; 
     node_idx_t expr_idx = *it++; 
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     A = A->clone();
     node_idx_t ret_A = new_node_array(A);
 	env_ptr_t env2 = new_env(env);
@@ -600,7 +662,7 @@ static node_idx_t native_areduce(env_ptr_t env, list_ptr_t args) {
     node_idx_t ret_idx = *it++; 
     node_idx_t init_idx = eval_node(env, *it++); 
     node_idx_t expr_idx = *it++; 
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     env_ptr_t env2 = new_env(env);
     node_idx_t ret = init_idx;
     node_let(env2, ret_idx, ret);
@@ -619,11 +681,11 @@ static node_idx_t native_booleans(env_ptr_t env, list_ptr_t args) {
         warnf("bytes: expected array\n");
         return NIL_NODE;
     }
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     if(A->type != TYPE_BOOL) {
         A = A->shallow_clone();
         A->type = TYPE_BOOL;
-        A->num_elements = A->data->size();
+        A->num_elements = A->byte_size();
         A->element_size = 1;
         return new_node_array(A);
     }
@@ -637,11 +699,11 @@ static node_idx_t native_bytes(env_ptr_t env, list_ptr_t args) {
         warnf("bytes: expected array\n");
         return NIL_NODE;
     }
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     if(A->type != TYPE_BYTE) {
         A = A->shallow_clone();
         A->type = TYPE_BYTE;
-        A->num_elements = A->data->size();
+        A->num_elements = A->byte_size();
         A->element_size = 1;
         return new_node_array(A);
     }
@@ -655,11 +717,11 @@ static node_idx_t native_chars(env_ptr_t env, list_ptr_t args) {
         warnf("bytes: expected array\n");
         return NIL_NODE;
     }
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     if(A->type != TYPE_CHAR) {
         A = A->shallow_clone();
         A->type = TYPE_CHAR;
-        A->num_elements = A->data->size();
+        A->num_elements = A->byte_size();
         A->element_size = 1;
         return new_node_array(A);
     }
@@ -673,11 +735,11 @@ static node_idx_t native_shorts(env_ptr_t env, list_ptr_t args) {
         warnf("bytes: expected array\n");
         return NIL_NODE;
     }
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     if(A->type != TYPE_SHORT) {
         A = A->shallow_clone();
         A->type = TYPE_SHORT;
-        A->num_elements = A->data->size();
+        A->num_elements = A->byte_size();
         A->element_size = 2;
         A->num_elements /= A->element_size;
         return new_node_array(A);
@@ -692,11 +754,11 @@ static node_idx_t native_ints(env_ptr_t env, list_ptr_t args) {
         warnf("bytes: expected array\n");
         return NIL_NODE;
     }
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     if(A->type != TYPE_INT) {
         A = A->shallow_clone();
         A->type = TYPE_INT;
-        A->num_elements = A->data->size();
+        A->num_elements = A->byte_size();
         A->element_size = 4;
         A->num_elements /= A->element_size;
         return new_node_array(A);
@@ -711,11 +773,11 @@ static node_idx_t native_longs(env_ptr_t env, list_ptr_t args) {
         warnf("bytes: expected array\n");
         return NIL_NODE;
     }
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     if(A->type != TYPE_LONG) {
         A = A->shallow_clone();
         A->type = TYPE_LONG;
-        A->num_elements = A->data->size();
+        A->num_elements = A->byte_size();
         A->element_size = 8;
         A->num_elements /= A->element_size;
         return new_node_array(A);
@@ -730,11 +792,11 @@ static node_idx_t native_floats(env_ptr_t env, list_ptr_t args) {
         warnf("bytes: expected array\n");
         return NIL_NODE;
     }
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     if(A->type != TYPE_FLOAT) {
         A = A->shallow_clone();
         A->type = TYPE_FLOAT;
-        A->num_elements = A->data->size();
+        A->num_elements = A->byte_size();
         A->element_size = 4;
         A->num_elements /= A->element_size;
         return new_node_array(A);
@@ -749,11 +811,11 @@ static node_idx_t native_doubles(env_ptr_t env, list_ptr_t args) {
         warnf("bytes: expected array\n");
         return NIL_NODE;
     }
-    jo_clojure_array_ptr_t A = get_node(*it++)->t_object.cast<jo_clojure_array_t>();
+    jo_clojure_array_ptr_t A = get_node(array_idx)->t_object.cast<jo_clojure_array_t>();
     if(A->type != TYPE_DOUBLE) {
         A = A->shallow_clone();
         A->type = TYPE_DOUBLE;
-        A->num_elements = A->data->size();
+        A->num_elements = A->byte_size();
         A->element_size = 8;
         A->num_elements /= A->element_size;
         return new_node_array(A);
@@ -0,0 +1,382 @@
+#pragma once
+
+// Tape based reverse-mode automatic differentiation over tensors.
+//
+// Ops compute their value eagerly and, when any input needs a gradient, push a closure onto the
+// tape that maps the gradient of their output onto their inputs. backward() seeds the root with
+// ones and runs the tape in reverse. Gradients accumulate into one buffer per tape slot; reset()
+// keeps those buffers, so a training step that rebuilds the same graph reuses the memory of the
+// previous step instead of allocating every gradient from scratch.
+//
+// An op given an invalid input (or shapes that don't line up) returns AD_INVALID, which every
+// other op passes through, so a graph only needs checking once at the end.
+
+typedef int ad_var_t;
+
+enum { AD_INVALID = -1 };
+
+// dst += src, where dst is contiguous and src has the same shape
+static void ad_add_into(const jo_clojure_tensor_ptr_t &dst, const jo_clojure_tensor_ptr_t &src) {
+    int nd = dst->ndim;
+    long long iss = nd ? src->strides[nd-1] : 0;
+    auto run = [&](auto *d, auto *s) {
+        tensor_walk(nd, dst->shape, dst->strides, src->strides, src->strides, [&](long long od, long long os, long long, long long n) {
+            auto *dd = d + od;
+            auto *ss = s + os;
+            for(long long i = 0; i < n; ++i) dd[i] += ss[i*iss];
+        });
+    };
+    if(dst->dtype == TYPE_FLOAT) {
+        if(src->dtype == TYPE_FLOAT) run(dst->data<float>(), src->data<float>());
+        else run(dst->data<float>(), src->data<double>());
+    } else {
+        if(src->dtype == TYPE_FLOAT) run(dst->data<double>(), src->data<float>());
+        else run(dst->data<double>(), src->data<double>());
+    }
+}
+
+// Undoes broadcasting: sums g down to the shape of like (or stretches it up, for a scalar g).
+static jo_clojure_tensor_ptr_t ad_match_shape(jo_clojure_tensor_ptr_t g, const jo_clojure_tensor_t &like) {
+    if(g->same_shape(like)) return g;
+    while(g->ndim > like.ndim) {
+        g = tensor_reduce(g, TENSOR_SUM, 0, false);
+    }
+    if(g->ndim == like.ndim) {
+        for(int i = 0; i < g->ndim; ++i) {
+            if(like.shape[i] == 1 && g->shape[i] != 1) {
+                g = tensor_reduce(g, TENSOR_SUM, i, true);
+            }
+        }
+    }
+    if(!g->same_shape(like)) {
+        g = tensor_binary(new_tensor(like.dtype, like.ndim, like.shape, true), g, TENSOR_ADD);
+    }
+    return g;
+}
+
+struct ad_tape_t {
+    typedef std::function<void(const jo_clojure_tensor_ptr_t &)> backward_fn_t;
+
+    struct slot_t {
+        jo_clojure_tensor_ptr_t value;
+        jo_clojure_tensor_ptr_t grad; // outlives reset() so the buffer can be reused
+        bool requires_grad;
+        bool has_grad;
+    };
+
+    struct op_t {
+        ad_var_t out;
+        backward_fn_t backward;
+    };
+
+    std::vector<slot_t> slots;
+    std::vector<op_t> ops;
+    int num_slots;
+
+    ad_tape_t() : num_slots(0) {}
+
+    // Starts a new graph. Values are dropped, gradient buffers are kept.
+    void reset() {
+        for(int i = 0; i < num_slots; ++i) {
+            slots[i].value = jo_clojure_tensor_ptr_t();
+            slots[i].has_grad = false;
+        }
+        num_slots = 0;
+        ops.clear();
+    }
+
+    ad_var_t var(const jo_clojure_tensor_ptr_t &value, bool requires_grad) {
+        if(!value) return AD_INVALID;
+        if(num_slots == (int)slots.size()) {
+            slots.push_back(slot_t());
+        }
+        slot_t &s = slots[num_slots];
+        s.value = value;
+        s.requires_grad = requires_grad;
+        s.has_grad = false;
+        return num_slots++;
+    }
+
+    // a parameter we want the gradient of
+    ad_var_t leaf(const jo_clojure_tensor_ptr_t &value) { return var(value, true); }
+    // an input or target, no gradient
+    ad_var_t constant(const jo_clojure_tensor_ptr_t &value) { return var(value, false); }
+
+    const jo_clojure_tensor_ptr_t &value(ad_var_t v) const { return slots[v].value; }
+    bool requires_grad(ad_var_t v) const { return v >= 0 && slots[v].requires_grad; }
+
+    // d(root)/d(v) after backward(). The tape keeps writing into this buffer on later steps unless
+    // it's still referenced, so it's safe to hand out.
+    jo_clojure_tensor_ptr_t grad(ad_var_t v) const {
+        const slot_t &s = slots[v];
+        if(s.has_grad) return s.grad;
+        return new_tensor_like(s.value);
+    }
+
+    void accumulate(ad_var_t v, const jo_clojure_tensor_ptr_t &g_in) {
+        slot_t &s = slots[v];
+        if(!s.requires_grad || !g_in) return;
+        jo_clojure_tensor_ptr_t g = ad_match_shape(g_in, *s.value);
+        if(s.has_grad) {
+            ad_add_into(s.grad, g);
+            return;
+        }
+        // only reuse last step's buffer if nothing else can see it any more
+        bool reuse = s.grad && s.grad->dtype == s.value->dtype && s.grad->same_shape(*s.value)
+                  && s.grad.use_count() == 1 && s.grad->storage.use_count() == 1;
+        if(!reuse) {
+            s.grad = new_tensor(s.value->dtype, s.value->ndim, s.value->shape, false);
+        }
+        tensor_copy_into(s.grad, g);
+        s.has_grad = true;
+    }
+
+    // Adds the result of an op. backward gets d(root)/d(out) and accumulates into the op's inputs.
+    ad_var_t record(const jo_clojure_tensor_ptr_t &value, bool requires_grad, backward_fn_t backward) {
+        ad_var_t out = var(value, requires_grad);
+        if(out != AD_INVALID && requires_grad) {
+            ops.push_back(op_t{out, std::move(backward)});
+        }
+        return out;
+    }
+
+    void backward(ad_var_t root) {
+        if(root < 0) return;
+        const jo_clojure_tensor_ptr_t &r = slots[root].value;
+        accumulate(root, tensor_full(r->dtype, r->ndim, r->shape, 1));
+        for(int i = (int)ops.size() - 1; i >= 0; --i) {
+            const op_t &op = ops[i];
+            if(slots[op.out].has_grad) {
+                op.backward(slots[op.out].grad);
+            }
+        }
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Primitives
+
+// Broadcasting elementwise add/sub/mul/div
+static ad_var_t ad_binary(ad_tape_t &tape, ad_var_t a, ad_var_t b, tensor_op_t op) {
+    if(a < 0 || b < 0) return AD_INVALID;
+    jo_clojure_tensor_ptr_t C = tensor_binary(tape.value(a), tape.value(b), op);
+    if(!C) return AD_INVALID;
+    return tape.record(C, tape.requires_grad(a) || tape.requires_grad(b), [&tape, a, b, op, C](const jo_clojure_tensor_ptr_t &dout) {
+        const jo_clojure_tensor_ptr_t &A = tape.value(a);
+        const jo_clojure_tensor_ptr_t &B = tape.value(b);
+        switch(op) {
+        case TENSOR_ADD:
+            tape.accumulate(a, dout);
+            tape.accumulate(b, dout);
+            break;
+        case TENSOR_SUB:
+            tape.accumulate(a, dout);
+            if(tape.requires_grad(b)) tape.accumulate(b, tensor_map(dout, [](auto v) { return -v; }));
+            break;
+        case TENSOR_MUL:
+            if(tape.requires_grad(a)) tape.accumulate(a, tensor_binary(dout, B, TENSOR_MUL));
+            if(tape.requires_grad(b)) tape.accumulate(b, tensor_binary(dout, A, TENSOR_MUL));
+            break;
+        case TENSOR_DIV:
+            // d(a/b)/db = -(a/b)/b
+            if(tape.requires_grad(a)) tape.accumulate(a, tensor_binary(dout, B, TENSOR_DIV));
+            if(tape.requires_grad(b)) tape.accumulate(b, tensor_map(tensor_binary(tensor_binary(dout, C, TENSOR_MUL), B, TENSOR_DIV), [](auto v) { return -v; }));
+            break;
+        default:
+            break;
+        }
+    });
+}
+
+static ad_var_t ad_add(ad_tape_t &tape, ad_var_t a, ad_var_t b) { return ad_binary(tape, a, b, TENSOR_ADD); }
+static ad_var_t ad_sub(ad_tape_t &tape, ad_var_t a, ad_var_t b) { return ad_binary(tape, a, b, TENSOR_SUB); }
+static ad_var_t ad_mul(ad_tape_t &tape, ad_var_t a, ad_var_t b) { return ad_binary(tape, a, b, TENSOR_MUL); }
+static ad_var_t ad_div(ad_tape_t &tape, ad_var_t a, ad_var_t b) { return ad_binary(tape, a, b, TENSOR_DIV); }
+
+// Batched matrix multiply; both operands must be at least 2-d.
+static ad_var_t ad_matmul(ad_tape_t &tape, ad_var_t a, ad_var_t b) {
+    if(a < 0 || b < 0) return AD_INVALID;
+    if(tape.value(a)->ndim < 2 || tape.value(b)->ndim < 2) return AD_INVALID;
+    jo_clojure_tensor_ptr_t C = tensor_matmul(tape.value(a), tape.value(b));
+    if(!C) return AD_INVALID;
+    return tape.record(C, tape.requires_grad(a) || tape.requires_grad(b), [&tape, a, b](const jo_clojure_tensor_ptr_t &dout) {
+        if(tape.requires_grad(a)) tape.accumulate(a, tensor_matmul(dout, tensor_transpose(tape.value(b))));
+        if(tape.requires_grad(b)) tape.accumulate(b, tensor_matmul(tensor_transpose(tape.value(a)), dout));
+    });
+}
+
+// dout * d(x, y) elementwise, where d gets each input and output element
+template<typename D>
+static jo_clojure_tensor_ptr_t ad_unary_grad(const jo_clojure_tensor_ptr_t &dout, const jo_clojure_tensor_ptr_t &X, const jo_clojure_tensor_ptr_t &Y, D d) {
+    jo_clojure_tensor_ptr_t G = tensor_contiguous(tensor_astype(dout, X->dtype));
+    jo_clojure_tensor_ptr_t C = new_tensor_like(G, false);
+    int nd = X->ndim;
+    long long isx = nd ? X->strides[nd-1] : 0, isy = nd ? Y->strides[nd-1] : 0;
+    auto run = [&](auto *g, auto *x, auto *y, auto *c) {
+        tensor_walk(nd, X->shape, G->strides, X->strides, Y->strides, [&](long long og, long long ox, long long oy, long long n) {
+            for(long long i = 0; i < n; ++i) c[og+i] = g[og+i] * d(x[ox + i*isx], y[oy + i*isy]);
+        });
+    };
+    if(X->dtype == TYPE_FLOAT) {
+        run(G->data<float>(), X->data<float>(), Y->data<float>(), C->data<float>());
+    } else {
+        run(G->data<double>(), X->data<double>(), Y->data<double>(), C->data<double>());
+    }
+    return C;
+}
+
+// y = f(x) elementwise, with dy/dx = d(x, y)
+template<typename F, typename D>
+static ad_var_t ad_unary(ad_tape_t &tape, ad_var_t x, F f, D d) {
+    if(x < 0) return AD_INVALID;
+    jo_clojure_tensor_ptr_t Y = tensor_map(tape.value(x), f);
+    return tape.record(Y, tape.requires_grad(x), [&tape, x, Y, d](const jo_clojure_tensor_ptr_t &dout) {
+        tape.accumulate(x, ad_unary_grad(dout, tape.value(x), Y, d));
+    });
+}
+
+static ad_var_t ad_relu(ad_tape_t &tape, ad_var_t x) {
+    return ad_unary(tape, x, [](auto v) { return v > 0 ? v : 0; }, [](auto x, auto y) { return x > 0 ? 1 : 0; });
+}
+
+static ad_var_t ad_sigmoid(ad_tape_t &tape, ad_var_t x) {
+    return ad_unary(tape, x, [](auto v) { return (decltype(v))(1.0 / (1.0 + exp(-v))); }, [](auto x, auto y) { return y * (1 - y); });
+}
+
+static ad_var_t ad_tanh(ad_tape_t &tape, ad_var_t x) {
+    return ad_unary(tape, x, [](auto v) { return (decltype(v))tanh(v); }, [](auto x, auto y) { return 1 - y * y; });
+}
+
+static ad_var_t ad_leaky_relu(ad_tape_t &tape, ad_var_t x, double alpha) {
+    return ad_unary(tape, x, [alpha](auto v) { return v > 0 ? v : (decltype(v))(alpha * v); }, [alpha](auto x, auto y) { return x > 0 ? 1.0 : alpha; });
+}
+
+static ad_var_t ad_elu(ad_tape_t &tape, ad_var_t x, double alpha) {
+    // for x <= 0, d/dx alpha*(e^x - 1) = y + alpha
+    return ad_unary(tape, x, [alpha](auto v) { return v > 0 ? v : (decltype(v))(alpha * (exp(v) - 1.0)); }, [alpha](auto x, auto y) { return x > 0 ? 1.0 : y + alpha; });
+}
+
+// tanh approximation, same as nn/gelu
+static ad_var_t ad_gelu(ad_tape_t &tape, ad_var_t x) {
+    return ad_unary(tape, x, [](auto v) {
+        double inner = sqrt(2.0/M_PI) * (v + 0.044715 * v * v * v);
+        return (decltype(v))(0.5 * v * (1.0 + tanh(inner)));
+    }, [](auto x, auto y) {
+        double c = sqrt(2.0/M_PI);
+        double t = tanh(c * (x + 0.044715 * x * x * x));
+        return 0.5 * (1.0 + t) + 0.5 * x * (1.0 - t * t) * c * (1.0 + 3.0 * 0.044715 * x * x);
+    });
+}
+
+static ad_var_t ad_swish(ad_tape_t &tape, ad_var_t x, double beta) {
+    return ad_unary(tape, x, [beta](auto v) { return (decltype(v))(v / (1.0 + exp(-beta * v))); }, [beta](auto x, auto y) {
+        double s = 1.0 / (1.0 + exp(-beta * x));
+        return s + beta * x * s * (1.0 - s);
+    });
+}
+
+static ad_var_t ad_sqrt(ad_tape_t &tape, ad_var_t x) {
+    return ad_unary(tape, x, [](auto v) { return (decltype(v))sqrt(v); }, [](auto x, auto y) { return (decltype(y))0.5 / y; });
+}
+
+static jo_clojure_tensor_ptr_t ad_softmax_value(const jo_clojure_tensor_ptr_t &Z) {
+    jo_clojure_tensor_ptr_t max_val = tensor_reduce(Z, TENSOR_RMAX, -1, true);
+    jo_clojure_tensor_ptr_t e = tensor_map(tensor_binary(Z, max_val, TENSOR_SUB), [](auto v) { return (decltype(v))exp(v); });
+    return tensor_binary(e, tensor_reduce(e, TENSOR_SUM, -1, true), TENSOR_DIV);
+}
+
+// softmax over the last axis
+static ad_var_t ad_softmax(ad_tape_t &tape, ad_var_t x) {
+    if(x < 0) return AD_INVALID;
+    jo_clojure_tensor_ptr_t Y = ad_softmax_value(tape.value(x));
+    return tape.record(Y, tape.requires_grad(x), [&tape, x, Y](const jo_clojure_tensor_ptr_t &dout) {
+        // dx = y * (dout - sum(dout * y))
+        jo_clojure_tensor_ptr_t dot = tensor_reduce(tensor_binary(dout, Y, TENSOR_MUL), TENSOR_SUM, -1, true);
+        tape.accumulate(x, tensor_binary(Y, tensor_binary(dout, dot, TENSOR_SUB), TENSOR_MUL));
+    });
+}
+
+// TENSOR_SUM or TENSOR_MEAN along axis (or TENSOR_ALL_AXES)
+static ad_var_t ad_reduce(ad_tape_t &tape, ad_var_t x, tensor_reduce_t op, int axis = TENSOR_ALL_AXES, bool keepdims = false) {
+    if(x < 0 || (op != TENSOR_SUM && op != TENSOR_MEAN)) return AD_INVALID;
+    const jo_clojure_tensor_ptr_t &X = tape.value(x);
+    if(axis != TENSOR_ALL_AXES) {
+        axis = tensor_axis(*X, axis);
+        if(axis < 0) return AD_INVALID;
+    }
+    jo_clojure_tensor_ptr_t Y = tensor_reduce(X, op, axis, keepdims);
+    return tape.record(Y, tape.requires_grad(x), [&tape, x, op, axis](const jo_clojure_tensor_ptr_t &dout) {
+        const jo_clojure_tensor_ptr_t &X = tape.value(x);
+        jo_clojure_tensor_ptr_t g = dout;
+        long long n = X->size();
+        if(axis != TENSOR_ALL_AXES) {
+            // put the reduced axis back so the gradient broadcasts along it
+            long long dims[TENSOR_MAX_DIMS];
+            for(int i = 0; i < X->ndim; ++i) dims[i] = i == axis ? 1 : X->shape[i];
+            g = tensor_reshape(g, X->ndim, dims);
+            n = X->shape[axis];
+        }
+        if(op == TENSOR_MEAN && n > 0) {
+            g = tensor_binary(g, tensor_scalar(1.0 / n), TENSOR_MUL);
+        }
+        tape.accumulate(x, g);
+    });
+}
+
+static ad_var_t ad_reshape(ad_tape_t &tape, ad_var_t x, int nd, const long long *dims) {
+    if(x < 0) return AD_INVALID;
+    jo_clojure_tensor_ptr_t Y = tensor_reshape(tape.value(x), nd, dims);
+    if(!Y) return AD_INVALID;
+    return tape.record(Y, tape.requires_grad(x), [&tape, x](const jo_clojure_tensor_ptr_t &dout) {
+        const jo_clojure_tensor_ptr_t &X = tape.value(x);
+        tape.accumulate(x, tensor_reshape(dout, X->ndim, X->shape));
+    });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Losses. Each returns a scalar and is the sum over all elements times scale.
+
+// 0.5 * sum((p - target)^2); the gradient is (p - target) * scale
+static ad_var_t ad_squared_error(ad_tape_t &tape, ad_var_t p, ad_var_t target, double scale) {
+    if(p < 0 || target < 0) return AD_INVALID;
+    jo_clojure_tensor_ptr_t diff = tensor_binary(tape.value(p), tape.value(target), TENSOR_SUB);
+    if(!diff) return AD_INVALID;
+    jo_clojure_tensor_ptr_t L = tensor_reduce(tensor_binary(diff, diff, TENSOR_MUL), TENSOR_SUM);
+    L = tensor_binary(L, tensor_scalar(0.5 * scale), TENSOR_MUL);
+    return tape.record(L, tape.requires_grad(p), [&tape, p, diff, scale](const jo_clojure_tensor_ptr_t &dout) {
+        tape.accumulate(p, tensor_binary(diff, tensor_binary(dout, tensor_scalar(scale), TENSOR_MUL), TENSOR_MUL));
+    });
+}
+
+// binary cross entropy of sigmoid(z); the gradient is (sigmoid(z) - target) * scale
+static ad_var_t ad_bce_with_logits(ad_tape_t &tape, ad_var_t z, ad_var_t target, double scale) {
+    if(z < 0 || target < 0) return AD_INVALID;
+    const jo_clojure_tensor_ptr_t &Z = tape.value(z);
+    const jo_clojure_tensor_ptr_t &T = tape.value(target);
+    // max(z, 0) - z*t + log(1 + e^-|z|) is the stable form of -t*log(p) - (1-t)*log(1-p)
+    jo_clojure_tensor_ptr_t soft = tensor_map(Z, [](auto v) { return (decltype(v))((v > 0 ? v : 0) + log1p(exp(v > 0 ? -v : v))); });
+    jo_clojure_tensor_ptr_t zt = tensor_binary(Z, T, TENSOR_MUL);
+    if(!zt) return AD_INVALID;
+    jo_clojure_tensor_ptr_t L = tensor_reduce(tensor_binary(soft, zt, TENSOR_SUB), TENSOR_SUM);
+    L = tensor_binary(L, tensor_scalar(scale), TENSOR_MUL);
+    return tape.record(L, tape.requires_grad(z), [&tape, z, target, scale](const jo_clojure_tensor_ptr_t &dout) {
+        jo_clojure_tensor_ptr_t P = tensor_map(tape.value(z), [](auto v) { return (decltype(v))(1.0 / (1.0 + exp(-v))); });
+        jo_clojure_tensor_ptr_t dz = tensor_binary(P, tape.value(target), TENSOR_SUB);
+        tape.accumulate(z, tensor_binary(dz, tensor_binary(dout, tensor_scalar(scale), TENSOR_MUL), TENSOR_MUL));
+    });
+}
+
+// categorical cross entropy of softmax(z) over the last axis; the gradient is (softmax(z) - target) * scale
+static ad_var_t ad_softmax_cross_entropy(ad_tape_t &tape, ad_var_t z, ad_var_t target, double scale) {
+    if(z < 0 || target < 0) return AD_INVALID;
+    const jo_clojure_tensor_ptr_t &Z = tape.value(z);
+    jo_clojure_tensor_ptr_t P = ad_softmax_value(Z);
+    jo_clojure_tensor_ptr_t logp = tensor_map(P, [](auto v) { return (decltype(v))log(v > 1e-15 ? v : 1e-15); });
+    jo_clojure_tensor_ptr_t tl = tensor_binary(tape.value(target), logp, TENSOR_MUL);
+    if(!tl) return AD_INVALID;
+    jo_clojure_tensor_ptr_t L = tensor_binary(tensor_reduce(tl, TENSOR_SUM), tensor_scalar(-scale), TENSOR_MUL);
+    return tape.record(L, tape.requires_grad(z), [&tape, z, target, P, scale](const jo_clojure_tensor_ptr_t &dout) {
+        jo_clojure_tensor_ptr_t dz = tensor_binary(P, tape.value(target), TENSOR_SUB);
+        tape.accumulate(z, tensor_binary(dz, tensor_binary(dout, tensor_scalar(scale), TENSOR_MUL), TENSOR_MUL));
+    });
+}
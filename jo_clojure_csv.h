@@ -0,0 +1,454 @@
+#pragma once
+
+// CSV/TSV reader.
+//
+// Files are memory-mapped (or slurped, when they can't be) and split into fields by scanning for
+// the separator and line ends 16 bytes at a time. csv/read hands out rows lazily. csv/read-columns
+// reads the whole file into typed columns: ints and doubles become dense arrays (or tensors),
+// anything else a vector of strings in which equal values share one node. Files without quotes
+// are cut into chunks at line ends and parsed on the thread pool.
+
+struct csv_source_t {
+    const char *buf = NULL, *end = NULL;
+    void *mapping = NULL;
+    size_t mapping_size = 0;
+    char *owned = NULL;
+
+    csv_source_t() {}
+    csv_source_t(const csv_source_t &) = delete;
+    ~csv_source_t() {
+        if(mapping) jo_munmap_file(mapping, mapping_size);
+        free(owned);
+    }
+
+    bool open(const char *path) {
+        mapping = jo_mmap_file(path, &mapping_size);
+        if(mapping) {
+            buf = (const char *)mapping;
+            end = buf + mapping_size;
+            return true;
+        }
+        // empty files can't be mapped
+        size_t size = 0;
+        owned = (char *)jo_slurp_file(path, &size);
+        buf = owned;
+        end = owned + size;
+        return owned != 0;
+    }
+};
+typedef jo_shared_ptr<csv_source_t> csv_source_ptr_t;
+
+enum csv_kind_t {
+    CSV_EMPTY = 0,
+    CSV_INT,
+    CSV_FLOAT,
+    CSV_STRING,
+    CSV_ESCAPED, // quoted, with doubled quotes inside
+};
+
+struct csv_field_t {
+    const char *s;
+    unsigned len;
+    unsigned char kind;
+};
+
+struct csv_format_t {
+    char sep = ',';
+    char quote = '"';
+    bool header = false;
+    bool tensors = false;
+};
+
+// first a, b or c in [p, end), or end
+static inline const char *csv_scan(const char *p, const char *end, char a, char b, char c) {
+#ifdef JSON_SSE2
+    const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b), vc = _mm_set1_epi8(c);
+    for(; p + 16 <= end; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)), _mm_cmpeq_epi8(v, vc));
+        int mask = _mm_movemask_epi8(m);
+        if(mask) {
+#ifdef _MSC_VER
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            return p + bit;
+#else
+            return p + __builtin_ctz(mask);
+#endif
+        }
+    }
+#endif
+    for(; p < end && *p != a && *p != b && *p != c; ++p) {}
+    return p;
+}
+
+static unsigned char csv_classify(const char *s, unsigned len) {
+    if(!len) return CSV_EMPTY;
+    unsigned i = s[0] == '-' || s[0] == '+';
+    unsigned digits = 0, frac = 0;
+    for(; i < len && s[i] >= '0' && s[i] <= '9'; ++i) digits++;
+    if(i == len) return !digits ? CSV_STRING : digits <= 18 ? CSV_INT : CSV_FLOAT;
+    if(s[i] == '.') {
+        for(++i; i < len && s[i] >= '0' && s[i] <= '9'; ++i) frac++;
+    }
+    if(!digits && !frac) return CSV_STRING;
+    if(i < len && (s[i] == 'e' || s[i] == 'E')) {
+        ++i;
+        if(i < len && (s[i] == '+' || s[i] == '-')) ++i;
+        unsigned exp = 0;
+        for(; i < len && s[i] >= '0' && s[i] <= '9'; ++i) exp++;
+        if(!exp) return CSV_STRING;
+    }
+    return i == len ? CSV_FLOAT : CSV_STRING;
+}
+
+// Parses the row at p into fields[0..n), returning the start of the next row.
+static const char *csv_parse_row(const char *p, const char *end, const csv_format_t &fmt, jo_vector<csv_field_t> &fields, size_t &n) {
+    n = 0;
+    for(;;) {
+        csv_field_t f;
+        if(p < end && *p == fmt.quote) {
+            const char *s = ++p;
+            bool escaped = false;
+            for(;;) {
+                const char *q = (const char *)memchr(p, fmt.quote, end - p);
+                if(!q) {
+                    // unterminated, take the rest
+                    f = {s, (unsigned)(end - s), CSV_STRING};
+                    p = end;
+                    break;
+                }
+                if(q + 1 < end && q[1] == fmt.quote) {
+                    escaped = true;
+                    p = q + 2;
+                    continue;
+                }
+                f = {s, (unsigned)(q - s), escaped ? (unsigned char)CSV_ESCAPED : csv_classify(s, (unsigned)(q - s))};
+                if(f.kind == CSV_EMPTY) f.kind = CSV_STRING;
+                p = q + 1;
+                break;
+            }
+            // anything between the closing quote and the separator is dropped
+            p = csv_scan(p, end, fmt.sep, '\n', '\r');
+        } else {
+            const char *q = csv_scan(p, end, fmt.sep, '\n', '\r');
+            f = {p, (unsigned)(q - p), csv_classify(p, (unsigned)(q - p))};
+            p = q;
+        }
+        if(n == fields.size()) fields.push_back(f);
+        else fields[n] = f;
+        n++;
+        if(p >= end) return end;
+        if(*p == fmt.sep) {
+            p++;
+            continue;
+        }
+        if(*p == '\r') p++;
+        if(p < end && *p == '\n') p++;
+        return p;
+    }
+}
+
+static inline const char *csv_skip_blank_lines(const char *p, const char *end) {
+    while(p < end && (*p == '\n' || *p == '\r')) p++;
+    return p;
+}
+
+static jo_string csv_field_string(const csv_field_t &f, char quote) {
+    if(f.kind != CSV_ESCAPED) return jo_string(f.s, f.len);
+    jo_string out;
+    for(unsigned i = 0; i < f.len; ++i) {
+        out += f.s[i];
+        if(f.s[i] == quote && i + 1 < f.len && f.s[i + 1] == quote) i++;
+    }
+    return out;
+}
+
+static inline long long csv_parse_int(const char *s, unsigned len) {
+    bool neg = s[0] == '-';
+    unsigned i = s[0] == '-' || s[0] == '+';
+    long long v = 0;
+    for(; i < len; ++i) v = v * 10 + (s[i] - '0');
+    return neg ? -v : v;
+}
+
+// Arguments: ([opts]) where opts may have :separator (char or string), :quote, :header and
+// :numeric (:array or :tensor, for csv/read-columns). Files ending in .tsv default to tabs.
+static bool csv_parse_opts(const jo_string &path, node_idx_t opts_idx, csv_format_t &fmt, const char *fn_name) {
+    if(path.length() > 4 && !strcmp(path.c_str() + path.length() - 4, ".tsv")) fmt.sep = '\t';
+    if(opts_idx == NIL_NODE) return true;
+    if(!get_node(opts_idx)->is_hash_map()) {
+        warnf("%s: options must be a map\n", fn_name);
+        return false;
+    }
+    hash_map_ptr_t opts = get_node(opts_idx)->as_hash_map();
+    node_idx_t sep = opts->get(new_node_keyword("separator"), node_eq);
+    if(sep != NIL_NODE) fmt.sep = get_node_type(sep) == NODE_STRING ? get_node(sep)->t_string.c_str()[0] : (char)get_node_int(sep);
+    node_idx_t quote = opts->get(new_node_keyword("quote"), node_eq);
+    if(quote != NIL_NODE) fmt.quote = get_node_type(quote) == NODE_STRING ? get_node(quote)->t_string.c_str()[0] : (char)get_node_int(quote);
+    node_idx_t header = opts->get(new_node_keyword("header"), node_eq);
+    if(header != NIL_NODE) fmt.header = get_node_bool(header);
+    node_idx_t numeric = opts->get(new_node_keyword("numeric"), node_eq);
+    if(numeric != NIL_NODE) fmt.tensors = get_node(numeric)->t_string == "tensor";
+    if(fmt.sep == '\n' || fmt.sep == '\r' || fmt.sep == fmt.quote) {
+        warnf("%s: invalid separator\n", fn_name);
+        return false;
+    }
+    return true;
+}
+
+// State behind csv/read
+struct csv_rows_t {
+    csv_source_ptr_t src;
+    csv_format_t fmt;
+    const char *p;
+    jo_vector<node_idx_t> keys;
+    jo_vector<csv_field_t> fields;
+};
+typedef jo_shared_ptr<csv_rows_t> csv_rows_ptr_t;
+
+static node_idx_t csv_rows_next(env_ptr_t env, csv_rows_ptr_t rows) {
+    const char *end = rows->src->end;
+    rows->p = csv_skip_blank_lines(rows->p, end);
+    if(rows->p >= end) return NIL_NODE;
+    size_t n;
+    rows->p = csv_parse_row(rows->p, end, rows->fmt, rows->fields, n);
+    node_idx_t row;
+    if(rows->fmt.header) {
+        hash_map_ptr_t m = new_hash_map();
+        for(size_t i = 0; i < n && i < rows->keys.size(); ++i) {
+            m->assoc_inplace(rows->keys[i], new_node_string(csv_field_string(rows->fields[i], rows->fmt.quote)), node_eq);
+        }
+        row = new_node_hash_map(m);
+    } else {
+        vector_ptr_t v = new_vector();
+        for(size_t i = 0; i < n; ++i) {
+            v->push_back_inplace(new_node_string(csv_field_string(rows->fields[i], rows->fmt.quote)));
+        }
+        row = new_node_vector(v);
+    }
+    return new_node_list(list_va(row, new_node_native_function("csv/read-next", [rows](env_ptr_t env, list_ptr_t args) -> node_idx_t {
+        return csv_rows_next(env, rows);
+    }, true, NODE_FLAG_PRERESOLVE)));
+}
+
+// (csv/read path)
+// (csv/read path opts)
+// Returns the rows of the CSV file at path as a lazy sequence of vectors of strings, or with
+// :header true, of maps from the first row's names (as keywords) to strings. Quoted fields may
+// contain separators, newlines and doubled quotes.
+static node_idx_t native_csv_read(env_ptr_t env, list_ptr_t args) {
+    jo_string path = get_node(args->first_value())->as_string();
+    csv_rows_ptr_t rows(new csv_rows_t());
+    if(!csv_parse_opts(path, args->size() > 1 ? args->second_value() : NIL_NODE, rows->fmt, "csv/read")) return NIL_NODE;
+    rows->src = csv_source_ptr_t(new csv_source_t());
+    if(!rows->src->open(path.c_str())) {
+        warnf("csv/read: could not open %s\n", path.c_str());
+        return NIL_NODE;
+    }
+    rows->p = rows->src->buf;
+    if(rows->fmt.header) {
+        rows->p = csv_skip_blank_lines(rows->p, rows->src->end);
+        size_t n;
+        rows->p = csv_parse_row(rows->p, rows->src->end, rows->fmt, rows->fields, n);
+        for(size_t i = 0; i < n; ++i) rows->keys.push_back(new_node_keyword(csv_field_string(rows->fields[i], rows->fmt.quote)));
+    }
+    return new_node_lazy_list(env, new_node_list(list_va(new_node_native_function("csv/read-next", [rows](env_ptr_t env, list_ptr_t args) -> node_idx_t {
+        return csv_rows_next(env, rows);
+    }, true, NODE_FLAG_PRERESOLVE))));
+}
+
+// One slice of the file for csv/read-columns. Fields are stored row major, padded to the column
+// count, and kinds holds the widest kind seen in each column.
+struct csv_chunk_t {
+    const char *begin, *end;
+    long long rows = 0, first_row = 0;
+    jo_vector<csv_field_t> fields;
+    jo_vector<unsigned char> kinds;
+    jo_vector<unsigned char> has_empty;
+};
+
+// Runs fn(0..n-1) on the thread pool and the calling thread, returning when all are done.
+// Indices are claimed atomically, so a busy pool only means the caller does more of the work.
+template<typename F>
+static void csv_parallel_for(int n, F fn) {
+    if(n <= 1) {
+        if(n == 1) fn(0);
+        return;
+    }
+    struct shared_t {
+        std::atomic<int> next{0}, done{0};
+    };
+    jo_shared_ptr<shared_t> shared(new shared_t());
+    jo_shared_ptr<std::function<void(int)>> work(new std::function<void(int)>(fn));
+    auto run = [shared, work, n]() mutable -> node_idx_t {
+        for(int i; (i = shared->next.fetch_add(1)) < n;) {
+            (*work)(i);
+            shared->done.fetch_add(1);
+        }
+        return NIL_NODE;
+    };
+    for(int i = 1; i < n; ++i) thread_pool->add_task(new jo_task_t(run));
+    run();
+    int count = 0;
+    while(shared->done.load() != n) {
+        jo_yield_backoff(&count);
+    }
+}
+
+// (csv/read-columns path)
+// (csv/read-columns path opts)
+// Reads the CSV file at path into a map from column name (keyword, or index with :header false)
+// to a typed column: an array of longs if every value is an integer, an array of doubles if every
+// value is a number (empty fields are NaN), otherwise a vector of strings in which equal strings
+// share one node. With :numeric :tensor, numeric columns are float64 tensors instead.
+// Takes the options of csv/read, but :header defaults to true.
+static node_idx_t native_csv_read_columns(env_ptr_t env, list_ptr_t args) {
+    jo_string path = get_node(args->first_value())->as_string();
+    csv_format_t fmt;
+    fmt.header = true;
+    if(!csv_parse_opts(path, args->size() > 1 ? args->second_value() : NIL_NODE, fmt, "csv/read-columns")) return NIL_NODE;
+    csv_source_t src;
+    if(!src.open(path.c_str())) {
+        warnf("csv/read-columns: could not open %s\n", path.c_str());
+        return NIL_NODE;
+    }
+
+    jo_vector<csv_field_t> fields;
+    size_t ncols = 0;
+    const char *p = csv_skip_blank_lines(src.buf, src.end);
+    jo_vector<node_idx_t> names;
+    if(p < src.end) {
+        const char *body = csv_parse_row(p, src.end, fmt, fields, ncols);
+        if(fmt.header) {
+            for(size_t i = 0; i < ncols; ++i) names.push_back(new_node_keyword(csv_field_string(fields[i], fmt.quote)));
+            p = body;
+        } else {
+            for(size_t i = 0; i < ncols; ++i) names.push_back(new_node_int(i));
+        }
+    }
+    if(!ncols) return new_node_hash_map(new_hash_map());
+
+    // Quoted fields can hold newlines, so only quote free files are safe to cut at any line end
+    size_t bytes = src.end - p;
+    int nchunks = 1;
+    if(bytes > (1 << 20) && !memchr(p, fmt.quote, bytes)) {
+        nchunks = (int)jo_min((size_t)processor_count, bytes >> 18);
+        if(nchunks < 1) nchunks = 1;
+    }
+    csv_chunk_t *chunks = new csv_chunk_t[nchunks];
+    for(int c = 0; c < nchunks; ++c) {
+        const char *b = c == 0 ? p : chunks[c - 1].end;
+        const char *e = c == nchunks - 1 ? src.end : p + bytes * (c + 1) / nchunks;
+        if(e < b) e = b;
+        if(c != nchunks - 1) {
+            const char *nl = (const char *)memchr(e, '\n', src.end - e);
+            e = nl ? nl + 1 : src.end;
+        }
+        chunks[c].begin = b;
+        chunks[c].end = e;
+    }
+
+    // pass 1: split into fields and find each column's kind
+    csv_parallel_for(nchunks, [&](int c) {
+        csv_chunk_t &ch = chunks[c];
+        ch.kinds.resize(ncols);
+        ch.has_empty.resize(ncols);
+        memset(ch.kinds.data(), 0, ncols);
+        memset(ch.has_empty.data(), 0, ncols);
+        jo_vector<csv_field_t> row;
+        const char *q = ch.begin;
+        for(;;) {
+            q = csv_skip_blank_lines(q, ch.end);
+            if(q >= ch.end) break;
+            size_t n;
+            q = csv_parse_row(q, ch.end, fmt, row, n);
+            for(size_t i = 0; i < ncols; ++i) {
+                csv_field_t f = i < n ? row[i] : csv_field_t{q, 0, CSV_EMPTY};
+                unsigned char kind = f.kind == CSV_ESCAPED ? (unsigned char)CSV_STRING : (unsigned char)f.kind;
+                if(kind > ch.kinds[i]) ch.kinds[i] = kind;
+                if(kind == CSV_EMPTY) ch.has_empty[i] = 1;
+                ch.fields.push_back(f);
+            }
+            ch.rows++;
+        }
+    });
+
+    long long rows = 0;
+    jo_vector<unsigned char> kinds;
+    kinds.resize(ncols);
+    for(size_t i = 0; i < ncols; ++i) {
+        unsigned char kind = CSV_EMPTY;
+        bool empty = false;
+        for(int c = 0; c < nchunks; ++c) {
+            if(chunks[c].kinds[i] > kind) kind = chunks[c].kinds[i];
+            empty |= chunks[c].has_empty[i] != 0;
+        }
+        if(kind == CSV_INT && (empty || fmt.tensors)) kind = CSV_FLOAT;
+        if(kind == CSV_EMPTY) kind = CSV_STRING;
+        kinds[i] = kind;
+    }
+    for(int c = 0; c < nchunks; ++c) {
+        chunks[c].first_row = rows;
+        rows += chunks[c].rows;
+    }
+
+    // pass 2: convert numeric columns straight into their final buffers
+    jo_vector<void *> out;
+    out.resize(ncols);
+    for(size_t i = 0; i < ncols; ++i) out[i] = kinds[i] == CSV_STRING ? NULL : malloc((rows ? rows : 1) * 8);
+    csv_parallel_for(nchunks, [&](int c) {
+        const csv_chunk_t &ch = chunks[c];
+        for(long long r = 0; r < ch.rows; ++r) {
+            const csv_field_t *row = &ch.fields[r * ncols];
+            for(size_t i = 0; i < ncols; ++i) {
+                if(kinds[i] == CSV_INT) {
+                    ((long long *)out[i])[ch.first_row + r] = csv_parse_int(row[i].s, row[i].len);
+                } else if(kinds[i] == CSV_FLOAT) {
+                    ((double *)out[i])[ch.first_row + r] = row[i].len ? parse_float(row[i].s, row[i].s + row[i].len) : NAN;
+                }
+            }
+        }
+    });
+
+    hash_map_ptr_t result = new_hash_map();
+    for(size_t i = 0; i < ncols; ++i) {
+        node_idx_t col;
+        if(kinds[i] == CSV_STRING) {
+            parse_intern_t dict(0, 256);
+            vector_ptr_t v = new_vector();
+            for(int c = 0; c < nchunks; ++c) {
+                const csv_chunk_t &ch = chunks[c];
+                for(long long r = 0; r < ch.rows; ++r) {
+                    const csv_field_t &f = ch.fields[r * ncols + i];
+                    if(f.kind == CSV_ESCAPED) {
+                        jo_string s = csv_field_string(f, fmt.quote);
+                        v->push_back_inplace(dict.get(NODE_STRING, s.c_str(), (int)s.length()));
+                    } else {
+                        v->push_back_inplace(dict.get(NODE_STRING, f.s, (int)f.len));
+                    }
+                }
+            }
+            col = new_node_vector(v);
+        } else if(fmt.tensors) {
+            jo_clojure_tensor_ptr_t t = new_tensor(TYPE_DOUBLE, 1, &rows, false);
+            memcpy(t->data<double>(), out[i], rows * sizeof(double));
+            col = new_node_tensor(t);
+        } else {
+            jo_clojure_array_ptr_t A = new_array((const unsigned char *)out[i], rows * 8);
+            A->num_elements = rows;
+            A->element_size = 8;
+            A->type = kinds[i] == CSV_INT ? TYPE_LONG : TYPE_DOUBLE;
+            col = new_node_array(A);
+        }
+        free(out[i]);
+        result->assoc_inplace(names[i], col, node_eq);
+    }
+    delete [] chunks;
+    return new_node_hash_map(result);
+}
+
+void jo_clojure_csv_init(env_ptr_t env) {
+    env->set("csv/read", new_node_native_function("csv/read", &native_csv_read, false, NODE_FLAG_PRERESOLVE));
+    env->set("csv/read-columns", new_node_native_function("csv/read-columns", &native_csv_read_columns, false, NODE_FLAG_PRERESOLVE));
+}
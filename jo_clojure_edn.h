@@ -0,0 +1,509 @@
+#pragma once
+
+// EDN data reader and writer.
+//
+// Unlike read-string, which goes through the code reader, this only reads data: nothing is
+// evaluated, and the nodes it makes are ordinary collectable values. It streams from a file one
+// form at a time or reads from a string or byte array, and builds collections in place.
+// Characters read as char ints, like the rest of jo_clojure. Tagged literals read as the tagged
+// value unless :readers or :default say otherwise.
+
+// byte arrays aren't contiguous, so readers copy them out first
+static void array_copy_bytes(jo_clojure_array_ptr_t arr, jo_vector<char> &out) {
+    out.resize(arr->num_elements * arr->element_size);
+    arr->copy_bytes(0, out.size(), (unsigned char*)out.data());
+}
+
+struct edn_mem_source_t {
+    const char *p, *end;
+    inline int get() { return p < end ? (unsigned char)*p++ : EOF; }
+    inline void unget(int c) { p--; }
+};
+
+// Reads through stdio's own buffer, so the stream is left just after the form that was read.
+struct edn_file_source_t {
+    FILE *fp;
+    inline int get() { return jo_getc_unlocked(fp); }
+    inline void unget(int c) { ungetc(c, fp); }
+};
+
+static inline bool edn_is_delim(int c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == ',' || c == '(' || c == ')' || c == '[' || c == ']'
+        || c == '{' || c == '}' || c == '"' || c == ';' || c == '\f' || c == EOF;
+}
+
+template<typename S>
+struct edn_reader_t {
+    S src;
+    env_ptr_t env;
+    hash_map_ptr_t readers;
+    node_idx_t default_reader;
+    jo_vector<char> tok;
+    parse_intern_t keywords;
+    int line = 1;
+    const char *error = NULL;
+
+    edn_reader_t(S s, env_ptr_t e) : src(s), env(e), default_reader(NIL_NODE), keywords(0, 64) {}
+
+    inline int get() {
+        int c = src.get();
+        if(c == '\n') line++;
+        return c;
+    }
+    inline void unget(int c) {
+        if(c == EOF) return;
+        if(c == '\n') line--;
+        src.unget(c);
+    }
+    bool fail(const char *msg) {
+        if(!error) error = msg;
+        return false;
+    }
+
+    // first character after whitespace, commas and comments
+    int skip() {
+        for(;;) {
+            int c = get();
+            if(c == ';') {
+                while(c != '\n' && c != EOF) c = get();
+            } else if(!(c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == ',' || c == '\f')) {
+                return c;
+            }
+        }
+    }
+
+    // reads up to the next delimiter into tok, starting with c
+    void token(int c) {
+        tok.resize(0);
+        while(!edn_is_delim(c)) {
+            tok.push_back((char)c);
+            c = get();
+        }
+        unget(c);
+        tok.push_back(0);
+        tok.resize(tok.size() - 1);
+    }
+
+    static void put_utf8(jo_vector<char> &out, unsigned cp) {
+        if(cp < 0x80) {
+            out.push_back((char)cp);
+        } else if(cp < 0x800) {
+            out.push_back((char)(0xC0 | (cp >> 6)));
+            out.push_back((char)(0x80 | (cp & 0x3F)));
+        } else {
+            out.push_back((char)(0xE0 | (cp >> 12)));
+            out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back((char)(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    bool read_string(node_idx_t &out) {
+        tok.resize(0);
+        for(;;) {
+            int c = get();
+            if(c == EOF) return fail("unterminated string");
+            if(c == '"') break;
+            if(c == '\\') {
+                c = get();
+                switch(c) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case '\\': case '"': break;
+                case 'u': {
+                    unsigned cp = 0;
+                    for(int i = 0; i < 4; ++i) {
+                        int h = get();
+                        if(h >= '0' && h <= '9') cp = cp * 16 + h - '0';
+                        else if(h >= 'a' && h <= 'f') cp = cp * 16 + h - 'a' + 10;
+                        else if(h >= 'A' && h <= 'F') cp = cp * 16 + h - 'A' + 10;
+                        else return fail("bad \\u escape in string");
+                    }
+                    put_utf8(tok, cp);
+                    continue;
+                }
+                default: return fail("unknown escape sequence in string");
+                }
+            }
+            tok.push_back((char)c);
+        }
+        out = new_node_string(jo_string(tok.data(), tok.size()));
+        return true;
+    }
+
+    bool read_char(node_idx_t &out) {
+        token(get());
+        const char *t = tok.data();
+        size_t n = tok.size();
+        long long c = -1;
+        if(n == 0) {
+            // \ followed by a delimiter is that delimiter, e.g. \( or \,
+            c = get();
+            if(c == EOF) return fail("unexpected end of input in character");
+        } else if(n == 1) {
+            c = (unsigned char)t[0];
+        } else if(n == 7 && !memcmp(t, "newline", 7)) c = '\n';
+        else if(n == 5 && !memcmp(t, "space", 5)) c = ' ';
+        else if(n == 3 && !memcmp(t, "tab", 3)) c = '\t';
+        else if(n == 6 && !memcmp(t, "return", 6)) c = '\r';
+        else if(n == 8 && !memcmp(t, "formfeed", 8)) c = '\f';
+        else if(n == 9 && !memcmp(t, "backspace", 9)) c = '\b';
+        else if(n == 5 && t[0] == 'u') c = strtol(t + 1, NULL, 16);
+        else return fail("unknown character literal");
+        out = new_node_int(c, NODE_FLAG_CHAR);
+        return true;
+    }
+
+    // numbers, symbols, nil/true/false
+    bool read_atom(int c, node_idx_t &out) {
+        token(c);
+        const char *t = tok.data(), *end = t + tok.size();
+        bool number = (t[0] >= '0' && t[0] <= '9') || ((t[0] == '-' || t[0] == '+') && tok.size() > 1 && t[1] >= '0' && t[1] <= '9');
+        if(number) {
+            if(end[-1] == 'N' || end[-1] == 'M') {
+                bool exact = end[-1] == 'N';
+                --end;
+                if(!exact) {
+                    out = new_node_float(parse_float(t, end));
+                    return true;
+                }
+            }
+            const char *slash = (const char*)memchr(t, '/', end - t);
+            if(slash) {
+                out = new_node_float(parse_float(t, slash) / parse_float(slash + 1, end));
+                return true;
+            }
+            for(const char *p = t; p < end; ++p) {
+                if(*p == '.' || *p == 'e' || *p == 'E') {
+                    out = new_node_float(parse_float(t, end));
+                    return true;
+                }
+            }
+            // integers too big for 64 bits become floats
+            bool neg = t[0] == '-';
+            unsigned long long v = 0;
+            for(const char *p = t + (t[0] == '-' || t[0] == '+'); p < end; ++p) {
+                if(*p < '0' || *p > '9') return fail("invalid number");
+                if(v > (ULLONG_MAX - 9) / 10 || v > (unsigned long long)LLONG_MAX) {
+                    out = new_node_float(parse_float(t, end));
+                    return true;
+                }
+                v = v * 10 + (*p - '0');
+            }
+            if(v > (unsigned long long)LLONG_MAX) {
+                out = new_node_float(neg ? -(double)v : (double)v);
+                return true;
+            }
+            out = new_node_int(neg ? -(long long)v : (long long)v);
+            return true;
+        }
+        size_t n = tok.size();
+        if(n == 3 && !memcmp(t, "nil", 3)) out = NIL_NODE;
+        else if(n == 4 && !memcmp(t, "true", 4)) out = TRUE_NODE;
+        else if(n == 5 && !memcmp(t, "false", 5)) out = FALSE_NODE;
+        else out = new_node_symbol(jo_string(t, n));
+        return true;
+    }
+
+    // Reads the next form into out. Returns false at the closing delimiter close, at the end of the
+    // input, or on an error (error is set).
+    bool next(node_idx_t &out, int close) {
+        int c = skip();
+        if(c == EOF) {
+            return close ? fail("unexpected end of input") : false;
+        }
+        if(c == close) {
+            return false;
+        }
+        switch(c) {
+        case '(': {
+            list_ptr_t l = new_list();
+            node_idx_t v;
+            while(next(v, ')')) l->push_back_inplace(v);
+            if(error) return false;
+            out = new_node_list(l);
+            return true;
+        }
+        case '[': {
+            vector_ptr_t vec = new_vector();
+            node_idx_t v;
+            while(next(v, ']')) vec->push_back_inplace(v);
+            if(error) return false;
+            out = new_node_vector(vec);
+            return true;
+        }
+        case '{': {
+            hash_map_ptr_t m = new_hash_map();
+            node_idx_t k, v;
+            while(next(k, '}')) {
+                if(!next(v, '}')) return fail("map literal must contain an even number of forms");
+                m->assoc_inplace(k, v, node_eq);
+            }
+            if(error) return false;
+            out = new_node_hash_map(m);
+            return true;
+        }
+        case ')': case ']': case '}':
+            return fail("unmatched delimiter");
+        case '"':
+            return read_string(out);
+        case '\\':
+            return read_char(out);
+        case ':': {
+            token(get());
+            if(tok.size() == 0) return fail("invalid keyword");
+            out = keywords.get(NODE_KEYWORD, tok.data(), (int)tok.size());
+            return true;
+        }
+        case '#': {
+            c = get();
+            if(c == '{') {
+                hash_set_ptr_t s = new_hash_set();
+                node_idx_t v;
+                while(next(v, '}')) s->assoc_inplace(v, node_eq);
+                if(error) return false;
+                out = new_node_hash_set(s);
+                return true;
+            }
+            if(c == '_') {
+                node_idx_t discard;
+                if(!next(discard, close)) return error ? false : fail("nothing to discard after #_");
+                return next(out, close);
+            }
+            if(c == '#') {
+                token(get());
+                if(tok.size() == 3 && !memcmp(tok.data(), "Inf", 3)) out = new_node_float(INFINITY);
+                else if(tok.size() == 4 && !memcmp(tok.data(), "-Inf", 4)) out = new_node_float(-INFINITY);
+                else if(tok.size() == 3 && !memcmp(tok.data(), "NaN", 3)) out = new_node_float(NAN);
+                else return fail("unknown symbolic value");
+                return true;
+            }
+            // tagged literal
+            token(c);
+            if(tok.size() == 0) return fail("invalid dispatch character");
+            node_idx_t tag = new_node_symbol(jo_string(tok.data(), tok.size()));
+            node_idx_t value;
+            if(!next(value, close)) return error ? false : fail("missing value for tagged literal");
+            node_idx_t fn = readers.ptr ? readers->get(tag, node_eq) : NIL_NODE;
+            if(fn != NIL_NODE) out = eval_va(env, fn, value);
+            else if(default_reader != NIL_NODE) out = eval_va(env, default_reader, tag, value);
+            else out = value;
+            return true;
+        }
+        default:
+            return read_atom(c, out);
+        }
+    }
+
+    // one top level form, eof if there are none left
+    node_idx_t read(node_idx_t eof) {
+        node_idx_t out;
+        if(next(out, 0)) return out;
+        if(error) {
+            warnf("edn: %s on line %d\n", error, line);
+            return NIL_NODE;
+        }
+        return eof;
+    }
+};
+
+// Arguments: ([opts] ...) where opts may have :eof, :readers and :default
+template<typename S>
+static node_idx_t edn_read_with(env_ptr_t env, S src, node_idx_t opts_idx) {
+    edn_reader_t<S> r(src, env);
+    node_idx_t eof = NIL_NODE;
+    if(opts_idx != NIL_NODE && get_node(opts_idx)->is_hash_map()) {
+        hash_map_ptr_t opts = get_node(opts_idx)->as_hash_map();
+        eof = opts->get(new_node_keyword("eof"), node_eq);
+        node_idx_t readers = opts->get(new_node_keyword("readers"), node_eq);
+        if(get_node(readers)->is_hash_map()) r.readers = get_node(readers)->as_hash_map();
+        r.default_reader = opts->get(new_node_keyword("default"), node_eq);
+    }
+    return r.read(eof);
+}
+
+// (edn/read-string s)
+// (edn/read-string opts s)
+// Reads one object from the string s. Returns nil (or the :eof option) when s is empty.
+static node_idx_t native_edn_read_string(env_ptr_t env, list_ptr_t args) {
+    node_idx_t opts = args->size() > 1 ? args->first_value() : NIL_NODE;
+    node_idx_t s_idx = args->size() > 1 ? args->second_value() : args->first_value();
+    node_t *s = get_node(s_idx);
+    if(!s->is_string()) {
+        warnf("edn/read-string: expected a string\n");
+        return NIL_NODE;
+    }
+    edn_mem_source_t src = {s->t_string.c_str(), s->t_string.c_str() + s->t_string.length()};
+    return edn_read_with(env, src, opts);
+}
+
+// (edn/read)
+// (edn/read reader)
+// (edn/read opts reader)
+// Reads the next object from reader: a file (by default *in*), which is left just after it, or a
+// byte array, which is read from the start.
+static node_idx_t native_edn_read(env_ptr_t env, list_ptr_t args) {
+    node_idx_t opts = args->size() > 1 ? args->first_value() : NIL_NODE;
+    node_idx_t rdr_idx = args->size() > 1 ? args->second_value() : args->size() ? args->first_value() : env->get("*in*");
+    node_t *rdr = get_node(rdr_idx);
+    if(rdr->type == NODE_FILE) {
+        if(!rdr->t_file) {
+            warnf("edn/read: file is closed\n");
+            return NIL_NODE;
+        }
+        edn_file_source_t src = {rdr->t_file};
+        return edn_read_with(env, src, opts);
+    }
+    if(rdr->type == NODE_ARRAY) {
+        jo_vector<char> bytes;
+        array_copy_bytes(rdr->t_object.cast<jo_clojure_array_t>(), bytes);
+        edn_mem_source_t src = {bytes.data(), bytes.data() + bytes.size()};
+        return edn_read_with(env, src, opts);
+    }
+    warnf("edn/read: expected a file or byte array\n");
+    return NIL_NODE;
+}
+
+static void edn_write(jo_text_writer_t &w, node_idx_t idx) {
+    node_t *n = get_node(idx);
+    switch(n->type) {
+    case NODE_NIL: w.put("nil", 3); return;
+    case NODE_BOOL: w.put(n->t_bool ? "true" : "false"); return;
+    case NODE_INT:
+        if(n->flags & NODE_FLAG_CHAR) {
+            switch(n->t_int) {
+            case '\n': w.put("\\newline"); return;
+            case ' ': w.put("\\space"); return;
+            case '\t': w.put("\\tab"); return;
+            case '\r': w.put("\\return"); return;
+            case '\f': w.put("\\formfeed"); return;
+            case '\b': w.put("\\backspace"); return;
+            }
+            if(n->t_int > ' ' && n->t_int < 127) {
+                w.put('\\');
+                w.put((char)n->t_int);
+            } else {
+                w.putf("\\u%04x", (unsigned)n->t_int & 0xFFFF);
+            }
+            return;
+        }
+        w.putf("%lld", n->t_int);
+        return;
+    case NODE_FLOAT: {
+        double d = n->t_float;
+        if(d != d) w.put("##NaN");
+        else if(d == INFINITY) w.put("##Inf");
+        else if(d == -INFINITY) w.put("##-Inf");
+        else {
+            size_t at = w.size;
+            w.put_double(d);
+            // keep it a float when read back
+            if(!memchr(w.buf + at, '.', w.size - at) && !memchr(w.buf + at, 'e', w.size - at)) w.put(".0", 2);
+        }
+        return;
+    }
+    case NODE_STRING: {
+        const char *s = n->t_string.c_str();
+        size_t len = n->t_string.length();
+        w.put('"');
+        size_t run = 0;
+        for(size_t i = 0; i < len; ++i) {
+            unsigned char c = s[i];
+            if(c >= 0x20 && c != '"' && c != '\\') continue;
+            w.put(s + run, i - run);
+            run = i + 1;
+            switch(c) {
+            case '"': w.put("\\\"", 2); break;
+            case '\\': w.put("\\\\", 2); break;
+            case '\n': w.put("\\n", 2); break;
+            case '\t': w.put("\\t", 2); break;
+            case '\r': w.put("\\r", 2); break;
+            case '\b': w.put("\\b", 2); break;
+            case '\f': w.put("\\f", 2); break;
+            default: w.putf("\\u%04x", c); break;
+            }
+        }
+        w.put(s + run, len - run);
+        w.put('"');
+        return;
+    }
+    case NODE_KEYWORD:
+        w.put(':');
+        w.put(n->t_string.c_str(), n->t_string.length());
+        return;
+    case NODE_SYMBOL:
+        w.put(n->t_string.c_str(), n->t_string.length());
+        return;
+    case NODE_LIST:
+    case NODE_LAZY_LIST:
+    case NODE_VECTOR: {
+        bool vec = n->type == NODE_VECTOR;
+        bool first = true;
+        w.put(vec ? '[' : '(');
+        seq_iterate(idx, [&](node_idx_t v) {
+            if(!first) w.put(' ');
+            first = false;
+            edn_write(w, v);
+            return true;
+        });
+        w.put(vec ? ']' : ')');
+        return;
+    }
+    case NODE_HASH_MAP: {
+        w.put('{');
+        for(auto it = n->as_hash_map()->begin(); it;) {
+            edn_write(w, it->first);
+            w.put(' ');
+            edn_write(w, it->second);
+            ++it;
+            if(it) w.put(", ", 2);
+        }
+        w.put('}');
+        return;
+    }
+    case NODE_HASH_SET: {
+        w.put("#{", 2);
+        for(auto it = n->as_hash_set()->begin(); it;) {
+            edn_write(w, it->first);
+            ++it;
+            if(it) w.put(' ');
+        }
+        w.put('}');
+        return;
+    }
+    default: {
+        jo_string s = n->as_string(3);
+        w.put(s.c_str(), s.length());
+        return;
+    }
+    }
+}
+
+// (edn/write x)
+// (edn/write x writer)
+// Writes x as EDN. Returns the text as a string, or writes it to the file writer and returns nil.
+static node_idx_t native_edn_write(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    node_idx_t x = *it++;
+    if(it) {
+        node_t *out = get_node(*it);
+        if(out->type != NODE_FILE || !out->t_file) {
+            warnf("edn/write: expected an open file\n");
+            return NIL_NODE;
+        }
+        jo_text_writer_t w(out->t_file);
+        edn_write(w, x);
+        return NIL_NODE;
+    }
+    jo_text_writer_t w;
+    edn_write(w, x);
+    return new_node_string(w.str());
+}
+
+void jo_clojure_edn_init(env_ptr_t env) {
+    env->set("edn/read", new_node_native_function("edn/read", &native_edn_read, false, NODE_FLAG_PRERESOLVE));
+    env->set("edn/read-string", new_node_native_function("edn/read-string", &native_edn_read_string, false, NODE_FLAG_PRERESOLVE));
+    env->set("edn/write", new_node_native_function("edn/write", &native_edn_write, false, NODE_FLAG_PRERESOLVE));
+}
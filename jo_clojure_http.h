@@ -2,11 +2,20 @@
 
 #include "httplib.h"
 
+// where the path (or a query, as in "http://host?q=1") starts after the host, or jo_npos
+static size_t http_url_path_pos(const jo_string &rest) {
+    for(size_t i = 0; i < rest.length(); ++i) {
+        char c = rest.c_str()[i];
+        if(c == '/' || c == '?' || c == '#') return i;
+    }
+    return jo_npos;
+}
+
 static jo_string http_url_server(jo_string url) {
     int pos = url.find("://");
     if (pos == jo_npos) return "";
     url = url.substr(pos + 3);
-    pos = url.find("/");
+    pos = http_url_path_pos(url);
     if (pos == jo_npos) return url;
     return url.substr(0, pos);
 }
@@ -15,18 +24,125 @@ static jo_string http_url_path(jo_string url) {
     int pos = url.find("://");
     if (pos == jo_npos) return "";
     url = url.substr(pos + 3);
-    pos = url.find("/");
+    pos = http_url_path_pos(url);
     if (pos == jo_npos) return "/";
+    if (url.c_str()[pos] != '/') return "/" + url.substr(pos);
     return url.substr(pos);
 }
 
-static node_idx_t http_get(jo_string url) {
-    jo_string server = http_url_server(url);
+static jo_string http_lower(const char *s, size_t n) {
+    jo_string r(s, n);
+    char *p = (char*)r.c_str();
+    for(size_t i = 0; i < n; ++i) p[i] = (char)tolower((unsigned char)p[i]);
+    return r;
+}
+static jo_string http_lower(const std::string &s) { return http_lower(s.c_str(), s.size()); }
+
+// Idle keep-alive clients per scheme://host:port. A client is checked out for one request
+// at a time, so concurrent requests to one host each get their own connection and
+// sequential ones reuse an open socket instead of reconnecting.
+struct http_client_pool_t {
+    struct host_t {
+        jo_string key;
+        jo_vector<httplib::Client*> idle;
+    };
+    enum { MAX_IDLE = 32 };
+    jo_mutex lock;
+    jo_vector<host_t*> hosts;
+
+    host_t *find(const jo_string &key) {
+        for(size_t i = 0; i < hosts.size(); ++i) {
+            if(hosts[i]->key == key.c_str()) return hosts[i];
+        }
+        host_t *h = new host_t();
+        h->key = key;
+        hosts.push_back(h);
+        return h;
+    }
+
+    httplib::Client *checkout(const jo_string &key) {
+        {
+            jo_lock_guard guard(lock);
+            host_t *h = find(key);
+            if(h->idle.size() > 0) {
+                httplib::Client *cli = h->idle.back();
+                h->idle.pop_back();
+                return cli;
+            }
+        }
+        httplib::Client *cli = new httplib::Client(std::string(key.c_str(), key.length()));
+        if(!cli->is_valid()) {
+            delete cli;
+            return 0;
+        }
+        cli->set_keep_alive(true);
+        cli->set_tcp_nodelay(true);
+        return cli;
+    }
+
+    // Clients that failed are dropped rather than reused, their socket state is unknown.
+    void checkin(const jo_string &key, httplib::Client *cli, bool ok) {
+        if(ok) {
+            jo_lock_guard guard(lock);
+            host_t *h = find(key);
+            if(h->idle.size() < MAX_IDLE) {
+                h->idle.push_back(cli);
+                return;
+            }
+        }
+        delete cli;
+    }
+};
+
+// Never destroyed, requests may still be in flight on pool threads at exit.
+static http_client_pool_t *http_client_pool = new http_client_pool_t();
+
+static jo_string http_url_scheme(jo_string url) {
+    int pos = url.find("://");
+    if (pos == jo_npos) return "http";
+    return url.substr(0, pos);
+}
+
+struct http_request_opts_t {
+    std::string method = "GET";
+    std::string body;
+    httplib::Headers headers;
+    long long connect_timeout_ms = CPPHTTPLIB_CONNECTION_TIMEOUT_SECOND * 1000;
+    long long timeout_ms = CPPHTTPLIB_READ_TIMEOUT_SECOND * 1000;
+    bool follow_redirects = true;
+};
+
+static bool http_send(const jo_string &url, const http_request_opts_t &opts, httplib::Response &res, httplib::Error &err) {
+    jo_string key = http_url_scheme(url) + "://" + http_url_server(url);
     jo_string path = http_url_path(url);
-    httplib::Client cli(server.c_str());
-    auto res = cli.Get(path.c_str());
-    if (res) return new_node_string(res->body.c_str());
-    return new_node_int(res->status);
+    httplib::Client *cli = http_client_pool->checkout(key);
+    if(!cli) {
+        err = httplib::Error::Connection;
+        return false;
+    }
+    cli->set_connection_timeout(opts.connect_timeout_ms / 1000, (opts.connect_timeout_ms % 1000) * 1000);
+    cli->set_read_timeout(opts.timeout_ms / 1000, (opts.timeout_ms % 1000) * 1000);
+    cli->set_write_timeout(opts.timeout_ms / 1000, (opts.timeout_ms % 1000) * 1000);
+    cli->set_follow_location(opts.follow_redirects);
+
+    httplib::Request req;
+    req.method = opts.method;
+    req.path = std::string(path.c_str(), path.length());
+    req.headers = opts.headers;
+    req.body = opts.body;
+    bool ok = cli->send(req, res, err);
+    http_client_pool->checkin(key, cli, ok);
+    return ok;
+}
+
+static node_idx_t http_get(jo_string url) {
+    httplib::Response res;
+    httplib::Error err;
+    if(!http_send(url, http_request_opts_t(), res, err)) {
+        warnf("http/get: %s: %s\n", url.c_str(), httplib::to_string(err).c_str());
+        return NIL_NODE;
+    }
+    return new_node_string(jo_string(res.body.c_str(), res.body.size()));
 }
 
 static jo_string url_decode(jo_string url) {
@@ -87,11 +203,476 @@ static node_idx_t native_http_get(env_ptr_t env, list_ptr_t args) {
     return http_get(url);
 }
 
+// Reads the request map of http/request. Returns false when there is no :url.
+static bool http_parse_request(node_idx_t req_idx, jo_string &url, http_request_opts_t &opts, bool &as_string) {
+    if(get_node_type(req_idx) == NODE_STRING) {
+        url = get_node_string(req_idx);
+        as_string = false;
+        return true;
+    }
+    if(get_node_type(req_idx) != NODE_HASH_MAP) {
+        return false;
+    }
+    hash_map_ptr_t m = get_node(req_idx)->as_hash_map();
+    auto opt = [&](const char *name) { return m->get(new_node_keyword(name), node_eq); };
+    node_idx_t v;
+    if((v = opt("url")) == NIL_NODE) {
+        return false;
+    }
+    url = get_node_string(v);
+    if((v = opt("method")) != NIL_NODE) {
+        node_t *n = get_node(v);
+        jo_string method = n->type == NODE_KEYWORD || n->type == NODE_STRING ? n->t_string : n->as_string(1);
+        opts.method.clear();
+        for(size_t i = 0; i < method.length(); ++i) opts.method += (char)toupper((unsigned char)method.c_str()[i]);
+    }
+    if((v = opt("query-params")) != NIL_NODE && get_node_type(v) == NODE_HASH_MAP) {
+        bool first = url.find("?") == jo_npos;
+        for(auto it = get_node(v)->as_hash_map()->begin(); it; ++it) {
+            node_t *k = get_node(it->first);
+            jo_string key = k->type == NODE_STRING || k->type == NODE_KEYWORD ? k->t_string : k->as_string(1);
+            jo_string val = get_node(it->second)->as_string(1);
+            url += first ? "?" : "&";
+            url += url_encode(key.c_str(), key.length()) + "=" + url_encode(val.c_str(), val.length());
+            first = false;
+        }
+    }
+    if((v = opt("headers")) != NIL_NODE && get_node_type(v) == NODE_HASH_MAP) {
+        for(auto it = get_node(v)->as_hash_map()->begin(); it; ++it) {
+            node_t *k = get_node(it->first);
+            jo_string key = k->type == NODE_STRING || k->type == NODE_KEYWORD ? k->t_string : k->as_string(1);
+            jo_string val = get_node(it->second)->as_string(1);
+            opts.headers.emplace(std::string(key.c_str(), key.length()), std::string(val.c_str(), val.length()));
+        }
+    }
+    if((v = opt("body")) != NIL_NODE) {
+        node_t *n = get_node(v);
+        if(n->type == NODE_ARRAY) {
+            jo_clojure_array_ptr_t A = n->t_object.cast<jo_clojure_array_t>();
+            opts.body.resize(A->num_elements * A->element_size);
+            A->copy_bytes(0, opts.body.size(), (unsigned char*)&opts.body[0]);
+        } else {
+            jo_string s = n->as_string(1);
+            opts.body.assign(s.c_str(), s.length());
+        }
+    }
+    if((v = opt("timeout")) != NIL_NODE) opts.timeout_ms = get_node_int(v);
+    if((v = opt("connect-timeout")) != NIL_NODE) opts.connect_timeout_ms = get_node_int(v);
+    if((v = opt("follow-redirects")) != NIL_NODE) opts.follow_redirects = get_node_bool(v);
+    as_string = false;
+    if((v = opt("as")) != NIL_NODE) as_string = get_node(v)->t_string == "string";
+    return true;
+}
+
+static node_idx_t http_do_request(const jo_string &url, const http_request_opts_t &opts, bool as_string) {
+    httplib::Response res;
+    httplib::Error err;
+    hash_map_ptr_t m = new_hash_map();
+    if(!http_send(url, opts, res, err)) {
+        std::string e = httplib::to_string(err);
+        m->assoc_inplace(new_node_keyword("error"), new_node_string(jo_string(e.c_str(), e.size())), node_eq);
+        return new_node_hash_map(m);
+    }
+    m->assoc_inplace(new_node_keyword("status"), new_node_int(res.status), node_eq);
+    hash_map_ptr_t headers = new_hash_map();
+    for(auto it = res.headers.begin(); it != res.headers.end(); ++it) {
+        node_idx_t k = new_node_string(http_lower(it->first));
+        jo_string v(it->second.c_str(), it->second.size());
+        node_idx_t prev = headers->get(k, node_eq);
+        if(prev != NIL_NODE) {
+            v = get_node_string(prev) + "," + v;
+        }
+        headers->assoc_inplace(k, new_node_string(v), node_eq);
+    }
+    m->assoc_inplace(new_node_keyword("headers"), new_node_hash_map(headers), node_eq);
+    node_idx_t body;
+    if(as_string) {
+        body = new_node_string(jo_string(res.body.c_str(), res.body.size()));
+    } else {
+        body = new_node_array(new_array((const unsigned char*)res.body.data(), (long long)res.body.size()));
+    }
+    m->assoc_inplace(new_node_keyword("body"), body, node_eq);
+    return new_node_hash_map(m);
+}
+
+// (http/request {:url "http://host/path" :method :post :headers {...} :body "..." ...})
+// Sends one request over a pooled keep-alive connection and returns {:status :headers :body}.
+// :body may be a string or byte array, :query-params a map appended to the url. Timeouts
+// (:timeout, :connect-timeout) are in milliseconds. The response body is a byte array
+// unless :as :string is given. On a transport failure the result is {:error "..."}.
+static node_idx_t native_http_request(env_ptr_t env, list_ptr_t args) {
+    jo_string url;
+    http_request_opts_t opts;
+    bool as_string;
+    if(!http_parse_request(args->first_value(), url, opts, as_string)) {
+        warnf("(http/request) requires a request map with a :url\n");
+        return NIL_NODE;
+    }
+    return http_do_request(url, opts, as_string);
+}
+
+// (http/request-async req)
+// Like http/request but returns a future. Many requests can be in flight at once, each on
+// its own pooled connection.
+static node_idx_t native_http_request_async(env_ptr_t env, list_ptr_t args) {
+    jo_string url;
+    http_request_opts_t opts;
+    bool as_string;
+    if(!http_parse_request(args->first_value(), url, opts, as_string)) {
+        warnf("(http/request-async) requires a request map with a :url\n");
+        return NIL_NODE;
+    }
+    node_idx_t f = new_node_native_function("http/request", [url,opts,as_string](env_ptr_t env, list_ptr_t args) -> node_idx_t {
+        return http_do_request(url, opts, as_string);
+    }, false, 0);
+    return eval_va(env, env->get("future-call"), f);
+}
+
+// (http/serve ...) runs an httplib::Server and routes requests to Clojure functions using
+// Ring-style request and response maps. Each request is handled on one of the server's
+// worker threads.
+struct jo_clojure_http_server_t : jo_object {
+    httplib::Server svr;
+    std::thread thread;
+    int port = 0;
+
+    ~jo_clojure_http_server_t() {
+        svr.stop();
+        if(thread.joinable()) {
+            thread.join();
+        }
+    }
+};
+
+typedef jo_alloc_t<jo_clojure_http_server_t> jo_clojure_http_server_alloc_t;
+jo_clojure_http_server_alloc_t jo_clojure_http_server_alloc;
+typedef jo_shared_ptr_t<jo_clojure_http_server_t> jo_clojure_http_server_ptr_t;
+template<typename...A>
+jo_clojure_http_server_ptr_t new_http_server(A...args) { return jo_clojure_http_server_ptr_t(jo_clojure_http_server_alloc.emplace(args...)); }
+
+static node_idx_t new_node_http_server(jo_clojure_http_server_ptr_t s, int flags=0) { return new_node_object(NODE_HTTP_SERVER, s.cast<jo_object>(), flags); }
+
+// The request body reader is only valid while the handler runs.
+struct http_body_reader_t {
+    const httplib::ContentReader *reader;
+    bool used;
+};
+
+static node_idx_t http_request_map(const httplib::Request &req, node_idx_t body, node_idx_t read_body) {
+    hash_map_ptr_t m = new_hash_map();
+    m->assoc_inplace(new_node_keyword("request-method"), new_node_keyword(http_lower(req.method)), node_eq);
+    m->assoc_inplace(new_node_keyword("uri"), new_node_string(jo_string(req.path.c_str(), req.path.size())), node_eq);
+    size_t q = req.target.find('?');
+    if(q != std::string::npos) {
+        m->assoc_inplace(new_node_keyword("query-string"), new_node_string(jo_string(req.target.c_str() + q + 1, req.target.size() - q - 1)), node_eq);
+    }
+    m->assoc_inplace(new_node_keyword("protocol"), new_node_string(jo_string(req.version.c_str(), req.version.size())), node_eq);
+    m->assoc_inplace(new_node_keyword("scheme"), new_node_keyword("http"), node_eq);
+    m->assoc_inplace(new_node_keyword("remote-addr"), new_node_string(jo_string(req.remote_addr.c_str(), req.remote_addr.size())), node_eq);
+    m->assoc_inplace(new_node_keyword("server-name"), new_node_string(jo_string(req.local_addr.c_str(), req.local_addr.size())), node_eq);
+    m->assoc_inplace(new_node_keyword("server-port"), new_node_int(req.local_port), node_eq);
+
+    // Header names are lower case as in Ring. Repeated headers are joined with commas.
+    hash_map_ptr_t headers = new_hash_map();
+    for(auto it = req.headers.begin(); it != req.headers.end(); ++it) {
+        node_idx_t k = new_node_string(http_lower(it->first));
+        jo_string v(it->second.c_str(), it->second.size());
+        node_idx_t prev = headers->get(k, node_eq);
+        if(prev != NIL_NODE) {
+            v = get_node_string(prev) + "," + v;
+        }
+        headers->assoc_inplace(k, new_node_string(v), node_eq);
+    }
+    m->assoc_inplace(new_node_keyword("headers"), new_node_hash_map(headers), node_eq);
+
+    hash_map_ptr_t params = new_hash_map();
+    for(auto it = req.params.begin(); it != req.params.end(); ++it) {
+        params->assoc_inplace(new_node_string(jo_string(it->first.c_str(), it->first.size())), new_node_string(jo_string(it->second.c_str(), it->second.size())), node_eq);
+    }
+    m->assoc_inplace(new_node_keyword("params"), new_node_hash_map(params), node_eq);
+
+    // Capture groups of the route pattern
+    if(req.matches.size() > 1) {
+        vector_ptr_t groups = new_vector();
+        for(size_t i = 1; i < req.matches.size(); ++i) {
+            std::string g = req.matches[i].str();
+            groups->push_back_inplace(new_node_string(jo_string(g.c_str(), g.size())));
+        }
+        m->assoc_inplace(new_node_keyword("route-params"), new_node_vector(groups), node_eq);
+    }
+    if(body != NIL_NODE) {
+        m->assoc_inplace(new_node_keyword("body"), body, node_eq);
+    }
+    if(read_body != NIL_NODE) {
+        m->assoc_inplace(new_node_keyword("read-body"), read_body, node_eq);
+    }
+    return new_node_hash_map(m);
+}
+
+static void http_set_body(httplib::Response &res, node_idx_t body, const std::string &ctype) {
+    node_t *n = get_node(body);
+    switch(n->type) {
+    case NODE_NIL:
+        return;
+    case NODE_STRING:
+        res.set_content(n->t_string.c_str(), n->t_string.length(), ctype);
+        return;
+    case NODE_ARRAY: {
+        // copied a leaf at a time as the socket asks for it
+        jo_clojure_array_ptr_t A = n->t_object.cast<jo_clojure_array_t>();
+        size_t total = A->num_elements * A->element_size;
+        res.set_content_provider(total, ctype, [A](size_t offset, size_t length, httplib::DataSink &sink) -> bool {
+            char buf[16384];
+            size_t len = jo_min(length, sizeof(buf));
+            A->copy_bytes(offset, len, (unsigned char*)buf);
+            return sink.write(buf, len);
+        });
+        return;
+    }
+    case NODE_LIST:
+    case NODE_LAZY_LIST:
+    case NODE_VECTOR: {
+        // A seq of strings goes out as one chunk per element, realized only as the
+        // client reads, so an unbounded lazy seq streams in constant memory.
+        res.set_chunked_content_provider(ctype, [cur = body](size_t offset, httplib::DataSink &sink) mutable -> bool {
+            auto fr = get_node(cur)->seq_first_rest();
+            if(!fr.third) {
+                sink.done();
+                return true;
+            }
+            cur = fr.second;
+            jo_string s = get_node_string(fr.first);
+            return !s.length() || sink.write(s.c_str(), s.length());
+        });
+        return;
+    }
+    default: {
+        jo_string s = n->as_string(1);
+        res.set_content(s.c_str(), s.length(), ctype);
+        return;
+    }
+    }
+}
+
+static void http_set_response(httplib::Response &res, node_idx_t ret) {
+    node_t *n = get_node(ret);
+    if(n->type == NODE_EXCEPTION) {
+        jo_string s = n->as_string(1);
+        res.status = 500;
+        res.set_content(s.c_str(), s.length(), "text/plain");
+        return;
+    }
+    if(n->type != NODE_HASH_MAP) {
+        res.status = 200;
+        http_set_body(res, ret, "text/plain");
+        return;
+    }
+    hash_map_ptr_t m = n->as_hash_map();
+    node_idx_t status = m->get(new_node_keyword("status"), node_eq);
+    res.status = status != NIL_NODE ? (int)get_node_int(status) : 200;
+    std::string ctype = "text/plain";
+    node_idx_t headers = m->get(new_node_keyword("headers"), node_eq);
+    if(get_node_type(headers) == NODE_HASH_MAP) {
+        for(auto it = get_node(headers)->as_hash_map()->begin(); it; ++it) {
+            node_t *k = get_node(it->first);
+            jo_string key = k->type == NODE_STRING || k->type == NODE_KEYWORD ? k->t_string : k->as_string(1);
+            node_t *v = get_node(it->second);
+            if(http_lower(key.c_str(), key.length()) == "content-type") {
+                ctype = v->as_string(1).c_str();
+            } else if(v->is_seq() && v->type != NODE_STRING) {
+                seq_iterate(it->second, [&](node_idx_t x) {
+                    res.set_header(key.c_str(), get_node_string(x).c_str());
+                    return true;
+                });
+            } else {
+                res.set_header(key.c_str(), v->as_string(1).c_str());
+            }
+        }
+    }
+    http_set_body(res, m->get(new_node_keyword("body"), node_eq), ctype);
+}
+
+static void http_handle(env_ptr_t env, node_idx_t handler, bool stream_body, const httplib::Request &req, httplib::Response &res, const httplib::ContentReader *reader) {
+    node_idx_t body = NIL_NODE, read_body = NIL_NODE;
+    jo_shared_ptr<http_body_reader_t> br;
+    if(reader && stream_body) {
+        // (read-body on-chunk) hands each chunk to on-chunk as it arrives, stopping if it
+        // returns false. (read-body) returns the whole body.
+        br = jo_shared_ptr<http_body_reader_t>(new http_body_reader_t{reader, false});
+        read_body = new_node_native_function("read-body", [br](env_ptr_t env, list_ptr_t args) -> node_idx_t {
+            http_body_reader_t *b = br.ptr;
+            if(!b->reader || b->used) {
+                warnf("read-body: the body can only be read once, while the handler runs\n");
+                return NIL_NODE;
+            }
+            b->used = true;
+            if(!args->size()) {
+                jo_string all;
+                bool ok = (*b->reader)([&](const char *data, size_t len) { all.append(data, len); return true; });
+                return ok ? new_node_string(all) : NIL_NODE;
+            }
+            node_idx_t f = args->first_value();
+            bool ok = (*b->reader)([&](const char *data, size_t len) {
+                return eval_va(env, f, new_node_string(jo_string(data, len))) != FALSE_NODE;
+            });
+            return ok ? TRUE_NODE : FALSE_NODE;
+        }, false, 0);
+    } else if(reader) {
+        jo_string all;
+        (*reader)([&](const char *data, size_t len) { all.append(data, len); return true; });
+        body = new_node_string(all);
+    } else if(req.body.size()) {
+        body = new_node_string(jo_string(req.body.c_str(), req.body.size()));
+    }
+    node_idx_t ret = eval_va(env, handler, http_request_map(req, body, read_body));
+    if(br.ptr) {
+        if(!br->used) {
+            // leave the connection at the next request
+            (*reader)([](const char *, size_t) { return true; });
+        }
+        br->reader = 0;
+    }
+    http_set_response(res, ret);
+}
+
+static void http_add_route(env_ptr_t env, httplib::Server &svr, const jo_string &method, const std::string &pattern, node_idx_t handler, bool stream_body) {
+    bool any = method == "any";
+    httplib::Server::Handler h = [env, handler, stream_body](const httplib::Request &req, httplib::Response &res) {
+        http_handle(env, handler, stream_body, req, res, 0);
+    };
+    httplib::Server::HandlerWithContentReader hr = [env, handler, stream_body](const httplib::Request &req, httplib::Response &res, const httplib::ContentReader &reader) {
+        http_handle(env, handler, stream_body, req, res, &reader);
+    };
+    if(any || method == "get") svr.Get(pattern, h);
+    if(any || method == "post") svr.Post(pattern, hr);
+    if(any || method == "put") svr.Put(pattern, hr);
+    if(any || method == "patch") svr.Patch(pattern, hr);
+    if(any || method == "delete") svr.Delete(pattern, hr);
+    if(any || method == "options") svr.Options(pattern, h);
+}
+
+// (http/serve handler)(http/serve handler opts)
+// Serves HTTP with handler, a function of a Ring request map, or a vector of routes
+// [[method pattern handler] ...] tried in order, where method is :get, :post, :put, :patch,
+// :delete, :options or :any and pattern is a regex over the path whose groups show up as
+// :route-params. A handler returns a response map {:status :headers :body} or just a body.
+// A body may be a string, an array, or a seq of strings sent chunked as it is realized.
+// opts:
+//   :host, :port                 defaults "0.0.0.0" and 8080. Port 0 picks a free port.
+//   :workers                     worker thread count
+//   :keep-alive-timeout          seconds an idle keep-alive connection is held
+//   :keep-alive-max              requests per keep-alive connection
+//   :read-timeout, :write-timeout seconds
+//   :max-body                    largest accepted request body in bytes
+//   :stream-body                 instead of :body, requests get (:read-body req), a
+//                                function taking an on-chunk callback
+//   :join?                       block until the server stops (default true)
+// Returns the server, see http/stop and http/port.
+static node_idx_t native_http_serve(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    node_idx_t handler = *it++;
+    node_idx_t opts_idx = it ? *it++ : NIL_NODE;
+    hash_map_ptr_t opts = get_node_type(opts_idx) == NODE_HASH_MAP ? get_node(opts_idx)->as_hash_map() : new_hash_map();
+    auto opt = [&](const char *name) { return opts->get(new_node_keyword(name), node_eq); };
+
+    jo_clojure_http_server_ptr_t s = new_http_server();
+    httplib::Server &svr = s->svr;
+    // headers and body go out in separate writes, which Nagle would hold back for an ACK
+    svr.set_tcp_nodelay(true);
+    node_idx_t v;
+    if((v = opt("workers")) != NIL_NODE) {
+        size_t n = (size_t)jo_max(1ll, get_node_int(v));
+        svr.new_task_queue = [n] { return new httplib::ThreadPool(n); };
+    }
+    if((v = opt("keep-alive-timeout")) != NIL_NODE) svr.set_keep_alive_timeout((time_t)get_node_int(v));
+    if((v = opt("keep-alive-max")) != NIL_NODE) svr.set_keep_alive_max_count((size_t)get_node_int(v));
+    if((v = opt("read-timeout")) != NIL_NODE) svr.set_read_timeout((time_t)get_node_int(v));
+    if((v = opt("write-timeout")) != NIL_NODE) svr.set_write_timeout((time_t)get_node_int(v));
+    if((v = opt("max-body")) != NIL_NODE) svr.set_payload_max_length((size_t)get_node_int(v));
+    bool stream_body = get_node_bool(opt("stream-body"));
+
+    if(get_node_type(handler) == NODE_VECTOR) {
+        bool ok = true;
+        seq_iterate(handler, [&](node_idx_t route) {
+            vector_ptr_t r = get_node_type(route) == NODE_VECTOR ? get_node_vector(route) : vector_ptr_t();
+            if(!r.ptr || r->size() != 3) {
+                warnf("(http/serve) routes look like [method pattern handler]\n");
+                return ok = false;
+            }
+            jo_string pattern = get_node_string(r->nth(1));
+            http_add_route(env, svr, get_node(r->nth(0))->t_string, std::string(pattern.c_str(), pattern.length()), r->nth(2), stream_body);
+            return true;
+        });
+        if(!ok) {
+            return NIL_NODE;
+        }
+    } else {
+        http_add_route(env, svr, "any", ".*", handler, stream_body);
+    }
+
+    v = opt("host");
+    jo_string host = v != NIL_NODE ? get_node_string(v) : jo_string("0.0.0.0");
+    v = opt("port");
+    int port = v != NIL_NODE ? (int)get_node_int(v) : 8080;
+    if(port == 0) {
+        port = svr.bind_to_any_port(host.c_str());
+    } else if(!svr.bind_to_port(host.c_str(), port)) {
+        port = -1;
+    }
+    if(port < 0) {
+        warnf("(http/serve) could not bind %s\n", host.c_str());
+        return NIL_NODE;
+    }
+    s->port = port;
+
+    node_idx_t ret = new_node_http_server(s);
+    v = opt("join?");
+    if(v == NIL_NODE || get_node_bool(v)) {
+        svr.listen_after_bind();
+    } else {
+        jo_clojure_http_server_t *p = s.ptr;
+        s->thread = std::thread([p] { p->svr.listen_after_bind(); });
+        for(int i = 0; i < 1000 && !svr.is_running(); ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    return ret;
+}
+
+// (http/stop server)
+// Stops accepting connections and waits for the listener to finish.
+static node_idx_t native_http_stop(env_ptr_t env, list_ptr_t args) {
+    node_t *n = get_node(args->first_value());
+    if(n->type != NODE_HTTP_SERVER) {
+        return NIL_NODE;
+    }
+    jo_clojure_http_server_t *s = n->t_object.cast<jo_clojure_http_server_t>().ptr;
+    s->svr.stop();
+    if(s->thread.joinable()) {
+        s->thread.join();
+    }
+    return NIL_NODE;
+}
+
+// (http/port server)
+// The port the server is bound to.
+static node_idx_t native_http_port(env_ptr_t env, list_ptr_t args) {
+    node_t *n = get_node(args->first_value());
+    if(n->type != NODE_HTTP_SERVER) {
+        return NIL_NODE;
+    }
+    return new_node_int(n->t_object.cast<jo_clojure_http_server_t>()->port);
+}
+
 void jo_clojure_http_init(env_ptr_t env) {
 	env->set("url/encode", new_node_native_function("url/encode", &native_url_encode, false, NODE_FLAG_PRERESOLVE));
 	env->set("url/decode", new_node_native_function("url/decode", &native_url_decode, false, NODE_FLAG_PRERESOLVE));
  
 	env->set("http/get", new_node_native_function("http/get", &native_http_get, false, NODE_FLAG_PRERESOLVE));
+	env->set("http/request", new_node_native_function("http/request", &native_http_request, false, NODE_FLAG_PRERESOLVE));
+	env->set("http/request-async", new_node_native_function("http/request-async", &native_http_request_async, false, NODE_FLAG_PRERESOLVE));
+	env->set("http/serve", new_node_native_function("http/serve", &native_http_serve, false, NODE_FLAG_PRERESOLVE));
+	env->set("http/stop", new_node_native_function("http/stop", &native_http_stop, false, NODE_FLAG_PRERESOLVE));
+	env->set("http/port", new_node_native_function("http/port", &native_http_port, false, NODE_FLAG_PRERESOLVE));
 }
 
-
@@ -0,0 +1,861 @@
+#pragma once
+
+// Heap images.
+//
+//   jclj --save-image app.img lib1.clj lib2.clj   runs the files, then writes everything they defined
+//   jclj --load-image app.img script.clj ...      maps the image back in instead of re-reading the libs
+//
+// An image is a flat table of records, one per reachable node or env, that refer to each other by
+// record id rather than by node index, so it loads into any heap. Natives can't be written out;
+// they're recorded by the name they're bound to in the root env (the stable id table, taken right
+// after startup) and looked up again on load. Special nodes (nil, small ints, true, ...) are
+// allocated deterministically at startup and are stored as their index.
+//
+// That id table is why every builtin is still registered before an image loads: an image stands
+// in for running the libraries, not for jclj's own startup.
+//
+// Loading is two passes over the mapped file: the first allocates a node or env for every record,
+// which lets fns and the envs they close over point at each other; the second fills in the
+// references, each record after the ones it refers to.
+
+enum {
+    IMAGE_VERSION = 2,
+    IMAGE_BYTE_ORDER = 0x01020304,
+    IMAGE_NO_REF = 0xFFFFFFFFu,
+};
+
+enum image_kind_t {
+    IMAGE_SPECIAL = 0,
+    IMAGE_BUILTIN,
+    IMAGE_INT,
+    IMAGE_FLOAT,
+    IMAGE_STRING,
+    IMAGE_SYMBOL,
+    IMAGE_KEYWORD,
+    IMAGE_REGEX,
+    IMAGE_LIST,
+    IMAGE_VECTOR,
+    IMAGE_SET,
+    IMAGE_MAP,
+    IMAGE_FUNC,
+    IMAGE_DELAY,
+    IMAGE_MULTI_FN,
+    IMAGE_MACRO_EXPANDER,
+    IMAGE_ATOM,
+    IMAGE_VAR,
+    IMAGE_LAZY_LIST,
+    IMAGE_ENV,
+    IMAGE_ROOT_ENV,
+};
+
+struct image_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t build_id;
+    uint64_t source_hash; // form cache only: what the forms were parsed from
+    uint64_t source_size;
+    uint32_t num_records;
+    uint32_t num_bindings;
+    uint64_t bindings_offset;
+};
+
+struct image_record_t {
+    uint32_t kind;
+    uint32_t flags;
+    uint32_t size; // payload bytes that follow
+};
+
+static inline uint64_t image_hash_mix(uint64_t h, uint64_t w) {
+    h ^= w * 0xC2B2AE3D27D4EB4Full;
+    return ((h << 29) | (h >> 35)) * 0x9E3779B97F4A7C15ull;
+}
+
+static uint64_t image_hash_bytes(const void *data, size_t n, uint64_t seed = 0) {
+    const char *p = (const char *)data;
+    uint64_t h = image_hash_mix(seed, n);
+    for(; n >= 8; n -= 8, p += 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = image_hash_mix(h, w);
+    }
+    if(n) {
+        uint64_t w = 0;
+        memcpy(&w, p, n);
+        h = image_hash_mix(h, w);
+    }
+    h ^= h >> 33;
+    h *= 0xC2B2AE3D27D4EB4Full;
+    return h ^ (h >> 29);
+}
+
+// Special node indices and record layouts can change with any rebuild, so images are only good
+// for the binary that wrote them.
+static uint64_t image_build_id() {
+    static const char stamp[] = __DATE__ " " __TIME__;
+    return image_hash_bytes(stamp, sizeof(stamp), IMAGE_VERSION * 0x100000000ull + START_USER_NODES * sizeof(node_idx_unsafe_t));
+}
+
+// What the root env looked like once the builtins were registered. Anything bound after this is
+// user state and goes into an image; anything that was there is referred to by name.
+static jo_hash_map<node_idx_unsafe_t, jo_string> image_builtin_names;
+static jo_hash_map<jo_string, node_idx_unsafe_t> image_builtin_values;
+
+static void image_snapshot_builtins(env_ptr_t env) {
+    for(auto it = env->fast_map.begin(); it; it++) {
+        node_idx_unsafe_t value = it->second;
+        jo_string name = get_node_string(it->first);
+        image_builtin_values.assoc(name, value);
+        if(value >= START_USER_NODES) {
+            image_builtin_names.assoc(value, name);
+        }
+    }
+}
+
+struct image_writer_t {
+    env_ptr_t root;
+    jo_text_writer_t out;
+    jo_hash_map<node_idx_unsafe_t, uint32_t> node_ids;
+    jo_hash_map<size_t, uint32_t> env_ids;
+    // records waiting to be written, in id order
+    jo_vector<node_idx_t> pending_nodes;
+    jo_vector<env_ptr_t> pending_envs;
+    jo_vector<bool> pending_is_env;
+    size_t next_pending = 0;
+    size_t unsupported = 0;
+    jo_vector<jo_string> binding_names;
+    jo_vector<uint32_t> binding_values;
+
+    image_writer_t(env_ptr_t r) : root(r) {
+        image_header_t header;
+        memset(&header, 0, sizeof(header));
+        out.put((const char *)&header, sizeof(header));
+    }
+
+    template<typename T> void put(const T &v) { out.put((const char *)&v, sizeof(T)); }
+    void put_str(const jo_string &s) {
+        put((uint32_t)s.length());
+        out.put(s.c_str(), s.length());
+    }
+
+    uint32_t ref(node_idx_unsafe_t idx) {
+        auto found = node_ids.find(idx);
+        if(found.third) return found.second;
+        uint32_t id = (uint32_t)pending_is_env.size();
+        node_ids.assoc(idx, id);
+        pending_nodes.push_back(node_idx_t(idx));
+        pending_envs.push_back(env_ptr_t());
+        pending_is_env.push_back(false);
+        return id;
+    }
+    uint32_t ref(env_ptr_t env) {
+        if(!env) return IMAGE_NO_REF;
+        size_t key = (size_t)env.ptr;
+        auto found = env_ids.find(key);
+        if(found.third) return found.second;
+        uint32_t id = (uint32_t)pending_is_env.size();
+        env_ids.assoc(key, id);
+        pending_nodes.push_back(node_idx_t());
+        pending_envs.push_back(env);
+        pending_is_env.push_back(true);
+        return id;
+    }
+    void put_ref(node_idx_unsafe_t idx) { put(ref(idx)); }
+    void put_ref(env_ptr_t env) { put(ref(env)); }
+
+    size_t begin_record(uint32_t kind, uint32_t flags) {
+        image_record_t rec = {kind, flags, 0};
+        size_t at = out.size;
+        put(rec);
+        return at;
+    }
+    void end_record(size_t at) {
+        ((image_record_t *)(out.buf + at))->size = (uint32_t)(out.size - at - sizeof(image_record_t));
+    }
+
+    void write_env(env_ptr_t env) {
+        if(env.ptr == root.ptr) {
+            end_record(begin_record(IMAGE_ROOT_ENV, 0));
+            return;
+        }
+        size_t at = begin_record(IMAGE_ENV, 0);
+        put_ref(env->parent);
+        put((uint32_t)env->fast_map.size());
+        for(auto it = env->fast_map.begin(); it; it++) {
+            put_ref(it->first);
+            put_ref(it->second);
+        }
+        end_record(at);
+    }
+
+    void write_node(node_idx_unsafe_t idx) {
+        if(idx < START_USER_NODES) {
+            size_t at = begin_record(IMAGE_SPECIAL, 0);
+            put((int64_t)idx);
+            end_record(at);
+            return;
+        }
+        auto builtin = image_builtin_names.find(idx);
+        if(builtin.third) {
+            size_t at = begin_record(IMAGE_BUILTIN, 0);
+            put_str(builtin.second);
+            end_record(at);
+            return;
+        }
+
+        node_t *n = get_node(idx);
+        uint32_t flags = n->flags & ~NODE_FLAG_GARBAGE;
+        size_t at;
+        switch(n->type) {
+        case NODE_INT:
+            at = begin_record(IMAGE_INT, flags);
+            put((int64_t)n->t_int);
+            break;
+        case NODE_FLOAT:
+            at = begin_record(IMAGE_FLOAT, flags);
+            put(n->t_float);
+            break;
+        case NODE_STRING:
+        case NODE_SYMBOL:
+        case NODE_KEYWORD:
+            at = begin_record(n->type == NODE_STRING ? IMAGE_STRING : n->type == NODE_SYMBOL ? IMAGE_SYMBOL : IMAGE_KEYWORD, flags);
+            put_str(n->t_string);
+            break;
+        case NODE_REGEX:
+            // patterns recompile on load; a matcher's position in its input isn't kept
+            if(regex_of(idx)->is_matcher) goto unsupported;
+            at = begin_record(IMAGE_REGEX, flags);
+            put_str(n->t_string);
+            break;
+        case NODE_LIST: {
+            at = begin_record(IMAGE_LIST, flags);
+            list_ptr_t list = n->t_list;
+            put((uint32_t)(list ? list->size() : 0));
+            if(list) for(list_t::iterator it(list); it; it++) put_ref(*it);
+            break;
+        }
+        case NODE_VECTOR: {
+            at = begin_record(IMAGE_VECTOR, flags);
+            vector_ptr_t vec = n->as_vector();
+            put((uint32_t)vec->size());
+            for(vector_t::iterator it = vec->begin(); it; it++) put_ref(*it);
+            break;
+        }
+        case NODE_HASH_SET: {
+            at = begin_record(IMAGE_SET, flags);
+            hash_set_ptr_t set = n->as_hash_set();
+            put((uint32_t)set->size());
+            for(hash_set_t::iterator it = set->begin(); it; it++) put_ref(it->first);
+            break;
+        }
+        case NODE_HASH_MAP: {
+            at = begin_record(IMAGE_MAP, flags);
+            hash_map_ptr_t map = n->as_hash_map();
+            put((uint32_t)map->size());
+            for(hash_map_t::iterator it = map->begin(); it; it++) {
+                put_ref(it->first);
+                put_ref(it->second);
+            }
+            break;
+        }
+        case NODE_FUNC:
+        case NODE_DELAY: {
+            at = begin_record(n->type == NODE_FUNC ? IMAGE_FUNC : IMAGE_DELAY, flags);
+            put_str(n->t_string);
+            vector_ptr_t args = n->t_func.args;
+            put(args ? (uint32_t)args->size() : IMAGE_NO_REF);
+            if(args) for(vector_t::iterator it = args->begin(); it; it++) put_ref(*it);
+            list_ptr_t body = n->t_func.body;
+            put((uint32_t)(body ? body->size() : 0));
+            if(body) for(list_t::iterator it(body); it; it++) put_ref(*it);
+            put((uint64_t)n->t_func.fixed_args_count);
+            put_ref(n->t_env);
+            put_ref(n->t_meta);
+            put_ref(n->t_extra);
+            break;
+        }
+        case NODE_NATIVE_FUNC:
+            // only multi-arity fns and macros carry enough to be rebuilt; other closures made at runtime don't
+            if(n->t_list && n->t_string == "fn_lambda") {
+                at = begin_record(IMAGE_MULTI_FN, flags);
+                put((uint32_t)n->t_list->size());
+                for(list_t::iterator it(n->t_list); it; it++) put_ref(*it);
+                put_ref(n->t_extra);
+                break;
+            }
+            if(n->t_string == "defmacro__inner" && get_node_type(n->t_extra) == NODE_FUNC) {
+                at = begin_record(IMAGE_MACRO_EXPANDER, flags);
+                put_ref(n->t_extra);
+                break;
+            }
+            goto unsupported;
+        case NODE_ATOM:
+            at = begin_record(IMAGE_ATOM, flags);
+            put_ref(n->t_atom.load());
+            break;
+        case NODE_VAR:
+            at = begin_record(IMAGE_VAR, flags);
+            put_str(n->t_string);
+            put_ref(n->t_extra);
+            break;
+        case NODE_LAZY_LIST:
+            at = begin_record(IMAGE_LAZY_LIST, flags);
+            put_ref(n->t_env);
+            put_ref(n->t_extra);
+            break;
+        default:
+        unsupported:
+            // files, threads, tensors and friends don't survive the process; they come back as nil
+            unsupported++;
+            at = begin_record(IMAGE_SPECIAL, 0);
+            put((int64_t)NIL_NODE);
+            break;
+        }
+        end_record(at);
+    }
+
+    void add_binding(const jo_string &name, node_idx_unsafe_t value) {
+        binding_names.push_back(name);
+        binding_values.push_back(ref(value));
+    }
+
+    // writes every record reachable from the bindings, then the bindings, then fills in the header
+    void finish(uint64_t source_hash = 0, uint64_t source_size = 0) {
+        while(next_pending < pending_is_env.size()) {
+            size_t i = next_pending++;
+            if(pending_is_env[i]) {
+                write_env(pending_envs[i]);
+            } else {
+                write_node(pending_nodes[i]);
+            }
+        }
+
+        uint64_t bindings_offset = out.size;
+        for(size_t i = 0; i < binding_names.size(); ++i) {
+            put_str(binding_names[i]);
+            put(binding_values[i]);
+        }
+
+        image_header_t *h = (image_header_t *)out.buf;
+        memcpy(h->magic, "JCLJIMG", 8);
+        h->version = IMAGE_VERSION;
+        h->byte_order = IMAGE_BYTE_ORDER;
+        h->build_id = image_build_id();
+        h->source_hash = source_hash;
+        h->source_size = source_size;
+        h->num_records = (uint32_t)pending_is_env.size();
+        h->num_bindings = (uint32_t)binding_names.size();
+        h->bindings_offset = bindings_offset;
+    }
+
+    bool write_file(const char *path) {
+        FILE *fp = fopen(path, "wb");
+        if(!fp) return false;
+        bool ok = fwrite(out.buf, 1, out.size, fp) == out.size;
+        return fclose(fp) == 0 && ok;
+    }
+};
+
+static bool image_save(env_ptr_t env, const char *path) {
+    image_writer_t w(env);
+    // user bindings: anything new in the root env, or rebound since startup
+    for(auto it = env->fast_map.begin(); it; it++) {
+        jo_string name = get_node_string(it->first);
+        auto builtin = image_builtin_values.find(name);
+        if(builtin.third && builtin.second == (node_idx_unsafe_t)it->second) continue;
+        w.add_binding(name, it->second);
+    }
+    w.finish();
+    if(w.unsupported) {
+        warnf("save-image: %zu values can't be saved (natives made at runtime, files, threads, ...) and will load as nil\n", w.unsupported);
+    }
+    if(!w.write_file(path)) {
+        warnf("save-image: could not write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+struct image_reader_t {
+    const char *p, *end;
+    bool failed = false;
+
+    image_reader_t(const char *s, const char *e) : p(s), end(e) {}
+
+    template<typename T> T get() {
+        T v;
+        if((size_t)(end - p) < sizeof(T)) {
+            failed = true;
+            memset(&v, 0, sizeof(T));
+            return v;
+        }
+        memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return v;
+    }
+    jo_string get_str() {
+        uint32_t len = get<uint32_t>();
+        if((size_t)(end - p) < len) {
+            failed = true;
+            return jo_string();
+        }
+        jo_string s(p, len);
+        p += len;
+        return s;
+    }
+};
+
+struct image_loader_t {
+    env_ptr_t root;
+    void *mapping = NULL;
+    size_t size = 0;
+    const image_header_t *header = NULL;
+    jo_vector<node_idx_t> nodes_by_id;
+    jo_vector<env_ptr_t> envs_by_id;
+    jo_vector<const image_record_t *> records;
+
+    image_loader_t(env_ptr_t r) : root(r) {}
+    image_loader_t(const image_loader_t &) = delete;
+    ~image_loader_t() {
+        if(mapping) jo_munmap_file(mapping, size);
+    }
+
+    node_idx_t node(uint32_t id) const { return id < nodes_by_id.size() ? nodes_by_id[id] : node_idx_t(NIL_NODE); }
+    env_ptr_t env(uint32_t id) const { return id < envs_by_id.size() ? envs_by_id[id] : env_ptr_t(); }
+
+    // first pass: a node or env for every record, with scalars filled in right away
+    bool create(uint32_t id) {
+        const image_record_t *rec = records[id];
+        image_reader_t r((const char *)(rec + 1), (const char *)(rec + 1) + rec->size);
+        node_idx_t idx = NIL_NODE;
+        switch(rec->kind) {
+        case IMAGE_SPECIAL: {
+            int64_t special = r.get<int64_t>();
+            if(special != INV_NODE && (special < 0 || special >= START_USER_NODES)) return false;
+            idx = (node_idx_unsafe_t)special;
+            break;
+        }
+        case IMAGE_BUILTIN: {
+            jo_string name = r.get_str();
+            idx = root->get(name.c_str());
+            if(idx == INV_NODE) {
+                warnf("load-image: %s is not defined in this build\n", name.c_str());
+                idx = NIL_NODE;
+            }
+            break;
+        }
+        case IMAGE_INT:
+            idx = new_node(NODE_INT, rec->flags);
+            get_node(idx)->t_int = r.get<int64_t>();
+            break;
+        case IMAGE_FLOAT:
+            idx = new_node(NODE_FLOAT, rec->flags);
+            get_node(idx)->t_float = r.get<double>();
+            break;
+        case IMAGE_STRING:
+            idx = new_node(NODE_STRING, rec->flags);
+            get_node(idx)->t_string = r.get_str();
+            break;
+        case IMAGE_SYMBOL:
+        case IMAGE_KEYWORD: {
+            jo_string name = r.get_str();
+            idx = parse_intern.get(rec->kind == IMAGE_SYMBOL ? NODE_SYMBOL : NODE_KEYWORD, name.c_str(), (int)name.length());
+            break;
+        }
+        case IMAGE_REGEX:
+            idx = new_node_regex(r.get_str(), rec->flags);
+            break;
+        case IMAGE_LIST: idx = new_node(NODE_LIST, rec->flags); break;
+        case IMAGE_VECTOR: idx = new_node(NODE_VECTOR, rec->flags); break;
+        case IMAGE_SET: idx = new_node(NODE_HASH_SET, rec->flags); break;
+        case IMAGE_MAP: idx = new_node(NODE_HASH_MAP, rec->flags); break;
+        case IMAGE_FUNC: idx = new_node(NODE_FUNC, rec->flags); break;
+        case IMAGE_DELAY: idx = new_node(NODE_DELAY, rec->flags); break;
+        case IMAGE_MULTI_FN:
+        case IMAGE_MACRO_EXPANDER: idx = new_node(NODE_NATIVE_FUNC, rec->flags); break;
+        case IMAGE_ATOM: idx = new_node(NODE_ATOM, rec->flags); break;
+        case IMAGE_VAR: idx = new_node(NODE_VAR, rec->flags); break;
+        case IMAGE_LAZY_LIST: idx = new_node(NODE_LAZY_LIST, rec->flags); break;
+        case IMAGE_ENV: envs_by_id[id] = new_env(NULL); return true;
+        case IMAGE_ROOT_ENV: envs_by_id[id] = root; return true;
+        default: return false;
+        }
+        nodes_by_id[id] = idx;
+        return !r.failed;
+    }
+
+    // second pass: everything that refers to other records
+    bool fill(uint32_t id) {
+        const image_record_t *rec = records[id];
+        image_reader_t r((const char *)(rec + 1), (const char *)(rec + 1) + rec->size);
+        if(rec->kind < IMAGE_LIST) return true; // nothing to refer to
+        node_t *n = rec->kind == IMAGE_ENV ? NULL : get_node(nodes_by_id[id]);
+        switch(rec->kind) {
+        case IMAGE_LIST: {
+            list_ptr_t list = new_list();
+            for(uint32_t i = 0, count = r.get<uint32_t>(); i < count && !r.failed; ++i) {
+                list->push_back_inplace(node(r.get<uint32_t>()));
+            }
+            n->t_list = list;
+            break;
+        }
+        case IMAGE_VECTOR: {
+            vector_ptr_t vec = new_vector();
+            for(uint32_t i = 0, count = r.get<uint32_t>(); i < count && !r.failed; ++i) {
+                vec->push_back_inplace(node(r.get<uint32_t>()));
+            }
+            n->t_object = vec.cast<jo_object>();
+            break;
+        }
+        case IMAGE_SET: {
+            hash_set_ptr_t set = new_hash_set();
+            for(uint32_t i = 0, count = r.get<uint32_t>(); i < count && !r.failed; ++i) {
+                set = set->assoc(node(r.get<uint32_t>()), node_eq);
+            }
+            n->t_object = set.cast<jo_object>();
+            break;
+        }
+        case IMAGE_MAP: {
+            hash_map_ptr_t map = new_hash_map();
+            for(uint32_t i = 0, count = r.get<uint32_t>(); i < count && !r.failed; ++i) {
+                node_idx_t k = node(r.get<uint32_t>());
+                map->assoc_inplace(k, node(r.get<uint32_t>()), node_eq);
+            }
+            n->t_object = map.cast<jo_object>();
+            break;
+        }
+        case IMAGE_FUNC:
+        case IMAGE_DELAY: {
+            n->t_string = r.get_str();
+            uint32_t num_args = r.get<uint32_t>();
+            if(num_args != IMAGE_NO_REF) {
+                vector_ptr_t args = new_vector();
+                for(uint32_t i = 0; i < num_args && !r.failed; ++i) {
+                    args->push_back_inplace(node(r.get<uint32_t>()));
+                }
+                n->t_func.args = args;
+            }
+            list_ptr_t body = new_list();
+            for(uint32_t i = 0, count = r.get<uint32_t>(); i < count && !r.failed; ++i) {
+                body->push_back_inplace(node(r.get<uint32_t>()));
+            }
+            n->t_func.body = body;
+            n->t_func.fixed_args_count = (size_t)r.get<uint64_t>();
+            n->t_env = env(r.get<uint32_t>());
+            n->t_meta = node(r.get<uint32_t>());
+            n->t_extra = node(r.get<uint32_t>());
+            break;
+        }
+        case IMAGE_MULTI_FN: {
+            list_ptr_t fn_list = new_list();
+            for(uint32_t i = 0, count = r.get<uint32_t>(); i < count && !r.failed; ++i) {
+                fn_list->push_back_inplace(node(r.get<uint32_t>()));
+            }
+            node_idx_t private_fn_name = node(r.get<uint32_t>());
+            node_idx_t built = new_node_multi_fn(fn_list, private_fn_name, (rec->flags & NODE_FLAG_MACRO) != 0);
+            n->t_native_function = get_node(built)->t_native_function;
+            n->t_string = get_node(built)->t_string;
+            n->t_list = fn_list;
+            n->t_extra = private_fn_name;
+            break;
+        }
+        case IMAGE_MACRO_EXPANDER: {
+            node_idx_t built = new_node_macro_expander(node(r.get<uint32_t>()));
+            n->t_native_function = get_node(built)->t_native_function;
+            n->t_string = get_node(built)->t_string;
+            n->t_extra = get_node(built)->t_extra;
+            break;
+        }
+        case IMAGE_ATOM:
+            n->t_atom = node(r.get<uint32_t>());
+            break;
+        case IMAGE_VAR:
+            n->t_string = r.get_str();
+            n->t_extra = node(r.get<uint32_t>());
+            break;
+        case IMAGE_LAZY_LIST:
+            n->t_env = env(r.get<uint32_t>());
+            n->t_extra = node(r.get<uint32_t>());
+            break;
+        case IMAGE_ENV: {
+            env_ptr_t e = envs_by_id[id];
+            e->parent = env(r.get<uint32_t>());
+            if(e->parent) e->tx = e->parent->tx;
+            for(uint32_t i = 0, count = r.get<uint32_t>(); i < count && !r.failed; ++i) {
+                node_idx_t k = node(r.get<uint32_t>());
+                e->set(k, node(r.get<uint32_t>()));
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        return !r.failed;
+    }
+
+    // maps the file and checks it was written by this build
+    bool open(const char *path) {
+        mapping = jo_mmap_file(path, &size);
+        if(!mapping) return false;
+        header = (const image_header_t *)mapping;
+        return size >= sizeof(image_header_t) && !memcmp(header->magic, "JCLJIMG", 8) && header->version == IMAGE_VERSION
+            && header->byte_order == IMAGE_BYTE_ORDER && header->build_id == image_build_id();
+    }
+
+    bool read_records() {
+        const char *base = (const char *)mapping, *end = base + size;
+        const char *p = base + sizeof(image_header_t);
+        if(header->bindings_offset > size) return false;
+        for(uint32_t i = 0; i < header->num_records; ++i) {
+            const image_record_t *rec = (const image_record_t *)p;
+            if((size_t)(end - p) < sizeof(image_record_t) || rec->size > (size_t)(end - p) - sizeof(image_record_t)) return false;
+            records.push_back(rec);
+            p += sizeof(image_record_t) + rec->size;
+        }
+        nodes_by_id.resize(records.size());
+        envs_by_id.resize(records.size());
+        for(uint32_t i = 0; i < records.size(); ++i) if(!create(i)) return false;
+        return fill_all();
+    }
+
+    // The ids a record refers to, in the order fill reads them.
+    bool refs(uint32_t id, jo_vector<uint32_t> &out) const {
+        const image_record_t *rec = records[id];
+        image_reader_t r((const char *)(rec + 1), (const char *)(rec + 1) + rec->size);
+        auto refs_n = [&](uint32_t count) {
+            for(uint32_t i = 0; i < count && !r.failed; ++i) out.push_back(r.get<uint32_t>());
+        };
+        switch(rec->kind) {
+        case IMAGE_LIST:
+        case IMAGE_VECTOR:
+        case IMAGE_SET:
+            refs_n(r.get<uint32_t>());
+            break;
+        case IMAGE_MAP:
+            refs_n(r.get<uint32_t>() * 2);
+            break;
+        case IMAGE_FUNC:
+        case IMAGE_DELAY: {
+            r.get_str();
+            uint32_t num_args = r.get<uint32_t>();
+            if(num_args != IMAGE_NO_REF) refs_n(num_args);
+            refs_n(r.get<uint32_t>());
+            r.get<uint64_t>();
+            refs_n(3);
+            break;
+        }
+        case IMAGE_MULTI_FN:
+            refs_n(r.get<uint32_t>());
+            refs_n(1);
+            break;
+        case IMAGE_MACRO_EXPANDER:
+        case IMAGE_ATOM:
+            refs_n(1);
+            break;
+        case IMAGE_VAR:
+            r.get_str();
+            refs_n(1);
+            break;
+        case IMAGE_LAZY_LIST:
+            refs_n(2);
+            break;
+        case IMAGE_ENV:
+            refs_n(1);
+            refs_n(r.get<uint32_t>() * 2);
+            break;
+        default:
+            break;
+        }
+        return !r.failed;
+    }
+
+    // Fills every record after the records it refers to (depth first, post-order), so a set or
+    // map only hashes its keys once they're complete, shared or not. References back into a
+    // record still being filled are cycles through fns, envs or atoms, which don't hash by content.
+    bool fill_all() {
+        struct frame_t { uint32_t id; size_t begin, next, end; };
+        enum { UNSEEN, OPEN, DONE };
+        jo_vector<unsigned char> state(records.size());
+        for(size_t i = 0; i < state.size(); ++i) state[i] = UNSEEN;
+        jo_vector<frame_t> stack;
+        jo_vector<uint32_t> kids;
+        for(uint32_t root = 0; root < records.size(); ++root) {
+            if(state[root] != UNSEEN) continue;
+            uint32_t push_id = root;
+            for(;;) {
+                if(push_id != IMAGE_NO_REF) {
+                    size_t begin = kids.size();
+                    if(!refs(push_id, kids)) return false;
+                    state[push_id] = OPEN;
+                    stack.push_back(frame_t{push_id, begin, begin, kids.size()});
+                    push_id = IMAGE_NO_REF;
+                }
+                if(stack.size() == 0) break;
+                frame_t &f = stack.back();
+                if(f.next < f.end) {
+                    uint32_t kid = kids[f.next++];
+                    if(kid < records.size() && state[kid] == UNSEEN) push_id = kid;
+                    continue;
+                }
+                if(!fill(f.id)) return false;
+                state[f.id] = DONE;
+                kids.resize(f.begin);
+                stack.pop_back();
+            }
+        }
+        return true;
+    }
+
+    template<typename F>
+    bool each_binding(F f) {
+        image_reader_t r((const char *)mapping + header->bindings_offset, (const char *)mapping + size);
+        for(uint32_t i = 0; i < header->num_bindings && !r.failed; ++i) {
+            jo_string name = r.get_str();
+            node_idx_t value = node(r.get<uint32_t>());
+            if(!r.failed) f(name, value);
+        }
+        return !r.failed;
+    }
+};
+
+static bool image_load(env_ptr_t env, const char *path) {
+    image_loader_t loader(env);
+    if(!loader.open(path)) {
+        warnf(loader.mapping ? "load-image: %s was not written by this build of jclj\n" : "load-image: could not open %s\n", path);
+        return false;
+    }
+    if(!loader.read_records() || !loader.each_binding([&](const jo_string &name, node_idx_t value) { env->set(name.c_str(), value); })) {
+        warnf("load-image: %s is truncated or corrupt\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Parsed-form cache.
+//
+// include and load-file keep what they parsed in $XDG_CACHE_HOME/jclj (~/.cache/jclj by default),
+// one file per source, named by a hash of its contents. JCLJ_FORM_CACHE=<dir> puts the entries in
+// dir instead, JCLJ_FORM_CACHE=0 turns the cache off. The header carries the build id too: an
+// edited file misses and a new jclj overwrites the entry, either way it's parsed afresh. The entries are images of the list of top-level forms,
+// so the literal flags the parser worked out come back with them, and the natives it puts in for
+// reader macros ('x, @x, #(...)) are rebound by name like any other. Entries are written to a
+// temporary name and renamed into place, so concurrent runs never see half a file. Each write
+// drops the oldest entries past FORM_CACHE_MAX_ENTRIES.
+
+enum {
+    // below this, parsing is quicker than opening the cache entry
+    FORM_CACHE_MIN_SIZE = 4096,
+    FORM_CACHE_MAX_ENTRIES = 256,
+};
+
+static const jo_string &form_cache_dir() {
+    static jo_string dir;
+    static bool checked = false;
+    if(checked) return dir;
+    checked = true;
+    const char *opt = getenv("JCLJ_FORM_CACHE");
+    if(opt && (!strcmp(opt, "0") || !strcmp(opt, "off"))) return dir;
+    const char *base = getenv("XDG_CACHE_HOME");
+    jo_string root;
+    if(opt && *opt) {
+        jo_mkdir(opt);
+        struct stat st;
+        if(stat(opt, &st) == 0 && (st.st_mode & S_IFDIR)) {
+            dir = opt;
+        }
+        return dir;
+    }
+    if(base && *base) {
+        root = base;
+    } else {
+#ifdef _WIN32
+        base = getenv("LOCALAPPDATA");
+        if(!base || !*base) return dir;
+        root = base;
+#else
+        base = getenv("HOME");
+        if(!base || !*base) return dir;
+        root = jo_string(base) + "/.cache";
+#endif
+    }
+    jo_mkdir(root.c_str());
+    jo_string path = root + "/jclj";
+    jo_mkdir(path.c_str());
+    struct stat st;
+    if(stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFDIR)) {
+        dir = path;
+    }
+    return dir;
+}
+
+static list_ptr_t form_cache_load(env_ptr_t env, const char *cache_path, uint64_t hash, uint64_t size) {
+    image_loader_t loader(env);
+    if(!loader.open(cache_path) || loader.header->source_hash != hash || loader.header->source_size != size || loader.header->num_bindings != 1) {
+        return list_ptr_t();
+    }
+    list_ptr_t forms;
+    if(loader.read_records()) {
+        loader.each_binding([&](const jo_string &, node_idx_t value) {
+            if(get_node_type(value) == NODE_LIST) forms = get_node_list(value);
+        });
+    }
+    return forms;
+}
+
+// Keeps the newest FORM_CACHE_MAX_ENTRIES entries by when they were written.
+static void form_cache_prune(const jo_string &dir) {
+    struct entry_t { jo_string name; long long mtime; };
+    jo_vector<entry_t> entries;
+    io_walk_read_dir(dir, true, [&](const io_walk_entry_t &e) {
+        size_t len = strlen(e.name);
+        if(!e.dir && e.has_stat && len > 6 && !strcmp(e.name + len - 6, ".forms")) {
+            entries.push_back(entry_t{jo_string(e.name), e.mtime});
+        }
+    });
+    if(entries.size() <= FORM_CACHE_MAX_ENTRIES) return;
+    pdqsort(entries.begin(), entries.end(), [](const entry_t &a, const entry_t &b) { return a.mtime < b.mtime; });
+    for(size_t i = 0; i < entries.size() - FORM_CACHE_MAX_ENTRIES; ++i) {
+        remove((dir + "/" + entries[i].name).c_str());
+    }
+}
+
+static void form_cache_save(env_ptr_t env, const char *cache_path, list_ptr_t forms, uint64_t hash, uint64_t size) {
+    image_writer_t w(env);
+    node_idx_t forms_node = new_node_list(forms);
+    w.add_binding("", forms_node);
+    w.finish(hash, size);
+    if(w.unsupported) return; // the parser made something that isn't plain data; don't trust it
+    jo_string tmp_path = jo_string(cache_path) + jo_string(va(".%d.tmp", (int)jo_getpid()));
+    if(!w.write_file(tmp_path.c_str()) || rename(tmp_path.c_str(), cache_path) != 0) {
+        remove(tmp_path.c_str());
+        return;
+    }
+    form_cache_prune(form_cache_dir());
+}
+
+// Reads all the top-level forms of a file, going through the cache when it's worth it.
+// Returns a null list if the file can't be read.
+static list_ptr_t parse_file_forms(env_ptr_t env, const char *path) {
+    parse_state_t parse_state;
+    if(!parse_state.open(path)) {
+        return list_ptr_t();
+    }
+
+    jo_string cache_path;
+    uint64_t size = parse_state.buf_end - parse_state.buf, hash = 0;
+    if(size >= FORM_CACHE_MIN_SIZE && form_cache_dir().length()) {
+        hash = image_hash_bytes(parse_state.buf, size);
+        cache_path = form_cache_dir() + jo_string(va("/%016llx.forms", (unsigned long long)hash));
+        list_ptr_t forms = form_cache_load(env, cache_path.c_str(), hash, size);
+        if(forms) return forms;
+    }
+
+    list_ptr_t forms = new_list();
+    for(node_idx_t next = parse_next(env, &parse_state, 0); next != INV_NODE; next = parse_next(env, &parse_state, 0)) {
+        forms->push_back_inplace(next);
+    }
+    if(cache_path.length()) {
+        form_cache_save(env, cache_path.c_str(), forms, hash, size);
+    }
+    return forms;
+}
@@ -6,6 +6,7 @@
 #ifdef _WIN32
 #include <io.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #define popen _popen
 #define pclose _pclose
 #define opendir _opendir
@@ -19,6 +20,11 @@
 #include <sys/socket.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
 #endif
 
 
@@ -27,31 +33,192 @@
 // However, IMO, side-effects are side-effects and you can't avoid them with files.
 // Might as well embrace them in this case.
 
-// TODO: should directory scans be lazy? would make sense for read-dir-all and the like
-//
-// (file-seq dir)
-// A tree seq on java.io.Files
-static node_idx_t native_io_file_seq(env_ptr_t env, list_ptr_t args) {
-    return NIL_NODE;
+// Buffers handed to setvbuf by io/reader and io/writer, freed once the file is closed.
+struct io_file_buffer_t {
+    FILE *fp;
+    char *buf;
+};
+static jo_mutex io_file_buffers_lock;
+static jo_vector<io_file_buffer_t> io_file_buffers;
+
+static FILE *io_fopen_buffered(const char *path, const char *mode, size_t buffer_size) {
+    FILE *fp = fopen(path, mode);
+    if(!fp || buffer_size == 0) {
+        return fp;
+    }
+    // glibc ignores the size when given a NULL buffer, so supply our own
+    char *buf = (char*)malloc(buffer_size);
+    if(buf && setvbuf(fp, buf, _IOFBF, buffer_size) == 0) {
+        jo_lock_guard guard(io_file_buffers_lock);
+        io_file_buffers.push_back(io_file_buffer_t{fp, buf});
+    } else {
+        free(buf);
+    }
+    return fp;
+}
+
+// The entry comes out before fclose: once fp is closed another thread can fopen a FILE at
+// the same address and register a buffer of its own. The buffer is freed last because fclose
+// still flushes through it.
+static void io_fclose(FILE *fp) {
+    char *buf = NULL;
+    {
+        jo_lock_guard guard(io_file_buffers_lock);
+        for(size_t i = 0; i < io_file_buffers.size(); ++i) {
+            if(io_file_buffers[i].fp == fp) {
+                buf = io_file_buffers[i].buf;
+                io_file_buffers[i] = io_file_buffers.back();
+                io_file_buffers.pop_back();
+                break;
+            }
+        }
+    }
+    fclose(fp);
+    free(buf);
 }
 
+// Writes strings and byte arrays as-is. Seqs are walked an element at a time so lazy
+// seqs are never held in memory whole.
+static bool io_write_node(FILE *fp, node_idx_t idx) {
+    node_t *n = get_node(idx);
+    switch(n->type) {
+    case NODE_NIL:
+        return true;
+    case NODE_STRING:
+        return fwrite(n->t_string.c_str(), 1, n->t_string.length(), fp) == (size_t)n->t_string.length();
+    case NODE_ARRAY:
+        n->t_object.cast<jo_clojure_array_t>()->write(fp);
+        return !ferror(fp);
+    case NODE_LIST:
+    case NODE_LAZY_LIST:
+    case NODE_VECTOR: {
+        bool ok = true;
+        seq_iterate(idx, [&](node_idx_t x) {
+            ok = io_write_node(fp, x);
+            return ok;
+        });
+        return ok;
+    }
+    default: {
+        jo_string str = n->as_string(1);
+        return fwrite(str.c_str(), 1, str.length(), fp) == (size_t)str.length();
+    }
+    }
+}
+
+// (slurp f)
+// Reads the whole of f, a path, url or open file, into a string. Binary safe.
 static node_idx_t native_io_slurp(env_ptr_t env, list_ptr_t args) {
-    jo_string path = get_node_string(args->first_value());
+    node_t *f = get_node(args->first_value());
+    if(f->type == NODE_FILE) {
+        if(!f->t_file) {
+            return NIL_NODE;
+        }
+        jo_string ret;
+        char buf[65536];
+        size_t n;
+        while((n = fread(buf, 1, sizeof(buf), f->t_file)) > 0) {
+            ret.append(buf, n);
+        }
+        return new_node_string(ret);
+    }
+    jo_string path = f->as_string(1);
     jo_string url_server = http_url_server(path);
     if(!url_server.empty()) {
         return http_get(path);
     }
-    char *c = (char*)jo_slurp_file(path.c_str());
-    node_idx_t ret = new_node_string(c?c:"");
+    size_t size = 0;
+    char *c = (char*)jo_slurp_file(path.c_str(), &size);
+    node_idx_t ret = new_node_string(c ? jo_string(c, size) : jo_string());
     free(c);
     return ret;
 }
 
+// (spit f content & options)
+// Writes content to f, a path or open file. content may be a string, byte array or a
+// (lazy) seq of them, which is streamed out as it is realized. With :append true the
+// file is appended to rather than truncated.
 static node_idx_t native_io_spit(env_ptr_t env, list_ptr_t args) {
 	// TODO: HTTP/HTTPS!
-    jo_string path = get_node_string(args->first_value());
-    jo_string contents_str = get_node_string(args->second_value());
-    return new_node_bool(jo_spit_file(path.c_str(), contents_str.c_str()) == 0);
+    list_t::iterator it(args);
+    node_idx_t f_idx = *it++;
+    node_idx_t content = *it++;
+    bool append = false;
+    for(; it; ++it) {
+        node_t *k = get_node(*it++);
+        if(!it) break;
+        if(k->type == NODE_KEYWORD && k->t_string == "append") {
+            append = get_node_bool(*it);
+        }
+    }
+    node_t *f = get_node(f_idx);
+    if(f->type == NODE_FILE) {
+        return new_node_bool(f->t_file && io_write_node(f->t_file, content));
+    }
+    jo_string path = f->as_string(1);
+    FILE *fp = io_fopen_buffered(path.c_str(), append ? "ab" : "wb", 1 << 16);
+    if(!fp) {
+        return FALSE_NODE;
+    }
+    bool ok = io_write_node(fp, content);
+    io_fclose(fp);
+    return new_node_bool(ok);
+}
+
+// (io/reader path & options)
+// Opens path for reading with a large buffer (:buffer-size, default 256KiB). The result is
+// an ordinary file for line-seq, io/read-line, io/chunk-seq and friends.
+static node_idx_t native_io_reader(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    node_idx_t f_idx = *it++;
+    if(get_node_type(f_idx) == NODE_FILE) {
+        return f_idx;
+    }
+    size_t buffer_size = 1 << 18;
+    for(; it; ++it) {
+        node_t *k = get_node(*it++);
+        if(!it) break;
+        if(k->type == NODE_KEYWORD && k->t_string == "buffer-size") {
+            buffer_size = (size_t)get_node_int(*it);
+        }
+    }
+    jo_string path = get_node_string(f_idx);
+    FILE *fp = io_fopen_buffered(path.c_str(), "rb", buffer_size);
+    if(!fp) {
+        warnf("io/reader: could not open %s\n", path.c_str());
+        return NIL_NODE;
+    }
+    return new_node_file(fp);
+}
+
+// (io/writer path & options)
+// Opens path for writing with a large buffer (:buffer-size, default 256KiB). :append true
+// appends to an existing file. Close with io/close-file to flush.
+static node_idx_t native_io_writer(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    node_idx_t f_idx = *it++;
+    if(get_node_type(f_idx) == NODE_FILE) {
+        return f_idx;
+    }
+    size_t buffer_size = 1 << 18;
+    bool append = false;
+    for(; it; ++it) {
+        node_t *k = get_node(*it++);
+        if(!it) break;
+        if(k->type != NODE_KEYWORD) continue;
+        if(k->t_string == "buffer-size") {
+            buffer_size = (size_t)get_node_int(*it);
+        } else if(k->t_string == "append") {
+            append = get_node_bool(*it);
+        }
+    }
+    jo_string path = get_node_string(f_idx);
+    FILE *fp = io_fopen_buffered(path.c_str(), append ? "ab" : "wb", buffer_size);
+    if(!fp) {
+        warnf("io/writer: could not open %s\n", path.c_str());
+        return NIL_NODE;
+    }
+    return new_node_file(fp);
 }
 
 // (file opts arg)(file opts parent child)(file opts parent child & more)
@@ -96,7 +263,7 @@ static node_idx_t native_io_close_file(env_ptr_t env, list_ptr_t args) {
         return NIL_NODE;
     }
     if(n->t_file) {
-        fclose(n->t_file);
+        io_fclose(n->t_file);
         n->t_file = 0;
     }
     return NIL_NODE;
@@ -105,15 +272,28 @@ static node_idx_t native_io_close_file(env_ptr_t env, list_ptr_t args) {
 // (io/read-line file)
 // Reads a line from the file.
 static node_idx_t native_io_read_line(env_ptr_t env, list_ptr_t args) {
-	char buf[1024]; // TODO: not sure I like this fixed size, but its better to have a limit than no limit... right?
+	char buf[4096];
 	node_t *n = get_node(args->first_value());
 	if(n->type != NODE_FILE || !n->t_file) {
 		return NIL_NODE;
 	}
-	if(!fgets(buf, 1024, n->t_file)) {
+	if(!fgets(buf, sizeof(buf), n->t_file)) {
 		return NIL_NODE;
 	}
-	return new_node_string(buf);
+	size_t len = strlen(buf);
+	if(len == 0 || buf[len-1] == '\n') {
+		return new_node_string(jo_string(buf, len));
+	}
+	// longer than the buffer, keep going until the newline
+	jo_string line(buf, len);
+	while(fgets(buf, sizeof(buf), n->t_file)) {
+		len = strlen(buf);
+		line.append(buf, len);
+		if(buf[len-1] == '\n') {
+			break;
+		}
+	}
+	return new_node_string(line);
 }
 
 // (io/write-line file str)
@@ -293,7 +473,7 @@ static node_idx_t native_io_write_str(env_ptr_t env, list_ptr_t args) {
         return NIL_NODE;
     }
     jo_string str = get_node_string(args->second_value());
-    fputs(str.c_str(), n->t_file);
+    fwrite(str.c_str(), 1, str.length(), n->t_file);
     return NIL_NODE;
 }
 
@@ -584,6 +764,443 @@ static node_idx_t native_io_tell_dir(env_ptr_t env, list_ptr_t args) {
 #endif
 }
 
+// file-seq walks the tree on the thread pool. Each task takes a directory off a shared
+// stack, lists it (getdents64 on Linux, with d_type so most entries need no stat) and pushes
+// the subdirectories back for whoever is free. Filtering happens as directories are read, so
+// only wanted entries are ever queued for the seq. The queue is bounded: tasks stop while
+// the seq is behind, and for good once it is freed.
+struct io_walk_entry_t {
+    const char *name;
+    bool dir;
+    bool has_stat;
+    long long size;
+    long long mtime;
+};
+
+// * and ? wildcards, matched against a file name
+static bool io_glob_match(const char *pat, const char *s) {
+    const char *star = 0, *ss = 0;
+    while(*s) {
+        if(*pat == '?' || *pat == *s) {
+            ++pat;
+            ++s;
+        } else if(*pat == '*') {
+            star = pat++;
+            ss = s;
+        } else if(star) {
+            pat = star + 1;
+            s = ++ss;
+        } else {
+            return false;
+        }
+    }
+    while(*pat == '*') ++pat;
+    return !*pat;
+}
+
+#ifdef __linux__
+struct io_dirent64_t {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+#endif
+
+template<typename F>
+static void io_walk_read_dir(const jo_string &dir, bool want_stat, F emit) {
+#if defined(_WIN32)
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA((dir + "\\*").c_str(), &fd);
+    if(h == INVALID_HANDLE_VALUE) return;
+    do {
+        const char *name = fd.cFileName;
+        if(name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) continue;
+        io_walk_entry_t e;
+        e.name = name;
+        e.dir = (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && !(fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT);
+        e.has_stat = true;
+        e.size = ((long long)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+        // 100ns ticks since 1601 to ms since 1970
+        e.mtime = ((((long long)fd.ftLastWriteTime.dwHighDateTime << 32) | fd.ftLastWriteTime.dwLowDateTime) - 116444736000000000ll) / 10000;
+        emit(e);
+    } while(FindNextFileA(h, &fd));
+    FindClose(h);
+#else
+    auto entry = [&](int dfd, const char *name, int d_type) {
+        if(name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) return;
+        io_walk_entry_t e;
+        e.name = name;
+        e.dir = d_type == DT_DIR;
+        e.has_stat = false;
+        if(want_stat || d_type == DT_UNKNOWN) {
+            struct stat st;
+            if(fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                e.dir = S_ISDIR(st.st_mode);
+                e.has_stat = true;
+                e.size = st.st_size;
+                e.mtime = (long long)st.st_mtime * 1000;
+            }
+        }
+        emit(e);
+    };
+#ifdef __linux__
+    int dfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dfd < 0) return;
+    char buf[1 << 15];
+    long n;
+    while((n = syscall(SYS_getdents64, dfd, buf, sizeof(buf))) > 0) {
+        for(long off = 0; off < n; ) {
+            io_dirent64_t *d = (io_dirent64_t*)(buf + off);
+            off += d->d_reclen;
+            entry(dfd, d->d_name, d->d_type);
+        }
+    }
+    close(dfd);
+#else
+    DIR *d = opendir(dir.c_str());
+    if(!d) return;
+    struct dirent *ent;
+    while((ent = readdir(d)) != NULL) {
+        entry(dirfd(d), ent->d_name, ent->d_type);
+    }
+    closedir(d);
+#endif
+#endif
+}
+
+// Directories are read by tasks on the shared thread pool. A task never waits: it reads
+// directories until there are none queued or the consumer has fallen MAX_READY entries
+// behind, then returns its thread to the pool. Tasks are started again as directories turn
+// up and as take() drains the ready queue.
+// take() doesn't rely on the pool either. Rather than wait while a directory is queued it
+// reads that directory itself, so a seq realized on a pool thread (in a future, under pmap)
+// finishes even when every pool thread is a consumer and the tasks never get to run.
+// Tasks hold a reference to the walker; dropping the seq only sets stop, see io_walk_handle_t.
+struct io_walker_t : jo_object {
+    enum { MAX_READY = 1 << 16 };
+    env_ptr_t env;
+    jo_string glob;
+    node_idx_t filter;
+    bool want_stat;
+    bool want_dirs;
+    int max_tasks;
+
+    std::mutex lock;
+    std::condition_variable ready_cv;
+    jo_vector<jo_string> dirs;
+    jo_vector<node_idx_t> ready;
+    size_t ready_head;
+    int tasks; // queued or running on the pool
+    int busy;  // directories being read right now
+    bool stop;
+    node_idx_unsafe_t step;
+
+    io_walker_t(env_ptr_t e) : env(e), glob(), filter(NIL_NODE), want_stat(false), want_dirs(true), max_tasks(1), ready_head(0), tasks(0), busy(0), stop(false), step() {}
+
+    size_t pending() const { return ready.size() - ready_head; }
+    bool finished() const { return dirs.size() == 0 && busy == 0; }
+
+    void cancel() {
+        std::unique_lock<std::mutex> l(lock);
+        stop = true;
+    }
+
+    // How many more tasks to start, counted as running already. Called with the lock held,
+    // the tasks are handed to the pool after it is released.
+    int claim() {
+        int n = 0;
+        while(!stop && tasks < max_tasks && (size_t)tasks < dirs.size() && pending() < MAX_READY) {
+            ++tasks;
+            ++n;
+        }
+        return n;
+    }
+
+    void launch(int n) {
+        jo_shared_ptr_t<io_walker_t> self(this);
+        for(int i = 0; i < n; ++i) {
+            thread_pool->add_task(new jo_task_t([self]() mutable -> node_idx_t { self->work(); return NIL_NODE; }));
+        }
+    }
+
+    // The node for one entry, or NIL_NODE when it is filtered out.
+    node_idx_t entry_node(const jo_string &path, const io_walk_entry_t &e) {
+        if(e.dir && !want_dirs) {
+            return NIL_NODE;
+        }
+        if(glob.length() > 0 && !io_glob_match(glob.c_str(), e.name)) {
+            return NIL_NODE;
+        }
+        node_idx_t ret = new_node_string(path);
+        if(want_stat) {
+            hash_map_ptr_t m = new_hash_map();
+            m->assoc_inplace(new_node_keyword("path"), ret, node_eq);
+            m->assoc_inplace(new_node_keyword("dir?"), new_node_bool(e.dir), node_eq);
+            if(e.has_stat) {
+                m->assoc_inplace(new_node_keyword("size"), new_node_int(e.size), node_eq);
+                m->assoc_inplace(new_node_keyword("mtime"), new_node_int(e.mtime), node_eq);
+            }
+            ret = new_node_hash_map(m);
+        }
+        if(filter != NIL_NODE && !get_node_bool(eval_va(env, filter, ret))) {
+            return NIL_NODE;
+        }
+        return ret;
+    }
+
+    // Reads the next queued directory. Called with the lock held, which is dropped meanwhile.
+    void read_one(std::unique_lock<std::mutex> &l) {
+        jo_string dir = dirs.back();
+        dirs.pop_back();
+        ++busy;
+        l.unlock();
+
+        jo_vector<jo_string> subdirs;
+        jo_vector<node_idx_t> found;
+        const char *sep = dir.length() > 0 && (dir.c_str()[dir.length()-1] == '/' || dir.c_str()[dir.length()-1] == '\\') ? "" : "/";
+        io_walk_read_dir(dir, want_stat, [&](const io_walk_entry_t &e) {
+            jo_string path = dir + sep + e.name;
+            if(e.dir) {
+                subdirs.push_back(path);
+            }
+            node_idx_t n = entry_node(path, e);
+            if(n != NIL_NODE) {
+                found.push_back(n);
+            }
+        });
+
+        l.lock();
+        for(size_t i = 0; i < subdirs.size(); ++i) {
+            dirs.push_back(subdirs[i]);
+        }
+        for(size_t i = 0; i < found.size(); ++i) {
+            ready.push_back(found[i]);
+        }
+        --busy;
+        ready_cv.notify_all();
+        int n = claim();
+        if(n > 0) {
+            l.unlock();
+            launch(n);
+            l.lock();
+        }
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> l(lock);
+        while(!stop && dirs.size() > 0 && pending() < MAX_READY) {
+            read_one(l);
+        }
+        --tasks;
+        ready_cv.notify_all();
+    }
+
+    // next entry for the seq in the order the walk found them, NIL_NODE once it is done
+    node_idx_t take() {
+        std::unique_lock<std::mutex> l(lock);
+        while(pending() == 0) {
+            if(finished()) {
+                return NIL_NODE;
+            }
+            if(dirs.size() > 0) {
+                read_one(l);
+            } else {
+                // the directories left are being read on threads that don't block
+                ready_cv.wait(l);
+            }
+        }
+        node_idx_t ret = ready[ready_head++];
+        if(ready_head == ready.size()) {
+            ready.clear();
+            ready_head = 0;
+        } else if(ready_head > ready.size() / 2) {
+            size_t n = pending();
+            for(size_t i = 0; i < n; ++i) {
+                ready[i] = ready[ready_head + i];
+            }
+            ready.resize(n);
+            ready_head = 0;
+        }
+        int n = pending() <= MAX_READY / 2 ? claim() : 0;
+        l.unlock();
+        launch(n);
+        return ret;
+    }
+};
+
+typedef jo_alloc_t<io_walker_t> io_walker_alloc_t;
+io_walker_alloc_t io_walker_alloc;
+typedef jo_shared_ptr_t<io_walker_t> io_walker_ptr_t;
+template<typename...A>
+io_walker_ptr_t new_io_walker(A...args) { return io_walker_ptr_t(io_walker_alloc.emplace(args...)); }
+
+// Held by the seq alone, so the walk stops once nothing can read it any more, even while pool
+// tasks still hold the walker.
+struct io_walk_handle_t : jo_object {
+    io_walker_ptr_t w;
+    io_walk_handle_t(io_walker_ptr_t p) : w(p) {}
+    ~io_walk_handle_t() { w->cancel(); }
+};
+
+typedef jo_alloc_t<io_walk_handle_t> io_walk_handle_alloc_t;
+io_walk_handle_alloc_t io_walk_handle_alloc;
+typedef jo_shared_ptr_t<io_walk_handle_t> io_walk_handle_ptr_t;
+template<typename...A>
+io_walk_handle_ptr_t new_io_walk_handle(A...args) { return io_walk_handle_ptr_t(io_walk_handle_alloc.emplace(args...)); }
+
+// (file-seq dir & options)
+// A lazy seq of the paths of dir and everything under it, starting with dir itself.
+// Directories are read in parallel, so the rest is not sorted. Options are applied on
+// whichever thread reads the directory, and may also be passed as one map:
+//   :glob "*.o"    only names matching the pattern (* and ?)
+//   :filter f      only entries for which (f entry) is truthy
+//   :stat true     entries are {:path :dir? :size :mtime} maps instead of path strings
+//   :dirs false    leave directories out (they are still walked)
+//   :threads n     directories read at once on the thread pool, one per core by default
+static node_idx_t native_io_file_seq(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    jo_string root = get_node_string(*it++);
+    io_walker_ptr_t w = new_io_walker(env);
+    int num_threads = (int)processor_count;
+    list_ptr_t opts = args->rest();
+    if(opts->size() == 1 && get_node_type(opts->first_value()) == NODE_HASH_MAP) {
+        hash_map_ptr_t m = get_node(opts->first_value())->as_hash_map();
+        opts = new_list();
+        for(hash_map_t::iterator i = m->begin(); i; i++) {
+            opts->push_back_inplace(i->first);
+            opts->push_back_inplace(i->second);
+        }
+    }
+    for(list_t::iterator o(opts); o; ++o) {
+        node_t *k = get_node(*o++);
+        if(!o || k->type != NODE_KEYWORD) {
+            warnf("file-seq: options must be keyword/value pairs\n");
+            return NIL_NODE;
+        }
+        if(k->t_string == "glob") w->glob = get_node_string(*o);
+        else if(k->t_string == "filter") w->filter = *o;
+        else if(k->t_string == "stat") w->want_stat = get_node_bool(*o);
+        else if(k->t_string == "dirs") w->want_dirs = get_node_bool(*o);
+        else if(k->t_string == "threads") num_threads = (int)get_node_int(*o);
+        else {
+            warnf("file-seq: unknown option :%s\n", k->t_string.c_str());
+            return NIL_NODE;
+        }
+    }
+    w->max_tasks = jo_max(num_threads, 1);
+
+    struct stat st;
+    if(stat(root.c_str(), &st) != 0) {
+        return NIL_NODE;
+    }
+    io_walk_entry_t e;
+    const char *slash = strrchr(root.c_str(), '/');
+    e.name = slash && slash[1] ? slash + 1 : root.c_str();
+    e.dir = S_ISDIR(st.st_mode);
+    e.has_stat = true;
+    e.size = st.st_size;
+    e.mtime = (long long)st.st_mtime * 1000;
+    node_idx_t first = w->entry_node(root, e);
+    if(first != NIL_NODE) {
+        w->ready.push_back(first);
+    }
+    if(e.dir) {
+        w->dirs.push_back(root);
+        w->tasks = 1;
+        w->launch(1);
+    }
+
+    io_walk_handle_ptr_t h = new_io_walk_handle(w);
+    node_idx_t step = new_node_native_function("file-seq-next", [h](env_ptr_t env, list_ptr_t args) -> node_idx_t {
+        io_walker_t *wp = h->w.ptr;
+        node_idx_t n = wp->take();
+        if(n == NIL_NODE) {
+            return NIL_NODE;
+        }
+        return new_node_list(list_va(n, node_idx_t(wp->step)));
+    }, false, 0);
+    w->step = step.idx;
+    return new_node_lazy_list(env, new_node_list(list_va(step)));
+}
+
+static bool io_is_regular_file(FILE *fp) {
+#ifdef _WIN32
+    struct _stat st;
+    return fp && _fstat(_fileno(fp), &st) == 0 && (st.st_mode & _S_IFMT) == _S_IFREG;
+#else
+    struct stat st;
+    return fp && fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode);
+#endif
+}
+
+// Reads ahead a megabyte at a time and splits the whole buffer into lines in one pass, so
+// each step of line-seq only hands out the next one. A line may be any length, the part
+// left at the end of a buffer is carried over into the next.
+// Pipes, terminals and sockets are read a line at a time instead: fread would wait for a
+// full megabyte before handing out the first line.
+struct io_line_reader_t : jo_object {
+    enum { BUF_SIZE = 1 << 20 };
+    FILE *fp;
+    char *buf;
+    bool regular;
+    jo_string partial;
+    jo_vector<node_idx_t> lines;
+    size_t next;
+    node_idx_unsafe_t step;
+
+    io_line_reader_t(FILE *f) : fp(f), buf((char*)malloc(BUF_SIZE)), regular(io_is_regular_file(f)), partial(), lines(), next(0), step() {}
+    ~io_line_reader_t() { free(buf); }
+
+    void push(const char *p, size_t n) {
+        if(n > 0 && p[n-1] == '\r') --n;
+        lines.push_back(new_node_string(jo_string(p, n)));
+    }
+
+    // fgets stops after the first newline, so this only waits for what the writer has sent.
+    // A line longer than the buffer comes back in pieces and is joined through partial.
+    size_t read_some() {
+        return fgets(buf, BUF_SIZE, fp) ? strlen(buf) : 0;
+    }
+
+    // false once the file is exhausted
+    bool fill() {
+        lines.clear();
+        next = 0;
+        while(lines.size() == 0) {
+            size_t n = fp && buf ? (regular ? fread(buf, 1, BUF_SIZE, fp) : read_some()) : 0;
+            if(n == 0) {
+                if(partial.length() > 0) {
+                    push(partial.c_str(), partial.length());
+                    partial = jo_string();
+                }
+                return lines.size() > 0;
+            }
+            const char *p = buf, *end = buf + n;
+            const char *nl;
+            while((nl = (const char*)memchr(p, '\n', end - p)) != NULL) {
+                if(partial.length() > 0) {
+                    partial.append(p, nl - p);
+                    push(partial.c_str(), partial.length());
+                    partial = jo_string();
+                } else {
+                    push(p, nl - p);
+                }
+                p = nl + 1;
+            }
+            partial.append(p, end - p);
+        }
+        return true;
+    }
+};
+
+typedef jo_alloc_t<io_line_reader_t> io_line_reader_alloc_t;
+io_line_reader_alloc_t io_line_reader_alloc;
+typedef jo_shared_ptr_t<io_line_reader_t> io_line_reader_ptr_t;
+template<typename...A>
+io_line_reader_ptr_t new_io_line_reader(A...args) { return io_line_reader_ptr_t(io_line_reader_alloc.emplace(args...)); }
+
 // (line-seq rdr)
 // Returns the lines of text from rdr as a lazy sequence of strings.
 // rdr must implement java.io.BufferedReader.
@@ -593,20 +1210,70 @@ static node_idx_t native_io_line_seq(env_ptr_t env, list_ptr_t args) {
 		warnf("line-seq: rdr must be a file\n");
 		return NIL_NODE;
 	}
-	return new_node_lazy_list(env, new_node_list(list_va(env->get("line-seq-next"), rdr_idx)));
+	io_line_reader_ptr_t r = new_io_line_reader(get_node(rdr_idx)->t_file);
+	// the step function returns itself as the rest of the seq, it is found through the reader
+	// rather than looked up by name on every line. Holding rdr_idx keeps the file node alive.
+	node_idx_t step = new_node_native_function("line-seq-next", [r,rdr_idx](env_ptr_t env, list_ptr_t args) -> node_idx_t {
+		io_line_reader_t *rd = r.ptr;
+		if(rd->next >= rd->lines.size() && !rd->fill()) {
+			return NIL_NODE;
+		}
+		node_idx_t line = rd->lines[rd->next];
+		rd->lines[rd->next++] = NIL_NODE;
+		return new_node_list(list_va(line, node_idx_t(rd->step)));
+	}, false, 0);
+	r->step = step.idx;
+	return new_node_lazy_list(env, new_node_list(list_va(step)));
 }
 
-static node_idx_t native_io_line_seq_next(env_ptr_t env, list_ptr_t args) {
-	node_idx_t rdr_idx = args->first_value();
-	node_t *rdr = get_node(rdr_idx);
-	if(feof(rdr->t_file)) {
-		return NIL_NODE;
-	}
-    node_idx_t line = native_io_read_line(env, args);
-    if(line == NIL_NODE) {
+// (io/chunk-seq f)(io/chunk-seq f size)
+// A lazy seq of byte arrays of up to size bytes (default 64KiB) read from f, a path or
+// open file. A path is opened by the seq and closed when it reaches the end.
+static node_idx_t native_io_chunk_seq(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    node_idx_t f_idx = *it++;
+    long long size = it ? get_node_int(*it++) : 65536;
+    if(size <= 0) {
+        warnf("io/chunk-seq: size must be positive\n");
+        return NIL_NODE;
+    }
+    bool own = false;
+    if(get_node_type(f_idx) != NODE_FILE) {
+        jo_string path = get_node_string(f_idx);
+        FILE *fp = fopen(path.c_str(), "rb");
+        if(!fp) {
+            warnf("io/chunk-seq: could not open %s\n", path.c_str());
+            return NIL_NODE;
+        }
+        f_idx = new_node_file(fp);
+        own = true;
+    }
+    return new_node_lazy_list(env, new_node_list(list_va(env->get("io/chunk-seq-next"), f_idx, new_node_int(size), new_node_bool(own))));
+}
+
+static node_idx_t native_io_chunk_seq_next(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    node_idx_t f_idx = *it++;
+    node_idx_t size_idx = *it++;
+    node_idx_t own_idx = *it++;
+    node_t *f = get_node(f_idx);
+    if(!f->t_file) {
+        return NIL_NODE;
+    }
+    size_t size = (size_t)get_node_int(size_idx);
+    unsigned char *buf = (unsigned char*)malloc(size);
+    size_t n = buf ? fread(buf, 1, size, f->t_file) : 0;
+    if(n == 0) {
+        free(buf);
+        if(get_node_bool(own_idx)) {
+            fclose(f->t_file);
+            f->t_file = 0;
+        }
         return NIL_NODE;
     }
-	return new_node_list(list_va(line, env->get("line-seq-next"), rdr_idx));
+    node_idx_t chunk = new_node_array(new_array(buf, (long long)n));
+    free(buf);
+    return new_node_list(list_va(chunk, env->get("io/chunk-seq-next"), f_idx, size_idx, own_idx));
 }
 
 static node_idx_t native_io_file_to_array(env_ptr_t env, list_ptr_t args) {
@@ -624,17 +1291,69 @@ static node_idx_t native_io_file_to_array(env_ptr_t env, list_ptr_t args) {
     long long size = jo_ftell64(file->t_file);
     fseek(file->t_file, 0, SEEK_SET);
     unsigned char *buf = (unsigned char*)malloc(size);
-    fread(buf, 1, size, file->t_file);
-    return new_node_array(new_array(buf, size));
+    size = fread(buf, 1, size, file->t_file);
+    node_idx_t ret = new_node_array(new_array(buf, size));
+    free(buf);
+    return ret;
+}
+
+// (io/mmap path & options)
+// Maps path into memory and returns it as a byte array that reads straight out of the page
+// cache with no load step. The mapping is read-only unless :copy-on-write true is given, in
+// which case aset changes the private pages and never the file. ints, doubles etc. give
+// typed views of the same mapping.
+static node_idx_t native_io_mmap(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    jo_string path = get_node_string(*it++);
+    bool writable = false;
+    for(; it; ++it) {
+        node_t *k = get_node(*it++);
+        if(!it) break;
+        if(k->type == NODE_KEYWORD && k->t_string == "copy-on-write") {
+            writable = get_node_bool(*it);
+        }
+    }
+    size_t size = 0;
+    void *base = jo_mmap_file(path.c_str(), &size, writable);
+    if(!base) {
+        if(jo_file_exists(path.c_str())) {
+            // an empty file has nothing to map
+            return new_node_array(new_array(0, 1, TYPE_BYTE));
+        }
+        warnf("io/mmap: could not map %s\n", path.c_str());
+        return NIL_NODE;
+    }
+    return new_node_array(new_array(array_mapping_ptr_t(new array_mapping_t(base, size, writable))));
+}
+
+// (io/munmap array)
+// Detaches a mapped array, leaving it empty. The pages are unmapped once no typed view of
+// the mapping is left either.
+static node_idx_t native_io_munmap(env_ptr_t env, list_ptr_t args) {
+    node_t *n = get_node(args->first_value());
+    if(n->type != NODE_ARRAY) {
+        return NIL_NODE;
+    }
+    jo_clojure_array_ptr_t A = n->t_object.cast<jo_clojure_array_t>();
+    if(!A->mapping.ptr) {
+        return NIL_NODE;
+    }
+    A->mapping = array_mapping_ptr_t();
+    A->data = new_array_data();
+    A->num_elements = 0;
+    return NIL_NODE;
 }   
 
 
 void jo_clojure_io_init(env_ptr_t env) {
     env->set("file-seq", new_node_native_function("file-seq", &native_io_file_seq, false, NODE_FLAG_PRERESOLVE));
     env->set("line-seq", new_node_native_function("line-seq", &native_io_line_seq, false, NODE_FLAG_PRERESOLVE));
-    env->set("line-seq-next", new_node_native_function("line-seq-next", &native_io_line_seq_next, true, NODE_FLAG_PRERESOLVE));
     env->set("slurp", new_node_native_function("slurp", &native_io_slurp, false, NODE_FLAG_PRERESOLVE));
     env->set("spit", new_node_native_function("spit", &native_io_spit, false, NODE_FLAG_PRERESOLVE));
+    env->set("io/reader", new_node_native_function("io/reader", &native_io_reader, false, NODE_FLAG_PRERESOLVE));
+    env->set("io/writer", new_node_native_function("io/writer", &native_io_writer, false, NODE_FLAG_PRERESOLVE));
+    env->set("io/chunk-seq", new_node_native_function("io/chunk-seq", &native_io_chunk_seq, false, NODE_FLAG_PRERESOLVE));
+    env->set("io/chunk-seq-next", new_node_native_function("io/chunk-seq-next", &native_io_chunk_seq_next, true, NODE_FLAG_PRERESOLVE));
     env->set("io/open-dir", new_node_native_function("io/open-dir", &native_io_open_dir, false, NODE_FLAG_PRERESOLVE));
     env->set("io/close-dir", new_node_native_function("io/close-dir", &native_io_close_dir, false, NODE_FLAG_PRERESOLVE));
     env->set("io/read-dir", new_node_native_function("io/read-dir", &native_io_read_dir, false, NODE_FLAG_PRERESOLVE));
@@ -672,6 +1391,8 @@ void jo_clojure_io_init(env_ptr_t env) {
     env->set("io/delete-file", new_node_native_function("io/delete-file", &native_io_delete_file, false, NODE_FLAG_PRERESOLVE));
     env->set("io/copy", new_node_native_function("io/copy", &native_io_copy, false, NODE_FLAG_PRERESOLVE));
     env->set("io/file-to-array", new_node_native_function("io/file-to-array", &native_io_file_to_array, false, NODE_FLAG_PRERESOLVE));
+    env->set("io/mmap", new_node_native_function("io/mmap", &native_io_mmap, false, NODE_FLAG_PRERESOLVE));
+    env->set("io/munmap", new_node_native_function("io/munmap", &native_io_munmap, false, NODE_FLAG_PRERESOLVE));
 
     env->set("*in*", new_node_file(stdin, NODE_FLAG_PRERESOLVE));
     env->set("*out*", new_node_file(stdout, NODE_FLAG_PRERESOLVE));
@@ -0,0 +1,606 @@
+#pragma once
+
+// JSON reader and writer.
+//
+// Objects read as hash maps and arrays as vectors, both built in place. Object keys are interned,
+// so every object in a document shares one node per distinct key, as strings or (with
+// :key-fn keyword) keywords. Parsing runs over a contiguous buffer: files are first cut into whole
+// values (or lines, for json/parsed-seq), and the scan for the end of each string goes 16 bytes
+// at a time with SSE2.
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define JSON_SSE2
+#include <emmintrin.h>
+#endif
+
+// first '"', '\\' or control character in [p, end), or end
+static inline const char *json_scan_special(const char *p, const char *end) {
+#ifdef JSON_SSE2
+    const __m128i quote = _mm_set1_epi8('"'), bslash = _mm_set1_epi8('\\'), ctrl = _mm_set1_epi8(0x1F);
+    for(; p + 16 <= end; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl));
+        int mask = _mm_movemask_epi8(m);
+        if(mask) {
+#ifdef _MSC_VER
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            return p + bit;
+#else
+            return p + __builtin_ctz(mask);
+#endif
+        }
+    }
+#endif
+    for(; p < end; ++p) {
+        unsigned char c = *p;
+        if(c == '"' || c == '\\' || c < 0x20) break;
+    }
+    return p;
+}
+
+enum {
+    JSON_KEY_STRING = 0,
+    JSON_KEY_KEYWORD,
+    JSON_KEY_FN,
+};
+
+struct json_opts_t {
+    int key_mode = JSON_KEY_STRING;
+    node_idx_t key_fn = NIL_NODE;
+    node_idx_t eof_value = NIL_NODE;
+};
+
+// Parses trailing keyword options, e.g. (json/read-str s :key-fn keyword)
+static bool json_parse_opts(env_ptr_t env, list_t::iterator it, json_opts_t &opts, const char *fn_name) {
+    for(; it; ++it) {
+        node_t *k = get_node(*it++);
+        if(!it || k->type != NODE_KEYWORD) {
+            warnf("%s: options must be keyword/value pairs\n", fn_name);
+            return false;
+        }
+        if(k->t_string == "key-fn") {
+            opts.key_fn = *it;
+            opts.key_mode = *it == NIL_NODE ? JSON_KEY_STRING : *it == env->get("keyword") ? JSON_KEY_KEYWORD : JSON_KEY_FN;
+        } else if(k->t_string == "eof-value") {
+            opts.eof_value = *it;
+        } else {
+            warnf("%s: unknown option :%s\n", fn_name, k->t_string.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+struct json_reader_t {
+    const char *p, *start, *end;
+    env_ptr_t env;
+    const json_opts_t &opts;
+    parse_intern_t &keys;
+    jo_text_writer_t scratch;
+    const char *error = NULL;
+    int depth = 0;
+
+    json_reader_t(env_ptr_t e, const char *s, const char *en, const json_opts_t &o, parse_intern_t &k) : p(s), start(s), end(en), env(e), opts(o), keys(k) {}
+
+    bool fail(const char *msg) {
+        if(!error) error = msg;
+        return false;
+    }
+    inline void skip_ws() {
+        while(p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+    }
+    static int hex4(const char *h) {
+        int cp = 0;
+        for(int i = 0; i < 4; ++i) {
+            char c = h[i];
+            if(c >= '0' && c <= '9') cp = cp * 16 + c - '0';
+            else if(c >= 'a' && c <= 'f') cp = cp * 16 + c - 'a' + 10;
+            else if(c >= 'A' && c <= 'F') cp = cp * 16 + c - 'A' + 10;
+            else return -1;
+        }
+        return cp;
+    }
+    void put_utf8(unsigned cp) {
+        if(cp < 0x80) {
+            scratch.put((char)cp);
+        } else if(cp < 0x800) {
+            scratch.put((char)(0xC0 | (cp >> 6)));
+            scratch.put((char)(0x80 | (cp & 0x3F)));
+        } else if(cp < 0x10000) {
+            scratch.put((char)(0xE0 | (cp >> 12)));
+            scratch.put((char)(0x80 | ((cp >> 6) & 0x3F)));
+            scratch.put((char)(0x80 | (cp & 0x3F)));
+        } else {
+            scratch.put((char)(0xF0 | (cp >> 18)));
+            scratch.put((char)(0x80 | ((cp >> 12) & 0x3F)));
+            scratch.put((char)(0x80 | ((cp >> 6) & 0x3F)));
+            scratch.put((char)(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    // Reads a string body (p is just past the opening quote). Strings without escapes are
+    // returned in place, others are decoded into scratch.
+    bool read_string(const char *&s, size_t &len) {
+        const char *q = json_scan_special(p, end);
+        if(q < end && *q == '"') {
+            s = p;
+            len = q - p;
+            p = q + 1;
+            return true;
+        }
+        scratch.size = 0;
+        for(;;) {
+            if(q >= end) return fail("unterminated string");
+            scratch.put(p, q - p);
+            p = q;
+            char c = *p++;
+            if(c == '"') break;
+            if(c == '\\') {
+                if(p >= end) return fail("unterminated string");
+                c = *p++;
+                switch(c) {
+                case '"': case '\\': case '/': scratch.put(c); break;
+                case 'n': scratch.put('\n'); break;
+                case 't': scratch.put('\t'); break;
+                case 'r': scratch.put('\r'); break;
+                case 'b': scratch.put('\b'); break;
+                case 'f': scratch.put('\f'); break;
+                case 'u': {
+                    int cp = p + 4 <= end ? hex4(p) : -1;
+                    if(cp < 0) return fail("bad \\u escape");
+                    p += 4;
+                    // surrogate pair
+                    if(cp >= 0xD800 && cp < 0xDC00 && p + 6 <= end && p[0] == '\\' && p[1] == 'u') {
+                        int lo = hex4(p + 2);
+                        if(lo >= 0xDC00 && lo < 0xE000) {
+                            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                            p += 6;
+                        }
+                    }
+                    put_utf8(cp);
+                    break;
+                }
+                default: return fail("unknown escape in string");
+                }
+            } else {
+                // control characters aren't valid JSON, but pass them through
+                scratch.put(c);
+            }
+            q = json_scan_special(p, end);
+        }
+        s = scratch.buf;
+        len = scratch.size;
+        return true;
+    }
+
+    bool read_number(node_idx_t &out) {
+        const char *s = p;
+        bool neg = *p == '-';
+        if(neg) p++;
+        // integers that don't fit in 64 bits become floats
+        unsigned long long v = 0, limit = neg ? 1ull << 63 : (1ull << 63) - 1;
+        int digits = 0;
+        bool is_float = false;
+        for(; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+            unsigned d = *p - '0';
+            if(v > (limit - d) / 10) is_float = true;
+            else v = v * 10 + d;
+        }
+        if(!digits) return fail("invalid number");
+        if(p < end && *p == '.') {
+            is_float = true;
+            for(p++; p < end && *p >= '0' && *p <= '9'; p++) {}
+        }
+        if(p < end && (*p == 'e' || *p == 'E')) {
+            is_float = true;
+            p++;
+            if(p < end && (*p == '+' || *p == '-')) p++;
+            for(; p < end && *p >= '0' && *p <= '9'; p++) {}
+        }
+        if(is_float) {
+            out = new_node_float(parse_float(s, p));
+        } else {
+            out = new_node_int(neg ? (long long)(0 - v) : (long long)v);
+        }
+        return true;
+    }
+
+    node_idx_t make_key(const char *s, size_t len) {
+        switch(opts.key_mode) {
+        case JSON_KEY_KEYWORD: return keys.get(NODE_KEYWORD, s, (int)len);
+        case JSON_KEY_FN: return eval_va(env, opts.key_fn, keys.get(NODE_STRING, s, (int)len));
+        default: return keys.get(NODE_STRING, s, (int)len);
+        }
+    }
+
+    bool value(node_idx_t &out) {
+        skip_ws();
+        if(p >= end) return fail("unexpected end of input");
+        switch(*p) {
+        case '{': {
+            if(++depth > 512) return fail("nesting too deep");
+            p++;
+            hash_map_ptr_t m = new_hash_map();
+            skip_ws();
+            if(p < end && *p == '}') {
+                p++;
+            } else for(;;) {
+                skip_ws();
+                if(p >= end || *p != '"') return fail("expected a string key");
+                p++;
+                const char *s;
+                size_t len;
+                if(!read_string(s, len)) return false;
+                node_idx_t k = make_key(s, len);
+                skip_ws();
+                if(p >= end || *p != ':') return fail("expected ':' after key");
+                p++;
+                node_idx_t v;
+                if(!value(v)) return false;
+                m->assoc_inplace(k, v, node_eq);
+                skip_ws();
+                if(p < end && *p == ',') { p++; continue; }
+                if(p < end && *p == '}') { p++; break; }
+                return fail("expected ',' or '}'");
+            }
+            depth--;
+            out = new_node_hash_map(m);
+            return true;
+        }
+        case '[': {
+            if(++depth > 512) return fail("nesting too deep");
+            p++;
+            vector_ptr_t vec = new_vector();
+            skip_ws();
+            if(p < end && *p == ']') {
+                p++;
+            } else for(;;) {
+                node_idx_t v;
+                if(!value(v)) return false;
+                vec->push_back_inplace(v);
+                skip_ws();
+                if(p < end && *p == ',') { p++; continue; }
+                if(p < end && *p == ']') { p++; break; }
+                return fail("expected ',' or ']'");
+            }
+            depth--;
+            out = new_node_vector(vec);
+            return true;
+        }
+        case '"': {
+            p++;
+            const char *s;
+            size_t len;
+            if(!read_string(s, len)) return false;
+            out = new_node_string(jo_string(s, len));
+            return true;
+        }
+        case 't':
+            if(end - p >= 4 && !memcmp(p, "true", 4)) { p += 4; out = TRUE_NODE; return true; }
+            return fail("invalid literal");
+        case 'f':
+            if(end - p >= 5 && !memcmp(p, "false", 5)) { p += 5; out = FALSE_NODE; return true; }
+            return fail("invalid literal");
+        case 'n':
+            if(end - p >= 4 && !memcmp(p, "null", 4)) { p += 4; out = NIL_NODE; return true; }
+            return fail("invalid literal");
+        default:
+            if(*p == '-' || (*p >= '0' && *p <= '9')) return read_number(out);
+            return fail("unexpected character");
+        }
+    }
+
+    // one value, or eof_value if the input is only whitespace
+    node_idx_t read() {
+        skip_ws();
+        if(p >= end) return opts.eof_value;
+        node_idx_t out;
+        if(value(out)) {
+            skip_ws();
+            if(p >= end) return out;
+            fail("unexpected data after value");
+        }
+        warnf("json: %s at offset %lld\n", error, (long long)(p - start));
+        return NIL_NODE;
+    }
+};
+
+// Cuts the next whole value out of a file into buf, leaving the file just after it. This only
+// tracks nesting and strings; the parser does the real checking afterwards.
+static bool json_next_value(FILE *fp, jo_vector<char> &buf) {
+    buf.resize(0);
+    int c;
+    do {
+        c = jo_getc_unlocked(fp);
+    } while(c == ' ' || c == '\n' || c == '\r' || c == '\t');
+    if(c == EOF) return false;
+    int depth = 0;
+    bool in_string = false;
+    for(;;) {
+        buf.push_back((char)c);
+        if(in_string) {
+            if(c == '\\') {
+                c = jo_getc_unlocked(fp);
+                if(c == EOF) break;
+                buf.push_back((char)c);
+            } else if(c == '"') {
+                in_string = false;
+                if(depth == 0) break;
+            }
+        } else if(c == '"') {
+            in_string = true;
+        } else if(c == '{' || c == '[') {
+            depth++;
+        } else if(c == '}' || c == ']') {
+            if(--depth <= 0) break;
+        }
+        c = jo_getc_unlocked(fp);
+        if(c == EOF) break;
+        // a bare number or literal ends at the next delimiter, which stays in the stream
+        if(depth == 0 && !in_string && (c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == ',' || c == '{' || c == '[' || c == '"' || c == ']' || c == '}')) {
+            ungetc(c, fp);
+            break;
+        }
+    }
+    return true;
+}
+
+// (json/read-str s & opts)
+// Reads one JSON value from the string s. Options:
+//   :key-fn f       applied to each object key (string); keyword is handled natively
+//   :eof-value v    returned when s has no value (default nil)
+static node_idx_t native_json_read_str(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    node_t *s = get_node(*it++);
+    if(!s->is_string()) {
+        warnf("json/read-str: expected a string\n");
+        return NIL_NODE;
+    }
+    json_opts_t opts;
+    if(!json_parse_opts(env, it, opts, "json/read-str")) return NIL_NODE;
+    parse_intern_t keys(0, 64);
+    json_reader_t r(env, s->t_string.c_str(), s->t_string.c_str() + s->t_string.length(), opts, keys);
+    return r.read();
+}
+
+// (json/read reader & opts)
+// Reads the next JSON value from reader: a file, which is left just after the value, or a byte
+// array. Takes the same options as json/read-str.
+static node_idx_t native_json_read(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    node_t *rdr = get_node(*it++);
+    json_opts_t opts;
+    if(!json_parse_opts(env, it, opts, "json/read")) return NIL_NODE;
+    jo_vector<char> buf;
+    if(rdr->type == NODE_FILE) {
+        if(!rdr->t_file) {
+            warnf("json/read: file is closed\n");
+            return NIL_NODE;
+        }
+        if(!json_next_value(rdr->t_file, buf)) return opts.eof_value;
+    } else if(rdr->type == NODE_ARRAY) {
+        array_copy_bytes(rdr->t_object.cast<jo_clojure_array_t>(), buf);
+    } else {
+        warnf("json/read: expected a file or byte array\n");
+        return NIL_NODE;
+    }
+    parse_intern_t keys(0, 64);
+    json_reader_t r(env, buf.data(), buf.data() + buf.size(), opts, keys);
+    return r.read();
+}
+
+// State behind json/parsed-seq. Reads the file in large blocks and splits them into lines with
+// memchr. The key table is shared by all lines, and dropped once it gets big.
+struct json_lines_t {
+    node_idx_t file;
+    json_opts_t opts;
+    parse_intern_t keys;
+    char *buf;
+    size_t cap, pos = 0, len = 0;
+    bool eof = false;
+
+    json_lines_t(node_idx_t f, const json_opts_t &o) : file(f), opts(o), keys(0, 256), buf((char*)malloc(1 << 20)), cap(1 << 20) {}
+    ~json_lines_t() { free(buf); }
+
+    // next non-blank line as [s, e)
+    bool next_line(const char *&s, const char *&e) {
+        FILE *fp = get_node(file)->t_file;
+        for(;;) {
+            char *nl = (char*)memchr(buf + pos, '\n', len - pos);
+            if(nl || (eof && pos < len)) {
+                s = buf + pos;
+                e = nl ? nl : buf + len;
+                pos = nl ? nl - buf + 1 : len;
+                const char *t = s;
+                while(t < e && (*t == ' ' || *t == '\r' || *t == '\t')) t++;
+                if(t == e) continue;
+                return true;
+            }
+            if(eof || !fp) return false;
+            // keep the partial line and refill behind it, growing for lines longer than the buffer
+            memmove(buf, buf + pos, len - pos);
+            len -= pos;
+            pos = 0;
+            if(len == cap) {
+                cap *= 2;
+                buf = (char*)realloc(buf, cap);
+            }
+            size_t n = fread(buf + len, 1, cap - len, fp);
+            len += n;
+            if(n == 0) eof = true;
+        }
+    }
+};
+typedef jo_shared_ptr<json_lines_t> json_lines_ptr_t;
+
+static node_idx_t json_parsed_seq_next(env_ptr_t env, json_lines_ptr_t lines) {
+    const char *s, *e;
+    if(!lines->next_line(s, e)) return NIL_NODE;
+    if(lines->keys.count > 65536) lines->keys = parse_intern_t(0, 256);
+    json_reader_t r(env, s, e, lines->opts, lines->keys);
+    node_idx_t v = r.read();
+    return new_node_list(list_va(v, new_node_native_function("json/parsed-seq-next", [lines](env_ptr_t env, list_ptr_t args) -> node_idx_t {
+        return json_parsed_seq_next(env, lines);
+    }, true, NODE_FLAG_PRERESOLVE)));
+}
+
+// (json/parsed-seq reader & opts)
+// Returns a lazy sequence of the values in newline-delimited JSON read from the file reader, one
+// per non-blank line. Takes the same options as json/read-str. The file is consumed as the
+// sequence is walked, so walk it once.
+static node_idx_t native_json_parsed_seq(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    node_idx_t rdr_idx = *it++;
+    if(get_node_type(rdr_idx) != NODE_FILE || !get_node(rdr_idx)->t_file) {
+        warnf("json/parsed-seq: expected an open file\n");
+        return NIL_NODE;
+    }
+    json_opts_t opts;
+    if(!json_parse_opts(env, it, opts, "json/parsed-seq")) return NIL_NODE;
+    json_lines_ptr_t lines(new json_lines_t(rdr_idx, opts));
+    return new_node_lazy_list(env, new_node_list(list_va(new_node_native_function("json/parsed-seq-next", [lines](env_ptr_t env, list_ptr_t args) -> node_idx_t {
+        return json_parsed_seq_next(env, lines);
+    }, true, NODE_FLAG_PRERESOLVE))));
+}
+
+static void json_write_string(jo_text_writer_t &w, const char *s, size_t len) {
+    const char *end = s + len;
+    w.put('"');
+    for(;;) {
+        const char *q = json_scan_special(s, end);
+        w.put(s, q - s);
+        if(q == end) break;
+        unsigned char c = *q;
+        switch(c) {
+        case '"': w.put("\\\"", 2); break;
+        case '\\': w.put("\\\\", 2); break;
+        case '\n': w.put("\\n", 2); break;
+        case '\t': w.put("\\t", 2); break;
+        case '\r': w.put("\\r", 2); break;
+        case '\b': w.put("\\b", 2); break;
+        case '\f': w.put("\\f", 2); break;
+        default: w.putf("\\u%04x", c); break;
+        }
+        s = q + 1;
+    }
+    w.put('"');
+}
+
+static void json_write(jo_text_writer_t &w, node_idx_t idx);
+
+// object keys must be strings, so other keys are written as their text
+static void json_write_key(jo_text_writer_t &w, node_idx_t idx) {
+    node_t *n = get_node(idx);
+    if(n->type == NODE_STRING || n->type == NODE_KEYWORD || n->type == NODE_SYMBOL) {
+        json_write_string(w, n->t_string.c_str(), n->t_string.length());
+    } else {
+        jo_string s = n->as_string(1);
+        json_write_string(w, s.c_str(), s.length());
+    }
+}
+
+static void json_write(jo_text_writer_t &w, node_idx_t idx) {
+    node_t *n = get_node(idx);
+    switch(n->type) {
+    case NODE_NIL: w.put("null", 4); return;
+    case NODE_BOOL: w.put(n->t_bool ? "true" : "false"); return;
+    case NODE_INT:
+        if(n->flags & NODE_FLAG_CHAR) {
+            char c = (char)n->t_int;
+            json_write_string(w, &c, 1);
+        } else {
+            w.putf("%lld", n->t_int);
+        }
+        return;
+    case NODE_FLOAT: {
+        double d = n->t_float;
+        if(d != d || d == INFINITY || d == -INFINITY) {
+            // JSON has no NaN or infinity
+            w.put("null", 4);
+            return;
+        }
+        size_t at = w.size;
+        w.put_double(d);
+        if(!memchr(w.buf + at, '.', w.size - at) && !memchr(w.buf + at, 'e', w.size - at)) w.put(".0", 2);
+        return;
+    }
+    case NODE_STRING:
+    case NODE_KEYWORD:
+    case NODE_SYMBOL:
+        json_write_string(w, n->t_string.c_str(), n->t_string.length());
+        return;
+    case NODE_LIST:
+    case NODE_LAZY_LIST:
+    case NODE_VECTOR: {
+        bool first = true;
+        w.put('[');
+        seq_iterate(idx, [&](node_idx_t v) {
+            if(!first) w.put(',');
+            first = false;
+            json_write(w, v);
+            return true;
+        });
+        w.put(']');
+        return;
+    }
+    case NODE_HASH_SET: {
+        w.put('[');
+        for(auto it = n->as_hash_set()->begin(); it;) {
+            json_write(w, it->first);
+            ++it;
+            if(it) w.put(',');
+        }
+        w.put(']');
+        return;
+    }
+    case NODE_HASH_MAP: {
+        w.put('{');
+        for(auto it = n->as_hash_map()->begin(); it;) {
+            json_write_key(w, it->first);
+            w.put(':');
+            json_write(w, it->second);
+            ++it;
+            if(it) w.put(',');
+        }
+        w.put('}');
+        return;
+    }
+    default: {
+        jo_string s = n->as_string(1);
+        json_write_string(w, s.c_str(), s.length());
+        return;
+    }
+    }
+}
+
+// (json/write-str x)
+// Returns x as a JSON string. Maps become objects, other collections arrays, and keywords and
+// symbols strings.
+static node_idx_t native_json_write_str(env_ptr_t env, list_ptr_t args) {
+    jo_text_writer_t w;
+    json_write(w, args->first_value());
+    return new_node_string(w.str());
+}
+
+// (json/write x writer)
+// Writes x as JSON to the file writer.
+static node_idx_t native_json_write(env_ptr_t env, list_ptr_t args) {
+    node_t *out = get_node(args->second_value());
+    if(out->type != NODE_FILE || !out->t_file) {
+        warnf("json/write: expected an open file\n");
+        return NIL_NODE;
+    }
+    jo_text_writer_t w(out->t_file);
+    json_write(w, args->first_value());
+    return NIL_NODE;
+}
+
+void jo_clojure_json_init(env_ptr_t env) {
+    env->set("json/read-str", new_node_native_function("json/read-str", &native_json_read_str, false, NODE_FLAG_PRERESOLVE));
+    env->set("json/read", new_node_native_function("json/read", &native_json_read, false, NODE_FLAG_PRERESOLVE));
+    env->set("json/parsed-seq", new_node_native_function("json/parsed-seq", &native_json_parsed_seq, false, NODE_FLAG_PRERESOLVE));
+    env->set("json/write-str", new_node_native_function("json/write-str", &native_json_write_str, false, NODE_FLAG_PRERESOLVE));
+    env->set("json/write", new_node_native_function("json/write", &native_json_write, false, NODE_FLAG_PRERESOLVE));
+}
@@ -24,6 +24,18 @@ typedef signed long long sockfile_t;
 #include <netdb.h>
 #include <termios.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#define JO_NET_EPOLL
+#endif
 
 typedef int sockfile_t;
 #endif
@@ -213,41 +225,41 @@ static node_idx_t native_net_live_q(env_ptr_t env, list_ptr_t args) {
     return TRUE_NODE;
 }
 
-static node_idx_t native_net_close(env_ptr_t env, list_ptr_t args) {
-    int fd = get_node_int(args->first_value());
-#ifdef _WIN32
-	shutdown(fd, SD_BOTH);
-	closesocket(fd);
-#else
-	close(fd);
-#endif
-    return NIL_NODE;
-}
-
 static node_idx_t native_net_recv(env_ptr_t env, list_ptr_t args) {
     int fd = get_node_int(args->first_value());
     int tmp_size = get_node_int(args->second_value());
     tmp_size = tmp_size <= 0 ? 8192 : tmp_size;
-    char *tmp = (char*)jo_alloca(tmp_size+1);
+    char *tmp = (char*)jo_alloca(tmp_size);
     int count = recv(fd, (char*)tmp, tmp_size, 0);
     if(count <= 0) {
         return NIL_NODE;
     }
-    tmp[count] = 0;
-    return new_node_string(tmp);
+    return new_node_string(jo_string(tmp, count));
 }
 
+// Peeks at what has arrived and only consumes up to the newline, so the line costs two
+// syscalls per chunk instead of one per byte and nothing past it is taken from the socket.
+// Use net/stream for line protocols; it does one syscall per buffer.
 static node_idx_t native_net_recv_line(env_ptr_t env, list_ptr_t args) {
     int fd = get_node_int(args->first_value());
-    jo_string res = "";
-    char tmp[2] = {0};
-    do {
-        int count = recv(fd, tmp, 1, 0);
+    jo_string res;
+    char tmp[4096];
+    for(;;) {
+        int count = recv(fd, tmp, sizeof(tmp), MSG_PEEK);
         if(count <= 0) {
             break;
         }
-        res += tmp;
-    } while(tmp[0] != '\n');
+        const char *nl = (const char *)memchr(tmp, '\n', count);
+        int want = nl ? (int)(nl - tmp) + 1 : count;
+        count = recv(fd, tmp, want, 0);
+        if(count <= 0) {
+            break;
+        }
+        res.append(tmp, count);
+        if(nl && count == want) {
+            break;
+        }
+    }
     return new_node_string(res);
 }
 
@@ -255,18 +267,1104 @@ static node_idx_t native_net_send(env_ptr_t env, list_ptr_t args) {
     int fd = get_node_int(args->first_value());
     jo_string tmp = get_node_string(args->second_value());
 #ifdef _WIN32
-    int written = ::send(fd, tmp.c_str(), tmp.size, 0);
+    int written = ::send(fd, tmp.c_str(), (int)tmp.length(), 0);
 #else
-    int written = ::send(fd, tmp.c_str(), tmp.size, MSG_NOSIGNAL);
+    int written = ::send(fd, tmp.c_str(), tmp.length(), MSG_NOSIGNAL);
 #endif
     return new_node_int(written);
 }
 
+// Buffered stream over a socket (or any fd). Reads refill a buffer with as much as one
+// recv returns and frame lines, delimited records and length-prefixed records out of it.
+// Small writes are coalesced into one buffer, large ones are queued by reference, and a
+// flush hands everything to the kernel in one sendmsg/writev.
+struct jo_clojure_stream_t : jo_object {
+    enum { LARGE_WRITE = 4096, MAX_IOV = 64 };
+
+    sockfile_t fd;
+    bool socket;
+    bool eof = false;
+    char *rbuf;
+    size_t rcap, rpos = 0, rend = 0;
+    jo_vector<jo_string> wq; // queued in order, ahead of wbuf
+    jo_string wbuf;
+    size_t wcap, wq_bytes = 0;
+
+    jo_clojure_stream_t(sockfile_t fd, size_t cap) : fd(fd), rcap(cap), wcap(cap) {
+        int type = 0;
+        socklen_t len = sizeof(type);
+        socket = !getsockopt(fd, SOL_SOCKET, SO_TYPE, (char*)&type, &len);
+        rbuf = (char*)malloc(rcap);
+    }
+    ~jo_clojure_stream_t() { free(rbuf); }
+
+    // Reads once into the free tail of the buffer, making room first. Returns false at end of stream.
+    bool fill() {
+        if(eof) {
+            return false;
+        }
+        if(rpos == rend) {
+            rpos = rend = 0;
+        } else if(rend == rcap && rpos > 0) {
+            memmove(rbuf, rbuf + rpos, rend - rpos);
+            rend -= rpos;
+            rpos = 0;
+        }
+        if(rend == rcap) {
+            // one record is bigger than the buffer
+            rcap *= 2;
+            rbuf = (char*)realloc(rbuf, rcap);
+        }
+        for(;;) {
+#ifdef _WIN32
+            int n = socket ? ::recv(fd, rbuf + rend, (int)(rcap - rend), 0) : _read(fd, rbuf + rend, (unsigned)(rcap - rend));
+#else
+            ssize_t n = socket ? ::recv(fd, rbuf + rend, rcap - rend, 0) : ::read(fd, rbuf + rend, rcap - rend);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+#endif
+            if(n <= 0) {
+                eof = true;
+                return false;
+            }
+            rend += n;
+            return true;
+        }
+    }
+
+    jo_string take(size_t n, size_t skip) {
+        jo_string ret(rbuf + rpos, n);
+        rpos += n + skip;
+        return ret;
+    }
+
+    // Everything up to delim, without it. At end of stream returns the remainder, or false if there is none.
+    bool read_until(const char *delim, size_t dn, jo_string &out) {
+        size_t scanned = 0;
+        for(;;) {
+            size_t avail = rend - rpos;
+            if(avail >= dn) {
+                size_t from = scanned > dn - 1 ? scanned - (dn - 1) : 0;
+                const char *hit = dn == 1 ? (const char*)memchr(rbuf + rpos + from, delim[0], avail - from)
+                                          : jo_memmem(rbuf + rpos + from, avail - from, delim, dn);
+                if(hit) {
+                    out = take(hit - (rbuf + rpos), dn);
+                    return true;
+                }
+                scanned = avail;
+            }
+            if(!fill()) {
+                if(rend == rpos) {
+                    return false;
+                }
+                out = take(rend - rpos, 0);
+                return true;
+            }
+        }
+    }
+
+    bool read_line(jo_string &out) {
+        if(!read_until("\n", 1, out)) {
+            return false;
+        }
+        if(out.length() && out.c_str()[out.length()-1] == '\r') {
+            out.keep(0, out.length()-1);
+        }
+        return true;
+    }
+
+    bool read_bytes(size_t n, jo_string &out) {
+        while(rend - rpos < n) {
+            if(rcap - rpos < n && rpos) {
+                memmove(rbuf, rbuf + rpos, rend - rpos);
+                rend -= rpos;
+                rpos = 0;
+            }
+            if(rcap < n) {
+                rcap = n;
+                rbuf = (char*)realloc(rbuf, rcap);
+            }
+            if(!fill()) {
+                return false;
+            }
+        }
+        out = take(n, 0);
+        return true;
+    }
+
+    // Whatever is buffered, or one read's worth if nothing is.
+    bool read_some(jo_string &out) {
+        if(rpos == rend && !fill()) {
+            return false;
+        }
+        out = take(rend - rpos, 0);
+        return true;
+    }
+
+    bool write(const jo_string &s) {
+        size_t n = s.length();
+        if(n >= LARGE_WRITE) {
+            if(wbuf.length()) {
+                wq.push_back(wbuf);
+                wbuf = jo_string();
+            }
+            wq.push_back(s);
+        } else {
+            wbuf.append(s.c_str(), n);
+        }
+        wq_bytes += n;
+        return wq_bytes < wcap || flush();
+    }
+
+    bool flush() {
+        if(wbuf.length()) {
+            wq.push_back(wbuf);
+            wbuf = jo_string();
+        }
+        bool ok = true;
+        size_t first = 0, off = 0; // resume point after a short write
+        while(ok && first < wq.size()) {
+#ifdef _WIN32
+            int n = ::send(fd, wq[first].c_str() + off, (int)(wq[first].length() - off), 0);
+#else
+            struct iovec iov[MAX_IOV];
+            int cnt = 0;
+            for(size_t i = first; i < wq.size() && cnt < MAX_IOV; ++i, ++cnt) {
+                iov[cnt].iov_base = (void*)(wq[i].c_str() + (i == first ? off : 0));
+                iov[cnt].iov_len = wq[i].length() - (i == first ? off : 0);
+            }
+            ssize_t n;
+            if(socket) {
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = iov;
+                msg.msg_iovlen = cnt;
+                n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+            } else {
+                n = ::writev(fd, iov, cnt);
+            }
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+#endif
+            if(n <= 0) {
+                ok = false;
+                break;
+            }
+            size_t left = n;
+            while(left && first < wq.size()) {
+                size_t seg = wq[first].length() - off;
+                if(left < seg) {
+                    off += left;
+                    break;
+                }
+                left -= seg;
+                ++first;
+                off = 0;
+            }
+        }
+        wq.resize(0);
+        wq_bytes = 0;
+        return ok;
+    }
+};
+
+typedef jo_alloc_t<jo_clojure_stream_t> jo_clojure_stream_alloc_t;
+jo_clojure_stream_alloc_t jo_clojure_stream_alloc;
+typedef jo_shared_ptr_t<jo_clojure_stream_t> jo_clojure_stream_ptr_t;
+template<typename...A>
+jo_clojure_stream_ptr_t new_stream(A...args) { return jo_clojure_stream_ptr_t(jo_clojure_stream_alloc.emplace(args...)); }
+
+static node_idx_t new_node_stream(jo_clojure_stream_ptr_t s, int flags=0) { return new_node_object(NODE_STREAM, s.cast<jo_object>(), flags); }
+
+static jo_clojure_stream_t *stream_of(node_idx_t idx, const char *who) {
+    node_t *n = get_node(idx);
+    if(n->type != NODE_STREAM) {
+        warnf("(%s) expected a stream, got %s\n", who, n->type_name());
+        return nullptr;
+    }
+    return n->t_object.cast<jo_clojure_stream_t>().ptr;
+}
+
+// (net/stream fd)(net/stream fd buffer-size)
+// Wraps a connected socket in a buffered reader/writer. buffer-size (default 64k) is the
+// initial read buffer and the amount of queued output that triggers a flush.
+static node_idx_t native_net_stream(env_ptr_t env, list_ptr_t args) {
+    sockfile_t fd = get_node_int(args->first_value());
+    int cap = args->size() > 1 ? get_node_int(args->second_value()) : 0;
+    return new_node_stream(new_stream(fd, (size_t)(cap > 0 ? cap : 65536)));
+}
+
+// (net/read-line stream)
+// Next line without its "\n" or "\r\n", or nil at end of stream.
+static node_idx_t native_net_read_line(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_stream_t *s = stream_of(args->first_value(), "net/read-line");
+    jo_string line;
+    return s && s->read_line(line) ? new_node_string(line) : NIL_NODE;
+}
+
+// (net/read-until stream delim)
+// Everything up to the next delim, without it, or nil at end of stream.
+static node_idx_t native_net_read_until(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_stream_t *s = stream_of(args->first_value(), "net/read-until");
+    jo_string delim = get_node_string(args->second_value());
+    jo_string out;
+    if(!s || !delim.length()) {
+        return NIL_NODE;
+    }
+    return s->read_until(delim.c_str(), delim.length(), out) ? new_node_string(out) : NIL_NODE;
+}
+
+// (net/read-bytes stream n)
+// Exactly n bytes, or nil if the stream ends first.
+static node_idx_t native_net_read_bytes(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_stream_t *s = stream_of(args->first_value(), "net/read-bytes");
+    long long n = get_node_int(args->second_value());
+    jo_string out;
+    return s && n >= 0 && s->read_bytes((size_t)n, out) ? new_node_string(out) : NIL_NODE;
+}
+
+// (net/read stream)
+// Whatever is buffered, or the next chunk from the socket. nil at end of stream.
+static node_idx_t native_net_read(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_stream_t *s = stream_of(args->first_value(), "net/read");
+    jo_string out;
+    return s && s->read_some(out) ? new_node_string(out) : NIL_NODE;
+}
+
+// (net/read-frame stream)(net/read-frame stream max-size)
+// One record written by net/write-frame: a 4 byte big-endian length and then the payload.
+// nil if the length is over max-size (16MB by default), before anything is allocated for it.
+static node_idx_t native_net_read_frame(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    jo_clojure_stream_t *s = stream_of(*it++, "net/read-frame");
+    size_t max_size = it ? (size_t)jo_max(get_node_int(*it++), 0ll) : 16 << 20;
+    jo_string hdr, out;
+    if(!s || !s->read_bytes(4, hdr)) {
+        return NIL_NODE;
+    }
+    const unsigned char *h = (const unsigned char *)hdr.c_str();
+    size_t n = ((size_t)h[0] << 24) | ((size_t)h[1] << 16) | ((size_t)h[2] << 8) | h[3];
+    if(n > max_size) {
+        warnf("net/read-frame: %zu byte frame is over the %zu byte limit\n", n, max_size);
+        return NIL_NODE;
+    }
+    return s->read_bytes(n, out) ? new_node_string(out) : NIL_NODE;
+}
+
+// (net/write-frame stream data)
+// Queues data behind a 4 byte big-endian length.
+static node_idx_t native_net_write_frame(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_stream_t *s = stream_of(args->first_value(), "net/write-frame");
+    jo_string data = get_node_string(args->second_value());
+    if(!s) {
+        return FALSE_NODE;
+    }
+    size_t n = data.length();
+    char hdr[4] = { (char)(n >> 24), (char)(n >> 16), (char)(n >> 8), (char)n };
+    return s->write(jo_string(hdr, 4)) && s->write(data) ? TRUE_NODE : FALSE_NODE;
+}
+
+// (net/flush stream)
+// Sends everything queued on the stream. false if the socket failed.
+static node_idx_t native_net_flush(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_stream_t *s = stream_of(args->first_value(), "net/flush");
+    return s && s->flush() ? TRUE_NODE : FALSE_NODE;
+}
+
+#ifndef _WIN32
+// Pushes bytes from in_fd to a socket with the cheapest path the kernel offers: sendfile for
+// regular files, splice for pipes, and a read/send loop for everything else or when those are
+// refused. off < 0 reads from the current position. len < 0 sends until end of file.
+static long long net_send_fd(sockfile_t out_fd, int in_fd, long long off, long long len) {
+    struct stat st;
+    if(fstat(in_fd, &st)) {
+        return -1;
+    }
+    bool regular = S_ISREG(st.st_mode);
+    if(regular) {
+        long long start = off >= 0 ? off : (long long)lseek(in_fd, 0, SEEK_CUR);
+        long long avail = st.st_size > start ? st.st_size - start : 0;
+        len = len < 0 ? avail : jo_min(len, avail);
+    }
+    long long sent = 0;
+#ifdef __linux__
+    if(regular) {
+        off_t pos = off;
+        while(sent < len) {
+            size_t chunk = (size_t)jo_min(len - sent, (long long)(1 << 30));
+            ssize_t n = off >= 0 ? ::sendfile(out_fd, in_fd, &pos, chunk) : ::sendfile(out_fd, in_fd, 0, chunk);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n < 0 && sent == 0 && (errno == EINVAL || errno == ENOSYS)) {
+                break; // not supported for this pair, copy it instead
+            }
+            if(n <= 0) {
+                return n < 0 ? -1 : sent;
+            }
+            sent += n;
+        }
+        if(sent == len) {
+            return sent;
+        }
+    } else if(S_ISFIFO(st.st_mode) && off < 0) {
+        for(;;) {
+            size_t chunk = len < 0 ? (1 << 20) : (size_t)jo_min(len - sent, (long long)(1 << 20));
+            if(!chunk) {
+                return sent;
+            }
+            ssize_t n = ::splice(in_fd, 0, out_fd, 0, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n < 0 && sent == 0 && (errno == EINVAL || errno == ENOSYS)) {
+                break;
+            }
+            if(n <= 0) {
+                return n < 0 ? -1 : sent;
+            }
+            sent += n;
+        }
+    }
+#endif
+    char buf[65536];
+    while(len < 0 || sent < len) {
+        size_t chunk = len < 0 ? sizeof(buf) : (size_t)jo_min(len - sent, (long long)sizeof(buf));
+        ssize_t n = off >= 0 ? ::pread(in_fd, buf, chunk, off + sent) : ::read(in_fd, buf, chunk);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n < 0) {
+            return -1;
+        }
+        if(n == 0) {
+            break;
+        }
+        for(ssize_t done = 0; done < n; ) {
+            ssize_t w = ::send(out_fd, buf + done, n - done, MSG_NOSIGNAL);
+            if(w < 0 && errno == EINTR) {
+                continue;
+            }
+            if(w <= 0) {
+                return -1;
+            }
+            done += w;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+// Streams are flushed first so the file lands after whatever was already written to them.
+static bool net_target_fd(node_idx_t idx, sockfile_t &fd, const char *who) {
+    if(get_node_type(idx) == NODE_STREAM) {
+        jo_clojure_stream_t *s = stream_of(idx, who);
+        fd = s->fd;
+        return s->flush();
+    }
+    fd = get_node_int(idx);
+    return true;
+}
+
+// (net/send-file sock src)(net/send-file sock src offset)(net/send-file sock src offset length)
+// Sends a file to a socket or net/stream without bringing it into memory. src is a path, a
+// file from io/open-file, or an fd. Regular files go through sendfile, pipes through splice,
+// and anything else through a read/send loop. A nil offset or length means the current
+// position or everything up to end of file. Without an offset, files opened with
+// io/open-file are sent from their current position, which then moves past what was sent.
+// Returns the number of bytes sent, or nil on error.
+static node_idx_t native_net_send_file(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    sockfile_t out_fd;
+    if(!net_target_fd(*it++, out_fd, "net/send-file")) {
+        return NIL_NODE;
+    }
+    node_idx_t src = *it++;
+    node_idx_t off_idx = it ? *it++ : NIL_NODE;
+    node_idx_t len_idx = it ? *it++ : NIL_NODE;
+    long long off = off_idx != NIL_NODE ? get_node_int(off_idx) : -1;
+    long long len = len_idx != NIL_NODE ? get_node_int(len_idx) : -1;
+    int in_fd = -1;
+    bool opened = false;
+    FILE *fp = 0;
+    node_t *n = get_node(src);
+    if(n->type == NODE_FILE) {
+        if(!n->t_file) {
+            warnf("(net/send-file) file is closed\n");
+            return NIL_NODE;
+        }
+        // stdio reads ahead, so go by its position rather than the fd's
+        fp = n->t_file;
+        if(off < 0) {
+            off = jo_ftell64(fp);
+        }
+        in_fd = fileno(fp);
+    } else if(n->type == NODE_INT) {
+        in_fd = n->t_int;
+    } else {
+        jo_string path = n->as_string();
+        in_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(in_fd < 0) {
+            warnf("(net/send-file) could not open %s\n", path.c_str());
+            return NIL_NODE;
+        }
+        opened = true;
+    }
+    long long sent = net_send_fd(out_fd, in_fd, off, len);
+    if(opened) {
+        ::close(in_fd);
+    }
+    if(fp && sent > 0) {
+        jo_fseek64(fp, off + sent, SEEK_SET);
+    }
+    return sent < 0 ? NIL_NODE : new_node_int(sent);
+}
+
+// (net/send-array sock array)(net/send-array sock array offset)(net/send-array sock array offset length)
+// Sends the raw bytes of an array, offset and length in bytes, straight from its leaves in
+// 64k pieces instead of building a string of the whole thing first.
+// Returns the number of bytes sent, or nil on error.
+static node_idx_t native_net_send_array(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    sockfile_t out_fd;
+    if(!net_target_fd(*it++, out_fd, "net/send-array")) {
+        return NIL_NODE;
+    }
+    node_t *n = get_node(*it++);
+    if(n->type != NODE_ARRAY) {
+        warnf("(net/send-array) expected an array, got %s\n", n->type_name());
+        return NIL_NODE;
+    }
+    jo_clojure_array_ptr_t A = n->t_object.cast<jo_clojure_array_t>();
+    long long total = A->num_elements * A->element_size;
+    long long off = it ? get_node_int(*it++) : 0;
+    off = jo_max(0ll, jo_min(off, total));
+    long long len = it ? get_node_int(*it++) : total - off;
+    len = jo_max(0ll, jo_min(len, total - off));
+    unsigned char buf[65536];
+    long long sent = 0;
+    while(sent < len) {
+        long long chunk = jo_min(len - sent, (long long)sizeof(buf));
+        A->copy_bytes(off + sent, chunk, buf);
+        for(long long done = 0; done < chunk; ) {
+#ifdef _WIN32
+            int w = ::send(out_fd, (const char*)buf + done, (int)(chunk - done), 0);
+#else
+            ssize_t w = ::send(out_fd, buf + done, chunk - done, MSG_NOSIGNAL);
+            if(w < 0 && errno == EINTR) {
+                continue;
+            }
+#endif
+            if(w <= 0) {
+                return NIL_NODE;
+            }
+            done += w;
+        }
+        sent += chunk;
+    }
+    return new_node_int(sent);
+}
+#endif
+
+// (net/close fd)(net/close stream)
+// A stream is flushed before its socket is closed.
+static node_idx_t native_net_close(env_ptr_t env, list_ptr_t args) {
+    node_idx_t target = args->first_value();
+    int fd;
+    if(get_node_type(target) == NODE_STREAM) {
+        jo_clojure_stream_t *s = stream_of(target, "net/close");
+        s->flush();
+        fd = s->fd;
+    } else {
+        fd = get_node_int(target);
+    }
+#ifdef _WIN32
+	shutdown(fd, SD_BOTH);
+	closesocket(fd);
+#else
+	close(fd);
+#endif
+    return NIL_NODE;
+}
+
+// (net/shutdown fd)
+// Ends the sending side of a socket. The peer reads end of stream but can still reply.
+static node_idx_t native_net_shutdown(env_ptr_t env, list_ptr_t args) {
+    int fd = get_node_int(args->first_value());
+#ifdef _WIN32
+    return shutdown(fd, SD_SEND) ? FALSE_NODE : TRUE_NODE;
+#else
+    return shutdown(fd, SHUT_WR) ? FALSE_NODE : TRUE_NODE;
+#endif
+}
+
+#ifdef JO_NET_EPOLL
+
+// A reactor owns one epoll instance and the thread that waits on it. That thread does all
+// of the socket I/O edge-triggered (every read and write runs until EAGAIN) and hands what
+// it read to handlers on the thread pool. Handlers for one fd never run concurrently and
+// always see data in the order it arrived, so they can keep per-connection state without
+// locking. No thread ever blocks on a socket, so the number of connections is bounded by
+// the fd limit rather than by the number of threads.
+struct net_conn_t {
+    sockfile_t fd = -1;
+    unsigned gen = 0;
+    bool listener = false;
+    node_idx_t on_read;  // (on-read fd data), or (on-accept fd) for listeners
+    node_idx_t on_close; // (on-close fd)
+    node_idx_t on_drain; // (on-drain fd)
+    jo_mutex lock;
+    jo_string in;                   // read but not yet handed to on-read
+    jo_vector<sockfile_t> accepted; // accepted but not yet handed to on-accept
+    jo_string out;                  // queued by net/write but not yet sent
+    size_t out_pos = 0;
+    bool busy = false;    // a handler task is queued or running
+    bool eof = false;     // nothing more to read, on-close is pending once in is handed over
+    bool failed = false;  // the socket failed, nothing more can be sent either
+    bool closing = false; // on-close has run, close once out has gone
+    bool paused = false;  // stopped reading because in is full
+    bool dead = false;    // unwatched, drop everything from here on
+    bool drain = false;   // writes backed up, call on-drain once they are all sent
+    bool drained = false; // on-drain is pending
+};
+typedef jo_shared_ptr<net_conn_t> net_conn_ptr_t;
+
+struct jo_clojure_reactor_t;
+typedef jo_alloc_t<jo_clojure_reactor_t> jo_clojure_reactor_alloc_t;
+jo_clojure_reactor_alloc_t jo_clojure_reactor_alloc;
+typedef jo_shared_ptr_t<jo_clojure_reactor_t> jo_clojure_reactor_ptr_t;
+
+struct jo_clojure_reactor_t : jo_object {
+    static const unsigned long long WAKE_TOKEN = ~0ull;
+    static const size_t INPUT_LIMIT = 1 << 20; // stop reading a socket once this much waits for on-read
+
+    env_ptr_t env;
+    int epfd = -1;
+    int wakefd = -1;
+    std::atomic<bool> running;
+    std::thread thread;
+    jo_mutex lock; // guards conns, gen and count. Taken before any conn lock.
+    jo_vector<net_conn_ptr_t> conns; // indexed by fd
+    unsigned gen = 0;
+    int count = 0;
+    char rbuf[1<<16];
+
+    jo_clojure_reactor_t(env_ptr_t env) : env(env), running(false) {}
+    ~jo_clojure_reactor_t() { stop(); }
+
+    bool start() {
+        // Every connection is an fd, so let the process have as many as it is allowed.
+        struct rlimit rl;
+        if(!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(epfd < 0 || wakefd < 0) {
+            return false;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = WAKE_TOKEN;
+        if(epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev) < 0) {
+            return false;
+        }
+        running = true;
+        thread = std::thread([this]() { run(); });
+        return true;
+    }
+
+    void stop() {
+        if(running.exchange(false)) {
+            unsigned long long one = 1;
+            if(::write(wakefd, &one, sizeof(one)) < 0) {}
+            if(thread.get_id() == std::this_thread::get_id()) {
+                thread.detach();
+            } else {
+                thread.join();
+            }
+            jo_lock_guard guard(lock);
+            for(size_t i = 0; i < conns.size(); ++i) {
+                if(conns[i]) {
+                    close_conn(conns[i], true);
+                }
+            }
+            conns.resize(0);
+            count = 0;
+        }
+        if(epfd >= 0) { ::close(epfd); epfd = -1; }
+        if(wakefd >= 0) { ::close(wakefd); wakefd = -1; }
+    }
+
+    net_conn_ptr_t find(sockfile_t fd) {
+        jo_lock_guard guard(lock);
+        if(fd >= 0 && (size_t)fd < conns.size()) {
+            return conns[fd];
+        }
+        return net_conn_ptr_t();
+    }
+
+    bool add(sockfile_t fd, bool listener, node_idx_t on_read, node_idx_t on_close, node_idx_t on_drain) {
+        int fl = fcntl(fd, F_GETFL, 0);
+        if(fd < 0 || fl < 0 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) < 0) {
+            return false;
+        }
+        net_conn_ptr_t c(new net_conn_t());
+        c->fd = fd;
+        c->listener = listener;
+        c->on_read = on_read;
+        c->on_close = on_close;
+        c->on_drain = on_drain;
+
+        jo_lock_guard guard(lock);
+        if(!running) {
+            return false;
+        }
+        if((size_t)fd >= conns.size()) {
+            conns.resize(jo_max((size_t)fd + 1, conns.size() * 2));
+        }
+        if(conns[fd]) {
+            return false;
+        }
+        c->gen = ++gen;
+        if(!arm(c.ptr, EPOLL_CTL_ADD)) {
+            return false;
+        }
+        conns[fd] = c;
+        ++count;
+        return true;
+    }
+
+    // Caller holds lock. EPOLL_CTL_MOD also reports whatever is ready right now, which is how
+    // reading resumes after a pause.
+    bool arm(net_conn_t *c, int op) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET | (c->listener ? 0 : EPOLLOUT | EPOLLRDHUP);
+        ev.data.u64 = ((unsigned long long)c->gen << 32) | (unsigned)c->fd;
+        return epoll_ctl(epfd, op, c->fd, &ev) == 0;
+    }
+
+    // Caller holds lock.
+    void close_conn(net_conn_ptr_t c, bool close_fd) {
+        {
+            jo_lock_guard guard(c->lock);
+            c->dead = true;
+            for(size_t i = 0; i < c->accepted.size(); ++i) {
+                ::close(c->accepted[i]);
+            }
+            c->accepted.resize(0);
+        }
+        if((size_t)c->fd < conns.size() && conns[c->fd] == c) {
+            conns[c->fd] = net_conn_ptr_t();
+            --count;
+            epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, 0);
+            if(close_fd) {
+                ::close(c->fd);
+            }
+        }
+    }
+
+    void remove(net_conn_ptr_t c, bool close_fd) {
+        jo_lock_guard guard(lock);
+        close_conn(c, close_fd);
+    }
+
+    // Caller holds c->lock. Returns false if the socket failed.
+    static bool flush(net_conn_t *c) {
+        while(c->out_pos < c->out.length()) {
+            ssize_t n = ::send(c->fd, c->out.c_str() + c->out_pos, c->out.length() - c->out_pos, MSG_NOSIGNAL);
+            if(n > 0) {
+                c->out_pos += n;
+            } else if(n < 0 && errno == EINTR) {
+                continue;
+            } else if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return true;
+            } else {
+                return false;
+            }
+        }
+        c->out = jo_string();
+        c->out_pos = 0;
+        return true;
+    }
+
+    // Sends what the socket takes right away and queues the rest for the reactor thread.
+    bool write(sockfile_t fd, const jo_string &data) {
+        net_conn_ptr_t c = find(fd);
+        if(!c || c->listener) {
+            return false;
+        }
+        bool ok;
+        {
+            jo_lock_guard guard(c->lock);
+            if(c->dead || c->failed || c->closing) {
+                return false;
+            }
+            if(c->out_pos < c->out.length()) {
+                // Already backed up, keep the order and let the reactor send it. The sent part
+                // is dropped once it is most of the buffer, so a long backlog isn't copied
+                // on every write.
+                if(c->out_pos > c->out.length() / 2) {
+                    c->out = jo_string(c->out.c_str() + c->out_pos, c->out.length() - c->out_pos);
+                    c->out_pos = 0;
+                }
+                c->out += data;
+                return true;
+            }
+            c->out = data;
+            c->out_pos = 0;
+            ok = flush(c.ptr);
+            if(!ok) {
+                c->eof = c->failed = true;
+            } else if(c->out_pos < c->out.length()) {
+                c->drain = true;
+            }
+        }
+        if(!ok) {
+            schedule(c);
+        }
+        return ok;
+    }
+
+    // Reads until the socket is empty or in is full. A full in pauses reading; dispatch
+    // re-arms the socket once on-read has taken it.
+    void on_readable(net_conn_ptr_t &c) {
+        bool got = false, eof = false, failed = false;
+        {
+            jo_lock_guard guard(c->lock);
+            if(c->paused || c->eof) {
+                return;
+            }
+        }
+        for(;;) {
+            ssize_t n = ::recv(c->fd, rbuf, sizeof(rbuf), 0);
+            if(n > 0) {
+                jo_lock_guard guard(c->lock);
+                c->in.append(rbuf, n);
+                got = true;
+                if(c->in.length() >= INPUT_LIMIT) {
+                    c->paused = true;
+                    break;
+                }
+            } else if(n < 0 && errno == EINTR) {
+                continue;
+            } else if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                // 0 is the peer shutting its side; replies can still go out
+                eof = true;
+                failed = n < 0;
+                break;
+            }
+        }
+        if(eof) {
+            jo_lock_guard guard(c->lock);
+            c->eof = true;
+            c->failed |= failed;
+        }
+        if(got || eof) {
+            schedule(c);
+        }
+    }
+
+    void on_writable(net_conn_ptr_t &c) {
+        bool wake = false, finish = false;
+        {
+            jo_lock_guard guard(c->lock);
+            if(c->dead || c->out_pos >= c->out.length()) {
+                return;
+            }
+            if(!flush(c.ptr)) {
+                c->eof = c->failed = true;
+                wake = true;
+            } else if(c->out_pos >= c->out.length() && c->drain) {
+                c->drain = false;
+                c->drained = wake = c->on_drain != NIL_NODE;
+            }
+            if(c->closing && (c->failed || c->out_pos >= c->out.length())) {
+                finish = true;
+            }
+        }
+        if(finish) {
+            remove(c, true);
+        } else if(wake) {
+            schedule(c);
+        }
+    }
+
+    void on_acceptable(net_conn_ptr_t &c) {
+        bool got = false;
+        for(;;) {
+            sockfile_t cfd = ::accept(c->fd, 0, 0);
+            if(cfd < 0) {
+                if(errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                    warnf("net/reactor: accept failed (%s)\n", strerror(errno));
+                }
+                break;
+            }
+            jo_lock_guard guard(c->lock);
+            c->accepted.push_back(cfd);
+            got = true;
+        }
+        if(got) {
+            schedule(c);
+        }
+    }
+
+    void schedule(net_conn_ptr_t &c) {
+        {
+            jo_lock_guard guard(c->lock);
+            if(c->busy) {
+                return;
+            }
+            c->busy = true;
+        }
+        // The task holds the only extra reference so the reactor thread never ends up
+        // releasing the reactor itself.
+        jo_task_ptr_t task = new jo_task_t([self = jo_clojure_reactor_ptr_t(this), c]() -> node_idx_t {
+            self.ptr->dispatch(c);
+            return NIL_NODE;
+        });
+        thread_pool->add_task(task);
+    }
+
+    void call(node_idx_t f, node_idx_t a, node_idx_t b = INV_NODE) {
+        node_idx_t ret = b == INV_NODE ? eval_va(env, f, a) : eval_va(env, f, a, b);
+        if(get_node_type(ret) == NODE_EXCEPTION) {
+            warnf("net/reactor: handler threw %s\n", get_node(ret)->as_string().c_str());
+        }
+    }
+
+    // Runs on the thread pool, one task at a time per connection, until there is nothing
+    // left to hand over.
+    void dispatch(net_conn_ptr_t c) {
+        node_idx_t fd_idx = new_node_int(c->fd);
+        for(;;) {
+            jo_string data;
+            jo_vector<sockfile_t> fds;
+            bool drained = false, closing = false, resume = false;
+            {
+                jo_lock_guard guard(c->lock);
+                if(c->dead) {
+                    c->busy = false;
+                    return;
+                }
+                if(c->in.length()) {
+                    data.swap(c->in);
+                    resume = c->paused;
+                    c->paused = false;
+                } else if(c->accepted.size()) {
+                    // not a move: jo_vector leaves inline elements behind in the source
+                    fds = c->accepted;
+                    c->accepted.resize(0);
+                } else if(c->drained) {
+                    c->drained = false;
+                    drained = true;
+                } else if(c->eof) {
+                    closing = true;
+                } else {
+                    c->busy = false;
+                    return;
+                }
+            }
+            if(resume) {
+                jo_lock_guard guard(lock);
+                if((size_t)c->fd < conns.size() && conns[c->fd] == c) {
+                    arm(c.ptr, EPOLL_CTL_MOD);
+                }
+            }
+            if(data.length()) {
+                call(c->on_read, fd_idx, new_node_string(data));
+            } else if(fds.size()) {
+                for(size_t i = 0; i < fds.size(); ++i) {
+                    call(c->on_read, new_node_int(fds[i]));
+                }
+            } else if(drained) {
+                call(c->on_drain, fd_idx);
+            } else if(closing) {
+                if(c->on_close != NIL_NODE) {
+                    call(c->on_close, fd_idx);
+                }
+                // anything on-read or on-close wrote goes out before the socket is closed
+                bool done;
+                {
+                    jo_lock_guard guard(c->lock);
+                    c->closing = true;
+                    done = c->failed || c->out_pos >= c->out.length();
+                }
+                if(done) {
+                    remove(c, true);
+                }
+                return;
+            }
+        }
+    }
+
+    void run() {
+        tmProfileThread(0,0,0);
+        struct epoll_event events[256];
+        while(running.load()) {
+            int n = epoll_wait(epfd, events, 256, -1);
+            if(n < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                warnf("net/reactor: epoll_wait failed (%s)\n", strerror(errno));
+                break;
+            }
+            for(int i = 0; i < n; ++i) {
+                unsigned long long token = events[i].data.u64;
+                if(token == WAKE_TOKEN) {
+                    unsigned long long v;
+                    if(::read(wakefd, &v, sizeof(v)) < 0) {}
+                    continue;
+                }
+                net_conn_ptr_t c = find((sockfile_t)(token & 0xffffffff));
+                if(!c || c->gen != (unsigned)(token >> 32)) {
+                    continue; // unwatched since the event was queued
+                }
+                if(c->listener) {
+                    on_acceptable(c);
+                    continue;
+                }
+                if(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    on_readable(c);
+                }
+                if(events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+                    on_writable(c);
+                }
+            }
+        }
+    }
+};
+
+template<typename...A>
+jo_clojure_reactor_ptr_t new_reactor(A...args) { return jo_clojure_reactor_ptr_t(jo_clojure_reactor_alloc.emplace(args...)); }
+
+static node_idx_t new_node_reactor(jo_clojure_reactor_ptr_t r, int flags=0) { return new_node_object(NODE_REACTOR, r.cast<jo_object>(), flags); }
+
+static jo_clojure_reactor_t *reactor_of(node_idx_t idx, const char *who) {
+    node_t *n = get_node(idx);
+    if(n->type != NODE_REACTOR) {
+        warnf("(%s) expected a reactor, got %s\n", who, n->type_name());
+        return nullptr;
+    }
+    return n->t_object.cast<jo_clojure_reactor_t>().ptr;
+}
+
+// (net/reactor)
+// Starts an epoll event loop on its own thread. Sockets given to net/watch and
+// net/watch-accept are made non-blocking and serviced edge-triggered from that thread,
+// and their handlers run on the thread pool.
+static node_idx_t native_net_reactor(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_reactor_ptr_t r = new_reactor(env);
+    if(!r->start()) {
+        warnf("(net/reactor) failed to create epoll instance (%s)\n", strerror(errno));
+        return NIL_NODE;
+    }
+    return new_node_reactor(r);
+}
+
+// (net/watch reactor fd on-read)(net/watch reactor fd on-read on-close)(net/watch reactor fd on-read on-close on-drain)
+// (on-read fd data) gets everything read from fd as strings, in order. Reading pauses while
+// a megabyte is waiting for on-read. Once the peer hangs up or shuts its side (on-close fd)
+// runs, and the reactor closes fd after anything written so far has gone out. (on-drain fd)
+// runs when writes that had to be queued have all gone out. Returns fd, or nil if it could
+// not be watched.
+static node_idx_t native_net_watch(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    jo_clojure_reactor_t *r = reactor_of(*it++, "net/watch");
+    sockfile_t fd = get_node_int(*it++);
+    node_idx_t on_read = *it++;
+    node_idx_t on_close = it ? *it++ : NIL_NODE;
+    node_idx_t on_drain = it ? *it++ : NIL_NODE;
+    if(!r || !r->add(fd, false, on_read, on_close, on_drain)) {
+        return NIL_NODE;
+    }
+    return new_node_int(fd);
+}
+
+// (net/watch-accept reactor fd on-accept)
+// Accepts every connection that arrives on the listening socket fd and calls
+// (on-accept client-fd), typically to net/watch it.
+static node_idx_t native_net_watch_accept(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    jo_clojure_reactor_t *r = reactor_of(*it++, "net/watch-accept");
+    sockfile_t fd = get_node_int(*it++);
+    node_idx_t on_accept = *it++;
+    if(!r || !r->add(fd, true, on_accept, NIL_NODE, NIL_NODE)) {
+        return NIL_NODE;
+    }
+    return new_node_int(fd);
+}
+
+// (net/unwatch reactor fd)
+// Stops servicing fd without closing it. Queued data that was not sent is dropped.
+static node_idx_t native_net_unwatch(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_reactor_t *r = reactor_of(args->first_value(), "net/unwatch");
+    net_conn_ptr_t c = r ? r->find(get_node_int(args->second_value())) : net_conn_ptr_t();
+    if(!c) {
+        return FALSE_NODE;
+    }
+    r->remove(c, false);
+    return TRUE_NODE;
+}
+
+// (net/reactor-count reactor)
+// Number of sockets the reactor is watching.
+static node_idx_t native_net_reactor_count(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_reactor_t *r = reactor_of(args->first_value(), "net/reactor-count");
+    if(!r) {
+        return NIL_NODE;
+    }
+    jo_lock_guard guard(r->lock);
+    return new_node_int(r->count);
+}
+
+// (net/reactor-stop reactor)
+// Stops the event loop and closes every socket it was watching.
+static node_idx_t native_net_reactor_stop(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_reactor_t *r = reactor_of(args->first_value(), "net/reactor-stop");
+    if(r) {
+        r->stop();
+    }
+    return NIL_NODE;
+}
+
+#endif // JO_NET_EPOLL
+
+// (net/write stream data)(net/write reactor fd data)
+// On a stream, queues data and flushes once enough is queued. On a reactor, sends data on a
+// watched socket without blocking; whatever the socket does not take right away is queued
+// and sent by the reactor, in order. Returns false once the connection is gone.
+static node_idx_t native_net_write(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    node_idx_t target = *it++;
+#ifdef JO_NET_EPOLL
+    if(get_node_type(target) == NODE_REACTOR) {
+        jo_clojure_reactor_t *r = reactor_of(target, "net/write");
+        sockfile_t fd = get_node_int(*it++);
+        jo_string data = get_node_string(*it++);
+        return r->write(fd, data) ? TRUE_NODE : FALSE_NODE;
+    }
+#endif
+    jo_clojure_stream_t *s = stream_of(target, "net/write");
+    jo_string data = get_node_string(*it++);
+    return s && s->write(data) ? TRUE_NODE : FALSE_NODE;
+}
+
 void jo_clojure_net_init(env_ptr_t env) {
 	env->set("net/socket", new_node_native_function("net/socket", &native_net_socket, false, NODE_FLAG_PRERESOLVE));
 	env->set("net/bind", new_node_native_function("net/bind", &native_net_bind, false, NODE_FLAG_PRERESOLVE));
 	env->set("net/connect", new_node_native_function("net/connect", &native_net_connect, false, NODE_FLAG_PRERESOLVE));
 	env->set("net/close", new_node_native_function("net/close", &native_net_close, false, NODE_FLAG_PRERESOLVE));
+	env->set("net/shutdown", new_node_native_function("net/shutdown", &native_net_shutdown, false, NODE_FLAG_PRERESOLVE));
 	env->set("net/listen", new_node_native_function("net/listen", &native_net_listen, false, NODE_FLAG_PRERESOLVE));
 	env->set("net/accept", new_node_native_function("net/accept", &native_net_accept, false, NODE_FLAG_PRERESOLVE));
 	env->set("net/live?", new_node_native_function("net/live?", &native_net_live_q, false, NODE_FLAG_PRERESOLVE));
@@ -278,5 +1376,26 @@ void jo_clojure_net_init(env_ptr_t env) {
 	env->set("net/recv", new_node_native_function("net/recv", &native_net_recv, false, NODE_FLAG_PRERESOLVE));
 	env->set("net/recv-line", new_node_native_function("net/recv-line", &native_net_recv_line, false, NODE_FLAG_PRERESOLVE));
 	env->set("net/send", new_node_native_function("net/send", &native_net_send, false, NODE_FLAG_PRERESOLVE));
+#ifndef _WIN32
+	env->set("net/send-file", new_node_native_function("net/send-file", &native_net_send_file, false, NODE_FLAG_PRERESOLVE));
+	env->set("net/send-array", new_node_native_function("net/send-array", &native_net_send_array, false, NODE_FLAG_PRERESOLVE));
+#endif
+#ifdef JO_NET_EPOLL
+	env->set("net/reactor", new_node_native_function("net/reactor", &native_net_reactor, false, NODE_FLAG_PRERESOLVE));
+	env->set("net/reactor-stop", new_node_native_function("net/reactor-stop", &native_net_reactor_stop, false, NODE_FLAG_PRERESOLVE));
+	env->set("net/reactor-count", new_node_native_function("net/reactor-count", &native_net_reactor_count, false, NODE_FLAG_PRERESOLVE));
+	env->set("net/watch", new_node_native_function("net/watch", &native_net_watch, false, NODE_FLAG_PRERESOLVE));
+	env->set("net/watch-accept", new_node_native_function("net/watch-accept", &native_net_watch_accept, false, NODE_FLAG_PRERESOLVE));
+	env->set("net/unwatch", new_node_native_function("net/unwatch", &native_net_unwatch, false, NODE_FLAG_PRERESOLVE));
+#endif
+	env->set("net/write", new_node_native_function("net/write", &native_net_write, false, NODE_FLAG_PRERESOLVE));
+	env->set("net/stream", new_node_native_function("net/stream", &native_net_stream, false, NODE_FLAG_PRERESOLVE));
+	env->set("net/read", new_node_native_function("net/read", &native_net_read, false, NODE_FLAG_PRERESOLVE));
+	env->set("net/read-line", new_node_native_function("net/read-line", &native_net_read_line, false, NODE_FLAG_PRERESOLVE));
+	env->set("net/read-until", new_node_native_function("net/read-until", &native_net_read_until, false, NODE_FLAG_PRERESOLVE));
+	env->set("net/read-bytes", new_node_native_function("net/read-bytes", &native_net_read_bytes, false, NODE_FLAG_PRERESOLVE));
+	env->set("net/read-frame", new_node_native_function("net/read-frame", &native_net_read_frame, false, NODE_FLAG_PRERESOLVE));
+	env->set("net/write-frame", new_node_native_function("net/write-frame", &native_net_write_frame, false, NODE_FLAG_PRERESOLVE));
+	env->set("net/flush", new_node_native_function("net/flush", &native_net_flush, false, NODE_FLAG_PRERESOLVE));
 
 }
@@ -1,137 +1,200 @@
 #pragma once
 #include <stdio.h> // Added for printf
 
+// Layers, losses and optimizers compute on tensors. Matrices are converted on the way in and
+// back on the way out so existing matrix based models keep working; tensors in give tensors out.
+
+static inline bool nn_is_dense(const node_t *n) { return n->is_matrix() || n->is_tensor(); }
+
+// t as the same kind of value as like: a matrix, or a tensor of like's dtype
+static node_idx_t nn_result(node_idx_t like, const jo_clojure_tensor_ptr_t &t) {
+    node_t *n = get_node(like);
+    if(n->is_matrix()) {
+        return new_node_matrix(tensor_to_matrix(t));
+    }
+    if(n->is_tensor()) {
+        return new_node_tensor(tensor_astype(t, tensor_from_node(like)->dtype));
+    }
+    return new_node_tensor(t);
+}
+
+template<typename F>
+static node_idx_t nn_activation(node_idx_t x_idx, F f) {
+    return nn_result(x_idx, tensor_map(tensor_from_node(x_idx), f));
+}
+
+// read-only, contiguous float64 version of a dense value
+static jo_clojure_tensor_ptr_t nn_dense_tensor(const jo_clojure_tensor_ptr_t &t) {
+    return tensor_contiguous(tensor_astype(t, TYPE_DOUBLE));
+}
+
+static jo_clojure_tensor_ptr_t nn_dense(node_idx_t idx) {
+    return nn_dense_tensor(tensor_from_node(idx));
+}
+
+// contiguous version of a dense value in dtype, so optimizers can step float32 parameters without
+// converting them (and their state) to float64 and back
+static jo_clojure_tensor_ptr_t nn_dense_as(node_idx_t idx, array_type_t dtype) {
+    return tensor_contiguous(tensor_astype(tensor_from_node(idx), dtype));
+}
+
+// zeroed optimizer state shaped like param
+static node_idx_t nn_zeros_like(node_idx_t param_idx) {
+    return nn_result(param_idx, new_tensor_like(tensor_from_node(param_idx)));
+}
+
+// true if there's another positional argument; a trailing dtype keyword isn't one
+static inline bool nn_arg(const list_t::iterator &it) { return it && !get_node(*it)->is_keyword(); }
+
+// the dtype keyword (:float32 / :float64) in args, or NIL_NODE
+static node_idx_t nn_dtype_arg(list_ptr_t args) {
+    for (list_t::iterator it(args); it; it++) {
+        if (get_node(*it)->is_keyword()) return *it;
+    }
+    return NIL_NODE;
+}
+
+// Builds a rows x cols init matrix from f(i, j). Given a dtype keyword it's a [cols rows] tensor
+// of that dtype instead, filled in the same order so the same seed gives the same values.
+template<typename F>
+static node_idx_t nn_init_result(int rows, int cols, list_ptr_t args, F f) {
+    node_idx_t dtype_idx = nn_dtype_arg(args);
+    if (dtype_idx == NIL_NODE) {
+        matrix_ptr_t mat = new_matrix(rows, cols);
+        for (int i = 0; i < rows; i++) {
+            for (int j = 0; j < cols; j++) {
+                mat->set(i, j, new_node_float(f(i, j)));
+            }
+        }
+        return new_node_matrix(mat);
+    }
+    jo_clojure_tensor_ptr_t t = new_tensor_2d(tensor_parse_dtype(dtype_idx, TYPE_DOUBLE), cols, rows, false);
+    auto fill = [&](auto *d) {
+        for (int i = 0; i < rows; i++) {
+            for (int j = 0; j < cols; j++) {
+                d[(long long)j * rows + i] = f(i, j);
+            }
+        }
+    };
+    if (t->dtype == TYPE_FLOAT) fill(t->data<float>());
+    else fill(t->data<double>());
+    return new_node_tensor(t);
+}
+
 // Matrix initialization with random values scaled by init_scale
-// Arguments: (rows cols init_scale)
+// Arguments: (rows cols init_scale dtype)
 static node_idx_t native_nn_init_random_matrix(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     int rows = get_node_int(*it++);
     int cols = get_node_int(*it++);
-    double init_scale = it ? get_node_float(*it++) : 0.1; // Default scale if not provided
+    double init_scale = nn_arg(it) ? get_node_float(*it++) : 0.1; // Default scale if not provided
     
-    matrix_ptr_t mat = new_matrix(rows, cols);
-    
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            // Random values between -init_scale and init_scale
-            double rnd = (jo_pcg32(&jo_rnd_state) / (double)UINT32_MAX * 2.0 - 1.0) * init_scale;
-            mat->set(i, j, new_node_float(rnd));
-        }
-    }
-    
-    return new_node_matrix(mat);
+    return nn_init_result(rows, cols, args, [&](int i, int j) {
+        // Random values between -init_scale and init_scale
+        return (jo_pcg32(&jo_rnd_state) / (double)UINT32_MAX * 2.0 - 1.0) * init_scale;
+    });
 }
 
 // Initialize bias matrix with alternating values (used to break symmetry)
-// Arguments: (rows cols base_value)
+// Arguments: (rows cols base_value dtype)
 static node_idx_t native_nn_init_bias_matrix(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     int rows = get_node_int(*it++);
     int cols = get_node_int(*it++);
-    double base_value = it ? get_node_float(*it++) : 0.01; // Default value if not provided
-    
-    matrix_ptr_t mat = new_matrix(rows, cols);
-    
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            double value = (i % 2 == 0) ? base_value : -base_value;
-            mat->set(i, j, new_node_float(value));
-        }
-    }
+    double base_value = nn_arg(it) ? get_node_float(*it++) : 0.01; // Default value if not provided
     
-    return new_node_matrix(mat);
+    return nn_init_result(rows, cols, args, [&](int i, int j) { return (i % 2 == 0) ? base_value : -base_value; });
 }
 
 // Initialize matrix with same value in all cells
-// Arguments: (rows cols value)
+// Arguments: (rows cols value dtype)
 static node_idx_t native_nn_init_constant_matrix(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     int rows = get_node_int(*it++);
     int cols = get_node_int(*it++);
-    double value = it ? get_node_float(*it++) : 0.0; // Default value if not provided
-    
-    matrix_ptr_t mat = new_matrix(rows, cols);
+    double value = nn_arg(it) ? get_node_float(*it++) : 0.0; // Default value if not provided
     
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            mat->set(i, j, new_node_float(value));
-        }
-    }
-    
-    return new_node_matrix(mat);
+    return nn_init_result(rows, cols, args, [&](int i, int j) { return value; });
 }
 
 // Initialize with Xavier/Glorot initialization
-// Arguments: (rows cols fan_in fan_out)
+// Arguments: (rows cols fan_in fan_out dtype)
 static node_idx_t native_nn_init_xavier_matrix(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     int rows = get_node_int(*it++);
     int cols = get_node_int(*it++);
-    int fan_in = it ? get_node_int(*it++) : cols;  // Default to cols if not provided
-    int fan_out = it ? get_node_int(*it++) : rows; // Default to rows if not provided
+    int fan_in = nn_arg(it) ? get_node_int(*it++) : cols;  // Default to cols if not provided
+    int fan_out = nn_arg(it) ? get_node_int(*it++) : rows; // Default to rows if not provided
     
     double scale = sqrt(2.0 / (fan_in + fan_out));
-    matrix_ptr_t mat = new_matrix(rows, cols);
-    
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            double rnd = (jo_pcg32(&jo_rnd_state) / (double)UINT32_MAX * 2.0 - 1.0) * scale;
-            mat->set(i, j, new_node_float(rnd));
-        }
-    }
-    
-    return new_node_matrix(mat);
+    return nn_init_result(rows, cols, args, [&](int i, int j) {
+        return (jo_pcg32(&jo_rnd_state) / (double)UINT32_MAX * 2.0 - 1.0) * scale;
+    });
 }
 
 // Initialize with He/Kaiming initialization (better for ReLU networks)
-// Arguments: (rows cols fan_in)
+// Arguments: (rows cols fan_in dtype)
 static node_idx_t native_nn_init_he_matrix(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     int rows = get_node_int(*it++);
     int cols = get_node_int(*it++);
-    int fan_in = it ? get_node_int(*it++) : cols; // Default to cols if not provided
+    int fan_in = nn_arg(it) ? get_node_int(*it++) : cols; // Default to cols if not provided
     
     double scale = sqrt(2.0 / fan_in);
-    matrix_ptr_t mat = new_matrix(rows, cols);
-    
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            double rnd = (jo_pcg32(&jo_rnd_state) / (double)UINT32_MAX * 2.0 - 1.0) * scale;
-            mat->set(i, j, new_node_float(rnd));
-        }
-    }
-    
-    return new_node_matrix(mat);
+    return nn_init_result(rows, cols, args, [&](int i, int j) {
+        return (jo_pcg32(&jo_rnd_state) / (double)UINT32_MAX * 2.0 - 1.0) * scale;
+    });
 }
 
 // Linear layer implementation
-// Arguments: (in_features out_features)
+// Arguments: (in_features out_features dtype)
+// Parameters are matrices, or with a dtype (:float32 / :float64) tensors: weights [in out], bias [1 out]
 static node_idx_t native_nn_linear(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     int in_features = get_node_int(*it++);
     int out_features = get_node_int(*it++);
-    
-    // Standard W: (out_features x in_features) -> Stored as matrix(out_features, in_features)
-    matrix_ptr_t weights = new_matrix(out_features, in_features);
-    // Standard b: (out_features x 1) -> Stored as matrix(out_features, 1)
-    matrix_ptr_t bias = new_matrix(out_features, 1);
+    node_idx_t dtype_idx = nn_dtype_arg(args);
     
     // Xavier initialization (scale = sqrt(2 / (in_features + out_features)))
     double scale = jo_math_sqrt(2.0 / (in_features + out_features));
     
-    // Initialize weights W[row, col] -> matrix->set(col, row, ...)
-    for (int j = 0; j < weights->height /* in_features */; j++) { // row index (input feature)
-        for (int i = 0; i < weights->width /* out_features */; i++) { // column index (output feature)
-            // Random values between -scale and scale
-            double rnd = (jo_pcg32(&jo_rnd_state) / (double)UINT32_MAX * 2.0 - 1.0) * scale;
-            // W[k, i] -> set(col=i, row=k=j)
-            weights->set(i, j, new_node_float(rnd)); 
+    node_idx_t weights_idx, bias_idx;
+    if (dtype_idx == NIL_NODE) {
+        // Standard W: (out_features x in_features) -> Stored as matrix(out_features, in_features)
+        matrix_ptr_t weights = new_matrix(out_features, in_features);
+        // Standard b: (out_features x 1) -> Stored as matrix(out_features, 1)
+        matrix_ptr_t bias = new_matrix(out_features, 1);
+        
+        // Initialize weights W[row, col] -> matrix->set(col, row, ...)
+        for (int j = 0; j < weights->height /* in_features */; j++) { // row index (input feature)
+            for (int i = 0; i < weights->width /* out_features */; i++) { // column index (output feature)
+                // Random values between -scale and scale
+                double rnd = (jo_pcg32(&jo_rnd_state) / (double)UINT32_MAX * 2.0 - 1.0) * scale;
+                // W[k, i] -> set(col=i, row=k=j)
+                weights->set(i, j, new_node_float(rnd)); 
+            }
         }
-    }
-    
-    // Initialize bias to zeros b[i, 0] -> matrix->set(i, 0, ...)
-    for (int i = 0; i < bias->width /* out_features */; i++) {
-        bias->set(i, 0, ZERO_NODE); 
+        
+        // Initialize bias to zeros b[i, 0] -> matrix->set(i, 0, ...)
+        for (int i = 0; i < bias->width /* out_features */; i++) {
+            bias->set(i, 0, ZERO_NODE); 
+        }
+        weights_idx = new_node_matrix(weights);
+        bias_idx = new_node_matrix(bias);
+    } else {
+        array_type_t dtype = tensor_parse_dtype(dtype_idx, TYPE_DOUBLE);
+        jo_clojure_tensor_ptr_t weights = new_tensor_2d(dtype, in_features, out_features, false);
+        jo_clojure_tensor_ptr_t bias = new_tensor_2d(dtype, 1, out_features, true);
+        // same order as the matrix version
+        auto fill = [&](auto *w) {
+            for (long long j = 0, n = weights->size(); j < n; j++) {
+                w[j] = (jo_pcg32(&jo_rnd_state) / (double)UINT32_MAX * 2.0 - 1.0) * scale;
+            }
+        };
+        if (dtype == TYPE_FLOAT) fill(weights->data<float>());
+        else fill(weights->data<double>());
+        weights_idx = new_node_tensor(weights);
+        bias_idx = new_node_tensor(bias);
     }
     
     // Return a hashmap containing the layer parameters
@@ -139,8 +202,8 @@ static node_idx_t native_nn_linear(env_ptr_t env, list_ptr_t args) {
     layer->assoc_inplace(new_node_keyword("type"), new_node_keyword("linear"), node_eq);
     layer->assoc_inplace(new_node_keyword("in-features"), new_node_int(in_features), node_eq);
     layer->assoc_inplace(new_node_keyword("out-features"), new_node_int(out_features), node_eq);
-    layer->assoc_inplace(new_node_keyword("weights"), new_node_matrix(weights), node_eq);
-    layer->assoc_inplace(new_node_keyword("bias"), new_node_matrix(bias), node_eq);
+    layer->assoc_inplace(new_node_keyword("weights"), weights_idx, node_eq);
+    layer->assoc_inplace(new_node_keyword("bias"), bias_idx, node_eq);
     
     return new_node_hash_map(layer);
 }
@@ -158,44 +221,32 @@ static node_idx_t native_nn_linear_forward(env_ptr_t env, list_ptr_t args) {
     node_idx_t input_idx = *it++; // X
     
     hash_map_ptr_t layer = get_node(layer_idx)->as_hash_map();
-    // W is stored as matrix(out, in)
-    matrix_ptr_t weights = get_node(layer->get(new_node_keyword("weights"), node_eq))->as_matrix(); 
-    // b is stored as matrix(out, 1)
-    matrix_ptr_t bias = get_node(layer->get(new_node_keyword("bias"), node_eq))->as_matrix();       
-    // X is matrix(in, batch)
-    matrix_ptr_t input = get_node(input_idx)->as_matrix();                                         
-    
-    int batch_size = input->height;
-    int in_features = input->width;
-    // W is matrix(out, in), so height is in_features
-    int layer_in_features = weights->height; 
-    int out_features = weights->width; 
+    // W is [in, out], b is [1, out] (or [out])
+    jo_clojure_tensor_ptr_t weights = tensor_from_node(layer->get(new_node_keyword("weights"), node_eq));
+    jo_clojure_tensor_ptr_t bias = tensor_from_node(layer->get(new_node_keyword("bias"), node_eq));
+    // X is [..., batch, in]
+    jo_clojure_tensor_ptr_t input = tensor_from_node(input_idx);
+    if (!weights || !bias || !input || weights->ndim != 2 || input->ndim < 1) {
+        warnf("nn/linear-forward: expected a linear layer and a dense input\n");
+        return NIL_NODE;
+    }
+    
+    long long in_features = input->shape[input->ndim-1];
+    long long layer_in_features = weights->shape[0];
 
     // Check if the input features match layer's input features
-    // Check: X.width == W.height
     if (in_features != layer_in_features) { 
         warnf("nn/linear-forward: input features (%d) don't match layer's input features (%d)\n", (int)in_features, (int)layer_in_features); 
         return NIL_NODE;
     }
     
-    // Compute Z = W * X + b. 
-    // Z is matrix(out, batch), X is matrix(in, batch), W is matrix(out, in), b is matrix(out, 1)
-    matrix_ptr_t output = new_matrix(out_features, batch_size); // Z is matrix(out, batch)
-
-    for (int j = 0; j < batch_size; j++) {    // Iterate through batch samples (rows of Z)
-        for (int i = 0; i < out_features; i++) { // Iterate through output features (columns of Z)
-            double sum = 0.0;
-            for (int k = 0; k < in_features; k++) { // Iterate through input features
-                // Z(i,j) = sum_k W(i,k) * X(k,j) + B(i,0)
-                sum += get_node_float(weights->get(i, k)) * get_node_float(input->get(k, j));
-            }
-            // Add bias b[i, 0]
-            sum += get_node_float(bias->get(i, 0));
-            output->set(i, j, new_node_float(sum)); // Set Z[col=i, row=j]
-        }
+    // Z = X*W + b, batched over any leading dimensions of X
+    jo_clojure_tensor_ptr_t output = tensor_binary(tensor_matmul(input, weights), bias, TENSOR_ADD);
+    if (!output) {
+        warnf("nn/linear-forward: bias doesn't match the layer's output features\n");
+        return NIL_NODE;
     }
-    
-    return new_node_matrix(output);
+    return nn_result(input_idx, output);
 }
 
 // ReLU activation function
@@ -208,19 +259,8 @@ static node_idx_t native_nn_relu(env_ptr_t env, list_ptr_t args) {
         double val = x->as_float();
         return new_node_float(val > 0 ? val : 0);
     }
-    else if (x->is_matrix()) {
-        matrix_ptr_t matrix = x->as_matrix();
-        // Create a matrix with the same dimensions as the input
-        matrix_ptr_t result = new_matrix(matrix->width, matrix->height);
-        
-        for (int i = 0; i < matrix->width; i++) {
-            for (int j = 0; j < matrix->height; j++) {
-                double val = get_node_float(matrix->get(i, j));
-                result->set(i, j, new_node_float(val > 0 ? val : 0));
-            }
-        }
-        
-        return new_node_matrix(result);
+    else if (nn_is_dense(x)) {
+        return nn_activation(x_idx, [](auto val) { return val > 0 ? val : 0; });
     }
     else if (x->is_vector()) {
         vector_ptr_t vec = x->as_vector();
@@ -248,18 +288,8 @@ static node_idx_t native_nn_sigmoid(env_ptr_t env, list_ptr_t args) {
         double val = x->as_float();
         return new_node_float(1.0 / (1.0 + exp(-val)));
     }
-    else if (x->is_matrix()) {
-        matrix_ptr_t matrix = x->as_matrix();
-        matrix_ptr_t result = new_matrix(matrix->width, matrix->height);
-        
-        for (int i = 0; i < matrix->width; i++) {
-            for (int j = 0; j < matrix->height; j++) {
-                double val = get_node_float(matrix->get(i, j));
-                result->set(i, j, new_node_float(1.0 / (1.0 + exp(-val))));
-            }
-        }
-        
-        return new_node_matrix(result);
+    else if (nn_is_dense(x)) {
+        return nn_activation(x_idx, [](auto val) { return (decltype(val))(1.0 / (1.0 + exp(-val))); });
     }
     else if (x->is_vector()) {
         vector_ptr_t vec = x->as_vector();
@@ -287,18 +317,8 @@ static node_idx_t native_nn_tanh(env_ptr_t env, list_ptr_t args) {
         double val = x->as_float();
         return new_node_float(tanh(val));
     }
-    else if (x->is_matrix()) {
-        matrix_ptr_t matrix = x->as_matrix();
-        matrix_ptr_t result = new_matrix(matrix->width, matrix->height);
-        
-        for (int i = 0; i < matrix->width; i++) {
-            for (int j = 0; j < matrix->height; j++) {
-                double val = get_node_float(matrix->get(i, j));
-                result->set(i, j, new_node_float(tanh(val)));
-            }
-        }
-        
-        return new_node_matrix(result);
+    else if (nn_is_dense(x)) {
+        return nn_activation(x_idx, [](auto val) { return (decltype(val))tanh(val); });
     }
     else if (x->is_vector()) {
         vector_ptr_t vec = x->as_vector();
@@ -351,36 +371,13 @@ static node_idx_t native_nn_softmax(env_ptr_t env, list_ptr_t args) {
         
         return new_node_vector(result);
     }
-    else if (x->is_matrix()) {
-        // Apply softmax to each row
-        matrix_ptr_t matrix = x->as_matrix();
-        matrix_ptr_t result = new_matrix(matrix->width, matrix->height);
-        
-        for (int j = 0; j < matrix->height; j++) {
-            // Find max value in row
-            double max_val = -INFINITY;
-            for (int i = 0; i < matrix->width; i++) {
-                double val = get_node_float(matrix->get(i, j));
-                if (val > max_val) max_val = val;
-            }
-            
-            // Compute exp(x - max_val) for each element in row
-            double sum = 0.0;
-            for (int i = 0; i < matrix->width; i++) {
-                double val = get_node_float(matrix->get(i, j));
-                double exp_val = exp(val - max_val);
-                sum += exp_val;
-                result->set(i, j, new_node_float(exp_val));
-            }
-            
-            // Normalize
-            for (int i = 0; i < matrix->width; i++) {
-                double exp_val = get_node_float(result->get(i, j));
-                result->set(i, j, new_node_float(exp_val / sum));
-            }
-        }
-        
-        return new_node_matrix(result);
+    else if (nn_is_dense(x)) {
+        // Apply softmax along the last axis (each row of a matrix)
+        jo_clojure_tensor_ptr_t t = tensor_from_node(x_idx);
+        jo_clojure_tensor_ptr_t max_val = tensor_reduce(t, TENSOR_RMAX, -1, true);
+        jo_clojure_tensor_ptr_t e = tensor_map(tensor_binary(t, max_val, TENSOR_SUB), [](auto val) { return (decltype(val))exp(val); });
+        jo_clojure_tensor_ptr_t sum = tensor_reduce(e, TENSOR_SUM, -1, true);
+        return nn_result(x_idx, tensor_binary(e, sum, TENSOR_DIV));
     }
     
     warnf("nn/softmax: unsupported input type\n");
@@ -397,30 +394,19 @@ static node_idx_t native_nn_mse_loss(env_ptr_t env, list_ptr_t args) {
     node_t *pred = get_node(pred_idx);
     node_t *targets = get_node(targets_idx);
     
-    if (pred->is_matrix() && targets->is_matrix()) {
-        matrix_ptr_t pred_mat = pred->as_matrix();
-        matrix_ptr_t targets_mat = targets->as_matrix();
+    if (nn_is_dense(pred) && nn_is_dense(targets)) {
+        jo_clojure_tensor_ptr_t pred_t = tensor_from_node(pred_idx);
+        jo_clojure_tensor_ptr_t targets_t = tensor_from_node(targets_idx);
         
         // Check dimensions
-        if (pred_mat->width != targets_mat->width || pred_mat->height != targets_mat->height) {
+        if (!pred_t->same_shape(*targets_t)) {
             warnf("nn/mse-loss: prediction and target dimensions don't match\n");
             return NIL_NODE;
         }
         
-        double sum_squared_error = 0.0;
-        int count = 0;
-        
-        for (int i = 0; i < pred_mat->width; i++) {
-            for (int j = 0; j < pred_mat->height; j++) {
-                double pred_val = get_node_float(pred_mat->get(i, j));
-                double target_val = get_node_float(targets_mat->get(i, j));
-                double error = pred_val - target_val;
-                sum_squared_error += error * error;
-                count++;
-            }
-        }
-        
-        return new_node_float(sum_squared_error / count);
+        jo_clojure_tensor_ptr_t error = tensor_binary(pred_t, targets_t, TENSOR_SUB);
+        jo_clojure_tensor_ptr_t loss = tensor_reduce(tensor_binary(error, error, TENSOR_MUL), TENSOR_MEAN);
+        return new_node_float(loss->get_flat(0));
     }
     else if (pred->is_vector() && targets->is_vector()) {
         vector_ptr_t pred_vec = pred->as_vector();
@@ -482,32 +468,30 @@ static node_idx_t native_nn_cross_entropy_loss(env_ptr_t env, list_ptr_t args) {
         
         return new_node_float(loss / pred_vec->size());
     }
-    else if (pred->is_matrix() && targets->is_matrix()) {
-        matrix_ptr_t pred_mat = pred->as_matrix();
-        matrix_ptr_t targets_mat = targets->as_matrix();
+    else if (nn_is_dense(pred) && nn_is_dense(targets)) {
+        // computed in the predictions' dtype, accumulated in double
+        jo_clojure_tensor_ptr_t pred_t = tensor_contiguous(tensor_from_node(pred_idx));
+        jo_clojure_tensor_ptr_t targets_t = tensor_contiguous(tensor_astype(tensor_from_node(targets_idx), pred_t->dtype));
         
         // Check dimensions
-        if (pred_mat->width != targets_mat->width || pred_mat->height != targets_mat->height) {
+        if (!pred_t->same_shape(*targets_t)) {
             warnf("nn/cross-entropy-loss: prediction and target dimensions don't match\n");
             return NIL_NODE;
         }
         
+        long long count = pred_t->size();
         double loss = 0.0;
-        int count = 0;
-        
-        for (int i = 0; i < pred_mat->width; i++) {
-            for (int j = 0; j < pred_mat->height; j++) {
-                double p = get_node_float(pred_mat->get(i, j));
-                double t = get_node_float(targets_mat->get(i, j));
-                
+        auto run = [&](auto *p, auto *t) {
+            typedef typename std::remove_pointer<decltype(p)>::type T;
+            const T lo = (T)1e-7, hi = (T)(1.0 - 1e-7);
+            for (long long i = 0; i < count; i++) {
                 // Clip probability to avoid log(0)
-                double p_clipped = p < 1e-7 ? 1e-7 : (p > 1.0 - 1e-7 ? 1.0 - 1e-7 : p);
-                
-                double term = t * log(p_clipped) + (1 - t) * log(1 - p_clipped);
-                loss -= term; // Accumulate negated log likelihood
-                count++;
+                T p_clipped = p[i] < lo ? lo : (p[i] > hi ? hi : p[i]);
+                loss -= t[i] * log(p_clipped) + (1 - t[i]) * log(1 - p_clipped);
             }
-        }
+        };
+        if (pred_t->dtype == TYPE_FLOAT) run(pred_t->data<float>(), targets_t->data<float>());
+        else run(pred_t->data<double>(), targets_t->data<double>());
         
         double avg_loss = (count > 0) ? (loss / count) : 0.0;
         return new_node_float(avg_loss);
@@ -573,20 +557,15 @@ static node_idx_t native_nn_sgd_step(env_ptr_t env, list_ptr_t args) {
             
             node_t *param_node = get_node(param_idx);
             node_t *grad_node = get_node(grad_idx);
-            if (!param_node->is_matrix() || !grad_node->is_matrix()) continue;
+            if (!nn_is_dense(param_node) || !nn_is_dense(grad_node)) continue;
             
-            matrix_ptr_t param_mat = param_node->as_matrix();
-            matrix_ptr_t grad_mat = grad_node->as_matrix();
-            matrix_ptr_t updated_mat = new_matrix(param_mat->width, param_mat->height);
+            jo_clojure_tensor_ptr_t param_t = tensor_from_node(param_idx);
+            jo_clojure_tensor_ptr_t grad_t = tensor_from_node(grad_idx);
+            if (!param_t->same_shape(*grad_t)) continue;
             
-            for (int i = 0; i < param_mat->width; ++i) {
-                for (int j = 0; j < param_mat->height; ++j) {
-                    double p = get_node_float(param_mat->get(i, j));
-                    double g = get_node_float(grad_mat->get(i, j));
-                    updated_mat->set(i, j, new_node_float(p - lr * g));
-                }
-            }
-            updated_layer_params->assoc_inplace(param_key, new_node_matrix(updated_mat), node_eq);
+            // p - lr * g
+            jo_clojure_tensor_ptr_t step = tensor_binary(grad_t, tensor_scalar(lr), TENSOR_MUL);
+            updated_layer_params->assoc_inplace(param_key, nn_result(param_idx, tensor_binary(param_t, step, TENSOR_SUB)), node_eq);
         }
         
         // Place updated layer back into model
@@ -640,21 +619,10 @@ static node_idx_t native_nn_adam(env_ptr_t env, list_ptr_t args) {
                  node_idx_t param_key = param_it->first;
                  node_t* param_node = get_node(param_it->second);
                  
-                 if (param_node->is_matrix()) { // Check if the parameter is a matrix
-                     matrix_ptr_t param_mat = param_node->as_matrix();
-                     matrix_ptr_t m_mat = new_matrix(param_mat->width, param_mat->height);
-                     matrix_ptr_t v_mat = new_matrix(param_mat->width, param_mat->height);
-
-                     // Initialize moment matrices to zero
-                     for (int i = 0; i < param_mat->width; i++) {
-                         for (int j = 0; j < param_mat->height; j++) {
-                             m_mat->set(i, j, ZERO_NODE);
-                             v_mat->set(i, j, ZERO_NODE);
-                         }
-                     }
-                     // Add the zeroed moment matrix to the layer's moment map
-                     layer_m->assoc_inplace(param_key, new_node_matrix(m_mat), node_eq);
-                     layer_v->assoc_inplace(param_key, new_node_matrix(v_mat), node_eq);
+                 if (nn_is_dense(param_node)) {
+                     // Zeroed state shaped like the parameter
+                     layer_m->assoc_inplace(param_key, nn_zeros_like(param_it->second), node_eq);
+                     layer_v->assoc_inplace(param_key, nn_zeros_like(param_it->second), node_eq);
                  }
              }
              // Add the completed layer moment map to the main m and v maps
@@ -739,44 +707,52 @@ static node_idx_t native_nn_adam_step(env_ptr_t env, list_ptr_t args) {
             node_t *m_node = get_node(m_param);
             node_t *v_node = get_node(v_param);
             
-            if (param_node->is_matrix() && grad_node->is_matrix() && 
-                m_node->is_matrix() && v_node->is_matrix()) {
-                
-                matrix_ptr_t param_mat = param_node->as_matrix();
-                matrix_ptr_t grad_mat = grad_node->as_matrix();
-                matrix_ptr_t m_mat = m_node->as_matrix();
-                matrix_ptr_t v_mat = v_node->as_matrix();
+            if (nn_is_dense(param_node) && nn_is_dense(grad_node) && 
+                nn_is_dense(m_node) && nn_is_dense(v_node)) {
                 
-                matrix_ptr_t m_new_mat = new_matrix(m_mat->width, m_mat->height);
-                matrix_ptr_t v_new_mat = new_matrix(v_mat->width, v_mat->height);
-                matrix_ptr_t updated_param_mat = new_matrix(param_mat->width, param_mat->height);
+                array_type_t dtype = tensor_from_node(param)->dtype;
+                jo_clojure_tensor_ptr_t param_t = nn_dense_as(param, dtype);
+                jo_clojure_tensor_ptr_t grad_t = nn_dense_as(grad, dtype);
+                jo_clojure_tensor_ptr_t m_t = nn_dense_as(m_param, dtype);
+                jo_clojure_tensor_ptr_t v_t = nn_dense_as(v_param, dtype);
+                if (!param_t->same_shape(*grad_t) || !param_t->same_shape(*m_t) || !param_t->same_shape(*v_t)) continue;
                 
-                for (int i = 0; i < param_mat->width; i++) {
-                    for (int j = 0; j < param_mat->height; j++) {
-                        double p = get_node_float(param_mat->get(i, j));
-                        double g = get_node_float(grad_mat->get(i, j));
-                        double m_val = get_node_float(m_mat->get(i, j));
-                        double v_val = get_node_float(v_mat->get(i, j));
-                        
-                        double m_new_val = beta1 * m_val + (1 - beta1) * g;
-                        m_new_mat->set(i, j, new_node_float(m_new_val));
-                        
-                        double v_new_val = beta2 * v_val + (1 - beta2) * g * g;
-                        v_new_mat->set(i, j, new_node_float(v_new_val));
-                        
-                        double m_hat = m_new_val / (1 - pow(beta1, t));
-                        double v_hat = v_new_val / (1 - pow(beta2, t));
-                        
-                        double param_new = p - lr * m_hat / (sqrt(v_hat) + epsilon);
-                        updated_param_mat->set(i, j, new_node_float(param_new));
+                jo_clojure_tensor_ptr_t m_new_t = new_tensor_like(param_t, false);
+                jo_clojure_tensor_ptr_t v_new_t = new_tensor_like(param_t, false);
+                jo_clojure_tensor_ptr_t updated_param_t = new_tensor_like(param_t, false);
+                double bias_correction1 = 1 - pow(beta1, t);
+                double bias_correction2 = 1 - pow(beta2, t);
+                // stored in the parameter's dtype, computed in double
+                auto run = [&](auto *p_out) {
+                    typedef typename std::remove_pointer<decltype(p_out)>::type T;
+                    const T *p = param_t->data<T>();
+                    const T *g = grad_t->data<T>();
+                    const T *m_val = m_t->data<T>();
+                    const T *v_val = v_t->data<T>();
+                    T *m_out = m_new_t->data<T>();
+                    T *v_out = v_new_t->data<T>();
+                    for (long long i = 0, n = param_t->size(); i < n; i++) {
+                        // Update biased first and second moment estimates
+                        double m_i = beta1 * m_val[i] + (1 - beta1) * (double)g[i];
+                        double v_i = beta2 * v_val[i] + (1 - beta2) * (double)g[i] * g[i];
+                        m_out[i] = (T)m_i;
+                        v_out[i] = (T)v_i;
+                    
+                        // Bias correction
+                        double m_hat = m_i / bias_correction1;
+                        double v_hat = v_i / bias_correction2;
+                    
+                        p_out[i] = (T)(p[i] - lr * m_hat / (sqrt(v_hat) + epsilon));
                     }
-                }
+                };
+                if (dtype == TYPE_FLOAT) run(updated_param_t->data<float>());
+                else run(updated_param_t->data<double>());
                 
                 // Update the parameter within the layer's updated map
-                updated_layer_params->assoc_inplace(param_key, new_node_matrix(updated_param_mat), node_eq);
+                updated_layer_params->assoc_inplace(param_key, nn_result(param, updated_param_t), node_eq);
                 // Store the new moments in the layer's updated moment maps
-                updated_layer_m->assoc_inplace(param_key, new_node_matrix(m_new_mat), node_eq);
-                updated_layer_v->assoc_inplace(param_key, new_node_matrix(v_new_mat), node_eq);
+                updated_layer_m->assoc_inplace(param_key, nn_result(m_param, m_new_t), node_eq);
+                updated_layer_v->assoc_inplace(param_key, nn_result(v_param, v_new_t), node_eq);
             }
         }
         // Update the layer in the main model map
@@ -796,278 +772,221 @@ static node_idx_t native_nn_adam_step(env_ptr_t env, list_ptr_t args) {
     return new_node_hash_map(updated_optimizer);
 }
 
-// Analytical Backpropagation (Standard Dimensions Storage, Standard Mul, Derived Formulas)
-// Arguments: (model X y)
-// model: The model hash-map {:layer1 {...} :layer2 {...} ...}
-// X: Input matrix (batch x in_features) -> matrix(in_features, batch)
-// y: Target matrix (batch x out_features) -> matrix(out_features, batch)
-// Returns: Nested gradient map {:layer1 {:weights dW1 :bias db1} ...}
+// Applies a layer's activation on the tape. Anything unrecognised is linear.
+static ad_var_t nn_ad_activation(ad_tape_t &tape, ad_var_t z, const char *activation) {
+    if (strcmp(activation, "relu") == 0) return ad_relu(tape, z);
+    if (strcmp(activation, "sigmoid") == 0) return ad_sigmoid(tape, z);
+    if (strcmp(activation, "tanh") == 0) return ad_tanh(tape, z);
+    if (strcmp(activation, "softmax") == 0) return ad_softmax(tape, z);
+    if (strcmp(activation, "leaky-relu") == 0) return ad_leaky_relu(tape, z, 0.01);
+    if (strcmp(activation, "elu") == 0) return ad_elu(tape, z, 1.0);
+    if (strcmp(activation, "gelu") == 0) return ad_gelu(tape, z);
+    if (strcmp(activation, "swish") == 0) return ad_swish(tape, z, 1.0);
+    return z;
+}
+
+// Training mode batch norm over everything but the last axis, same as nn/batch-norm-forward
+static ad_var_t nn_ad_batch_norm(ad_tape_t &tape, ad_var_t x, ad_var_t gamma, ad_var_t beta, double epsilon) {
+    if (x < 0) return AD_INVALID;
+    jo_clojure_tensor_ptr_t X = tape.value(x);
+    long long dims[2] = {-1, X->shape[X->ndim-1]};
+    ad_var_t x2 = ad_reshape(tape, x, 2, dims);
+    ad_var_t mean = ad_reduce(tape, x2, TENSOR_MEAN, 0, true);
+    ad_var_t diff = ad_sub(tape, x2, mean);
+    ad_var_t var = ad_reduce(tape, ad_mul(tape, diff, diff), TENSOR_MEAN, 0, true);
+    ad_var_t stddev = ad_sqrt(tape, ad_add(tape, var, tape.constant(tensor_scalar(epsilon))));
+    ad_var_t out = ad_add(tape, ad_mul(tape, ad_div(tape, diff, stddev), gamma), beta);
+    return ad_reshape(tape, out, X->ndim, X->shape);
+}
+
+// Backpropagation
+// Arguments: (model X y) or (model X y loss), a nil loss picks the default
+// model: The model hash-map {:layer1 {...} :layer2 {...} ...}, run in order of N.
+//        linear, batch-norm and dropout layers are supported.
+// X: Input (batch x in_features) -> tensor [batch, in] or matrix(in_features, batch)
+// y: Target (batch x out_features) -> tensor [batch, out] or matrix(out_features, batch)
+// loss: :bce, :cross-entropy or :mse. :bce and :cross-entropy take the last layer's Z as the logits of a
+//       sigmoid / softmax output. By default the loss follows the output activation (sigmoid -> :bce,
+//       softmax -> :cross-entropy, otherwise :mse), which makes the output gradient dZ = (A - y) / batch.
+// Returns: Nested gradient map {:layer1 {:weights dW1 :bias db1} ...}, batch-norm layers get {:gamma :beta}
 static node_idx_t native_nn_backward(env_ptr_t env, list_ptr_t args) {
+    static node_idx_t kw_type = new_node_keyword("type");
+    static node_idx_t kw_weights = new_node_keyword("weights");
+    static node_idx_t kw_bias = new_node_keyword("bias");
+    static node_idx_t kw_activation = new_node_keyword("activation");
+    static node_idx_t kw_gamma = new_node_keyword("gamma");
+    static node_idx_t kw_beta = new_node_keyword("beta");
+    static node_idx_t kw_epsilon = new_node_keyword("epsilon");
+    static node_idx_t kw_drop_prob = new_node_keyword("drop-prob");
+    static node_idx_t kw_scale = new_node_keyword("scale");
+    // the graph is rebuilt every call, but its gradient buffers carry over
+    static thread_local ad_tape_t tape;
+
     list_t::iterator it(args);
     node_idx_t model_idx = *it++;
     node_idx_t X_idx = *it++;
     node_idx_t y_idx = *it++;
+    node_t *loss_node = it ? get_node(*it++) : NULL;
+    const char *loss = loss_node && loss_node->type != NODE_NIL ? loss_node->t_string.c_str() : NULL;
 
+    if (!get_node(model_idx)->is_hash_map()) {
+        warnf("nn/backward: expected a model map\n");
+        return NIL_NODE;
+    }
     hash_map_ptr_t model = get_node(model_idx)->as_hash_map();
-    matrix_ptr_t X = get_node(X_idx)->as_matrix(); // matrix(in, batch)
-    matrix_ptr_t y = get_node(y_idx)->as_matrix(); // matrix(out, batch)
-
-    int batch_size = X->height;
-    double scale_factor = 1.0 / batch_size; // For averaging gradients
-
-    // --- Forward Pass (with caching) ---
-    hash_map_ptr_t cache = new_hash_map();
-    cache->assoc_inplace(new_node_keyword("A0"), X_idx, node_eq); // Input is A0: matrix(in, batch)
-
-    // Detect network layers and structure
-    vector_ptr_t layer_keys = new_vector();
-    int layer_count = 0;
-    
-    // Find all layer keys and sort them
-    for (hash_map_t::iterator model_it = model->begin(); model_it; model_it++) {
-        node_idx_t key = model_it->first;
-        node_t* key_node = get_node(key);
-        
-        // Only process layers that are named in the format "layerX" where X is a number
-        if (key_node->type == NODE_KEYWORD) {
-            const char* key_str = key_node->t_string.c_str();
-            if (strncmp(key_str, "layer", 5) == 0) {
-                layer_keys->push_back_inplace(key);
-                layer_count++;
+    jo_clojure_tensor_ptr_t X = tensor_from_node(X_idx);
+    jo_clojure_tensor_ptr_t y = tensor_from_node(y_idx);
+    if (!X || !y || y->ndim < 1) {
+        warnf("nn/backward: expected dense inputs and targets\n");
+        return NIL_NODE;
+    }
+    double scale_factor = (double)y->shape[y->ndim-1] / y->size(); // 1 / batch, for averaging gradients
+
+    // Collect the :layerN entries, ordered by N. Models from nn/sequential number their layers
+    // 1..N with nothing else in the map, so look those up directly and only scan and sort the
+    // keys when that doesn't account for the whole map.
+    struct layer_t {
+        int num;
+        node_idx_t key;
+        node_idx_t params_idx;
+    };
+    static thread_local jo_vector<node_idx_t> layer_keys;
+    jo_vector<layer_t> layers;
+    for (int num = 1;; num++) {
+        if ((size_t)num > layer_keys.size()) {
+            char layer_name[32];
+            snprintf(layer_name, sizeof(layer_name), "layer%d", num);
+            layer_keys.push_back(new_node_keyword(layer_name, NODE_FLAG_LITERAL));
+        }
+        node_idx_t params_idx = model->get(layer_keys[num-1], node_eq);
+        if (params_idx == INV_NODE || params_idx == NIL_NODE) break;
+        layers.push_back(layer_t{num, layer_keys[num-1], params_idx});
+    }
+    if ((long long)layers.size() != (long long)model->size()) {
+        layers.clear();
+        for (hash_map_t::iterator model_it = model->begin(); model_it; model_it++) {
+            node_t *key_node = get_node(model_it->first);
+            if (key_node->type == NODE_KEYWORD && strncmp(key_node->t_string.c_str(), "layer", 5) == 0) {
+                layers.push_back(layer_t{atoi(key_node->t_string.c_str() + 5), model_it->first, model_it->second});
             }
         }
-    }
-    
-    // Sort layer keys in ascending order
-    // (Simple bubble sort for simplicity)
-    for (int i = 0; i < layer_keys->size(); i++) {
-        for (int j = i + 1; j < layer_keys->size(); j++) {
-            const char* key_i = get_node(layer_keys->nth(i))->t_string.c_str();
-            const char* key_j = get_node(layer_keys->nth(j))->t_string.c_str();
-            
-            // Extract and compare layer numbers
-            int num_i = atoi(key_i + 5); // +5 to skip "layer"
-            int num_j = atoi(key_j + 5);
-            
-            if (num_i > num_j) {
-                // Swap
-                node_idx_t temp = layer_keys->nth(i);
-                vector_ptr_t new_keys = layer_keys->assoc(i, layer_keys->nth(j));
-                new_keys = new_keys->assoc(j, temp);
-                layer_keys = new_keys;
+        for (size_t i = 1; i < layers.size(); i++) {
+            for (size_t j = i; j > 0 && layers[j-1].num > layers[j].num; j--) {
+                jo_swap(layers[j-1], layers[j]);
             }
         }
     }
-    
-    // --- Forward Pass (with caching) ---
-    node_idx_t current_A = X_idx; // Current activation starts with input X
-
-    // Process each layer in order
-    for (int i = 0; i < layer_keys->size(); i++) {
-        node_idx_t layer_key = layer_keys->nth(i);
-        const char* layer_name = get_node(layer_key)->t_string.c_str();
-
-        // Get the layer parameters
-        node_idx_t layer_params_idx = model->get(layer_key, node_eq);
-        hash_map_ptr_t layer_params = get_node(layer_params_idx)->as_hash_map();
-        
-        // Get layer type (default to "linear" if not specified)
-        node_idx_t type_idx = layer_params->get(new_node_keyword("type"), node_eq);
-        const char* layer_type = (type_idx != INV_NODE) ? get_node(type_idx)->t_string.c_str() : "linear";
+    if (layers.size() == 0) {
+        warnf("nn/backward: model has no :layerN entries\n");
+        return NIL_NODE;
+    }
 
-        // Get weights matrix
-        matrix_ptr_t W = get_node(layer_params->get(new_node_keyword("weights"), node_eq))->as_matrix();
-        
-        // Perform linear forward pass
-        node_idx_t Z_idx = native_nn_linear_forward(env, list_va(layer_params_idx, current_A));
-        
-        // Cache the weights and Z values
-        char W_cache_key[64];
-        char Z_cache_key[64];
-        char A_cache_key[64];
-        
-        snprintf(W_cache_key, sizeof(W_cache_key), "%s/W", layer_name);
-        snprintf(Z_cache_key, sizeof(Z_cache_key), "%s/Z", layer_name);
-        snprintf(A_cache_key, sizeof(A_cache_key), "%s/A", layer_name);
-        
-        cache->assoc_inplace(new_node_keyword(W_cache_key), new_node_matrix(W), node_eq);
-        cache->assoc_inplace(new_node_keyword(Z_cache_key), Z_idx, node_eq);
-        
-        // Apply activation function based on layer type or position
-        node_idx_t A_idx;
-        node_idx_t activation_key = layer_params->get(new_node_keyword("activation"), node_eq);
-        const char* activation_type = NULL;
+    // Parameters to report, in the order they were put on the tape
+    struct param_t {
+        size_t layer;
+        node_idx_t name;
+        node_idx_t value_idx;
+        ad_var_t var;
+    };
+    jo_vector<param_t> params;
+
+    // --- Forward Pass (recorded on the tape) ---
+    tape.reset();
+    ad_var_t A = tape.constant(X);
+    const char *output_activation = "linear";
+    for (size_t i = 0; i < layers.size(); i++) {
+        bool is_output = i == layers.size() - 1;
+        hash_map_ptr_t layer = get_node(layers[i].params_idx)->as_hash_map();
+        node_idx_t type_idx = layer->get(kw_type, node_eq);
+        const char *layer_type = (type_idx != NIL_NODE) ? get_node(type_idx)->t_string.c_str() : "linear";
 
-        // Check if the activation is specified in the layer parameters
-        if (activation_key != INV_NODE) {
-            activation_type = get_node(activation_key)->t_string.c_str();
-        } else {
-            // Default activation: relu for hidden layers, sigmoid for output layer
-            activation_type = (i < layer_keys->size() - 1) ? "relu" : "sigmoid";
-        }
-        
-        // Apply the activation function
-        if (strcmp(activation_type, "relu") == 0) {
-            A_idx = native_nn_relu(env, list_va(Z_idx));
-        } else if (strcmp(activation_type, "sigmoid") == 0) {
-            A_idx = native_nn_sigmoid(env, list_va(Z_idx));
-        } else if (strcmp(activation_type, "tanh") == 0) {
-            A_idx = native_nn_tanh(env, list_va(Z_idx));
-        } else if (strcmp(activation_type, "softmax") == 0) {
-            A_idx = native_nn_softmax(env, list_va(Z_idx));
+        if (strcmp(layer_type, "linear") == 0) {
+            node_idx_t W_idx = layer->get(kw_weights, node_eq);
+            node_idx_t b_idx = layer->get(kw_bias, node_eq);
+            ad_var_t W = tape.leaf(tensor_from_node(W_idx));
+            ad_var_t b = tape.leaf(tensor_from_node(b_idx));
+            params.push_back(param_t{i, kw_weights, W_idx, W});
+            params.push_back(param_t{i, kw_bias, b_idx, b});
+            A = ad_add(tape, ad_matmul(tape, A, W), b);
+
+            // No activation means linear
+            node_idx_t activation_idx = layer->get(kw_activation, node_eq);
+            const char *activation = (activation_idx != NIL_NODE) ? get_node(activation_idx)->t_string.c_str() : "linear";
+            if (is_output) {
+                // the logit losses fold the output activation in
+                output_activation = activation;
+                if (!loss) {
+                    loss = strcmp(activation, "sigmoid") == 0 ? "bce" : (strcmp(activation, "softmax") == 0 ? "cross-entropy" : "mse");
+                }
+                if (strcmp(loss, "bce") == 0 || strcmp(loss, "cross-entropy") == 0) continue;
+            }
+            A = nn_ad_activation(tape, A, activation);
+        } else if (strcmp(layer_type, "batch-norm") == 0) {
+            node_idx_t gamma_idx = layer->get(kw_gamma, node_eq);
+            node_idx_t beta_idx = layer->get(kw_beta, node_eq);
+            ad_var_t gamma = tape.leaf(tensor_from_node(gamma_idx));
+            ad_var_t beta = tape.leaf(tensor_from_node(beta_idx));
+            params.push_back(param_t{i, kw_gamma, gamma_idx, gamma});
+            params.push_back(param_t{i, kw_beta, beta_idx, beta});
+            A = nn_ad_batch_norm(tape, A, gamma, beta, get_node_float(layer->get(kw_epsilon, node_eq)));
+        } else if (strcmp(layer_type, "dropout") == 0) {
+            double drop_prob = get_node_float(layer->get(kw_drop_prob, node_eq));
+            double scale = get_node_float(layer->get(kw_scale, node_eq));
+            if (A >= 0 && drop_prob > 0) {
+                jo_clojure_tensor_ptr_t mask = new_tensor_like(tape.value(A), false);
+                auto fill = [&](auto *m) {
+                    for (long long j = 0, n = mask->size(); j < n; j++) {
+                        double rand_val = jo_pcg32(&jo_rnd_state) / (double)UINT32_MAX;
+                        m[j] = rand_val > drop_prob ? scale : 0;
+                    }
+                };
+                if (mask->dtype == TYPE_FLOAT) fill(mask->data<float>());
+                else fill(mask->data<double>());
+                A = ad_mul(tape, A, tape.constant(mask));
+            }
         } else {
-            // Default to linear (no activation)
-            A_idx = Z_idx;
+            warnf("nn/backward: unsupported layer type %s\n", layer_type);
+            return NIL_NODE;
         }
-        
-        // Cache the activation output
-        cache->assoc_inplace(new_node_keyword(A_cache_key), A_idx, node_eq);
-        
-        // Update current activation for next layer
-        current_A = A_idx;
+        if (A < 0) {
+            warnf("nn/backward: %s doesn't match its input\n", get_node(layers[i].key)->t_string.c_str());
+            return NIL_NODE;
+        }
+    }
+
+    if (!loss) {
+        // the output layer isn't linear, so there is no activation to pick a loss from
+        loss = "mse";
     }
 
     // --- Backward Pass ---
-    hash_map_ptr_t gradients = new_hash_map();
+    ad_var_t target = tape.constant(y);
+    ad_var_t L;
+    if (strcmp(loss, "bce") == 0) {
+        L = ad_bce_with_logits(tape, A, target, scale_factor);
+    } else if (strcmp(loss, "cross-entropy") == 0) {
+        L = ad_softmax_cross_entropy(tape, A, target, scale_factor);
+    } else if (strcmp(loss, "mse") == 0) {
+        L = ad_squared_error(tape, A, target, scale_factor);
+    } else {
+        warnf("nn/backward: unknown loss %s\n", loss);
+        return NIL_NODE;
+    }
+    if (L < 0) {
+        warnf("nn/backward: targets don't match the %s output\n", output_activation);
+        return NIL_NODE;
+    }
+    tape.backward(L);
 
-    // Initial gradient calculation depends on the last activation function
-    // For now, we assume binary cross-entropy (A - y) for sigmoid output
-    // In a more complete implementation, this should be determined by the loss function
-    node_idx_t last_layer_key = layer_keys->nth(layer_keys->size() - 1);
-    const char* last_layer_name = get_node(last_layer_key)->t_string.c_str();
-    char last_A_cache_key[64];
-    snprintf(last_A_cache_key, sizeof(last_A_cache_key), "%s/A", last_layer_name);
-    node_idx_t last_A_idx = cache->get(new_node_keyword(last_A_cache_key), node_eq);
-    
-    // Initial gradient dZ for output layer: A - y
-    node_idx_t dZ_curr_idx = native_math_matrix_sub(env, list_va(last_A_idx, y_idx));
-    
-    // Process each layer in reverse order
-    for (int i = layer_keys->size() - 1; i >= 0; i--) {
-        node_idx_t layer_key = layer_keys->nth(i);
-        const char* layer_name = get_node(layer_key)->t_string.c_str();
-        
-        // Get layer parameters and activation type
-        node_idx_t layer_params_idx = model->get(layer_key, node_eq);
-        hash_map_ptr_t layer_params = get_node(layer_params_idx)->as_hash_map();
-        
-        char W_cache_key[64];
-        char Z_cache_key[64];
-        char A_cache_key[64];
-        char prev_A_cache_key[64];
-        
-        snprintf(W_cache_key, sizeof(W_cache_key), "%s/W", layer_name);
-        snprintf(Z_cache_key, sizeof(Z_cache_key), "%s/Z", layer_name);
-        snprintf(A_cache_key, sizeof(A_cache_key), "%s/A", layer_name);
-        
-        // Get the activation for the previous layer (or input X for first layer)
-        if (i > 0) {
-            const char* prev_layer_name = get_node(layer_keys->nth(i-1))->t_string.c_str();
-            snprintf(prev_A_cache_key, sizeof(prev_A_cache_key), "%s/A", prev_layer_name);
-        } else {
-            strcpy(prev_A_cache_key, "A0");
-        }
-        
-        // Get cached values
-        matrix_ptr_t W = get_node(cache->get(new_node_keyword(W_cache_key), node_eq))->as_matrix();
-        node_idx_t Z_idx = cache->get(new_node_keyword(Z_cache_key), node_eq);
-        node_idx_t A_prev_idx = cache->get(new_node_keyword(prev_A_cache_key), node_eq);
-        
-        // 1. Calculate gradients for weights and bias
-        // dW = (1/m) * mul(transpose(A_prev), dZ)
-        // db = (1/m) * sum_rows(dZ)
-        node_idx_t A_prev_T_idx = native_math_matrix_transpose(env, list_va(A_prev_idx));
-        node_idx_t dW_unscaled_idx = native_math_matrix_mul(env, list_va(A_prev_T_idx, dZ_curr_idx));
-        node_idx_t dW_idx = native_math_matrix_scale(env, list_va(dW_unscaled_idx, new_node_float(scale_factor)));
-        node_idx_t db_unscaled_idx = native_math_matrix_sum_rows(env, list_va(dZ_curr_idx));
-        node_idx_t db_idx = native_math_matrix_scale(env, list_va(db_unscaled_idx, new_node_float(scale_factor)));
-        
-        // Store gradients for this layer
+    hash_map_ptr_t gradients = new_hash_map();
+    for (size_t p = 0; p < params.size(); ) {
+        size_t layer = params[p].layer;
         hash_map_ptr_t layer_grads = new_hash_map();
-        layer_grads->assoc_inplace(new_node_keyword("weights"), dW_idx, node_eq);
-        layer_grads->assoc_inplace(new_node_keyword("bias"), db_idx, node_eq);
-        gradients->assoc_inplace(layer_key, new_node_hash_map(layer_grads), node_eq);
-        
-        // Prepare for next layer (if not at the input)
-        if (i > 0) {
-            // Calculate dA_prev
-            node_idx_t W_T_idx = native_math_matrix_transpose(env, list_va(new_node_matrix(W)));
-            node_idx_t dA_prev_idx = native_math_matrix_mul(env, list_va(dZ_curr_idx, W_T_idx));
-            
-            // Apply activation gradient for the previous layer
-            node_idx_t activation_key = layer_params->get(new_node_keyword("activation"), node_eq);
-            const char* activation_type = NULL;
-            
-            // Determine the activation type of the previous layer
-            node_idx_t prev_layer_key = layer_keys->nth(i-1);
-            node_idx_t prev_layer_params_idx = model->get(prev_layer_key, node_eq);
-            hash_map_ptr_t prev_layer_params = get_node(prev_layer_params_idx)->as_hash_map();
-            node_idx_t prev_activation_key = prev_layer_params->get(new_node_keyword("activation"), node_eq);
-            
-            if (prev_activation_key != INV_NODE) {
-                activation_type = get_node(prev_activation_key)->t_string.c_str();
-            } else {
-                // Default activation: relu for hidden layers
-                activation_type = "relu";
-            }
-            
-            // Get the previous layer's Z values
-            char prev_Z_cache_key[64];
-            const char* prev_layer_name = get_node(layer_keys->nth(i-1))->t_string.c_str();
-            snprintf(prev_Z_cache_key, sizeof(prev_Z_cache_key), "%s/Z", prev_layer_name);
-            node_idx_t prev_Z_idx = cache->get(new_node_keyword(prev_Z_cache_key), node_eq);
-            matrix_ptr_t prev_Z = get_node(prev_Z_idx)->as_matrix();
-            
-            // Apply backprop through activation function
-            matrix_ptr_t dA_prev = get_node(dA_prev_idx)->as_matrix();
-            matrix_ptr_t dZ_prev;
-            
-            if (strcmp(activation_type, "relu") == 0) {
-                // ReLU derivative: f'(z) = z > 0 ? 1 : 0
-                dZ_prev = new_matrix(prev_Z->width, prev_Z->height);
-                for (int row = 0; row < prev_Z->width; row++) {
-                    for (int col = 0; col < prev_Z->height; col++) {
-                        double z_val = get_node_float(prev_Z->get(row, col));
-                        double da_val = get_node_float(dA_prev->get(row, col));
-                        dZ_prev->set(row, col, new_node_float(z_val > 0 ? da_val : 0.0));
-                    }
-                }
-            } else if (strcmp(activation_type, "sigmoid") == 0) {
-                // Sigmoid derivative: f'(z) = sigmoid(z) * (1 - sigmoid(z))
-                node_idx_t prev_A_idx = cache->get(new_node_keyword(prev_A_cache_key), node_eq);
-                matrix_ptr_t prev_A = get_node(prev_A_idx)->as_matrix();
-                dZ_prev = new_matrix(prev_Z->width, prev_Z->height);
-                for (int row = 0; row < prev_Z->width; row++) {
-                    for (int col = 0; col < prev_Z->height; col++) {
-                        double a_val = get_node_float(prev_A->get(row, col));
-                        double da_val = get_node_float(dA_prev->get(row, col));
-                        double dsigmoid = a_val * (1.0 - a_val);
-                        dZ_prev->set(row, col, new_node_float(da_val * dsigmoid));
-                    }
-                }
-            } else if (strcmp(activation_type, "tanh") == 0) {
-                // Tanh derivative: f'(z) = 1 - tanh(z)^2
-                node_idx_t prev_A_idx = cache->get(new_node_keyword(prev_A_cache_key), node_eq);
-                matrix_ptr_t prev_A = get_node(prev_A_idx)->as_matrix();
-                dZ_prev = new_matrix(prev_Z->width, prev_Z->height);
-                for (int row = 0; row < prev_Z->width; row++) {
-                    for (int col = 0; col < prev_Z->height; col++) {
-                        double a_val = get_node_float(prev_A->get(row, col));
-                        double da_val = get_node_float(dA_prev->get(row, col));
-                        double dtanh = 1.0 - (a_val * a_val);
-                        dZ_prev->set(row, col, new_node_float(da_val * dtanh));
-                    }
-                }
-            } else {
-                // Default to linear (derivative = 1)
-                dZ_prev = new_matrix(*dA_prev);
-            }
-            
-            // Update current dZ for next iteration
-            dZ_curr_idx = new_node_matrix(dZ_prev);
+        for (; p < params.size() && params[p].layer == layer; p++) {
+            layer_grads->assoc_inplace(params[p].name, nn_result(params[p].value_idx, tape.grad(params[p].var)), node_eq);
         }
+        gradients->assoc_inplace(layers[layer].key, new_node_hash_map(layer_grads), node_eq);
     }
-    
     return new_node_hash_map(gradients);
 }
 
@@ -1083,18 +1002,8 @@ static node_idx_t native_nn_leaky_relu(env_ptr_t env, list_ptr_t args) {
         double val = x->as_float();
         return new_node_float(val > 0 ? val : alpha * val);
     }
-    else if (x->is_matrix()) {
-        matrix_ptr_t matrix = x->as_matrix();
-        matrix_ptr_t result = new_matrix(matrix->width, matrix->height);
-        
-        for (int i = 0; i < matrix->width; i++) {
-            for (int j = 0; j < matrix->height; j++) {
-                double val = get_node_float(matrix->get(i, j));
-                result->set(i, j, new_node_float(val > 0 ? val : alpha * val));
-            }
-        }
-        
-        return new_node_matrix(result);
+    else if (nn_is_dense(x)) {
+        return nn_activation(x_idx, [alpha](auto val) { return val > 0 ? val : (decltype(val))(alpha * val); });
     }
     else if (x->is_vector()) {
         vector_ptr_t vec = x->as_vector();
@@ -1125,20 +1034,12 @@ static node_idx_t native_nn_gelu(env_ptr_t env, list_ptr_t args) {
         double inner = sqrt(2.0/M_PI) * (val + 0.044715 * x3);
         return new_node_float(0.5 * val * (1.0 + tanh(inner)));
     }
-    else if (x->is_matrix()) {
-        matrix_ptr_t matrix = x->as_matrix();
-        matrix_ptr_t result = new_matrix(matrix->width, matrix->height);
-        
-        for (int i = 0; i < matrix->width; i++) {
-            for (int j = 0; j < matrix->height; j++) {
-                double val = get_node_float(matrix->get(i, j));
-                double x3 = val * val * val;
-                double inner = sqrt(2.0/M_PI) * (val + 0.044715 * x3);
-                result->set(i, j, new_node_float(0.5 * val * (1.0 + tanh(inner))));
-            }
-        }
-        
-        return new_node_matrix(result);
+    else if (nn_is_dense(x)) {
+        return nn_activation(x_idx, [](auto val) {
+            double x3 = val * val * val;
+            double inner = sqrt(2.0/M_PI) * (val + 0.044715 * x3);
+            return (decltype(val))(0.5 * val * (1.0 + tanh(inner)));
+        });
     }
     else if (x->is_vector()) {
         vector_ptr_t vec = x->as_vector();
@@ -1170,18 +1071,8 @@ static node_idx_t native_nn_elu(env_ptr_t env, list_ptr_t args) {
         double val = x->as_float();
         return new_node_float(val > 0 ? val : alpha * (exp(val) - 1.0));
     }
-    else if (x->is_matrix()) {
-        matrix_ptr_t matrix = x->as_matrix();
-        matrix_ptr_t result = new_matrix(matrix->width, matrix->height);
-        
-        for (int i = 0; i < matrix->width; i++) {
-            for (int j = 0; j < matrix->height; j++) {
-                double val = get_node_float(matrix->get(i, j));
-                result->set(i, j, new_node_float(val > 0 ? val : alpha * (exp(val) - 1.0)));
-            }
-        }
-        
-        return new_node_matrix(result);
+    else if (nn_is_dense(x)) {
+        return nn_activation(x_idx, [alpha](auto val) { return val > 0 ? val : (decltype(val))(alpha * (exp(val) - 1.0)); });
     }
     else if (x->is_vector()) {
         vector_ptr_t vec = x->as_vector();
@@ -1212,19 +1103,11 @@ static node_idx_t native_nn_swish(env_ptr_t env, list_ptr_t args) {
         double sigmoid = 1.0 / (1.0 + exp(-beta * val));
         return new_node_float(val * sigmoid);
     }
-    else if (x->is_matrix()) {
-        matrix_ptr_t matrix = x->as_matrix();
-        matrix_ptr_t result = new_matrix(matrix->width, matrix->height);
-        
-        for (int i = 0; i < matrix->width; i++) {
-            for (int j = 0; j < matrix->height; j++) {
-                double val = get_node_float(matrix->get(i, j));
-                double sigmoid = 1.0 / (1.0 + exp(-beta * val));
-                result->set(i, j, new_node_float(val * sigmoid));
-            }
-        }
-        
-        return new_node_matrix(result);
+    else if (nn_is_dense(x)) {
+        return nn_activation(x_idx, [beta](auto val) {
+            double sigmoid = 1.0 / (1.0 + exp(-beta * val));
+            return (decltype(val))(val * sigmoid);
+        });
     }
     else if (x->is_vector()) {
         vector_ptr_t vec = x->as_vector();
@@ -1280,27 +1163,26 @@ static node_idx_t native_nn_dropout_forward(env_ptr_t env, list_ptr_t args) {
     
     node_t *input = get_node(input_idx);
     
-    if (input->is_matrix()) {
-        matrix_ptr_t input_mat = input->as_matrix();
-        matrix_ptr_t mask = new_matrix(input_mat->width, input_mat->height);
-        matrix_ptr_t output = new_matrix(input_mat->width, input_mat->height);
+    if (nn_is_dense(input)) {
+        jo_clojure_tensor_ptr_t input_t = tensor_from_node(input_idx);
+        jo_clojure_tensor_ptr_t mask = new_tensor_like(input_t, false);
         
-        // Generate dropout mask and apply scaling
-        for (int i = 0; i < input_mat->width; i++) {
-            for (int j = 0; j < input_mat->height; j++) {
+        // Generate dropout mask
+        auto fill = [&](auto *m) {
+            for (long long i = 0, n = mask->size(); i < n; i++) {
                 double rand_val = jo_pcg32(&jo_rnd_state) / (double)UINT32_MAX;
-                double mask_val = rand_val > drop_prob ? 1.0 : 0.0;
-                mask->set(i, j, new_node_float(mask_val));
-                
-                double input_val = get_node_float(input_mat->get(i, j));
-                output->set(i, j, new_node_float(input_val * mask_val * scale));
+                m[i] = rand_val > drop_prob ? 1 : 0;
             }
-        }
+        };
+        if (mask->dtype == TYPE_FLOAT) fill(mask->data<float>());
+        else fill(mask->data<double>());
         
         // Store the generated mask for backward pass
-        layer->assoc_inplace(new_node_keyword("last-mask"), new_node_matrix(mask), node_eq);
+        layer->assoc_inplace(new_node_keyword("last-mask"), nn_result(input_idx, mask), node_eq);
         
-        return new_node_matrix(output);
+        // Apply mask and scaling
+        jo_clojure_tensor_ptr_t output = tensor_binary(tensor_binary(input_t, mask, TENSOR_MUL), tensor_scalar(scale), TENSOR_MUL);
+        return nn_result(input_idx, output);
     }
     else if (input->is_vector()) {
         vector_ptr_t input_vec = input->as_vector();
@@ -1376,135 +1258,87 @@ static node_idx_t native_nn_batch_norm_forward(env_ptr_t env, list_ptr_t args) {
     hash_map_ptr_t layer = get_node(layer_idx)->as_hash_map();
     double momentum = get_node_float(layer->get(new_node_keyword("momentum"), node_eq));
     double epsilon = get_node_float(layer->get(new_node_keyword("epsilon"), node_eq));
-    matrix_ptr_t gamma = get_node(layer->get(new_node_keyword("gamma"), node_eq))->as_matrix();
-    matrix_ptr_t beta = get_node(layer->get(new_node_keyword("beta"), node_eq))->as_matrix();
-    matrix_ptr_t running_mean = get_node(layer->get(new_node_keyword("running-mean"), node_eq))->as_matrix();
-    matrix_ptr_t running_var = get_node(layer->get(new_node_keyword("running-var"), node_eq))->as_matrix();
-    
-    matrix_ptr_t input = get_node(input_idx)->as_matrix();
-    
-    // Input should be of shape (features, batch_size)
-    int features = input->width;
-    int batch_size = input->height;
+    node_idx_t running_mean_idx = layer->get(new_node_keyword("running-mean"), node_eq);
+    node_idx_t running_var_idx = layer->get(new_node_keyword("running-var"), node_eq);
+    jo_clojure_tensor_ptr_t gamma = tensor_from_node(layer->get(new_node_keyword("gamma"), node_eq));
+    jo_clojure_tensor_ptr_t beta = tensor_from_node(layer->get(new_node_keyword("beta"), node_eq));
+    jo_clojure_tensor_ptr_t running_mean = tensor_from_node(running_mean_idx);
+    jo_clojure_tensor_ptr_t running_var = tensor_from_node(running_var_idx);
+    
+    // Input is [..., features]; statistics are taken over everything but the last axis
+    jo_clojure_tensor_ptr_t input = tensor_from_node(input_idx);
+    if (!input || input->ndim < 1 || !gamma || !beta || !running_mean || !running_var) {
+        warnf("nn/batch-norm-forward: unsupported input type\n");
+        return NIL_NODE;
+    }
+    long long features = input->shape[input->ndim-1];
+    if (gamma->size() != features || beta->size() != features || running_mean->size() != features || running_var->size() != features) {
+        warnf("nn/batch-norm-forward: input features (%d) don't match the layer's features\n", (int)features);
+        return NIL_NODE;
+    }
+    long long dims[2] = {-1, features};
+    jo_clojure_tensor_ptr_t x = tensor_reshape(input, 2, dims);
     
-    matrix_ptr_t output = new_matrix(features, batch_size);
+    // (1 - momentum) * a + momentum * b, in the shape of a
+    auto lerp = [momentum](const jo_clojure_tensor_ptr_t &a, const jo_clojure_tensor_ptr_t &b) {
+        jo_clojure_tensor_ptr_t r = tensor_binary(tensor_binary(a, tensor_scalar(1 - momentum), TENSOR_MUL), tensor_binary(b, tensor_scalar(momentum), TENSOR_MUL), TENSOR_ADD);
+        return tensor_reshape(r, a->ndim, a->shape);
+    };
     
+    jo_clojure_tensor_ptr_t mean, var;
     if (training) {
-        // Calculate batch mean
-        matrix_ptr_t batch_mean = new_matrix(features, 1);
-        for (int i = 0; i < features; i++) {
-            double sum = 0.0;
-            for (int j = 0; j < batch_size; j++) {
-                sum += get_node_float(input->get(i, j));
-            }
-            batch_mean->set(i, 0, new_node_float(sum / batch_size));
-        }
-        
-        // Calculate batch variance
-        matrix_ptr_t batch_var = new_matrix(features, 1);
-        for (int i = 0; i < features; i++) {
-            double mean = get_node_float(batch_mean->get(i, 0));
-            double sum_sq_diff = 0.0;
-            for (int j = 0; j < batch_size; j++) {
-                double x = get_node_float(input->get(i, j));
-                double diff = x - mean;
-                sum_sq_diff += diff * diff;
-            }
-            batch_var->set(i, 0, new_node_float(sum_sq_diff / batch_size));
-        }
+        // Batch statistics
+        mean = tensor_reduce(x, TENSOR_MEAN, 0, true);
+        jo_clojure_tensor_ptr_t diff = tensor_binary(x, mean, TENSOR_SUB);
+        var = tensor_reduce(tensor_binary(diff, diff, TENSOR_MUL), TENSOR_MEAN, 0, true);
         
         // Update running statistics
-        matrix_ptr_t new_running_mean = new_matrix(features, 1);
-        matrix_ptr_t new_running_var = new_matrix(features, 1);
-        for (int i = 0; i < features; i++) {
-            double curr_mean = get_node_float(running_mean->get(i, 0));
-            double curr_var = get_node_float(running_var->get(i, 0));
-            double batch_mean_val = get_node_float(batch_mean->get(i, 0));
-            double batch_var_val = get_node_float(batch_var->get(i, 0));
-            
-            double new_mean = (1 - momentum) * curr_mean + momentum * batch_mean_val;
-            double new_var = (1 - momentum) * curr_var + momentum * batch_var_val;
-            
-            new_running_mean->set(i, 0, new_node_float(new_mean));
-            new_running_var->set(i, 0, new_node_float(new_var));
-        }
-        
-        // Store updated running statistics in layer
-        layer->assoc_inplace(new_node_keyword("running-mean"), new_node_matrix(new_running_mean), node_eq);
-        layer->assoc_inplace(new_node_keyword("running-var"), new_node_matrix(new_running_var), node_eq);
-        
-        // Normalize, scale and shift
-        for (int i = 0; i < features; i++) {
-            double mean = get_node_float(batch_mean->get(i, 0));
-            double var = get_node_float(batch_var->get(i, 0));
-            double scale = get_node_float(gamma->get(i, 0));
-            double shift = get_node_float(beta->get(i, 0));
-            
-            for (int j = 0; j < batch_size; j++) {
-                double x = get_node_float(input->get(i, j));
-                double normalized = (x - mean) / sqrt(var + epsilon);
-                double result = scale * normalized + shift;
-                output->set(i, j, new_node_float(result));
-            }
-        }
+        layer->assoc_inplace(new_node_keyword("running-mean"), nn_result(running_mean_idx, lerp(running_mean, mean)), node_eq);
+        layer->assoc_inplace(new_node_keyword("running-var"), nn_result(running_var_idx, lerp(running_var, var)), node_eq);
         
         // Cache values for backward pass
         layer->assoc_inplace(new_node_keyword("last-input"), input_idx, node_eq);
-        layer->assoc_inplace(new_node_keyword("last-batch-mean"), new_node_matrix(batch_mean), node_eq);
-        layer->assoc_inplace(new_node_keyword("last-batch-var"), new_node_matrix(batch_var), node_eq);
+        layer->assoc_inplace(new_node_keyword("last-batch-mean"), nn_result(input_idx, mean), node_eq);
+        layer->assoc_inplace(new_node_keyword("last-batch-var"), nn_result(input_idx, var), node_eq);
     } else {
         // Inference mode - use running statistics
-        for (int i = 0; i < features; i++) {
-            double mean = get_node_float(running_mean->get(i, 0));
-            double var = get_node_float(running_var->get(i, 0));
-            double scale = get_node_float(gamma->get(i, 0));
-            double shift = get_node_float(beta->get(i, 0));
-            
-            for (int j = 0; j < batch_size; j++) {
-                double x = get_node_float(input->get(i, j));
-                double normalized = (x - mean) / sqrt(var + epsilon);
-                double result = scale * normalized + shift;
-                output->set(i, j, new_node_float(result));
-            }
-        }
+        mean = running_mean;
+        var = running_var;
     }
     
-    return new_node_matrix(output);
+    // Normalize, scale and shift
+    jo_clojure_tensor_ptr_t stddev = tensor_map(tensor_binary(var, tensor_scalar(epsilon), TENSOR_ADD), [](auto v) { return (decltype(v))sqrt(v); });
+    jo_clojure_tensor_ptr_t normalized = tensor_binary(tensor_binary(x, mean, TENSOR_SUB), stddev, TENSOR_DIV);
+    jo_clojure_tensor_ptr_t output = tensor_binary(tensor_binary(normalized, gamma, TENSOR_MUL), beta, TENSOR_ADD);
+    return nn_result(input_idx, tensor_reshape(output, input->ndim, input->shape));
 }
 
 // Conv1d layer implementation
-// Arguments: (in_channels out_channels kernel_size stride padding)
+// Arguments: (in_channels out_channels kernel_size stride padding dtype)
 static node_idx_t native_nn_conv1d(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     int in_channels = get_node_int(*it++);
     int out_channels = get_node_int(*it++);
     int kernel_size = get_node_int(*it++);
-    int stride = it ? get_node_int(*it++) : 1;      // Default stride = 1
-    int padding = it ? get_node_int(*it++) : 0;     // Default padding = 0
-    
-    // Initialize weights with shape (out_channels, in_channels, kernel_size)
-    // Represented as a matrix with shape (out_channels, in_channels * kernel_size)
-    matrix_ptr_t weights = new_matrix(out_channels, in_channels * kernel_size);
+    int stride = nn_arg(it) ? get_node_int(*it++) : 1;      // Default stride = 1
+    int padding = nn_arg(it) ? get_node_int(*it++) : 0;     // Default padding = 0
+    array_type_t dtype = tensor_parse_dtype(nn_dtype_arg(args), TYPE_DOUBLE);
     
-    // Initialize bias with shape (out_channels, 1)
-    matrix_ptr_t bias = new_matrix(out_channels, 1);
+    // Weights are a [out_channels, in_channels, kernel_size] tensor, bias is [out_channels]
+    long long wdims[3] = {out_channels, in_channels, kernel_size};
+    jo_clojure_tensor_ptr_t weights = new_tensor(dtype, 3, wdims, false);
+    long long bdims[1] = {out_channels};
+    jo_clojure_tensor_ptr_t bias = new_tensor(dtype, 1, bdims, true);
     
     // Xavier initialization for weights
     double scale = sqrt(2.0 / (in_channels * kernel_size + out_channels));
-    
-    for (int oc = 0; oc < out_channels; oc++) {
-        // Initialize bias to zero
-        bias->set(oc, 0, ZERO_NODE);
-        
-        // Initialize weights with Xavier initialization
-        for (int ic = 0; ic < in_channels; ic++) {
-            for (int k = 0; k < kernel_size; k++) {
-                int idx = ic * kernel_size + k;
-                double rnd = (jo_pcg32(&jo_rnd_state) / (double)UINT32_MAX * 2.0 - 1.0) * scale;
-                weights->set(oc, idx, new_node_float(rnd));
-            }
+    auto fill = [&](auto *w) {
+        for (long long i = 0, n = weights->size(); i < n; i++) {
+            w[i] = (jo_pcg32(&jo_rnd_state) / (double)UINT32_MAX * 2.0 - 1.0) * scale;
         }
-    }
+    };
+    if (dtype == TYPE_FLOAT) fill(weights->data<float>());
+    else fill(weights->data<double>());
     
     // Return a hashmap containing the layer parameters
     hash_map_ptr_t layer = new_hash_map();
@@ -1514,12 +1348,45 @@ static node_idx_t native_nn_conv1d(env_ptr_t env, list_ptr_t args) {
     layer->assoc_inplace(new_node_keyword("kernel-size"), new_node_int(kernel_size), node_eq);
     layer->assoc_inplace(new_node_keyword("stride"), new_node_int(stride), node_eq);
     layer->assoc_inplace(new_node_keyword("padding"), new_node_int(padding), node_eq);
-    layer->assoc_inplace(new_node_keyword("weights"), new_node_matrix(weights), node_eq);
-    layer->assoc_inplace(new_node_keyword("bias"), new_node_matrix(bias), node_eq);
+    layer->assoc_inplace(new_node_keyword("weights"), new_node_tensor(weights), node_eq);
+    layer->assoc_inplace(new_node_keyword("bias"), new_node_tensor(bias), node_eq);
     
     return new_node_hash_map(layer);
 }
 
+// Sequence layers take a [batch_size, channels, seq_length] tensor. The older hash-map form
+// {:batch-size :channels :seq-length :data matrix(channels*seq_length, batch_size)} is still accepted
+// and is what they return when given one.
+static jo_clojure_tensor_ptr_t nn_seq_input(node_idx_t input_idx) {
+    node_t *input = get_node(input_idx);
+    if (input->is_hash_map()) {
+        hash_map_ptr_t input_map = input->as_hash_map();
+        long long dims[3];
+        dims[0] = get_node_int(input_map->get(new_node_keyword("batch-size"), node_eq));
+        dims[1] = get_node_int(input_map->get(new_node_keyword("channels"), node_eq));
+        dims[2] = get_node_int(input_map->get(new_node_keyword("seq-length"), node_eq));
+        jo_clojure_tensor_ptr_t data = tensor_from_node(input_map->get(new_node_keyword("data"), node_eq));
+        if (!data) return NULL;
+        return tensor_reshape(data, 3, dims);
+    }
+    jo_clojure_tensor_ptr_t t = tensor_from_node(input_idx);
+    if (!t || t->ndim != 3) return NULL;
+    return t;
+}
+
+static node_idx_t nn_seq_output(node_idx_t input_idx, const jo_clojure_tensor_ptr_t &output) {
+    if (!get_node(input_idx)->is_hash_map()) {
+        return new_node_tensor(output);
+    }
+    long long dims[2] = {output->shape[0], output->shape[1] * output->shape[2]};
+    hash_map_ptr_t output_map = new_hash_map();
+    output_map->assoc_inplace(new_node_keyword("batch-size"), new_node_int(output->shape[0]), node_eq);
+    output_map->assoc_inplace(new_node_keyword("channels"), new_node_int(output->shape[1]), node_eq);
+    output_map->assoc_inplace(new_node_keyword("seq-length"), new_node_int(output->shape[2]), node_eq);
+    output_map->assoc_inplace(new_node_keyword("data"), new_node_matrix(tensor_to_matrix(tensor_reshape(output, 2, dims))), node_eq);
+    return new_node_hash_map(output_map);
+}
+
 // Conv1d forward pass
 // Arguments: (layer input)
 // Input shape: (batch_size, in_channels, sequence_length)
@@ -1536,82 +1403,87 @@ static node_idx_t native_nn_conv1d_forward(env_ptr_t env, list_ptr_t args) {
     int kernel_size = get_node_int(layer->get(new_node_keyword("kernel-size"), node_eq));
     int stride = get_node_int(layer->get(new_node_keyword("stride"), node_eq));
     int padding = get_node_int(layer->get(new_node_keyword("padding"), node_eq));
-    matrix_ptr_t weights = get_node(layer->get(new_node_keyword("weights"), node_eq))->as_matrix();
-    matrix_ptr_t bias = get_node(layer->get(new_node_keyword("bias"), node_eq))->as_matrix();
+    node_idx_t weights_idx = layer->get(new_node_keyword("weights"), node_eq);
+    
+    jo_clojure_tensor_ptr_t weights = tensor_from_node(weights_idx);
+    long long wdims[3] = {out_channels, in_channels, kernel_size};
+    if (get_node(weights_idx)->is_matrix()) {
+        // layers saved before tensors: matrix(out_channels, in_channels * kernel_size)
+        weights = tensor_transpose(weights);
+    }
+    if (weights) weights = tensor_reshape(weights, 3, wdims);
+    jo_clojure_tensor_ptr_t bias = tensor_from_node(layer->get(new_node_keyword("bias"), node_eq));
+    long long bdims[1] = {out_channels};
+    if (bias) bias = tensor_reshape(bias, 1, bdims);
+    if (!weights || !bias) {
+        warnf("nn/conv1d-forward: layer weights don't match its channels and kernel size\n");
+        return NIL_NODE;
+    }
     
-    // Input is expected to be a 3D tensor represented as a hashmap
-    hash_map_ptr_t input_tensor = get_node(input_idx)->as_hash_map();
-    int batch_size = get_node_int(input_tensor->get(new_node_keyword("batch-size"), node_eq));
-    int seq_length = get_node_int(input_tensor->get(new_node_keyword("seq-length"), node_eq));
+    jo_clojure_tensor_ptr_t input = nn_seq_input(input_idx);
+    if (!input) {
+        warnf("nn/conv1d-forward: expected a [batch channels length] input\n");
+        return NIL_NODE;
+    }
     
     // Verify input channels match
-    int input_channels = get_node_int(input_tensor->get(new_node_keyword("channels"), node_eq));
+    int batch_size = input->shape[0];
+    int input_channels = input->shape[1];
+    int seq_length = input->shape[2];
     if (input_channels != in_channels) {
         warnf("nn/conv1d-forward: input channels (%d) don't match layer's input channels (%d)\n", 
               input_channels, in_channels);
         return NIL_NODE;
     }
     
-    // Get data matrix (channels*seq_length, batch_size)
-    matrix_ptr_t input_data = get_node(input_tensor->get(new_node_keyword("data"), node_eq))->as_matrix();
-    
     // Calculate output sequence length
     int output_length = (seq_length + 2 * padding - kernel_size) / stride + 1;
+    if (output_length <= 0) {
+        warnf("nn/conv1d-forward: input is shorter than the kernel\n");
+        return NIL_NODE;
+    }
     
-    // Create output data matrix (out_channels*output_length, batch_size)
-    matrix_ptr_t output_data = new_matrix(out_channels * output_length, batch_size);
-    
-    // For each batch and output position
-    for (int b = 0; b < batch_size; b++) {
-        for (int oc = 0; oc < out_channels; oc++) {
-            // Get bias for this output channel
-            double bias_val = get_node_float(bias->get(oc, 0));
-            
-            for (int out_pos = 0; out_pos < output_length; out_pos++) {
-                // Calculate the position in the input sequence
-                int in_start = out_pos * stride - padding;
-                
-                // Initialize with bias
-                double result = bias_val;
-                
-                // Convolve over input channels and kernel positions
-                for (int ic = 0; ic < in_channels; ic++) {
-                    for (int k = 0; k < kernel_size; k++) {
-                        int in_pos = in_start + k;
-                        
-                        // Skip if out of bounds (implicit zero padding)
-                        if (in_pos < 0 || in_pos >= seq_length) continue;
-                        
-                        // Get input value and weight
-                        int in_idx = ic * seq_length + in_pos;
-                        int weight_idx = ic * kernel_size + k;
-                        
-                        double in_val = get_node_float(input_data->get(in_idx, b));
-                        double weight_val = get_node_float(weights->get(oc, weight_idx));
-                        
-                        result += in_val * weight_val;
+    // computed in the input's dtype
+    array_type_t dtype = input->dtype;
+    jo_clojure_tensor_ptr_t x = tensor_contiguous(input);
+    jo_clojure_tensor_ptr_t w_t = tensor_contiguous(tensor_astype(weights, dtype));
+    jo_clojure_tensor_ptr_t b_t = tensor_contiguous(tensor_astype(bias, dtype));
+    long long odims[3] = {batch_size, out_channels, output_length};
+    jo_clojure_tensor_ptr_t output = new_tensor(dtype, 3, odims, false);
+    
+    // Unfold each sample into [in_channels * kernel_size, output_length] columns (implicit zero padding),
+    // so the convolution is a single matrix multiply with the [out_channels, in_channels * kernel_size] weights
+    int patch = in_channels * kernel_size;
+    jo_clojure_tensor_ptr_t cols_t = new_tensor_2d(dtype, patch, output_length, false);
+    bool acc_f64 = x->acc_f64 || w_t->acc_f64;
+    auto run = [&](auto *in, auto *w, auto *b, auto *out_all, auto *cols) {
+        for (int bi = 0; bi < batch_size; bi++) {
+            auto *sample = in + (long long)bi * in_channels * seq_length;
+            for (int ic = 0; ic < in_channels; ic++) {
+                for (int k = 0; k < kernel_size; k++) {
+                    auto *row = cols + (long long)(ic * kernel_size + k) * output_length;
+                    for (int out_pos = 0; out_pos < output_length; out_pos++) {
+                        int in_pos = out_pos * stride - padding + k;
+                        row[out_pos] = (in_pos < 0 || in_pos >= seq_length) ? 0 : sample[(long long)ic * seq_length + in_pos];
                     }
                 }
-                
-                // Store the result
-                int out_idx = oc * output_length + out_pos;
-                output_data->set(out_idx, b, new_node_float(result));
+            }
+            auto *out = out_all + (long long)bi * out_channels * output_length;
+            tensor_gemm(out_channels, patch, output_length, w, patch, cols, output_length, out, output_length, acc_f64);
+            for (int oc = 0; oc < out_channels; oc++) {
+                for (int out_pos = 0; out_pos < output_length; out_pos++) {
+                    out[(long long)oc * output_length + out_pos] += b[oc];
+                }
             }
         }
+    };
+    if (dtype == TYPE_FLOAT) {
+        run(x->data<float>(), w_t->data<float>(), b_t->data<float>(), output->data<float>(), cols_t->data<float>());
+    } else {
+        run(x->data<double>(), w_t->data<double>(), b_t->data<double>(), output->data<double>(), cols_t->data<double>());
     }
     
-    // Create output tensor
-    hash_map_ptr_t output_tensor = new_hash_map();
-    output_tensor->assoc_inplace(new_node_keyword("batch-size"), new_node_int(batch_size), node_eq);
-    output_tensor->assoc_inplace(new_node_keyword("channels"), new_node_int(out_channels), node_eq);
-    output_tensor->assoc_inplace(new_node_keyword("seq-length"), new_node_int(output_length), node_eq);
-    output_tensor->assoc_inplace(new_node_keyword("data"), new_node_matrix(output_data), node_eq);
-    
-    // Cache input for backward pass
-    hash_map_ptr_t updated_layer = new_hash_map(*layer);
-    updated_layer->assoc_inplace(new_node_keyword("last-input"), input_idx, node_eq);
-    
-    return new_node_hash_map(output_tensor);
+    return nn_seq_output(input_idx, output);
 }
 
 // MaxPool1d layer implementation
@@ -1644,74 +1516,50 @@ static node_idx_t native_nn_max_pool1d_forward(env_ptr_t env, list_ptr_t args) {
     int stride = get_node_int(layer->get(new_node_keyword("stride"), node_eq));
     int padding = get_node_int(layer->get(new_node_keyword("padding"), node_eq));
     
-    // Input is expected to be a 3D tensor represented as a hashmap
-    hash_map_ptr_t input_tensor = get_node(input_idx)->as_hash_map();
-    int batch_size = get_node_int(input_tensor->get(new_node_keyword("batch-size"), node_eq));
-    int channels = get_node_int(input_tensor->get(new_node_keyword("channels"), node_eq));
-    int seq_length = get_node_int(input_tensor->get(new_node_keyword("seq-length"), node_eq));
-    
-    // Get data matrix (channels*seq_length, batch_size)
-    matrix_ptr_t input_data = get_node(input_tensor->get(new_node_keyword("data"), node_eq))->as_matrix();
+    jo_clojure_tensor_ptr_t input = nn_seq_input(input_idx);
+    if (!input) {
+        warnf("nn/max-pool1d-forward: expected a [batch channels length] input\n");
+        return NIL_NODE;
+    }
+    int batch_size = input->shape[0];
+    int channels = input->shape[1];
+    int seq_length = input->shape[2];
     
     // Calculate output sequence length
     int output_length = (seq_length + 2 * padding - kernel_size) / stride + 1;
+    if (output_length <= 0) {
+        warnf("nn/max-pool1d-forward: input is shorter than the kernel\n");
+        return NIL_NODE;
+    }
     
-    // Create output data matrix (channels*output_length, batch_size)
-    matrix_ptr_t output_data = new_matrix(channels * output_length, batch_size);
-    
-    // Create indices matrix to store the position of max values (for backward pass)
-    matrix_ptr_t indices = new_matrix(channels * output_length, batch_size);
+    jo_clojure_tensor_ptr_t x = tensor_contiguous(input);
+    long long odims[3] = {batch_size, channels, output_length};
+    jo_clojure_tensor_ptr_t output = new_tensor(x->dtype, 3, odims, false);
     
-    // For each batch and channel
-    for (int b = 0; b < batch_size; b++) {
-        for (int c = 0; c < channels; c++) {
+    auto run = [&](auto *in, auto *out) {
+        // Each (batch, channel) pair is one contiguous row of the input
+        for (long long row = 0; row < (long long)batch_size * channels; row++) {
+            auto *seq = in + row * seq_length;
             for (int out_pos = 0; out_pos < output_length; out_pos++) {
                 // Calculate the position in the input sequence
                 int in_start = out_pos * stride - padding;
                 
-                // Find maximum value in the window
-                double max_val = -INFINITY;
-                int max_idx = -1;
-                
+                // Find maximum value in the window, skipping the padding
+                auto max_val = -(decltype(*seq + 0))INFINITY;
                 for (int k = 0; k < kernel_size; k++) {
                     int in_pos = in_start + k;
-                    
-                    // Skip if out of bounds (implicit zero padding)
                     if (in_pos < 0 || in_pos >= seq_length) continue;
-                    
-                    // Get input value
-                    int in_idx = c * seq_length + in_pos;
-                    double val = get_node_float(input_data->get(in_idx, b));
-                    
-                    // Update max if needed
-                    if (val > max_val) {
-                        max_val = val;
-                        max_idx = in_pos;
-                    }
+                    if (seq[in_pos] > max_val) max_val = seq[in_pos];
                 }
-                
-                // Store the maximum value and its index
-                int out_idx = c * output_length + out_pos;
-                output_data->set(out_idx, b, new_node_float(max_val));
-                indices->set(out_idx, b, new_node_int(max_idx));
+                out[row * output_length + out_pos] = max_val;
             }
         }
-    }
-    
-    // Create output tensor
-    hash_map_ptr_t output_tensor = new_hash_map();
-    output_tensor->assoc_inplace(new_node_keyword("batch-size"), new_node_int(batch_size), node_eq);
-    output_tensor->assoc_inplace(new_node_keyword("channels"), new_node_int(channels), node_eq);
-    output_tensor->assoc_inplace(new_node_keyword("seq-length"), new_node_int(output_length), node_eq);
-    output_tensor->assoc_inplace(new_node_keyword("data"), new_node_matrix(output_data), node_eq);
+    };
+    if (x->dtype == TYPE_FLOAT) run(x->data<float>(), output->data<float>());
+    else run(x->data<double>(), output->data<double>());
     
-    // Cache indices and input for backward pass
-    hash_map_ptr_t updated_layer = new_hash_map(*layer);
-    updated_layer->assoc_inplace(new_node_keyword("last-input"), input_idx, node_eq);
-    updated_layer->assoc_inplace(new_node_keyword("indices"), new_node_matrix(indices), node_eq);
-    
-    return new_node_hash_map(output_tensor);
-} 
+    return nn_seq_output(input_idx, output);
+}
 
 // RMSprop Optimizer
 // Arguments: (model learning_rate alpha epsilon)
@@ -1751,17 +1599,9 @@ static node_idx_t native_nn_rmsprop(env_ptr_t env, list_ptr_t args) {
                  node_idx_t param_key = param_it->first;
                  node_t* param_node = get_node(param_it->second);
                  
-                 if (param_node->is_matrix()) {
-                     matrix_ptr_t param_mat = param_node->as_matrix();
-                     matrix_ptr_t v_mat = new_matrix(param_mat->width, param_mat->height);
-
-                     // Initialize squared gradient accumulator to zero
-                     for (int i = 0; i < param_mat->width; i++) {
-                         for (int j = 0; j < param_mat->height; j++) {
-                             v_mat->set(i, j, ZERO_NODE);
-                         }
-                     }
-                     layer_v->assoc_inplace(param_key, new_node_matrix(v_mat), node_eq);
+                 if (nn_is_dense(param_node)) {
+                     // Zeroed state shaped like the parameter
+                     layer_v->assoc_inplace(param_key, nn_zeros_like(param_it->second), node_eq);
                  }
              }
              v->assoc_inplace(layer_key, new_node_hash_map(layer_v), node_eq);
@@ -1833,34 +1673,38 @@ static node_idx_t native_nn_rmsprop_step(env_ptr_t env, list_ptr_t args) {
             node_t *grad_node = get_node(grad);
             node_t *v_node = get_node(v_param);
             
-            if (param_node->is_matrix() && grad_node->is_matrix() && v_node->is_matrix()) {
-                matrix_ptr_t param_mat = param_node->as_matrix();
-                matrix_ptr_t grad_mat = grad_node->as_matrix();
-                matrix_ptr_t v_mat = v_node->as_matrix();
+            if (nn_is_dense(param_node) && nn_is_dense(grad_node) && nn_is_dense(v_node)) {
+                array_type_t dtype = tensor_from_node(param)->dtype;
+                jo_clojure_tensor_ptr_t param_t = nn_dense_as(param, dtype);
+                jo_clojure_tensor_ptr_t grad_t = nn_dense_as(grad, dtype);
+                jo_clojure_tensor_ptr_t v_t = nn_dense_as(v_param, dtype);
+                if (!param_t->same_shape(*grad_t) || !param_t->same_shape(*v_t)) continue;
                 
-                matrix_ptr_t v_new_mat = new_matrix(v_mat->width, v_mat->height);
-                matrix_ptr_t updated_param_mat = new_matrix(param_mat->width, param_mat->height);
-                
-                for (int i = 0; i < param_mat->width; i++) {
-                    for (int j = 0; j < param_mat->height; j++) {
-                        double p = get_node_float(param_mat->get(i, j));
-                        double g = get_node_float(grad_mat->get(i, j));
-                        double v_val = get_node_float(v_mat->get(i, j));
-                        
+                jo_clojure_tensor_ptr_t v_new_t = new_tensor_like(param_t, false);
+                jo_clojure_tensor_ptr_t updated_param_t = new_tensor_like(param_t, false);
+                // stored in the parameter's dtype, computed in double
+                auto run = [&](auto *p_out) {
+                    typedef typename std::remove_pointer<decltype(p_out)>::type T;
+                    const T *p = param_t->data<T>();
+                    const T *g = grad_t->data<T>();
+                    const T *v_val = v_t->data<T>();
+                    T *v_out = v_new_t->data<T>();
+                    for (long long i = 0, n = param_t->size(); i < n; i++) {
                         // Update squared gradient accumulator
-                        double v_new_val = alpha * v_val + (1 - alpha) * g * g;
-                        v_new_mat->set(i, j, new_node_float(v_new_val));
-                        
+                        double v_i = alpha * v_val[i] + (1 - alpha) * (double)g[i] * g[i];
+                        v_out[i] = (T)v_i;
+                    
                         // Update parameter
-                        double param_new = p - lr * g / (sqrt(v_new_val) + epsilon);
-                        updated_param_mat->set(i, j, new_node_float(param_new));
+                        p_out[i] = (T)(p[i] - lr * g[i] / (sqrt(v_i) + epsilon));
                     }
-                }
+                };
+                if (dtype == TYPE_FLOAT) run(updated_param_t->data<float>());
+                else run(updated_param_t->data<double>());
                 
                 // Update the parameter within the layer's updated map
-                updated_layer_params->assoc_inplace(param_key, new_node_matrix(updated_param_mat), node_eq);
+                updated_layer_params->assoc_inplace(param_key, nn_result(param, updated_param_t), node_eq);
                 // Store the new accumulator in the layer's updated map
-                updated_layer_v->assoc_inplace(param_key, new_node_matrix(v_new_mat), node_eq);
+                updated_layer_v->assoc_inplace(param_key, nn_result(v_param, v_new_t), node_eq);
             }
         }
         // Update the layer in the main model map
@@ -1922,20 +1766,10 @@ static node_idx_t native_nn_adamw(env_ptr_t env, list_ptr_t args) {
                  node_idx_t param_key = param_it->first;
                  node_t* param_node = get_node(param_it->second);
                  
-                 if (param_node->is_matrix()) {
-                     matrix_ptr_t param_mat = param_node->as_matrix();
-                     matrix_ptr_t m_mat = new_matrix(param_mat->width, param_mat->height);
-                     matrix_ptr_t v_mat = new_matrix(param_mat->width, param_mat->height);
-
-                     // Initialize moment matrices to zero
-                     for (int i = 0; i < param_mat->width; i++) {
-                         for (int j = 0; j < param_mat->height; j++) {
-                             m_mat->set(i, j, ZERO_NODE);
-                             v_mat->set(i, j, ZERO_NODE);
-                         }
-                     }
-                     layer_m->assoc_inplace(param_key, new_node_matrix(m_mat), node_eq);
-                     layer_v->assoc_inplace(param_key, new_node_matrix(v_mat), node_eq);
+                 if (nn_is_dense(param_node)) {
+                     // Zeroed state shaped like the parameter
+                     layer_m->assoc_inplace(param_key, nn_zeros_like(param_it->second), node_eq);
+                     layer_v->assoc_inplace(param_key, nn_zeros_like(param_it->second), node_eq);
                  }
              }
              m->assoc_inplace(layer_key, new_node_hash_map(layer_m), node_eq);
@@ -2019,51 +1853,53 @@ static node_idx_t native_nn_adamw_step(env_ptr_t env, list_ptr_t args) {
             node_t *m_node = get_node(m_param);
             node_t *v_node = get_node(v_param);
             
-            if (param_node->is_matrix() && grad_node->is_matrix() && 
-                m_node->is_matrix() && v_node->is_matrix()) {
-                
-                matrix_ptr_t param_mat = param_node->as_matrix();
-                matrix_ptr_t grad_mat = grad_node->as_matrix();
-                matrix_ptr_t m_mat = m_node->as_matrix();
-                matrix_ptr_t v_mat = v_node->as_matrix();
+            if (nn_is_dense(param_node) && nn_is_dense(grad_node) && 
+                nn_is_dense(m_node) && nn_is_dense(v_node)) {
                 
-                matrix_ptr_t m_new_mat = new_matrix(m_mat->width, m_mat->height);
-                matrix_ptr_t v_new_mat = new_matrix(v_mat->width, v_mat->height);
-                matrix_ptr_t updated_param_mat = new_matrix(param_mat->width, param_mat->height);
+                array_type_t dtype = tensor_from_node(param)->dtype;
+                jo_clojure_tensor_ptr_t param_t = nn_dense_as(param, dtype);
+                jo_clojure_tensor_ptr_t grad_t = nn_dense_as(grad, dtype);
+                jo_clojure_tensor_ptr_t m_t = nn_dense_as(m_param, dtype);
+                jo_clojure_tensor_ptr_t v_t = nn_dense_as(v_param, dtype);
+                if (!param_t->same_shape(*grad_t) || !param_t->same_shape(*m_t) || !param_t->same_shape(*v_t)) continue;
                 
-                for (int i = 0; i < param_mat->width; i++) {
-                    for (int j = 0; j < param_mat->height; j++) {
-                        double p = get_node_float(param_mat->get(i, j));
-                        double g = get_node_float(grad_mat->get(i, j));
-                        double m_val = get_node_float(m_mat->get(i, j));
-                        double v_val = get_node_float(v_mat->get(i, j));
-                        
-                        // Update biased first moment estimate
-                        double m_new_val = beta1 * m_val + (1 - beta1) * g;
-                        m_new_mat->set(i, j, new_node_float(m_new_val));
-                        
-                        // Update biased second raw moment estimate
-                        double v_new_val = beta2 * v_val + (1 - beta2) * g * g;
-                        v_new_mat->set(i, j, new_node_float(v_new_val));
-                        
+                jo_clojure_tensor_ptr_t m_new_t = new_tensor_like(param_t, false);
+                jo_clojure_tensor_ptr_t v_new_t = new_tensor_like(param_t, false);
+                jo_clojure_tensor_ptr_t updated_param_t = new_tensor_like(param_t, false);
+                double bias_correction1 = 1 - pow(beta1, t);
+                double bias_correction2 = 1 - pow(beta2, t);
+                // stored in the parameter's dtype, computed in double
+                auto run = [&](auto *p_out) {
+                    typedef typename std::remove_pointer<decltype(p_out)>::type T;
+                    const T *p = param_t->data<T>();
+                    const T *g = grad_t->data<T>();
+                    const T *m_val = m_t->data<T>();
+                    const T *v_val = v_t->data<T>();
+                    T *m_out = m_new_t->data<T>();
+                    T *v_out = v_new_t->data<T>();
+                    for (long long i = 0, n = param_t->size(); i < n; i++) {
+                        // Update biased first and second moment estimates
+                        double m_i = beta1 * m_val[i] + (1 - beta1) * (double)g[i];
+                        double v_i = beta2 * v_val[i] + (1 - beta2) * (double)g[i] * g[i];
+                        m_out[i] = (T)m_i;
+                        v_out[i] = (T)v_i;
+                    
                         // Bias correction
-                        double m_hat = m_new_val / (1 - pow(beta1, t));
-                        double v_hat = v_new_val / (1 - pow(beta2, t));
-                        
-                        // Decoupled weight decay
-                        double weight_decay_term = weight_decay * p;
-                        
-                        // Update parameter with weight decay
-                        double param_new = p - lr * (m_hat / (sqrt(v_hat) + epsilon) + weight_decay_term);
-                        updated_param_mat->set(i, j, new_node_float(param_new));
+                        double m_hat = m_i / bias_correction1;
+                        double v_hat = v_i / bias_correction2;
+                    
+                        // Update parameter with decoupled weight decay
+                        p_out[i] = (T)(p[i] - lr * (m_hat / (sqrt(v_hat) + epsilon) + weight_decay * p[i]));
                     }
-                }
+                };
+                if (dtype == TYPE_FLOAT) run(updated_param_t->data<float>());
+                else run(updated_param_t->data<double>());
                 
                 // Update the parameter within the layer's updated map
-                updated_layer_params->assoc_inplace(param_key, new_node_matrix(updated_param_mat), node_eq);
+                updated_layer_params->assoc_inplace(param_key, nn_result(param, updated_param_t), node_eq);
                 // Store the new moments in the layer's updated moment maps
-                updated_layer_m->assoc_inplace(param_key, new_node_matrix(m_new_mat), node_eq);
-                updated_layer_v->assoc_inplace(param_key, new_node_matrix(v_new_mat), node_eq);
+                updated_layer_m->assoc_inplace(param_key, nn_result(m_param, m_new_t), node_eq);
+                updated_layer_v->assoc_inplace(param_key, nn_result(v_param, v_new_t), node_eq);
             }
         }
         // Update the layer in the main model map
@@ -2146,17 +1982,328 @@ static node_idx_t native_nn_scheduler_step(env_ptr_t env, list_ptr_t args) {
     return new_node_hash_map(updated_scheduler);
 }
 
-// Save model to file
-// Arguments: (model file_path)
+static node_idx_t nn_astype(node_idx_t idx, array_type_t dtype) {
+    node_t *n = get_node(idx);
+    if (nn_is_dense(n)) {
+        return new_node_tensor(tensor_astype(tensor_from_node(idx), dtype));
+    }
+    if (n->is_hash_map()) {
+        // a fresh map: a copy shares its table with src, so assoc_inplace on it would change src too
+        hash_map_ptr_t src = n->as_hash_map();
+        hash_map_ptr_t dst = new_hash_map();
+        for (hash_map_t::iterator it = src->begin(); it; it++) {
+            dst->assoc_inplace(it->first, nn_astype(it->second, dtype), node_eq);
+        }
+        return new_node_hash_map(dst);
+    }
+    return idx;
+}
+
+// Converts every matrix and tensor in a model, layer or optimizer to a tensor of dtype
+// Arguments: (model dtype)
+static node_idx_t native_nn_astype(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    node_idx_t model_idx = *it++;
+    array_type_t dtype = tensor_parse_dtype(it ? *it++ : NIL_NODE, TYPE_FLOAT);
+    return nn_astype(model_idx, dtype);
+}
+
+// Binary model format, version 1. Everything is little endian.
+//   header  "JCLJNN\0\0", u32 version, u32 byte order mark 0x01020304, u32 num_layers, u32 reserved
+//   layer   str name, u32 num_params, then the params
+//   param   str name, u8 kind, then
+//             INT      i64
+//             FLOAT    f64
+//             KEYWORD  str
+//             TENSOR   u8 dtype, u8 ndim, i64 dims[ndim], u64 data offset
+//             MATRIX   u32 width, u32 height, u64 data offset (float64, width major like the text format)
+//   str     u32 length, bytes
+// Data offsets are from the start of the file and 64-byte aligned, so a mapped file can be used in
+// place as tensor storage.
+enum {
+    NN_MODEL_VERSION = 1,
+    NN_MODEL_BOM = 0x01020304,
+    NN_PARAM_INT = 1,
+    NN_PARAM_FLOAT,
+    NN_PARAM_KEYWORD,
+    NN_PARAM_TENSOR,
+    NN_PARAM_MATRIX,
+};
+static const char nn_model_magic[8] = {'J','C','L','J','N','N',0,0};
+
+struct nn_model_writer_t {
+    jo_vector<unsigned char> meta;
+    struct blob_t {
+        size_t patch; // where in meta the data offset goes
+        node_idx_t value;
+    };
+    jo_vector<blob_t> blobs;
+
+    void put(const void *p, size_t n) { meta.insert(meta.end(), (const unsigned char*)p, n); }
+    template<typename T> void put(T v) { put(&v, sizeof(v)); }
+    void put_str(const jo_string &str) {
+        put((uint32_t)str.length());
+        put(str.c_str(), str.length());
+    }
+    void put_blob(node_idx_t value) {
+        blobs.push_back(blob_t{meta.size(), value});
+        put((uint64_t)0);
+    }
+};
+
+static size_t nn_align64(size_t n) { return (n + 63) & ~(size_t)63; }
+
+static size_t nn_blob_bytes(node_t *n) {
+    if (n->is_tensor()) {
+        jo_clojure_tensor_ptr_t tensor = n->t_object.cast<jo_clojure_tensor_t>();
+        return tensor->size() * tensor->element_size();
+    }
+    return (size_t)n->as_matrix()->width * n->as_matrix()->height * sizeof(double);
+}
+
+// Models are written to a temp file and renamed over file_path, so saving over a model that
+// nn/load-model mapped never truncates the file its tensors are still reading from.
+static jo_string nn_save_tmp_path(const char *file_path) {
+    return jo_string(file_path) + jo_string(va(".%d.tmp", (int)jo_getpid()));
+}
+
+static node_idx_t nn_save_finish(FILE *file, bool ok, const jo_string &tmp_path, const char *file_path) {
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmp_path.c_str(), file_path) != 0) {
+        remove(tmp_path.c_str());
+        warnf("nn/save-model: failed writing %s\n", file_path);
+        return FALSE_NODE;
+    }
+    return TRUE_NODE;
+}
+
+static node_idx_t nn_save_model_binary(hash_map_ptr_t model, const char *file_path) {
+    nn_model_writer_t w;
+    w.put(nn_model_magic, sizeof(nn_model_magic));
+    w.put((uint32_t)NN_MODEL_VERSION);
+    w.put((uint32_t)NN_MODEL_BOM);
+    size_t num_layers_at = w.meta.size();
+    w.put((uint32_t)0);
+    w.put((uint32_t)0);
+
+    uint32_t num_layers = 0;
+    for (hash_map_t::iterator layer_it = model->begin(); layer_it; layer_it++) {
+        node_t *layer_node = get_node(layer_it->second);
+        if (!layer_node->is_hash_map()) continue;
+        hash_map_ptr_t layer = layer_node->as_hash_map();
+        num_layers++;
+
+        w.put_str(get_node(layer_it->first)->t_string);
+        size_t num_params_at = w.meta.size();
+        w.put((uint32_t)0);
+
+        uint32_t num_params = 0;
+        for (hash_map_t::iterator param_it = layer->begin(); param_it; param_it++) {
+            node_t *param_node = get_node(param_it->second);
+            const jo_string &param_name = get_node(param_it->first)->t_string;
+            if (param_node->is_int()) {
+                w.put_str(param_name);
+                w.put((uint8_t)NN_PARAM_INT);
+                w.put((int64_t)param_node->t_int);
+            } else if (param_node->is_float()) {
+                w.put_str(param_name);
+                w.put((uint8_t)NN_PARAM_FLOAT);
+                w.put((double)param_node->t_float);
+            } else if (param_node->is_keyword()) {
+                w.put_str(param_name);
+                w.put((uint8_t)NN_PARAM_KEYWORD);
+                w.put_str(param_node->t_string);
+            } else if (param_node->is_tensor()) {
+                jo_clojure_tensor_ptr_t tensor = param_node->t_object.cast<jo_clojure_tensor_t>();
+                w.put_str(param_name);
+                w.put((uint8_t)NN_PARAM_TENSOR);
+                w.put((uint8_t)(tensor->dtype == TYPE_FLOAT ? 0 : 1));
+                w.put((uint8_t)tensor->ndim);
+                for (int d = 0; d < tensor->ndim; d++) w.put((int64_t)tensor->shape[d]);
+                w.put_blob(param_it->second);
+            } else if (param_node->is_matrix()) {
+                matrix_ptr_t matrix = param_node->as_matrix();
+                w.put_str(param_name);
+                w.put((uint8_t)NN_PARAM_MATRIX);
+                w.put((uint32_t)matrix->width);
+                w.put((uint32_t)matrix->height);
+                w.put_blob(param_it->second);
+            } else {
+                continue;
+            }
+            num_params++;
+        }
+        memcpy(w.meta.data() + num_params_at, &num_params, sizeof(num_params));
+    }
+    memcpy(w.meta.data() + num_layers_at, &num_layers, sizeof(num_layers));
+
+    // lay out the blobs after the metadata, then patch their offsets in
+    size_t pos = nn_align64(w.meta.size());
+    for (size_t i = 0; i < w.blobs.size(); i++) {
+        uint64_t offset = pos;
+        memcpy(w.meta.data() + w.blobs[i].patch, &offset, sizeof(offset));
+        pos = nn_align64(pos + nn_blob_bytes(get_node(w.blobs[i].value)));
+    }
+
+    jo_string tmp_path = nn_save_tmp_path(file_path);
+    FILE *file = fopen(tmp_path.c_str(), "wb");
+    if (!file) {
+        warnf("nn/save-model: failed to open file for writing: %s\n", file_path);
+        return FALSE_NODE;
+    }
+    static const char zeros[64] = {};
+    bool ok = fwrite(w.meta.data(), 1, w.meta.size(), file) == w.meta.size();
+    pos = w.meta.size();
+    for (size_t i = 0; ok && i < w.blobs.size(); i++) {
+        size_t pad = nn_align64(pos) - pos;
+        ok = fwrite(zeros, 1, pad, file) == pad;
+        pos += pad;
+        node_t *n = get_node(w.blobs[i].value);
+        if (n->is_tensor()) {
+            jo_clojure_tensor_ptr_t tensor = tensor_contiguous(n->t_object.cast<jo_clojure_tensor_t>());
+            const void *data = tensor->dtype == TYPE_FLOAT ? (const void*)tensor->data<float>() : (const void*)tensor->data<double>();
+            ok = ok && fwrite(data, 1, nn_blob_bytes(n), file) == nn_blob_bytes(n);
+        } else {
+            matrix_ptr_t matrix = n->as_matrix();
+            for (int x = 0; ok && x < matrix->width; x++) {
+                for (int y = 0; ok && y < matrix->height; y++) {
+                    double value = get_node_float(matrix->get(x, y));
+                    ok = fwrite(&value, sizeof(value), 1, file) == 1;
+                }
+            }
+        }
+        pos += nn_blob_bytes(n);
+    }
+    return nn_save_finish(file, ok, tmp_path, file_path);
+}
+
+struct nn_model_reader_t {
+    const unsigned char *data;
+    size_t size, pos;
+    bool ok;
+
+    bool get(void *p, size_t n) {
+        if (!ok || n > size - pos) return ok = false;
+        memcpy(p, data + pos, n);
+        pos += n;
+        return true;
+    }
+    template<typename T> T get() {
+        T v = T();
+        get(&v, sizeof(v));
+        return v;
+    }
+    jo_string get_str() {
+        uint32_t n = get<uint32_t>();
+        if (!ok || n > size - pos) {
+            ok = false;
+            return jo_string();
+        }
+        jo_string str((const char*)data + pos, n);
+        pos += n;
+        return str;
+    }
+};
+
+// Parses a mapped binary model. Tensors are views straight into the mapping (copy-on-write, so the
+// file is never modified); matrices are boxed and so are copied out.
+static node_idx_t nn_load_model_binary(void *mapping, size_t size, const char *file_path) {
+    jo_tensor_storage_ptr_t storage = new_tensor_storage_mapped(mapping, size);
+    nn_model_reader_t r = {(const unsigned char*)mapping, size, sizeof(nn_model_magic), true};
+    uint32_t version = r.get<uint32_t>();
+    uint32_t bom = r.get<uint32_t>();
+    if (version != NN_MODEL_VERSION || bom != NN_MODEL_BOM) {
+        warnf("nn/load-model: unsupported model version or byte order in %s\n", file_path);
+        return NIL_NODE;
+    }
+    uint32_t num_layers = r.get<uint32_t>();
+    r.get<uint32_t>();
+
+    hash_map_ptr_t model = new_hash_map();
+    for (uint32_t l = 0; r.ok && l < num_layers; l++) {
+        jo_string layer_name = r.get_str();
+        uint32_t num_params = r.get<uint32_t>();
+        hash_map_ptr_t layer = new_hash_map();
+        for (uint32_t p = 0; r.ok && p < num_params; p++) {
+            jo_string param_name = r.get_str();
+            uint8_t kind = r.get<uint8_t>();
+            node_idx_t value = NIL_NODE;
+            if (kind == NN_PARAM_INT) {
+                value = new_node_int(r.get<int64_t>());
+            } else if (kind == NN_PARAM_FLOAT) {
+                value = new_node_float(r.get<double>());
+            } else if (kind == NN_PARAM_KEYWORD) {
+                value = new_node_keyword(r.get_str());
+            } else if (kind == NN_PARAM_TENSOR) {
+                array_type_t dtype = r.get<uint8_t>() == 0 ? TYPE_FLOAT : TYPE_DOUBLE;
+                int ndim = r.get<uint8_t>();
+                if (ndim > TENSOR_MAX_DIMS) {
+                    r.ok = false;
+                    break;
+                }
+                long long dims[TENSOR_MAX_DIMS];
+                unsigned long long n = 1;
+                for (int d = 0; d < ndim; d++) {
+                    dims[d] = r.get<int64_t>();
+                    // no tensor has more elements than the file has bytes, which also keeps n from overflowing
+                    if (dims[d] < 0 || (dims[d] > 0 && n > size / dims[d])) r.ok = false;
+                    else n *= dims[d];
+                }
+                uint64_t offset = r.get<uint64_t>();
+                long long elem = dtype == TYPE_FLOAT ? sizeof(float) : sizeof(double);
+                if (!r.ok || offset % 64 || offset > size || n > (size - offset) / elem) {
+                    r.ok = false;
+                    break;
+                }
+                value = new_node_tensor(new_tensor(dtype, ndim, dims, storage, (long long)(offset / elem)));
+            } else if (kind == NN_PARAM_MATRIX) {
+                uint32_t width = r.get<uint32_t>();
+                uint32_t height = r.get<uint32_t>();
+                uint64_t offset = r.get<uint64_t>();
+                if (!r.ok || offset > size || (uint64_t)width * height > (size - offset) / sizeof(double)) {
+                    r.ok = false;
+                    break;
+                }
+                const double *src = (const double*)((const char*)mapping + offset);
+                matrix_ptr_t matrix = new_matrix(width, height);
+                for (uint32_t x = 0; x < width; x++) {
+                    for (uint32_t y = 0; y < height; y++) {
+                        matrix->set(x, y, new_node_float(*src++));
+                    }
+                }
+                value = new_node_matrix(matrix);
+            } else {
+                r.ok = false;
+                break;
+            }
+            layer->assoc_inplace(new_node_keyword(param_name), value, node_eq);
+        }
+        model->assoc_inplace(new_node_keyword(layer_name), new_node_hash_map(layer), node_eq);
+    }
+    if (!r.ok) {
+        warnf("nn/load-model: corrupt model file %s\n", file_path);
+        return NIL_NODE;
+    }
+    return new_node_hash_map(model);
+}
+
+// Save model to file. The default binary format keeps full precision and loads without parsing;
+// :text writes the older human readable format.
+// Arguments: (model file_path [format])
 static node_idx_t native_nn_save_model(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it(args);
     node_idx_t model_idx = *it++;
     const char* file_path = get_node(*it++)->t_string.c_str();
+    bool text = it && get_node(*it)->is_keyword() && get_node(*it)->t_string == "text";
     
     hash_map_ptr_t model = get_node(model_idx)->as_hash_map();
+    if (!text) {
+        return nn_save_model_binary(model, file_path);
+    }
     
     // Open file for writing
-    FILE* file = fopen(file_path, "w");
+    jo_string tmp_path = nn_save_tmp_path(file_path);
+    FILE* file = fopen(tmp_path.c_str(), "w");
     if (!file) {
         warnf("nn/save-model: failed to open file for writing: %s\n", file_path);
         return FALSE_NODE;
@@ -2204,20 +2351,43 @@ static node_idx_t native_nn_save_model(env_ptr_t env, list_ptr_t args) {
                     fprintf(file, "\n");
                 }
             }
+            else if (param_node->is_tensor()) {
+                jo_clojure_tensor_ptr_t tensor = tensor_contiguous(param_node->t_object.cast<jo_clojure_tensor_t>());
+                fprintf(file, "TENSOR %s %s %d", param_name, tensor_dtype_name(tensor->dtype), tensor->ndim);
+                for (int d = 0; d < tensor->ndim; d++) {
+                    fprintf(file, " %lld", tensor->shape[d]);
+                }
+                fprintf(file, "\n");
+                
+                // Write tensor data, one row (last axis) per line, at full precision
+                long long row = tensor->ndim ? tensor->shape[tensor->ndim-1] : 1;
+                for (long long i = 0, n = tensor->size(); i < n; i++) {
+                    fprintf(file, tensor->dtype == TYPE_FLOAT ? "%.9g " : "%.17g ", tensor->get_flat(i));
+                    if (row && (i + 1) % row == 0) fprintf(file, "\n");
+                }
+            }
         }
         
         fprintf(file, "END_LAYER\n");
     }
     
-    fclose(file);
-    return TRUE_NODE;
+    return nn_save_finish(file, !ferror(file), tmp_path, file_path);
 }
 
-// Load model from file
+// Load model from file, in either format
 // Arguments: (file_path)
 static node_idx_t native_nn_load_model(env_ptr_t env, list_ptr_t args) {
     const char* file_path = get_node(args->first_value())->t_string.c_str();
     
+    size_t mapped_size = 0;
+    void *mapping = jo_mmap_file(file_path, &mapped_size);
+    if (mapping) {
+        if (mapped_size >= 24 && memcmp(mapping, nn_model_magic, sizeof(nn_model_magic)) == 0) {
+            return nn_load_model_binary(mapping, mapped_size, file_path);
+        }
+        jo_munmap_file(mapping, mapped_size);
+    }
+    
     // Open file for reading
     FILE* file = fopen(file_path, "r");
     if (!file) {
@@ -2307,6 +2477,46 @@ static node_idx_t native_nn_load_model(env_ptr_t env, list_ptr_t args) {
             
             current_layer->assoc_inplace(new_node_keyword(matrix_name), new_node_matrix(matrix), node_eq);
         }
+        else if (strcmp(cmd, "TENSOR") == 0 && current_layer) {
+            char tensor_name[256];
+            char dtype_name[64];
+            int ndim, offset;
+            
+            if (sscanf(line, "TENSOR %255s %63s %d%n", tensor_name, dtype_name, &ndim, &offset) != 3 || ndim < 0 || ndim > TENSOR_MAX_DIMS) continue;
+            
+            long long dims[TENSOR_MAX_DIMS];
+            const char *dims_str = line + offset;
+            for (int d = 0; d < ndim; d++) {
+                char *end;
+                dims[d] = strtoll(dims_str, &end, 10);
+                dims_str = end;
+            }
+            
+            array_type_t dtype = strcmp(dtype_name, "float32") == 0 ? TYPE_FLOAT : TYPE_DOUBLE;
+            if (!tensor_shape_ok("nn/load-model", dtype, ndim, dims)) {
+                fclose(file);
+                return NIL_NODE;
+            }
+            jo_clojure_tensor_ptr_t tensor = new_tensor(dtype, ndim, dims, true);
+            if (!tensor->storage->data) {
+                fclose(file);
+                return NIL_NODE;
+            }
+            
+            // Rows can be arbitrarily long, so read the values directly rather than by line
+            for (long long i = 0, n = tensor->size(); i < n; i++) {
+                double value;
+                if (fscanf(file, "%lf", &value) != 1) {
+                    warnf("nn/load-model: unexpected end of tensor data\n");
+                    fclose(file);
+                    return NIL_NODE;
+                }
+                if (dtype == TYPE_FLOAT) tensor->data<float>()[i] = (float)value;
+                else tensor->data<double>()[i] = value;
+            }
+            
+            current_layer->assoc_inplace(new_node_keyword(tensor_name), new_node_tensor(tensor), node_eq);
+        }
     }
     
     fclose(file);
@@ -2323,48 +2533,38 @@ static node_idx_t native_nn_accuracy(env_ptr_t env, list_ptr_t args) {
     node_t *pred = get_node(pred_idx);
     node_t *targets = get_node(targets_idx);
     
-    if (pred->is_matrix() && targets->is_matrix()) {
-        matrix_ptr_t pred_mat = pred->as_matrix();
-        matrix_ptr_t targets_mat = targets->as_matrix();
+    if (nn_is_dense(pred) && nn_is_dense(targets)) {
+        jo_clojure_tensor_ptr_t pred_t = nn_dense(pred_idx);
+        jo_clojure_tensor_ptr_t targets_t = nn_dense(targets_idx);
         
         // Check dimensions
-        if (pred_mat->width != targets_mat->width || pred_mat->height != targets_mat->height) {
+        if (!pred_t->same_shape(*targets_t) || pred_t->ndim < 1) {
             warnf("nn/accuracy: prediction and target dimensions don't match\n");
             return NIL_NODE;
         }
         
-        int correct = 0;
-        int total = 0;
+        // Each row (last axis) is one sample; compare the index of the max value
+        long long classes = pred_t->shape[pred_t->ndim-1];
+        long long total = classes ? pred_t->size() / classes : 0;
+        long long correct = 0;
+        const double *p = pred_t->data<double>();
+        const double *t = targets_t->data<double>();
         
-        // For each sample (column)
-        for (int j = 0; j < pred_mat->height; j++) {
-            // Find the index of max value in prediction and target
-            int pred_max_idx = 0;
-            int target_max_idx = 0;
-            double pred_max_val = get_node_float(pred_mat->get(0, j));
-            double target_max_val = get_node_float(targets_mat->get(0, j));
+        for (long long j = 0; j < total; j++) {
+            const double *p_row = p + j * classes;
+            const double *t_row = t + j * classes;
+            long long pred_max_idx = 0;
+            long long target_max_idx = 0;
             
-            for (int i = 1; i < pred_mat->width; i++) {
-                double pred_val = get_node_float(pred_mat->get(i, j));
-                double target_val = get_node_float(targets_mat->get(i, j));
-                
-                if (pred_val > pred_max_val) {
-                    pred_max_val = pred_val;
-                    pred_max_idx = i;
-                }
-                
-                if (target_val > target_max_val) {
-                    target_max_val = target_val;
-                    target_max_idx = i;
-                }
+            for (long long i = 1; i < classes; i++) {
+                if (p_row[i] > p_row[pred_max_idx]) pred_max_idx = i;
+                if (t_row[i] > t_row[target_max_idx]) target_max_idx = i;
             }
             
             // Check if prediction matches target
             if (pred_max_idx == target_max_idx) {
                 correct++;
             }
-            
-            total++;
         }
         
         return new_node_float((double)correct / total);
@@ -2557,12 +2757,11 @@ static node_idx_t native_nn_clip_gradients(env_ptr_t env, list_ptr_t args) {
     hash_map_ptr_t gradients = get_node(gradients_idx)->as_hash_map();
     hash_map_ptr_t clipped_gradients = new_hash_map();
     
-    // Calculate the global norm across all gradient matrices
+    // Calculate the global norm across all gradients
     double global_norm_squared = 0.0;
     
     // Iterate through layers in the gradients
     for (hash_map_t::iterator layer_it = gradients->begin(); layer_it; layer_it++) {
-        node_idx_t layer_key = layer_it->first;
         node_t* layer_node = get_node(layer_it->second);
         
         if (layer_node->is_hash_map()) {
@@ -2570,18 +2769,10 @@ static node_idx_t native_nn_clip_gradients(env_ptr_t env, list_ptr_t args) {
             
             // Iterate through params within the layer
             for (hash_map_t::iterator param_it = layer_grads->begin(); param_it; param_it++) {
-                node_t* param_node = get_node(param_it->second);
-                
-                if (param_node->is_matrix()) {
-                    matrix_ptr_t grad_mat = param_node->as_matrix();
-                    
+                if (nn_is_dense(get_node(param_it->second))) {
                     // Sum up the squared values
-                    for (int i = 0; i < grad_mat->width; i++) {
-                        for (int j = 0; j < grad_mat->height; j++) {
-                            double val = get_node_float(grad_mat->get(i, j));
-                            global_norm_squared += val * val;
-                        }
-                    }
+                    jo_clojure_tensor_ptr_t grad = tensor_from_node(param_it->second);
+                    global_norm_squared += tensor_reduce(tensor_binary(grad, grad, TENSOR_MUL), TENSOR_SUM)->get_flat(0);
                 }
             }
         }
@@ -2591,7 +2782,7 @@ static node_idx_t native_nn_clip_gradients(env_ptr_t env, list_ptr_t args) {
     
     // If global norm exceeds max_norm, scale all gradients
     if (global_norm > max_norm) {
-        double scale_factor = max_norm / global_norm;
+        jo_clojure_tensor_ptr_t scale_factor = tensor_scalar(max_norm / global_norm);
         
         // Iterate through layers again to scale gradients
         for (hash_map_t::iterator layer_it = gradients->begin(); layer_it; layer_it++) {
@@ -2605,21 +2796,11 @@ static node_idx_t native_nn_clip_gradients(env_ptr_t env, list_ptr_t args) {
                 // Iterate through params
                 for (hash_map_t::iterator param_it = layer_grads->begin(); param_it; param_it++) {
                     node_idx_t param_key = param_it->first;
-                    node_t* param_node = get_node(param_it->second);
+                    node_idx_t grad_idx = param_it->second;
                     
-                    if (param_node->is_matrix()) {
-                        matrix_ptr_t grad_mat = param_node->as_matrix();
-                        matrix_ptr_t clipped_grad_mat = new_matrix(grad_mat->width, grad_mat->height);
-                        
-                        // Scale each value
-                        for (int i = 0; i < grad_mat->width; i++) {
-                            for (int j = 0; j < grad_mat->height; j++) {
-                                double val = get_node_float(grad_mat->get(i, j));
-                                clipped_grad_mat->set(i, j, new_node_float(val * scale_factor));
-                            }
-                        }
-                        
-                        clipped_layer_grads->assoc_inplace(param_key, new_node_matrix(clipped_grad_mat), node_eq);
+                    if (nn_is_dense(get_node(grad_idx))) {
+                        jo_clojure_tensor_ptr_t clipped = tensor_binary(tensor_from_node(grad_idx), scale_factor, TENSOR_MUL);
+                        clipped_layer_grads->assoc_inplace(param_key, nn_result(grad_idx, clipped), node_eq);
                     }
                 }
                 
@@ -2634,6 +2815,265 @@ static node_idx_t native_nn_clip_gradients(env_ptr_t env, list_ptr_t args) {
     return gradients_idx;
 }
 
+// Mini-batch loader.
+// Rows come from a seq, matrix or tensor (converted once to a dense table), a CSV file or a raw
+// float32/float64 array file (both mapped). Batches are assembled on the thread pool, prefetch
+// batches ahead of the consumer, into buffers that are recycled once nothing else references them.
+struct nn_loader_t {
+    struct job_t {
+        std::atomic<int> state; // 0 queued, 1 running, 2 done
+        long long index;
+        jo_vector<long long> rows;
+        jo_clojure_tensor_ptr_t x, y;
+        job_t(long long i) : state(0), index(i) {}
+    };
+    typedef jo_shared_ptr<job_t> job_ptr_t;
+
+    // source
+    jo_clojure_tensor_ptr_t table;
+    void *mapping = NULL;
+    size_t mapping_size = 0;
+    bool csv = false;
+    csv_format_t csv_fmt;
+    array_type_t file_dtype = TYPE_DOUBLE;
+    jo_vector<size_t> line_start; // csv: offset of each data row
+    long long num_rows = 0, num_cols = 0;
+
+    // batching
+    long long batch_size = 32, targets = 0, prefetch = 4, num_batches = 0, total_batches = 0;
+    bool shuffle = true;
+    array_type_t dtype = TYPE_DOUBLE;
+    uint64_t seed = 0;
+    jo_vector<long long> order;
+    long long order_epoch = -1;
+    jo_mutex pending_lock; // pending and order, the seq can be walked from several threads
+    jo_vector<job_ptr_t> pending;
+
+    jo_mutex buffers_lock;
+    jo_vector<jo_clojure_tensor_ptr_t> buffers;
+
+    ~nn_loader_t() { jo_munmap_file(mapping, mapping_size); }
+
+    void read_row(long long row, double *out) const {
+        if(table.ptr) {
+            for(long long c = 0; c < num_cols; ++c) out[c] = table->get_flat(row * num_cols + c);
+        } else if(!csv) {
+            const char *p = (const char*)mapping + row * num_cols * (file_dtype == TYPE_FLOAT ? sizeof(float) : sizeof(double));
+            for(long long c = 0; c < num_cols; ++c) out[c] = file_dtype == TYPE_FLOAT ? ((const float*)p)[c] : ((const double*)p)[c];
+        } else {
+            static thread_local jo_vector<csv_field_t> fields;
+            const char *end = (const char*)mapping + mapping_size;
+            size_t n;
+            csv_parse_row((const char*)mapping + line_start[row], end, csv_fmt, fields, n);
+            for(long long c = 0; c < num_cols; ++c) {
+                const csv_field_t *f = c < (long long)n ? &fields[c] : NULL;
+                if(!f || f->kind == CSV_EMPTY) out[c] = 0;
+                else if(f->kind == CSV_INT || f->kind == CSV_FLOAT) out[c] = parse_float(f->s, f->s + f->len);
+                else out[c] = strtod(csv_field_string(*f, csv_fmt.quote).c_str(), NULL);
+            }
+        }
+    }
+
+    // a free buffer of the given shape, or a new one
+    jo_clojure_tensor_ptr_t claim(long long rows, long long cols) {
+        jo_lock_guard lock(buffers_lock);
+        for(size_t i = 0; i < buffers.size(); ++i) {
+            jo_clojure_tensor_ptr_t &b = buffers[i];
+            if(b.use_count() == 1 && b->storage.use_count() == 1 && b->shape[0] == rows && b->shape[1] == cols) {
+                return b;
+            }
+        }
+        jo_clojure_tensor_ptr_t b = new_tensor_2d(dtype, rows, cols, false);
+        if(buffers.size() < (size_t)(prefetch + 2) * 2) buffers.push_back(b);
+        return b;
+    }
+
+    void run(job_t &job) {
+        long long n = job.rows.size(), nx = num_cols - targets;
+        jo_clojure_tensor_ptr_t x = claim(n, nx), y = targets ? claim(n, targets) : jo_clojure_tensor_ptr_t();
+        jo_vector<double> row(num_cols);
+        for(long long i = 0; i < n; ++i) {
+            read_row(job.rows[i], row.data());
+            for(long long c = 0; c < num_cols; ++c) {
+                double v = row[c];
+                jo_clojure_tensor_t *t = c < nx ? x.ptr : y.ptr;
+                long long off = i * t->shape[1] + (c < nx ? c : c - nx);
+                if(dtype == TYPE_FLOAT) t->data<float>()[off] = (float)v;
+                else t->data<double>()[off] = v;
+            }
+        }
+        job.x = x;
+        job.y = y;
+    }
+
+    // the shuffled row order for an epoch, reproducible from the seed
+    void order_for(long long epoch) {
+        if(order_epoch == epoch) return;
+        order.resize(num_rows);
+        for(long long i = 0; i < num_rows; ++i) order[i] = i;
+        if(shuffle) {
+            uint64_t state = seed ^ (0x9E3779B97F4A7C15ull * (epoch + 1));
+            for(long long i = num_rows - 1; i > 0; --i) {
+                long long j = jo_pcg32(&state) % (i + 1);
+                long long t = order[i]; order[i] = order[j]; order[j] = t;
+            }
+        }
+        order_epoch = epoch;
+    }
+
+    job_ptr_t make_job(long long index) {
+        job_ptr_t job(new job_t(index));
+        order_for(index / num_batches);
+        long long start = (index % num_batches) * batch_size;
+        long long end = jo_min(start + batch_size, num_rows);
+        for(long long i = start; i < end; ++i) job->rows.push_back(order[i]);
+        return job;
+    }
+
+    static void try_run(jo_shared_ptr<nn_loader_t> loader, job_ptr_t job) {
+        int expected = 0;
+        if(job->state.compare_exchange_strong(expected, 1)) {
+            loader->run(*job.ptr);
+            job->state.store(2);
+        }
+    }
+};
+typedef jo_shared_ptr<nn_loader_t> nn_loader_ptr_t;
+
+// batch index of the loader, from the prefetch queue if it's the one we expected
+static node_idx_t nn_loader_next(nn_loader_ptr_t loader, long long index) {
+    if(index >= loader->total_batches) {
+        return NIL_NODE;
+    }
+    nn_loader_t::job_ptr_t job;
+    {
+        jo_lock_guard guard(loader->pending_lock);
+        if(loader->pending.size() && loader->pending[0]->index == index) {
+            job = loader->pending[0];
+            for(size_t i = 1; i < loader->pending.size(); ++i) loader->pending[i-1] = loader->pending[i];
+            loader->pending.resize(loader->pending.size() - 1);
+        } else {
+            loader->pending.clear();
+            job = loader->make_job(index);
+        }
+        for(long long next = index + 1 + loader->pending.size(); (long long)loader->pending.size() < loader->prefetch && next < loader->total_batches; ++next) {
+            nn_loader_t::job_ptr_t ahead = loader->make_job(next);
+            loader->pending.push_back(ahead);
+            thread_pool->add_task(new jo_task_t([loader, ahead]() -> node_idx_t {
+                nn_loader_t::try_run(loader, ahead);
+                return NIL_NODE;
+            }));
+        }
+    }
+    // run it here if no worker has picked it up yet, so a busy pool can't stall us
+    nn_loader_t::try_run(loader, job);
+    int count = 0;
+    while(job->state.load() != 2) {
+        jo_yield_backoff(&count);
+    }
+    node_idx_t x = new_node_tensor(job->x);
+    node_idx_t batch = loader->targets ? new_node_vector(vector_va(x, new_node_tensor(job->y))) : x;
+    node_idx_t next_fn = new_node_native_function("nn/data-loader-next", [loader](env_ptr_t env, list_ptr_t args) -> node_idx_t {
+        return nn_loader_next(loader, get_node_int(args->first_value()));
+    }, true, NODE_FLAG_PRERESOLVE);
+    return new_node_list(list_va(batch, next_fn, new_node_int(index + 1)));
+}
+
+// Lazy seq of shuffled mini-batches. Each batch is a [batch-size features] tensor, or [X Y] when
+// the last :targets columns of each row are the targets.
+// source: a seq of rows, a matrix or tensor, or a file path (CSV, or raw float32/float64 rows)
+// opts: :batch-size (32) :shuffle (true) :prefetch (4) :epochs (1) :drop-last (false) :targets (0)
+//       :dtype (:float64) :format (:csv, :float32 or :float64; CSV by default) :columns (raw files)
+//       :separator (",") :header (CSV, skipped automatically if it isn't numeric)
+// Arguments: (source [opts])
+static node_idx_t native_nn_data_loader(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    node_idx_t source_idx = *it++;
+    hash_map_ptr_t opts = it && get_node(*it)->is_hash_map() ? get_node(*it++)->as_hash_map() : new_hash_map();
+    auto opt = [&](const char *name) { return opts->get(new_node_keyword(name), node_eq); };
+    auto opt_int = [&](const char *name, long long def) { node_idx_t v = opt(name); return v == NIL_NODE ? def : get_node_int(v); };
+    auto opt_bool = [&](const char *name, bool def) { node_idx_t v = opt(name); return v == NIL_NODE ? def : get_node_bool(v); };
+
+    nn_loader_ptr_t loader(new nn_loader_t());
+    loader->batch_size = opt_int("batch-size", 32);
+    loader->targets = opt_int("targets", 0);
+    loader->prefetch = jo_max(opt_int("prefetch", 4), 0ll);
+    loader->shuffle = opt_bool("shuffle", true);
+    loader->dtype = tensor_parse_dtype(opt("dtype"), TYPE_DOUBLE);
+    loader->seed = ((uint64_t)jo_pcg32(&jo_rnd_state) << 32) | jo_pcg32(&jo_rnd_state);
+    long long epochs = opt_int("epochs", 1);
+    bool drop_last = opt_bool("drop-last", false);
+    if(loader->batch_size <= 0) {
+        warnf("nn/data-loader: batch size must be positive\n");
+        return NIL_NODE;
+    }
+
+    node_t *source = get_node(source_idx);
+    if(source->is_string()) {
+        const char *path = source->t_string.c_str();
+        node_idx_t format_idx = opt("format");
+        jo_string format = format_idx == NIL_NODE ? jo_string("csv") : get_node(format_idx)->t_string;
+        loader->mapping = jo_mmap_file(path, &loader->mapping_size);
+        if(!loader->mapping) {
+            warnf("nn/data-loader: failed to open %s\n", path);
+            return NIL_NODE;
+        }
+        if(format == "csv") {
+            loader->csv = true;
+            node_idx_t sep_idx = opt("separator");
+            if(sep_idx != NIL_NODE) loader->csv_fmt.sep = get_node(sep_idx)->t_string.c_str()[0];
+            const char *data = (const char*)loader->mapping, *end = data + loader->mapping_size;
+            node_idx_t header_idx = opt("header");
+            bool first = true;
+            jo_vector<csv_field_t> fields;
+            for(const char *p = csv_skip_blank_lines(data, end); p < end; p = csv_skip_blank_lines(p, end)) {
+                const char *row = p;
+                size_t n;
+                p = csv_parse_row(p, end, loader->csv_fmt, fields, n);
+                const char *q = fields[0].s, *q_end = q + fields[0].len;
+                while(q < q_end && (*q == ' ' || *q == '\t')) ++q;
+                if(n == 1 && q == q_end && *row != loader->csv_fmt.quote) continue; // whitespace only
+                // the first row is a header if asked, or if it doesn't start with a number
+                bool header = first && (header_idx != NIL_NODE ? get_node_bool(header_idx) : q == q_end || !((*q >= '0' && *q <= '9') || *q == '-' || *q == '+' || *q == '.'));
+                if(!header) {
+                    if(!loader->num_cols) loader->num_cols = n;
+                    loader->line_start.push_back(row - data);
+                }
+                first = false;
+            }
+            loader->num_rows = loader->line_start.size();
+        } else {
+            loader->file_dtype = format == "float32" ? TYPE_FLOAT : TYPE_DOUBLE;
+            loader->num_cols = opt_int("columns", 0);
+            if(loader->num_cols <= 0) {
+                warnf("nn/data-loader: raw %s files need :columns\n", format.c_str());
+                return NIL_NODE;
+            }
+            long long row_bytes = loader->num_cols * (loader->file_dtype == TYPE_FLOAT ? sizeof(float) : sizeof(double));
+            loader->num_rows = loader->mapping_size / row_bytes;
+        }
+    } else {
+        jo_clojure_tensor_ptr_t t = tensor_from_node(source_idx);
+        if(!t.ptr || t->ndim != 2) {
+            warnf("nn/data-loader: source must be rows of numbers, a 2d matrix or tensor, or a file path\n");
+            return NIL_NODE;
+        }
+        loader->table = tensor_contiguous(t);
+        loader->num_rows = t->shape[0];
+        loader->num_cols = t->shape[1];
+    }
+
+    if(loader->targets < 0 || loader->targets >= loader->num_cols) {
+        warnf("nn/data-loader: :targets must leave at least one feature column\n");
+        return NIL_NODE;
+    }
+    loader->num_batches = drop_last ? loader->num_rows / loader->batch_size : (loader->num_rows + loader->batch_size - 1) / loader->batch_size;
+    loader->total_batches = loader->num_batches * epochs;
+    return new_node_lazy_list(env, new_node_list(list_va(new_node_native_function("nn/data-loader-next", [loader](env_ptr_t env, list_ptr_t args) -> node_idx_t {
+        return nn_loader_next(loader, get_node_int(args->first_value()));
+    }, true, NODE_FLAG_PRERESOLVE), ZERO_NODE)));
+}
+
 // Module initialization function
 void jo_clojure_nn_init(env_ptr_t env) {
     // Neural network layers
@@ -2690,7 +3130,9 @@ void jo_clojure_nn_init(env_ptr_t env) {
     // Model utilities
     env->set("nn/sequential", new_node_native_function("nn/sequential", &native_nn_sequential, false, NODE_FLAG_PRERESOLVE));
     env->set("nn/sequential-forward", new_node_native_function("nn/sequential-forward", &native_nn_sequential_forward, false, NODE_FLAG_PRERESOLVE));
+    env->set("nn/astype", new_node_native_function("nn/astype", &native_nn_astype, false, NODE_FLAG_PRERESOLVE));
     env->set("nn/save-model", new_node_native_function("nn/save-model", &native_nn_save_model, false, NODE_FLAG_PRERESOLVE));
     env->set("nn/load-model", new_node_native_function("nn/load-model", &native_nn_load_model, false, NODE_FLAG_PRERESOLVE));
     env->set("nn/accuracy", new_node_native_function("nn/accuracy", &native_nn_accuracy, false, NODE_FLAG_PRERESOLVE));
+    env->set("nn/data-loader", new_node_native_function("nn/data-loader", &native_nn_data_loader, false, NODE_FLAG_PRERESOLVE));
 }
\ No newline at end of file
@@ -89,7 +89,7 @@ struct jo_alloc_t : jo_alloc_base_t {
                 }
                 n_idx = cnt_idx & 0xffffffff;
             }
-            sector = jo_pcg32(&jo_rnd_state) & (NUM_SECTORS-1);
+            sector = jo_pcg32(&jo_alloc_rnd_state) & (NUM_SECTORS-1);
         }
 		size_t idx = vec.push_back(std::move(T_t()));
 		T_t *n = &vec[idx];
@@ -179,6 +179,8 @@ struct jo_shared_ptr_t {
     bool operator!() const { return ptr == nullptr; }
     operator bool() const { return ptr != nullptr; }
 
+    int use_count() const { return ptr ? ((T_t*)((char*)ptr - sizeof(typename T_t::header_t)))->h.ref_count.load() : 0; }
+
     //operator T&() { return *ptr; }
     //operator T&() const { return *ptr; }
 
@@ -1232,27 +1234,26 @@ struct jo_persistent_vector : jo_object {
             head = new_root;
             ++depth;
             shift = 5 * (depth + 1);
-        } else {
+        } else if(head.use_count() != 1) {
             head = new_node(head);
         }
 
         // Set up our tree traversal. We subtract 5 from level each time
         // in order to get all the way down to the level above where we want to
         // insert this tail jo_persistent_vector_node_t.
-        node_shared_ptr cur = NULL;
-        node_shared_ptr prev = head;
+        // Nodes only this vector references are written in place, the rest are copied.
+        vector_node_t *prev = head.ptr;
         size_t key = tail_offset;
         for(size_t level = shift; level > 5; level -= 5) {
             size_t index = (key >> level) & 31;
             // we are at the end of our tree, insert tail jo_persistent_vector_node_t
-            cur = prev->children[index];
-            if(!cur) {
-                cur = new_node();
-            } else {
-                cur = new_node(cur);
+            node_shared_ptr &child = prev->children[index];
+            if(!child) {
+                child = new_node();
+            } else if(child.use_count() != 1) {
+                child = new_node(child);
             }
-            prev->children[index] = cur;
-            prev = cur;
+            prev = child.ptr;
         }
         prev->children[(key >> 5) & 31] = tail;
 
@@ -1288,6 +1289,23 @@ struct jo_persistent_vector : jo_object {
         length++;
     }
 
+    // Appends n elements, filling the tail a leaf at a time.
+    void append_inplace(const T *values, size_t n) {
+        while(n > 0) {
+            if(tail_length >= 32) {
+                append_tail();
+            }
+            size_t k = jo_min((size_t)(32 - tail_length), n);
+            for(size_t i = 0; i < k; ++i) {
+                tail->elements[tail_length + i] = values[i];
+            }
+            tail_length += (int)k;
+            length += k;
+            values += k;
+            n -= k;
+        }
+    }
+
     shared_ptr assoc(size_t index, const T &value) const {
         if(index >= length) {
             return append(value);
@@ -1651,6 +1669,15 @@ struct jo_persistent_vector : jo_object {
         return cur->elements[index & 31];
     }
 
+    // How many elements from index on sit next to &nth(index) in memory (the rest of its leaf).
+    inline long long run_length(long long index) const {
+        long long tail_offset = length - tail_length;
+        if(index >= tail_offset) {
+            return length - index;
+        }
+        return jo_min(32 - ((index + head_offset) & 31), tail_offset - index);
+    }
+
     inline T &nth_clamp(long long index) {
         index = index < 0 ? 0 : index;
         index = index > (long long)length-1 ? length-1 : index;
@@ -0,0 +1,1008 @@
+#pragma once
+
+// Regular expressions: #"..." literals, re-pattern, re-matcher, re-find, re-matches, re-seq and
+// re-groups, plus the regex forms of split and replace in jo_clojure_string.h.
+//
+// A pattern compiles once (literals when they are read) to bytecode for a Pike VM. Every live
+// thread advances over the input in lock step, so a match costs time linear in the input whatever
+// the pattern, with no catastrophic backtracking. That rules out backreferences and lookaround,
+// which are refused when the pattern compiles. Matching is over bytes and \w, \d, \s are ASCII.
+// While no thread is alive the search skips ahead to the next place a match can start: the
+// pattern's literal prefix found with jo_memmem, or one of the bytes it can begin with.
+
+enum {
+    RE_CHAR = 0,    // x = byte
+    RE_CLASS,       // x = class index
+    RE_ANY,         // any byte
+    RE_MATCH,
+    RE_JMP,         // x = target
+    RE_SPLIT,       // x = preferred target, y = the other
+    RE_SAVE,        // x = capture slot
+    RE_ASSERT,      // x = RE_AT_*
+};
+
+enum {
+    RE_AT_BOL = 0,  // ^
+    RE_AT_EOL,      // $
+    RE_AT_MBOL,     // ^ with (?m)
+    RE_AT_MEOL,     // $ with (?m)
+    RE_AT_BEGIN,    // \A
+    RE_AT_END,      // \z
+    RE_AT_ENDZ,     // \Z
+    RE_AT_WORD,     // \b
+    RE_AT_NOT_WORD, // \B
+};
+
+enum {
+    RE_FLAG_ICASE = 1,
+    RE_FLAG_MULTILINE = 2,
+    RE_FLAG_DOTALL = 4,
+    RE_FLAG_COMMENTS = 8,
+};
+
+// programs with more instructions than this are refused, it is what x{1000}{1000} runs into
+#define RE_MAX_INSTS 100000
+
+struct regex_inst_t {
+    int op, x, y;
+};
+
+struct regex_class_t {
+    uint32_t bits[8];
+    bool has(unsigned char c) const { return (bits[c >> 5] >> (c & 31)) & 1; }
+    void set(unsigned char c) { bits[c >> 5] |= 1u << (c & 31); }
+    void set_range(int lo, int hi) { for(int c = lo; c <= hi; ++c) set((unsigned char)c); }
+    void merge(const regex_class_t &o, bool negate) { for(int i = 0; i < 8; ++i) bits[i] |= negate ? ~o.bits[i] : o.bits[i]; }
+    void invert() { for(int i = 0; i < 8; ++i) bits[i] = ~bits[i]; }
+};
+
+static inline bool regex_is_word(unsigned char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_'; }
+
+struct regex_prog_t {
+    jo_vector<regex_inst_t> insts;
+    jo_vector<regex_class_t> classes;
+    int ngroups = 0;      // capture groups, not counting the whole match
+    jo_string prefix;     // every match starts with this
+    bool anchored = false; // can only match at the start of the input
+    int nfirst = -1;      // bytes a match can start with, -1 when any byte can
+    unsigned char first[256];
+    bool first_set[256];
+};
+typedef jo_shared_ptr<regex_prog_t> regex_prog_ptr_t;
+
+// Recursive descent over the pattern into a small syntax tree, which then emits the bytecode.
+// The tree makes counted repetition easy: x{2,4} is just x emitted four times.
+struct regex_compiler_t {
+    enum { N_EMPTY, N_CHAR, N_CLASS, N_ANY, N_ASSERT, N_CAT, N_ALT, N_GROUP, N_REPEAT };
+    struct ast_t {
+        int type;
+        int x, y;       // char / class / assert / group / repeat min, max (-1 for no limit)
+        int left, right;
+        bool greedy;
+    };
+
+    const char *p, *end;
+    jo_string err;
+    jo_vector<ast_t> ast;
+    regex_prog_t *prog;
+    int ngroups = 0;
+
+    regex_compiler_t(const char *s, size_t len, regex_prog_t *pr) : p(s), end(s + len), prog(pr) {}
+
+    int node(int type, int x = 0, int y = 0, int left = -1, int right = -1) {
+        ast_t a = { type, x, y, left, right, true };
+        ast.push_back(a);
+        return (int)ast.size() - 1;
+    }
+
+    int fail(const char *msg) {
+        if(!err.length()) err = msg;
+        return -1;
+    }
+
+    int add_class(const regex_class_t &c) {
+        prog->classes.push_back(c);
+        return (int)prog->classes.size() - 1;
+    }
+
+    static void fold_case(regex_class_t &c) {
+        for(int i = 'a'; i <= 'z'; ++i) {
+            if(c.has((unsigned char)i) || c.has((unsigned char)(i - 32))) {
+                c.set((unsigned char)i);
+                c.set((unsigned char)(i - 32));
+            }
+        }
+    }
+
+    int char_node(unsigned char c, int flags) {
+        if((flags & RE_FLAG_ICASE) && jo_isletter(c)) {
+            regex_class_t cls = {};
+            cls.set(c);
+            fold_case(cls);
+            return node(N_CLASS, add_class(cls));
+        }
+        return node(N_CHAR, c);
+    }
+
+    void skip_comments(int flags) {
+        if(!(flags & RE_FLAG_COMMENTS)) return;
+        while(p < end) {
+            if(jo_isspace(*p)) ++p;
+            else if(*p == '#') while(p < end && *p != '\n') ++p;
+            else break;
+        }
+    }
+
+    static int hex_digit(int c) {
+        if(c >= '0' && c <= '9') return c - '0';
+        if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    // \d \w \s and friends, and \p{...}; false if e isn't one
+    bool class_escape(int e, regex_class_t &out) {
+        regex_class_t c = {};
+        bool negate = false;
+        switch(e) {
+        case 'D': negate = true; // fallthrough
+        case 'd': c.set_range('0', '9'); break;
+        case 'W': negate = true; // fallthrough
+        case 'w': c.set_range('a', 'z'); c.set_range('A', 'Z'); c.set_range('0', '9'); c.set('_'); break;
+        case 'S': negate = true; // fallthrough
+        case 's': c.set(' '); c.set_range('\t', '\r'); break;
+        case 'H': negate = true; // fallthrough
+        case 'h': c.set(' '); c.set('\t'); break;
+        case 'P': negate = true; // fallthrough
+        case 'p': {
+            const char *name = p;
+            size_t n = 1;
+            if(p < end && *p == '{') {
+                const char *close = (const char*)memchr(p, '}', end - p);
+                if(!close) { fail("unterminated \\p{...}"); return true; }
+                name = p + 1;
+                n = close - name;
+                p = close + 1;
+            } else if(p < end) {
+                ++p;
+            }
+            jo_string cls(name, n);
+            if(cls.starts_with("Is")) cls.drop(2);
+            if(cls == "Lower" || cls == "Ll") c.set_range('a', 'z');
+            else if(cls == "Upper" || cls == "Lu") c.set_range('A', 'Z');
+            else if(cls == "Alpha" || cls == "L") { c.set_range('a', 'z'); c.set_range('A', 'Z'); }
+            else if(cls == "Digit" || cls == "Nd" || cls == "N") c.set_range('0', '9');
+            else if(cls == "Alnum") { c.set_range('a', 'z'); c.set_range('A', 'Z'); c.set_range('0', '9'); }
+            else if(cls == "Punct" || cls == "P") { c.set_range('!', '/'); c.set_range(':', '@'); c.set_range('[', '`'); c.set_range('{', '~'); }
+            else if(cls == "Space") { c.set(' '); c.set_range('\t', '\r'); }
+            else if(cls == "XDigit") { c.set_range('0', '9'); c.set_range('a', 'f'); c.set_range('A', 'F'); }
+            else if(cls == "Cntrl") { c.set_range(0, 31); c.set(127); }
+            else if(cls == "ASCII") c.set_range(0, 127);
+            else { fail("unknown \\p{...} class"); return true; }
+            break;
+        }
+        default:
+            return false;
+        }
+        out = regex_class_t();
+        out.merge(c, negate);
+        return true;
+    }
+
+    // the byte an escape stands for, after the backslash and e have been read
+    int escape_char(int e) {
+        switch(e) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'a': return '\a';
+        case 'e': return 27;
+        case '0': {
+            int v = 0;
+            for(int i = 0; i < 3 && p < end && *p >= '0' && *p <= '7'; ++i) v = v * 8 + (*p++ - '0');
+            return v & 255;
+        }
+        case 'x': {
+            int v = 0;
+            for(int i = 0; i < 2; ++i) {
+                int h = p < end ? hex_digit(*p) : -1;
+                if(h < 0) return fail("bad \\x escape");
+                v = v * 16 + h;
+                ++p;
+            }
+            return v;
+        }
+        case 'c':
+            if(p >= end) return fail("bad \\c escape");
+            return *p++ ^ 64;
+        }
+        if(jo_isletter(e) || (e >= '1' && e <= '9')) {
+            if(e >= '1' && e <= '9') return fail("backreferences are not supported");
+            if(e == 'k') return fail("backreferences are not supported");
+            return fail("unknown escape");
+        }
+        return e;
+    }
+
+    int parse_class(int flags) {
+        regex_class_t cls = {};
+        bool negate = false;
+        if(p < end && *p == '^') { negate = true; ++p; }
+        bool first = true;
+        for(;;) {
+            if(p >= end) return fail("unterminated character class");
+            int c = (unsigned char)*p++;
+            if(c == ']' && !first) break;
+            first = false;
+            if(c == '[') return fail("nested character classes are not supported");
+            if(c == '\\') {
+                if(p >= end) return fail("trailing backslash");
+                int e = (unsigned char)*p++;
+                regex_class_t esc;
+                if(class_escape(e, esc)) {
+                    if(err.length()) return -1;
+                    cls.merge(esc, false);
+                    continue;
+                }
+                if(e == 'u') return fail("\\u escapes beyond ASCII are not supported in classes");
+                c = escape_char(e);
+                if(c < 0) return -1;
+            }
+            if(p + 1 < end && *p == '-' && p[1] != ']') {
+                ++p;
+                int hi = (unsigned char)*p++;
+                if(hi == '\\') {
+                    if(p >= end) return fail("trailing backslash");
+                    hi = escape_char((unsigned char)*p++);
+                    if(hi < 0) return -1;
+                }
+                if(hi < c) return fail("bad character range");
+                cls.set_range(c, hi);
+            } else {
+                cls.set((unsigned char)c);
+            }
+        }
+        if(flags & RE_FLAG_ICASE) fold_case(cls);
+        if(negate) cls.invert();
+        return node(N_CLASS, add_class(cls));
+    }
+
+    // (?imsx-imsx) or (?imsx-imsx: ; p is just past the '?'. Returns true when a group follows.
+    bool parse_flags(int &flags) {
+        bool on = true;
+        while(p < end) {
+            int c = *p++;
+            int f = 0;
+            switch(c) {
+            case 'i': f = RE_FLAG_ICASE; break;
+            case 'm': f = RE_FLAG_MULTILINE; break;
+            case 's': f = RE_FLAG_DOTALL; break;
+            case 'x': f = RE_FLAG_COMMENTS; break;
+            case 'u': case 'd': case 'U': break;
+            case '-': on = false; continue;
+            case ')': return false;
+            case ':': return true;
+            default: fail("unknown inline flag"); return false;
+            }
+            if(on) flags |= f;
+            else flags &= ~f;
+        }
+        fail("unterminated inline flags");
+        return false;
+    }
+
+    int parse_atom(int &flags) {
+        int c = (unsigned char)*p++;
+        switch(c) {
+        case '(': {
+            int group = -1;
+            int inner = flags;
+            if(p < end && *p == '?') {
+                ++p;
+                if(p >= end) return fail("unterminated group");
+                if(*p == ':') {
+                    ++p;
+                } else if(*p == '=' || *p == '!' || (*p == '<' && p + 1 < end && (p[1] == '=' || p[1] == '!'))) {
+                    return fail("lookaround is not supported");
+                } else if(*p == '>') {
+                    return fail("atomic groups are not supported");
+                } else if(*p == '<') {
+                    const char *close = (const char*)memchr(p, '>', end - p);
+                    if(!close) return fail("unterminated group name");
+                    p = close + 1;
+                    group = ++ngroups;
+                } else if(!parse_flags(inner)) {
+                    // (?i) changes the flags for the rest of the enclosing group
+                    if(err.length()) return -1;
+                    flags = inner;
+                    return node(N_EMPTY);
+                }
+            } else {
+                group = ++ngroups;
+            }
+            int body = parse_alt(inner);
+            if(body < 0) return -1;
+            if(p >= end || *p != ')') return fail("missing )");
+            ++p;
+            return group < 0 ? body : node(N_GROUP, group, 0, body);
+        }
+        case '[': return parse_class(flags);
+        case '.': {
+            if(flags & RE_FLAG_DOTALL) return node(N_ANY);
+            regex_class_t cls = {};
+            cls.invert();
+            cls.bits['\n' >> 5] &= ~(1u << ('\n' & 31));
+            cls.bits['\r' >> 5] &= ~(1u << ('\r' & 31));
+            return node(N_CLASS, add_class(cls));
+        }
+        case '^': return node(N_ASSERT, (flags & RE_FLAG_MULTILINE) ? RE_AT_MBOL : RE_AT_BOL);
+        case '$': return node(N_ASSERT, (flags & RE_FLAG_MULTILINE) ? RE_AT_MEOL : RE_AT_EOL);
+        case '*': case '+': case '?': return fail("dangling quantifier");
+        case '\\': {
+            if(p >= end) return fail("trailing backslash");
+            int e = (unsigned char)*p++;
+            regex_class_t cls;
+            if(class_escape(e, cls)) {
+                if(err.length()) return -1;
+                return node(N_CLASS, add_class(cls));
+            }
+            switch(e) {
+            case 'b': return node(N_ASSERT, RE_AT_WORD);
+            case 'B': return node(N_ASSERT, RE_AT_NOT_WORD);
+            case 'A': return node(N_ASSERT, RE_AT_BEGIN);
+            case 'z': return node(N_ASSERT, RE_AT_END);
+            case 'Z': return node(N_ASSERT, RE_AT_ENDZ);
+            case 'G': return fail("\\G is not supported");
+            case 'Q': {
+                // quoted run up to \E
+                int seq = -1;
+                while(p < end && !(*p == '\\' && p + 1 < end && p[1] == 'E')) {
+                    int ch = char_node((unsigned char)*p++, flags);
+                    seq = seq < 0 ? ch : node(N_CAT, 0, 0, seq, ch);
+                }
+                if(p < end) p += 2;
+                return seq < 0 ? node(N_EMPTY) : seq;
+            }
+            case 'u': {
+                int v = 0;
+                for(int i = 0; i < 4; ++i) {
+                    int h = p < end ? hex_digit(*p) : -1;
+                    if(h < 0) return fail("bad \\u escape");
+                    v = v * 16 + h;
+                    ++p;
+                }
+                // as its UTF-8 bytes
+                unsigned char u[3];
+                int n = 0;
+                if(v < 0x80) u[n++] = (unsigned char)v;
+                else if(v < 0x800) { u[n++] = (unsigned char)(0xC0 | (v >> 6)); u[n++] = (unsigned char)(0x80 | (v & 63)); }
+                else { u[n++] = (unsigned char)(0xE0 | (v >> 12)); u[n++] = (unsigned char)(0x80 | ((v >> 6) & 63)); u[n++] = (unsigned char)(0x80 | (v & 63)); }
+                int seq = char_node(u[0], flags);
+                for(int i = 1; i < n; ++i) seq = node(N_CAT, 0, 0, seq, node(N_CHAR, u[i]));
+                return seq;
+            }
+            }
+            int ch = escape_char(e);
+            if(ch < 0) return -1;
+            return char_node((unsigned char)ch, flags);
+        }
+        }
+        return char_node((unsigned char)c, flags);
+    }
+
+    // {n}, {n,}, {n,m}; false (with p untouched) if what follows isn't one, then '{' is literal
+    bool parse_braces(int &lo, int &hi) {
+        const char *q = p + 1;
+        int a = 0, b = -1;
+        if(q >= end || *q < '0' || *q > '9') return false;
+        while(q < end && *q >= '0' && *q <= '9') a = jo_min(a * 10 + (*q++ - '0'), 100000);
+        if(q < end && *q == ',') {
+            ++q;
+            if(q < end && *q >= '0' && *q <= '9') {
+                b = 0;
+                while(q < end && *q >= '0' && *q <= '9') b = jo_min(b * 10 + (*q++ - '0'), 100000);
+            }
+        } else {
+            b = a;
+        }
+        if(q >= end || *q != '}') return false;
+        p = q + 1;
+        lo = a;
+        hi = b;
+        return true;
+    }
+
+    int parse_repeat(int &flags) {
+        int atom = parse_atom(flags);
+        if(atom < 0) return -1;
+        for(;;) {
+            skip_comments(flags);
+            if(p >= end) break;
+            int lo, hi;
+            if(*p == '*') { lo = 0; hi = -1; ++p; }
+            else if(*p == '+') { lo = 1; hi = -1; ++p; }
+            else if(*p == '?') { lo = 0; hi = 1; ++p; }
+            else if(*p == '{' && parse_braces(lo, hi)) {}
+            else break;
+            if(hi >= 0 && hi < lo) return fail("bad repetition range");
+            if(ast[atom].type == N_ASSERT || ast[atom].type == N_EMPTY) continue;
+            int r = node(N_REPEAT, lo, hi, atom);
+            if(p < end && *p == '?') { ast[r].greedy = false; ++p; }
+            else if(p < end && *p == '+') return fail("possessive quantifiers are not supported");
+            atom = r;
+        }
+        return atom;
+    }
+
+    int parse_cat(int &flags) {
+        int seq = -1;
+        for(;;) {
+            skip_comments(flags);
+            if(p >= end || *p == '|' || *p == ')') break;
+            int r = parse_repeat(flags);
+            if(r < 0) return -1;
+            seq = seq < 0 ? r : node(N_CAT, 0, 0, seq, r);
+        }
+        return seq < 0 ? node(N_EMPTY) : seq;
+    }
+
+    int parse_alt(int flags) {
+        int left = parse_cat(flags);
+        if(left < 0) return -1;
+        while(p < end && *p == '|') {
+            ++p;
+            int right = parse_cat(flags);
+            if(right < 0) return -1;
+            left = node(N_ALT, 0, 0, left, right);
+        }
+        return left;
+    }
+
+    int emit(int op, int x = 0, int y = 0) {
+        regex_inst_t i = { op, x, y };
+        prog->insts.push_back(i);
+        return (int)prog->insts.size() - 1;
+    }
+
+    bool gen(int n) {
+        if(prog->insts.size() > RE_MAX_INSTS) {
+            fail("pattern is too large");
+            return false;
+        }
+        const ast_t a = ast[n];
+        switch(a.type) {
+        case N_EMPTY: return true;
+        case N_CHAR: emit(RE_CHAR, a.x); return true;
+        case N_CLASS: emit(RE_CLASS, a.x); return true;
+        case N_ANY: emit(RE_ANY); return true;
+        case N_ASSERT: emit(RE_ASSERT, a.x); return true;
+        case N_CAT: return gen(a.left) && gen(a.right);
+        case N_ALT: {
+            int split = emit(RE_SPLIT, 0, 0);
+            prog->insts[split].x = (int)prog->insts.size();
+            if(!gen(a.left)) return false;
+            int jmp = emit(RE_JMP);
+            prog->insts[split].y = (int)prog->insts.size();
+            if(!gen(a.right)) return false;
+            prog->insts[jmp].x = (int)prog->insts.size();
+            return true;
+        }
+        case N_GROUP:
+            emit(RE_SAVE, a.x * 2);
+            if(!gen(a.left)) return false;
+            emit(RE_SAVE, a.x * 2 + 1);
+            return true;
+        case N_REPEAT: {
+            int lo = a.x, hi = a.y;
+            if(hi < 0 && lo > 0) {
+                // x{n,}: n-1 copies, then x+
+                for(int i = 0; i < lo - 1; ++i) if(!gen(a.left)) return false;
+                int top = (int)prog->insts.size();
+                if(!gen(a.left)) return false;
+                int split = emit(RE_SPLIT);
+                prog->insts[split].x = a.greedy ? top : split + 1;
+                prog->insts[split].y = a.greedy ? split + 1 : top;
+                return true;
+            }
+            for(int i = 0; i < lo; ++i) if(!gen(a.left)) return false;
+            if(hi < 0) {
+                // x*
+                int split = emit(RE_SPLIT);
+                if(!gen(a.left)) return false;
+                emit(RE_JMP, split);
+                int out = (int)prog->insts.size();
+                prog->insts[split].x = a.greedy ? split + 1 : out;
+                prog->insts[split].y = a.greedy ? out : split + 1;
+                return true;
+            }
+            // x{lo,hi}: each optional copy may skip to the end
+            jo_vector<int> splits;
+            for(int i = lo; i < hi; ++i) {
+                splits.push_back(emit(RE_SPLIT));
+                if(!gen(a.left)) return false;
+            }
+            int out = (int)prog->insts.size();
+            for(size_t i = 0; i < splits.size(); ++i) {
+                int s = splits[i];
+                prog->insts[s].x = a.greedy ? s + 1 : out;
+                prog->insts[s].y = a.greedy ? out : s + 1;
+            }
+            return true;
+        }
+        }
+        return true;
+    }
+
+    // What the search can skip ahead to: a literal prefix, or the set of possible first bytes.
+    void analyze() {
+        const jo_vector<regex_inst_t> &in = prog->insts;
+        int pc = 0;
+        while(in[pc].op == RE_SAVE) ++pc;
+        if(in[pc].op == RE_ASSERT && (in[pc].x == RE_AT_BOL || in[pc].x == RE_AT_BEGIN)) prog->anchored = true;
+        for(int i = pc; in[i].op == RE_CHAR; ++i) prog->prefix += (char)in[i].x;
+
+        memset(prog->first_set, 0, sizeof(prog->first_set));
+        jo_vector<int> stack;
+        jo_vector<bool> seen((size_t)in.size());
+        for(size_t i = 0; i < seen.size(); ++i) seen[i] = false;
+        stack.push_back(0);
+        bool any = false;
+        while(stack.size() && !any) {
+            int at = stack.back();
+            stack.resize(stack.size() - 1);
+            if(seen[at]) continue;
+            seen[at] = true;
+            const regex_inst_t &i = in[at];
+            switch(i.op) {
+            case RE_CHAR: prog->first_set[i.x] = true; break;
+            case RE_CLASS: for(int c = 0; c < 256; ++c) if(prog->classes[i.x].has((unsigned char)c)) prog->first_set[c] = true; break;
+            case RE_ANY: case RE_MATCH: any = true; break;
+            case RE_JMP: stack.push_back(i.x); break;
+            case RE_SPLIT: stack.push_back(i.y); stack.push_back(i.x); break;
+            default: stack.push_back(at + 1); break;
+            }
+        }
+        prog->nfirst = 0;
+        for(int c = 0; c < 256 && !any; ++c) {
+            if(!prog->first_set[c]) continue;
+            if(prog->nfirst < 8) prog->first[prog->nfirst] = (unsigned char)c;
+            prog->nfirst++;
+        }
+        if(any || prog->nfirst == 256) prog->nfirst = -1;
+    }
+
+    bool compile(int flags) {
+        int root = parse_alt(flags);
+        if(root >= 0 && p < end) fail("unmatched )");
+        if(err.length()) return false;
+        prog->ngroups = ngroups;
+        emit(RE_SAVE, 0);
+        if(!gen(root)) return false;
+        emit(RE_SAVE, 1);
+        emit(RE_MATCH);
+        analyze();
+        return true;
+    }
+};
+
+// Compiles pattern, or returns a null pointer with the reason in err
+static regex_prog_ptr_t regex_compile(const char *pattern, size_t len, jo_string &err) {
+    regex_prog_ptr_t prog(new regex_prog_t());
+    regex_compiler_t c(pattern, len, prog.ptr);
+    if(!c.compile(0)) {
+        err = c.err;
+        return regex_prog_ptr_t();
+    }
+    return prog;
+}
+
+// Per thread scratch for the VM: two thread lists, each a sparse set of program counters with a
+// capture array per entry, and the stack used to follow jumps and splits.
+struct regex_vm_t {
+    struct threads_t {
+        jo_vector<int> sparse, dense, caps;
+        int n = 0;
+        bool has(int pc) const { unsigned i = (unsigned)sparse[pc]; return i < (unsigned)n && dense[i] == pc; }
+        int add(int pc) { sparse[pc] = n; dense[n] = pc; return n++; }
+    };
+    struct frame_t { int pc, slot, old; };
+    threads_t lists[2];
+    jo_vector<frame_t> stack;
+    jo_vector<int> work;
+
+    void prepare(int ninst, int ncap) {
+        for(int i = 0; i < 2; ++i) {
+            if(lists[i].sparse.size() < (size_t)ninst) {
+                lists[i].sparse.resize(ninst);
+                lists[i].dense.resize(ninst);
+            }
+            if(lists[i].caps.size() < (size_t)ninst * ncap) lists[i].caps.resize((size_t)ninst * ncap);
+            lists[i].n = 0;
+        }
+        if(work.size() < (size_t)ncap) work.resize(ncap);
+        if(stack.size() < (size_t)ninst * 2 + 8) stack.resize((size_t)ninst * 2 + 8);
+    }
+};
+static thread_local regex_vm_t regex_vm;
+
+static bool regex_assert(int what, const char *s, size_t len, size_t pos) {
+    switch(what) {
+    case RE_AT_BOL: case RE_AT_BEGIN: return pos == 0;
+    case RE_AT_MBOL: return pos == 0 || s[pos - 1] == '\n';
+    case RE_AT_EOL: case RE_AT_ENDZ: return pos == len || (pos + 1 == len && s[pos] == '\n');
+    case RE_AT_MEOL: return pos == len || s[pos] == '\n';
+    case RE_AT_END: return pos == len;
+    case RE_AT_WORD: case RE_AT_NOT_WORD: {
+        bool a = pos > 0 && regex_is_word(s[pos - 1]);
+        bool b = pos < len && regex_is_word(s[pos]);
+        return (a != b) == (what == RE_AT_WORD);
+    }
+    }
+    return false;
+}
+
+// Follows jumps, splits, saves and assertions from pc at pos, adding the threads that consume a
+// byte (or match) to l in priority order.
+static void regex_add_thread(const regex_prog_t *prog, regex_vm_t &vm, regex_vm_t::threads_t &l, int pc0, const int *caps, int ncap, const char *s, size_t len, size_t pos) {
+    const regex_inst_t *in = prog->insts.data();
+    int *work = vm.work.data();
+    memcpy(work, caps, ncap * sizeof(int));
+    regex_vm_t::frame_t *stack = vm.stack.data();
+    int top = 0;
+    stack[top++] = { pc0, -1, 0 };
+    while(top) {
+        regex_vm_t::frame_t f = stack[--top];
+        if(f.slot >= 0) {
+            work[f.slot] = f.old;
+            continue;
+        }
+        int pc = f.pc;
+        for(;;) {
+            if(l.has(pc)) break;
+            int at = l.add(pc);
+            const regex_inst_t &i = in[pc];
+            if(i.op == RE_JMP) {
+                pc = i.x;
+            } else if(i.op == RE_SPLIT) {
+                stack[top++] = { i.y, -1, 0 };
+                pc = i.x;
+            } else if(i.op == RE_SAVE) {
+                if(i.x < ncap) {
+                    stack[top++] = { 0, i.x, work[i.x] };
+                    work[i.x] = (int)pos;
+                }
+                pc++;
+            } else if(i.op == RE_ASSERT) {
+                if(!regex_assert(i.x, s, len, pos)) break;
+                pc++;
+            } else {
+                memcpy(l.caps.data() + (size_t)at * ncap, work, ncap * sizeof(int));
+                break;
+            }
+        }
+    }
+}
+
+// Searches s[start, len) for the leftmost match, preferring earlier alternatives and greedy
+// repeats the way backtracking engines do. With whole, the match must span from start to len.
+// caps gets 2 * (ngroups + 1) offsets, -1 for groups that took no part.
+static bool regex_exec(const regex_prog_t *prog, const char *s, size_t len, size_t start, bool whole, int *caps) {
+    int ncap = 2 * (prog->ngroups + 1);
+    int ninst = (int)prog->insts.size();
+    const regex_inst_t *in = prog->insts.data();
+    regex_vm_t &vm = regex_vm;
+    vm.prepare(ninst, ncap);
+    regex_vm_t::threads_t *clist = &vm.lists[0], *nlist = &vm.lists[1];
+    int *init_caps = (int*)jo_alloca(ncap * sizeof(int));
+    for(int i = 0; i < ncap; ++i) init_caps[i] = -1;
+    bool matched = false;
+    bool anchored = whole || prog->anchored;
+    if(prog->anchored && start > 0 && !whole) return false;
+    for(size_t pos = start;; ++pos) {
+        if(!matched && (pos == start || !anchored)) {
+            if(clist->n == 0 && pos > start) {
+                // nothing alive: skip to where a match can next begin
+                const char *q = s + pos;
+                if(prog->prefix.length()) q = jo_memmem(q, len - pos, prog->prefix.c_str(), prog->prefix.length());
+                else if(prog->nfirst >= 0 && prog->nfirst <= 8) q = jo_memchr_any(q, s + len, prog->first, prog->nfirst);
+                else if(prog->nfirst > 8) { while(q < s + len && !prog->first_set[(unsigned char)*q]) ++q; }
+                if(!q || q == s + len) {
+                    if(prog->nfirst >= 0 || prog->prefix.length()) return false;
+                } else {
+                    pos = q - s;
+                }
+            }
+            regex_add_thread(prog, vm, *clist, 0, init_caps, ncap, s, len, pos);
+        }
+        if(clist->n == 0) break;
+        nlist->n = 0;
+        int c = pos < len ? (unsigned char)s[pos] : -1;
+        for(int t = 0; t < clist->n; ++t) {
+            int pc = clist->dense[t];
+            const regex_inst_t &i = in[pc];
+            const int *tc = clist->caps.data() + (size_t)t * ncap;
+            bool step = false;
+            switch(i.op) {
+            case RE_CHAR: step = c == i.x; break;
+            case RE_CLASS: step = c >= 0 && prog->classes[i.x].has((unsigned char)c); break;
+            case RE_ANY: step = c >= 0; break;
+            case RE_MATCH:
+                if(whole && pos != len) break;
+                matched = true;
+                memcpy(caps, tc, ncap * sizeof(int));
+                // lower priority threads lose to this one
+                t = clist->n;
+                break;
+            }
+            if(step) regex_add_thread(prog, vm, *nlist, pc + 1, tc, ncap, s, len, pos + 1);
+        }
+        regex_vm_t::threads_t *tmp = clist; clist = nlist; nlist = tmp;
+        if(pos >= len) break;
+    }
+    vm.lists[0].n = vm.lists[1].n = 0;
+    return matched;
+}
+
+// The node behind a regex value. Patterns are shared, immutable programs; a node made by
+// re-matcher also carries the input and where the last match was, for re-find and re-groups.
+struct jo_clojure_regex_t : jo_object {
+    regex_prog_ptr_t prog;
+    bool is_matcher = false;
+    jo_string input;
+    size_t pos = 0;
+    jo_vector<int> caps;
+
+    jo_clojure_regex_t(regex_prog_ptr_t p) : prog(p) {}
+};
+typedef jo_alloc_t<jo_clojure_regex_t> jo_clojure_regex_alloc_t;
+jo_clojure_regex_alloc_t jo_clojure_regex_alloc;
+typedef jo_shared_ptr_t<jo_clojure_regex_t> jo_clojure_regex_ptr_t;
+template<typename...A>
+jo_clojure_regex_ptr_t new_regex(A...args) { return jo_clojure_regex_ptr_t(jo_clojure_regex_alloc.emplace(args...)); }
+
+static node_idx_t new_node_regex(jo_clojure_regex_ptr_t re, const jo_string &pattern, int flags=0) {
+    node_idx_t idx = new_node_object(NODE_REGEX, re.cast<jo_object>(), flags);
+    get_node(idx)->t_string = pattern;
+    return idx;
+}
+
+// Compiles a pattern into a regex node, or warns and returns nil. The reader uses this for #"...".
+static node_idx_t new_node_regex(const jo_string &pattern, int flags) {
+    jo_string err;
+    regex_prog_ptr_t prog = regex_compile(pattern.c_str(), pattern.length(), err);
+    if(!prog.ptr) {
+        warnf("bad regex #\"%s\": %s\n", pattern.c_str(), err.c_str());
+        return NIL_NODE;
+    }
+    return new_node_regex(new_regex(prog), pattern, flags);
+}
+
+static jo_clojure_regex_t *regex_of(node_idx_t idx) {
+    node_t *n = get_node(idx);
+    if(n->type != NODE_REGEX) return NULL;
+    return (jo_clojure_regex_t*)n->t_object.ptr;
+}
+
+// A string or a vector of the whole match and its groups, the way re-find returns them
+static node_idx_t regex_groups(const jo_string &s, const int *caps, int ngroups) {
+    if(!ngroups) return new_node_string(s.substr(caps[0], caps[1] - caps[0]));
+    vector_ptr_t v = new_vector();
+    for(int g = 0; g <= ngroups; ++g) {
+        int a = caps[g * 2], b = caps[g * 2 + 1];
+        v->push_back_inplace(a < 0 || b < 0 ? NIL_NODE : new_node_string(s.substr(a, b - a)));
+    }
+    return new_node_vector(v);
+}
+
+// Next match at or after *pos, moving *pos past it. An empty match moves one further so the next
+// search can't find the same empty match again.
+static bool regex_next(const regex_prog_t *prog, const jo_string &s, size_t *pos, int *caps) {
+    if(*pos > s.length()) return false;
+    if(!regex_exec(prog, s.c_str(), s.length(), *pos, false, caps)) {
+        *pos = s.length() + 1;
+        return false;
+    }
+    *pos = caps[1] == caps[0] ? caps[1] + 1 : caps[1];
+    return true;
+}
+
+// (re-pattern s)
+// Returns an instance of a compiled regex, for use in re-find, re-matches, re-seq, split and replace.
+static node_idx_t native_re_pattern(env_ptr_t env, list_ptr_t args) {
+    node_idx_t s = args->first_value();
+    if(get_node_type(s) == NODE_REGEX) return s;
+    return new_node_regex(get_node_string(s), 0);
+}
+
+// (re-matcher re s)
+// Returns a matcher over s, for use with re-find and re-groups.
+static node_idx_t native_re_matcher(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_regex_t *re = regex_of(args->first_value());
+    if(!re) {
+        warnf("re-matcher: expected a regex\n");
+        return NIL_NODE;
+    }
+    jo_clojure_regex_ptr_t m = new_regex(re->prog);
+    m->is_matcher = true;
+    m->input = get_node_string(args->second_value());
+    return new_node_regex(m, get_node(args->first_value())->t_string);
+}
+
+// (re-find m)(re-find re s)
+// Returns the next regex match, if any, of string to pattern. Uses re-groups to return the groups.
+static node_idx_t native_re_find(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_regex_t *re = regex_of(args->first_value());
+    if(!re) {
+        warnf("re-find: expected a regex or matcher\n");
+        return NIL_NODE;
+    }
+    int ncap = 2 * (re->prog->ngroups + 1);
+    if(args->size() == 1) {
+        if(!re->is_matcher) {
+            warnf("re-find: expected a matcher\n");
+            return NIL_NODE;
+        }
+        re->caps.resize(ncap);
+        if(!regex_next(re->prog.ptr, re->input, &re->pos, re->caps.data())) {
+            re->caps.clear();
+            return NIL_NODE;
+        }
+        return regex_groups(re->input, re->caps.data(), re->prog->ngroups);
+    }
+    node_t *sn = get_node(args->second_value());
+    jo_string tmp;
+    const jo_string &s = sn->type == NODE_STRING ? sn->t_string : (tmp = sn->as_string());
+    int *caps = (int*)jo_alloca(ncap * sizeof(int));
+    if(!regex_exec(re->prog.ptr, s.c_str(), s.length(), 0, false, caps)) return NIL_NODE;
+    return regex_groups(s, caps, re->prog->ngroups);
+}
+
+// (re-matches re s)
+// Returns the match, if any, of string to pattern, which must span the whole string.
+static node_idx_t native_re_matches(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_regex_t *re = regex_of(args->first_value());
+    if(!re) {
+        warnf("re-matches: expected a regex\n");
+        return NIL_NODE;
+    }
+    node_t *sn = get_node(args->second_value());
+    jo_string tmp;
+    const jo_string &s = sn->type == NODE_STRING ? sn->t_string : (tmp = sn->as_string());
+    int *caps = (int*)jo_alloca(2 * (re->prog->ngroups + 1) * sizeof(int));
+    if(!regex_exec(re->prog.ptr, s.c_str(), s.length(), 0, true, caps)) return NIL_NODE;
+    return regex_groups(s, caps, re->prog->ngroups);
+}
+
+// (re-groups m)
+// Returns the groups from the most recent match of the matcher.
+static node_idx_t native_re_groups(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_regex_t *re = regex_of(args->first_value());
+    if(!re || !re->is_matcher || !re->caps.size()) {
+        warnf("re-groups: no match available\n");
+        return NIL_NODE;
+    }
+    return regex_groups(re->input, re->caps.data(), re->prog->ngroups);
+}
+
+static node_idx_t regex_seq_next(env_ptr_t env, regex_prog_ptr_t prog, jo_string s, size_t pos) {
+    int *caps = (int*)jo_alloca(2 * (prog->ngroups + 1) * sizeof(int));
+    if(!regex_next(prog.ptr, s, &pos, caps)) return NIL_NODE;
+    return new_node_list(list_va(regex_groups(s, caps, prog->ngroups), new_node_native_function("re-seq-next", [prog, s, pos](env_ptr_t env, list_ptr_t args) -> node_idx_t {
+        return regex_seq_next(env, prog, s, pos);
+    }, true, NODE_FLAG_PRERESOLVE)));
+}
+
+// (re-seq re s)
+// Returns a lazy sequence of successive matches of pattern in string.
+static node_idx_t native_re_seq(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_regex_t *re = regex_of(args->first_value());
+    if(!re) {
+        warnf("re-seq: expected a regex\n");
+        return NIL_NODE;
+    }
+    regex_prog_ptr_t prog = re->prog;
+    jo_string s = get_node_string(args->second_value());
+    return new_node_lazy_list(env, new_node_list(list_va(new_node_native_function("re-seq-next", [prog, s](env_ptr_t env, list_ptr_t args) -> node_idx_t {
+        return regex_seq_next(env, prog, s, 0);
+    }, true, NODE_FLAG_PRERESOLVE))));
+}
+
+// (split s re limit) with a regex: Java's rules, a leading empty match makes no empty first piece
+// and, without a limit, trailing empty pieces are dropped.
+static node_idx_t regex_split(const jo_string &s, const regex_prog_t *prog, int limit) {
+    vector_ptr_t V = new_vector();
+    int *caps = (int*)jo_alloca(2 * (prog->ngroups + 1) * sizeof(int));
+    size_t pos = 0, piece = 0;
+    while(limit <= 0 || (int)V->size() < limit - 1) {
+        if(!regex_next(prog, s, &pos, caps)) break;
+        if(caps[1] == 0) continue;
+        if(caps[0] == caps[1] && (size_t)caps[0] >= s.length()) break;
+        V->push_back_inplace(new_node_string(s.substr(piece, caps[0] - piece)));
+        piece = caps[1];
+    }
+    V->push_back_inplace(new_node_string(s.substr(piece)));
+    if(limit == 0) {
+        while(V->size() > 1 && !get_node(V->last_value())->t_string.length()) V->pop_back_inplace();
+    }
+    return new_node_vector(V);
+}
+
+// Appends replacement to out with $n and ${n} replaced by groups; \x is a literal x.
+static void regex_expand(jo_string &out, const jo_string &s, const jo_string &rep, const int *caps, int ngroups) {
+    const char *r = rep.c_str(), *end = r + rep.length();
+    while(r < end) {
+        const char *q = r;
+        while(q < end && *q != '$' && *q != '\\') ++q;
+        out.append(r, q - r);
+        if(q == end) break;
+        if(*q == '\\') {
+            if(q + 1 < end) out += q[1];
+            r = q + 2;
+            continue;
+        }
+        r = q + 1;
+        int g = -1;
+        if(r < end && *r == '{') {
+            const char *close = (const char*)memchr(r, '}', end - r);
+            if(close) {
+                g = atoi(r + 1);
+                r = close + 1;
+            }
+        } else if(r < end && *r >= '0' && *r <= '9') {
+            g = *r++ - '0';
+            while(r < end && *r >= '0' && *r <= '9' && g * 10 + (*r - '0') <= ngroups) g = g * 10 + (*r++ - '0');
+        }
+        if(g < 0 || g > ngroups) {
+            out += '$';
+            continue;
+        }
+        if(caps[g * 2] >= 0) out.append(s.c_str() + caps[g * 2], caps[g * 2 + 1] - caps[g * 2]);
+    }
+}
+
+// (replace s re replacement) with a regex; replacement is a string with $1 style group references
+// or a function of the match (as re-find would return it).
+static node_idx_t regex_replace(env_ptr_t env, const jo_string &s, const regex_prog_t *prog, node_idx_t replacement, bool first_only) {
+    node_t *rn = get_node(replacement);
+    bool is_fn = rn->is_func() || rn->type == NODE_NATIVE_FUNC;
+    jo_string rep = is_fn ? jo_string() : rn->as_string();
+    int *caps = (int*)jo_alloca(2 * (prog->ngroups + 1) * sizeof(int));
+    jo_string out;
+    size_t pos = 0, copied = 0;
+    while(regex_next(prog, s, &pos, caps)) {
+        out.append(s.c_str() + copied, caps[0] - copied);
+        if(is_fn) {
+            out += get_node_string(eval_va(env, replacement, regex_groups(s, caps, prog->ngroups)));
+        } else {
+            regex_expand(out, s, rep, caps, prog->ngroups);
+        }
+        copied = caps[1];
+        if(first_only) break;
+    }
+    if(!copied && !out.length()) return new_node_string(s);
+    out.append(s.c_str() + copied, s.length() - copied);
+    return new_node_string(out);
+}
+
+// (re-quote-replacement replacement)
+// Escapes $ and \ so replacement is used literally by replace.
+static node_idx_t native_re_quote_replacement(env_ptr_t env, list_ptr_t args) {
+    jo_string s = get_node_string(args->first_value());
+    jo_string out;
+    for(size_t i = 0; i < s.length(); ++i) {
+        if(s[i] == '$' || s[i] == '\\') out += '\\';
+        out += s[i];
+    }
+    return new_node_string(out);
+}
+
+void jo_clojure_regex_init(env_ptr_t env) {
+    env->set("re-pattern", new_node_native_function("re-pattern", &native_re_pattern, false, NODE_FLAG_PRERESOLVE));
+    env->set("re-matcher", new_node_native_function("re-matcher", &native_re_matcher, false, NODE_FLAG_PRERESOLVE));
+    env->set("re-find", new_node_native_function("re-find", &native_re_find, false, NODE_FLAG_PRERESOLVE));
+    env->set("re-matches", new_node_native_function("re-matches", &native_re_matches, false, NODE_FLAG_PRERESOLVE));
+    env->set("re-groups", new_node_native_function("re-groups", &native_re_groups, false, NODE_FLAG_PRERESOLVE));
+    env->set("re-seq", new_node_native_function("re-seq", &native_re_seq, false, NODE_FLAG_PRERESOLVE));
+    env->set("re-quote-replacement", new_node_native_function("re-quote-replacement", &native_re_quote_replacement, false, NODE_FLAG_PRERESOLVE));
+}
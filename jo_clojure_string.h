@@ -2,19 +2,36 @@
 
 #include "jo_stdcpp.h"
 
+// Borrows the characters of a string, keyword or symbol node without copying; anything else
+// is converted into tmp.
+static inline const jo_string &string_ref(node_idx_t idx, jo_string &tmp) {
+	node_t *n = get_node(idx);
+	if(n->type == NODE_STRING || n->type == NODE_KEYWORD || n->type == NODE_SYMBOL) return n->t_string;
+	tmp = n->as_string();
+	return tmp;
+}
+
 // concat all arguments as_string
+// Every argument is written into one growing buffer, so (apply str xs) is linear in the output.
 static node_idx_t native_str(env_ptr_t env, list_ptr_t args) {
-	jo_string str;
+	if(args->size() == 1) {
+		node_t *n = get_node(args->first_value());
+		if(n->type == NODE_STRING) return new_node_string(n->t_string);
+	}
+	jo_text_writer_t out(NULL, 256);
 	for(list_t::iterator it(args); it; it++) {
-		node_t *n = get_node(*it);
-		str += n->as_string();
+		get_node(*it)->write(out, 0);
 	}
-	return new_node_string(str);
+	return new_node_string(jo_string(out.buf, out.size));
 }
 
 // Returns the substring of 's' beginning at start inclusive, and ending at end (defaults to length of string), exclusive.
 static node_idx_t native_subs(env_ptr_t env, list_ptr_t args) { 
-	return new_node_string(get_node_string(args->first_value()).substr(get_node_int(args->second_value()), get_node_int(args->third_value()))); 
+	const jo_string &s = get_node(args->first_value())->t_string;
+	long long start = get_node_int(args->second_value());
+	if(args->size() < 3) return new_node_string(s.substr(start));
+	long long end = get_node_int(args->third_value());
+	return new_node_string(s.substr(start, end > start ? end - start : 0)); 
 }
 static node_idx_t native_compare(env_ptr_t env, list_ptr_t args) { return new_node_int(get_node_string(args->first_value()).compare(get_node_string(args->second_value()))); }
 static node_idx_t native_lower_case(env_ptr_t env, list_ptr_t args) { return new_node_string(get_node_string(args->first_value()).lower()); }
@@ -23,20 +40,79 @@ static node_idx_t native_trim(env_ptr_t env, list_ptr_t args) { return new_node_
 static node_idx_t native_triml(env_ptr_t env, list_ptr_t args) { return new_node_string(get_node_string(args->first_value()).ltrim()); }
 static node_idx_t native_trimr(env_ptr_t env, list_ptr_t args) { return new_node_string(get_node_string(args->first_value()).rtrim()); }
 static node_idx_t native_trim_newline(env_ptr_t env, list_ptr_t args) { return new_node_string(get_node_string(args->first_value()).chomp()); }
-static node_idx_t native_string_replace(env_ptr_t env, list_ptr_t args) { return new_node_string(get_node_string(args->first_value()).replace(get_node_string(args->second_value()).c_str(), get_node_string(args->third_value()).c_str())); }
-static node_idx_t native_string_replace_first(env_ptr_t env, list_ptr_t args) { return new_node_string(get_node_string(args->first_value()).replace_first(get_node_string(args->second_value()).c_str(), get_node_string(args->third_value()).c_str())); }
+// (replace s match replacement)(replace s {match replacement ...})
+// The map form replaces every key in one pass; where several keys match at the same place the longest wins.
+static node_idx_t native_string_replace(env_ptr_t env, list_ptr_t args) {
+	jo_string t0, t1, t2;
+	const jo_string &s = string_ref(args->first_value(), t0);
+	node_t *match = get_node(args->second_value());
+	if(match->type == NODE_REGEX) return regex_replace(env, s, regex_of(args->second_value())->prog.ptr, args->third_value(), false);
+	if(!match->is_hash_map()) {
+		return new_node_string(jo_string(s).replace(string_ref(args->second_value(), t1), string_ref(args->third_value(), t2)));
+	}
+	struct needle_t { jo_string from, to; };
+	jo_vector<needle_t> needles;
+	for(hash_map_t::iterator it = match->as_hash_map()->begin(); it; ++it) {
+		needle_t n = { get_node_string(it->first), get_node_string(it->second) };
+		if(n.from.length()) needles.push_back(n);
+	}
+	if(!needles.size()) return new_node_string(s);
+	// longest first, so the first needle that matches at a position is the longest one there
+	jo_sort(&needles[0], (int)needles.size(), [](const needle_t &a, const needle_t &b) { return a.from.length() > b.from.length(); });
+	unsigned char firsts[256];
+	int nfirsts = 0;
+	bool seen[256] = {};
+	for(size_t i = 0; i < needles.size(); ++i) {
+		unsigned char c = needles[i].from[0];
+		if(!seen[c]) seen[c] = true, firsts[nfirsts++] = c;
+	}
+	jo_string out;
+	out.reserve(s.length());
+	const char *p = s.c_str(), *end = p + s.length();
+	while(p < end) {
+		const char *q = jo_memchr_any(p, end, firsts, nfirsts);
+		out.append(p, q - p);
+		if(q == end) break;
+		size_t i = 0;
+		for(; i < needles.size(); ++i) {
+			const jo_string &from = needles[i].from;
+			if((size_t)(end - q) >= from.length() && !memcmp(q, from.c_str(), from.length())) break;
+		}
+		if(i < needles.size()) {
+			out += needles[i].to;
+			p = q + needles[i].from.length();
+		} else {
+			out += *q;
+			p = q + 1;
+		}
+	}
+	return new_node_string(out);
+}
+static node_idx_t native_string_replace_first(env_ptr_t env, list_ptr_t args) {
+	if(get_node_type(args->second_value()) == NODE_REGEX) {
+		jo_string t0;
+		return regex_replace(env, string_ref(args->first_value(), t0), regex_of(args->second_value())->prog.ptr, args->third_value(), true);
+	}
+	return new_node_string(get_node_string(args->first_value()).replace_first(get_node_string(args->second_value()).c_str(), get_node_string(args->third_value()).c_str()));
+}
 static node_idx_t native_is_string(env_ptr_t env, list_ptr_t args) { return new_node_bool(get_node(args->first_value())->is_string()); }
 static node_idx_t native_ston(env_ptr_t env, list_ptr_t args) { return new_node_int(get_node_int(args->first_value())); }
 static node_idx_t native_ntos(env_ptr_t env, list_ptr_t args) { return new_node_string(get_node_string(args->first_value())); }
-static node_idx_t native_includes(env_ptr_t env, list_ptr_t args) { return new_node_bool(get_node_string(args->first_value()).includes(get_node_string(args->second_value()).c_str())); }
-static node_idx_t native_index_of(env_ptr_t env, list_ptr_t args) {  return new_node_int(get_node_string(args->first_value()).index_of(get_node_string(args->second_value()).c_str())); }
-static node_idx_t native_last_index_of(env_ptr_t env, list_ptr_t args) { return new_node_int(get_node_string(args->first_value()).last_index_of(get_node_string(args->second_value()).c_str())); }
-static node_idx_t native_starts_with(env_ptr_t env, list_ptr_t args) {  return new_node_bool(get_node_string(args->first_value()).starts_with(get_node_string(args->second_value()).c_str())); }
-static node_idx_t native_ends_with(env_ptr_t env, list_ptr_t args) { return new_node_bool(get_node_string(args->first_value()).ends_with(get_node_string(args->second_value()).c_str())); }
+static node_idx_t native_includes(env_ptr_t env, list_ptr_t args) { jo_string t0, t1; return new_node_bool(string_ref(args->first_value(), t0).includes(string_ref(args->second_value(), t1))); }
+static node_idx_t native_index_of(env_ptr_t env, list_ptr_t args) { jo_string t0, t1; return new_node_int(string_ref(args->first_value(), t0).index_of(string_ref(args->second_value(), t1))); }
+static node_idx_t native_last_index_of(env_ptr_t env, list_ptr_t args) { jo_string t0, t1; return new_node_int(string_ref(args->first_value(), t0).last_index_of(string_ref(args->second_value(), t1))); }
+static node_idx_t native_starts_with(env_ptr_t env, list_ptr_t args) { jo_string t0, t1; return new_node_bool(string_ref(args->first_value(), t0).starts_with(string_ref(args->second_value(), t1))); }
+static node_idx_t native_ends_with(env_ptr_t env, list_ptr_t args) { jo_string t0, t1; return new_node_bool(string_ref(args->first_value(), t0).ends_with(string_ref(args->second_value(), t1))); }
 // Converts first character of the string to upper-case, all other characters to lower-case.
 static node_idx_t native_capitalize(env_ptr_t env, list_ptr_t args) { return new_node_string(get_node_string(args->first_value()).capitalize()); }
 // True if s is nil, empty, or contains only whitespace.
-static node_idx_t native_is_blank(env_ptr_t env, list_ptr_t args) { node_idx_t v = args->first_value(); return v != NIL_NODE ? get_node_string(v).empty() : TRUE_NODE; }
+static node_idx_t native_is_blank(env_ptr_t env, list_ptr_t args) {
+	node_idx_t v = args->first_value();
+	if(v == NIL_NODE) return TRUE_NODE;
+	jo_string tmp;
+	const jo_string &s = string_ref(v, tmp);
+	return new_node_bool(jo_skip_space(s.c_str(), s.c_str() + s.length()) == s.c_str() + s.length());
+}
 
 // splits a string separated by newlines into a list of strings
 static node_idx_t native_split_lines(env_ptr_t env, list_ptr_t args) {
@@ -70,15 +146,14 @@ static node_idx_t native_join(env_ptr_t env, list_ptr_t args) {
     }
     jo_string sep = get_node(args->second_value())->as_string();
     list_ptr_t list = node->as_list();
-    jo_string str;
+    jo_text_writer_t out(NULL, 256);
     for(list_t::iterator it(list); it;) {
-        node_t *n = get_node(*it++);
-        str += n->as_string();
+        get_node(*it++)->write(out, 0);
         if(it) {
-            str += sep;
+            out.put(sep.c_str(), sep.length());
         }
     }
-    return new_node_string(str);
+    return new_node_string(jo_string(out.buf, out.size));
 }
 
 // (split s re)(split s re limit)
@@ -91,8 +166,9 @@ static node_idx_t native_split(env_ptr_t env, list_ptr_t args) {
 		return NIL_NODE;
 	}
 	jo_string str = node->as_string();
-	jo_string re = get_node(args->second_value())->as_string();
 	int limit = get_node_int(args->third_value());
+	if(get_node_type(args->second_value()) == NODE_REGEX) return regex_split(str, regex_of(args->second_value())->prog.ptr, limit);
+	jo_string re = get_node(args->second_value())->as_string();
 	vector_ptr_t V = new_vector();
 	long long pos = 0;
 	long long prev_pos = 0;
@@ -127,7 +203,7 @@ static node_idx_t native_format(env_ptr_t env, list_ptr_t args) {
         return NIL_NODE;
     }
     
-    jo_string format_str = format_node->t_string;
+    const jo_string &format_str = format_node->t_string;
     ++it;
     
     // Collect all arguments into a vector
@@ -0,0 +1,1363 @@
+#pragma once
+
+// Dense N-dimensional tensors.
+//
+// A tensor is a view (shape, strides and offset, all counted in elements) onto a flat, 64-byte
+// aligned buffer of float or double (TYPE_FLOAT / TYPE_DOUBLE from jo_clojure_array.h).
+// reshape, transpose and slice only make a new view of the same buffer, nothing is copied.
+// Like every other value, a tensor is never mutated once it has been handed out.
+//
+// Elementwise ops broadcast numpy style: shapes are right aligned and dimensions of size 1 stretch.
+
+#define TENSOR_MAX_DIMS 8
+
+enum tensor_op_t {
+    TENSOR_ADD,
+    TENSOR_SUB,
+    TENSOR_MUL,
+    TENSOR_DIV,
+    TENSOR_MAX,
+    TENSOR_MIN,
+};
+
+enum tensor_reduce_t {
+    TENSOR_SUM,
+    TENSOR_MEAN,
+    TENSOR_RMAX,
+    TENSOR_RMIN,
+};
+
+// pass as axis to reduce over every element
+enum { TENSOR_ALL_AXES = -1000 };
+
+struct jo_tensor_storage_t {
+    void *data;
+    long long num_bytes;
+    bool mapped;
+
+    // data is NULL when the allocation fails
+    jo_tensor_storage_t(long long nbytes, bool zero) : num_bytes(nbytes), mapped(false) {
+        data = jo_aligned_malloc(nbytes > 0 ? nbytes : 64, 64);
+        if(!data) {
+            warnf("tensor: can't allocate %lld bytes\n", nbytes);
+        } else if(zero) {
+            jo_memset(data, 0, nbytes);
+        }
+    }
+    // takes ownership of a whole file mapping from jo_mmap_file
+    jo_tensor_storage_t(void *mapping, size_t nbytes) : data(mapping), num_bytes(nbytes), mapped(true) {}
+    jo_tensor_storage_t(const jo_tensor_storage_t &) = delete;
+    ~jo_tensor_storage_t() {
+        if(mapped) jo_munmap_file(data, num_bytes);
+        else jo_aligned_free(data);
+    }
+};
+
+typedef jo_alloc_t<jo_tensor_storage_t> jo_tensor_storage_alloc_t;
+jo_tensor_storage_alloc_t jo_tensor_storage_alloc;
+typedef jo_shared_ptr_t<jo_tensor_storage_t> jo_tensor_storage_ptr_t;
+static jo_tensor_storage_ptr_t new_tensor_storage(long long nbytes, bool zero) { return jo_tensor_storage_ptr_t(jo_tensor_storage_alloc.emplace(nbytes, zero)); }
+static jo_tensor_storage_ptr_t new_tensor_storage_mapped(void *mapping, size_t nbytes) { return jo_tensor_storage_ptr_t(jo_tensor_storage_alloc.emplace(mapping, nbytes)); }
+
+struct jo_clojure_tensor_t;
+
+typedef jo_alloc_t<jo_clojure_tensor_t> jo_clojure_tensor_alloc_t;
+jo_clojure_tensor_alloc_t jo_clojure_tensor_alloc;
+typedef jo_shared_ptr_t<jo_clojure_tensor_t> jo_clojure_tensor_ptr_t;
+template<typename...A>
+jo_clojure_tensor_ptr_t new_tensor(A...args) { return jo_clojure_tensor_ptr_t(jo_clojure_tensor_alloc.emplace(args...)); }
+
+static node_idx_t new_node_tensor(jo_clojure_tensor_ptr_t t, int flags=0) { return new_node_object(NODE_TENSOR, t.cast<jo_object>(), flags); }
+
+struct jo_clojure_tensor_t : jo_object {
+    array_type_t dtype;
+    int ndim;
+    long long shape[TENSOR_MAX_DIMS];
+    long long strides[TENSOR_MAX_DIMS];
+    long long offset;
+    jo_tensor_storage_ptr_t storage;
+    bool acc_f64; // float32 sums and matmuls accumulate in float64, see tensor/accumulator
+
+    // new contiguous (row-major) tensor
+    jo_clojure_tensor_t(array_type_t t, int nd, const long long *dims, bool zero = true) : dtype(t), ndim(nd), offset(0), acc_f64(true) {
+        long long n = 1;
+        for(int i = nd-1; i >= 0; --i) {
+            shape[i] = dims[i];
+            strides[i] = n;
+            n *= dims[i];
+        }
+        storage = new_tensor_storage(n * element_size(), zero);
+    }
+
+    // new contiguous view of existing storage, starting offset elements in
+    jo_clojure_tensor_t(array_type_t t, int nd, const long long *dims, jo_tensor_storage_ptr_t s, long long off) : dtype(t), ndim(nd), offset(off), storage(s), acc_f64(true) {
+        long long n = 1;
+        for(int i = nd-1; i >= 0; --i) {
+            shape[i] = dims[i];
+            strides[i] = n;
+            n *= dims[i];
+        }
+    }
+
+    // new view of other's storage
+    jo_clojure_tensor_t(const jo_clojure_tensor_t &other) : dtype(other.dtype), ndim(other.ndim), offset(other.offset), storage(other.storage), acc_f64(other.acc_f64) {
+        for(int i = 0; i < ndim; ++i) {
+            shape[i] = other.shape[i];
+            strides[i] = other.strides[i];
+        }
+    }
+
+    inline int element_size() const { return dtype == TYPE_FLOAT ? sizeof(float) : sizeof(double); }
+
+    long long size() const {
+        long long n = 1;
+        for(int i = 0; i < ndim; ++i) n *= shape[i];
+        return n;
+    }
+
+    bool is_contiguous() const {
+        long long n = 1;
+        for(int i = ndim-1; i >= 0; --i) {
+            if(shape[i] != 1 && strides[i] != n) return false;
+            n *= shape[i];
+        }
+        return true;
+    }
+
+    template<typename T> inline T *data() const { return (T*)storage->data + offset; }
+
+    // element offset (relative to data()) of the i'th element in row-major order
+    long long offset_of(long long i) const {
+        long long off = 0;
+        for(int d = ndim-1; d >= 0; --d) {
+            off += (i % shape[d]) * strides[d];
+            i /= shape[d];
+        }
+        return off;
+    }
+
+    double get_flat(long long i) const {
+        long long off = offset_of(i);
+        return dtype == TYPE_FLOAT ? data<float>()[off] : data<double>()[off];
+    }
+
+    bool same_shape(const jo_clojure_tensor_t &other) const {
+        if(ndim != other.ndim) return false;
+        for(int i = 0; i < ndim; ++i) {
+            if(shape[i] != other.shape[i]) return false;
+        }
+        return true;
+    }
+};
+
+static inline jo_clojure_tensor_ptr_t new_tensor_like(const jo_clojure_tensor_ptr_t &t, bool zero = true) {
+    jo_clojure_tensor_ptr_t r = new_tensor(t->dtype, t->ndim, t->shape, zero);
+    r->acc_f64 = t->acc_f64;
+    return r;
+}
+
+static inline jo_clojure_tensor_ptr_t new_tensor_2d(array_type_t dtype, long long rows, long long cols, bool zero = true) {
+    long long dims[2] = {rows, cols};
+    return new_tensor(dtype, 2, dims, zero);
+}
+
+static inline const char *tensor_dtype_name(array_type_t dtype) { return dtype == TYPE_FLOAT ? "float32" : "float64"; }
+
+// Walks every innermost row of an N-d shape, tracking the element offset of up to three operands.
+// fn(off_a, off_b, off_c, n) is called once per row of n elements.
+template<typename F>
+static void tensor_walk(int ndim, const long long *shape, const long long *sa, const long long *sb, const long long *sc, F fn) {
+    if(ndim == 0) {
+        fn(0ll, 0ll, 0ll, 1ll);
+        return;
+    }
+    long long outer = 1;
+    for(int d = 0; d < ndim; ++d) {
+        if(shape[d] == 0) return;
+        if(d < ndim-1) outer *= shape[d];
+    }
+    long long inner = shape[ndim-1];
+    long long idx[TENSOR_MAX_DIMS] = {};
+    long long oa = 0, ob = 0, oc = 0;
+    for(long long o = 0; o < outer; ++o) {
+        fn(oa, ob, oc, inner);
+        for(int d = ndim-2; d >= 0; --d) {
+            oa += sa[d];
+            ob += sb[d];
+            oc += sc[d];
+            if(++idx[d] < shape[d]) break;
+            oa -= sa[d] * shape[d];
+            ob -= sb[d] * shape[d];
+            oc -= sc[d] * shape[d];
+            idx[d] = 0;
+        }
+    }
+}
+
+// Copies (and converts) src into dst, which must have the same shape.
+static void tensor_copy_into(const jo_clojure_tensor_ptr_t &dst, const jo_clojure_tensor_ptr_t &src) {
+    int nd = src->ndim;
+    long long ids = nd ? dst->strides[nd-1] : 0, iss = nd ? src->strides[nd-1] : 0;
+    auto copy = [&](auto *d, auto *s) {
+        tensor_walk(nd, src->shape, dst->strides, src->strides, src->strides, [&](long long od, long long os, long long, long long n) {
+            auto *dd = d + od;
+            auto *ss = s + os;
+            if(ids == 1 && iss == 1) {
+                for(long long i = 0; i < n; ++i) dd[i] = ss[i];
+            } else {
+                for(long long i = 0; i < n; ++i) dd[i*ids] = ss[i*iss];
+            }
+        });
+    };
+    if(dst->dtype == TYPE_FLOAT) {
+        if(src->dtype == TYPE_FLOAT) copy(dst->data<float>(), src->data<float>());
+        else copy(dst->data<float>(), src->data<double>());
+    } else {
+        if(src->dtype == TYPE_FLOAT) copy(dst->data<double>(), src->data<float>());
+        else copy(dst->data<double>(), src->data<double>());
+    }
+}
+
+static jo_clojure_tensor_ptr_t tensor_contiguous(const jo_clojure_tensor_ptr_t &t) {
+    if(t->is_contiguous()) return t;
+    jo_clojure_tensor_ptr_t r = new_tensor_like(t, false);
+    tensor_copy_into(r, t);
+    return r;
+}
+
+static jo_clojure_tensor_ptr_t tensor_astype(const jo_clojure_tensor_ptr_t &t, array_type_t dtype) {
+    if(t->dtype == dtype) return t;
+    jo_clojure_tensor_ptr_t r = new_tensor(dtype, t->ndim, t->shape, false);
+    tensor_copy_into(r, t);
+    return r;
+}
+
+// null if the storage couldn't be allocated
+static jo_clojure_tensor_ptr_t tensor_full(array_type_t dtype, int nd, const long long *dims, double value) {
+    jo_clojure_tensor_ptr_t r = new_tensor(dtype, nd, dims, value == 0);
+    if(!r->storage->data) {
+        return jo_clojure_tensor_ptr_t();
+    }
+    if(value != 0) {
+        long long n = r->size();
+        if(dtype == TYPE_FLOAT) {
+            float *d = r->data<float>();
+            for(long long i = 0; i < n; ++i) d[i] = (float)value;
+        } else {
+            double *d = r->data<double>();
+            for(long long i = 0; i < n; ++i) d[i] = value;
+        }
+    }
+    return r;
+}
+
+static jo_clojure_tensor_ptr_t tensor_scalar(double value, array_type_t dtype = TYPE_DOUBLE) {
+    return tensor_full(dtype, 0, NULL, value);
+}
+
+// Computes the broadcast shape of a and b, and the strides to read each operand with.
+static bool tensor_broadcast(const jo_clojure_tensor_t &a, const jo_clojure_tensor_t &b, int &nd, long long *shape, long long *sa, long long *sb) {
+    nd = jo_max(a.ndim, b.ndim);
+    for(int d = 0; d < nd; ++d) {
+        int ia = d - (nd - a.ndim);
+        int ib = d - (nd - b.ndim);
+        long long da = ia >= 0 ? a.shape[ia] : 1;
+        long long db = ib >= 0 ? b.shape[ib] : 1;
+        if(da != db && da != 1 && db != 1) {
+            return false;
+        }
+        shape[d] = da == 1 ? db : da;
+        sa[d] = da == 1 ? 0 : a.strides[ia];
+        sb[d] = db == 1 ? 0 : b.strides[ib];
+    }
+    return true;
+}
+
+// Float32 kernels that use AVX2 (8 floats per register) when the CPU has it. They're compiled for
+// AVX2 + FMA with a target attribute and picked at runtime, so the binary still runs anywhere.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define TENSOR_AVX2
+#define TENSOR_AVX2_FN __attribute__((target("avx2,fma")))
+#include <immintrin.h>
+#endif
+
+static bool tensor_has_avx2() {
+#ifdef TENSOR_AVX2
+    static int has = -1;
+    if(has < 0) {
+        __builtin_cpu_init();
+        has = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }
+    return has != 0;
+#else
+    return false;
+#endif
+}
+
+#ifdef TENSOR_AVX2
+// c[i] = a[i] op b[i], where a stride of 0 repeats the first element
+template<tensor_op_t OP>
+TENSOR_AVX2_FN static void tensor_binary_row_avx2(const float *a, long long sa, const float *b, long long sb, float *c, long long n) {
+    __m256 av = _mm256_set1_ps(*a), bv = _mm256_set1_ps(*b);
+    long long i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m256 x = sa ? _mm256_loadu_ps(a + i) : av;
+        __m256 y = sb ? _mm256_loadu_ps(b + i) : bv;
+        __m256 r;
+        if(OP == TENSOR_ADD) r = _mm256_add_ps(x, y);
+        else if(OP == TENSOR_SUB) r = _mm256_sub_ps(x, y);
+        else if(OP == TENSOR_MUL) r = _mm256_mul_ps(x, y);
+        else if(OP == TENSOR_DIV) r = _mm256_div_ps(x, y);
+        else if(OP == TENSOR_MAX) r = _mm256_max_ps(x, y);
+        else r = _mm256_min_ps(x, y);
+        _mm256_storeu_ps(c + i, r);
+    }
+    for(; i < n; ++i) {
+        float x = a[i*sa], y = b[i*sb];
+        if(OP == TENSOR_ADD) c[i] = x + y;
+        else if(OP == TENSOR_SUB) c[i] = x - y;
+        else if(OP == TENSOR_MUL) c[i] = x * y;
+        else if(OP == TENSOR_DIV) c[i] = x / y;
+        else if(OP == TENSOR_MAX) c[i] = x > y ? x : y;
+        else c[i] = x < y ? x : y;
+    }
+}
+
+TENSOR_AVX2_FN static double tensor_sum_avx2(const float *a, long long n, bool acc64) {
+    long long i = 0;
+    if(acc64) {
+        __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+        for(; i + 8 <= n; i += 8) {
+            __m256 x = _mm256_loadu_ps(a + i);
+            s0 = _mm256_add_pd(s0, _mm256_cvtps_pd(_mm256_castps256_ps128(x)));
+            s1 = _mm256_add_pd(s1, _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)));
+        }
+        double tmp[4];
+        _mm256_storeu_pd(tmp, _mm256_add_pd(s0, s1));
+        double acc = (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+        for(; i < n; ++i) acc += a[i];
+        return acc;
+    }
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    for(; i + 16 <= n; i += 16) {
+        s0 = _mm256_add_ps(s0, _mm256_loadu_ps(a + i));
+        s1 = _mm256_add_ps(s1, _mm256_loadu_ps(a + i + 8));
+    }
+    for(; i + 8 <= n; i += 8) {
+        s0 = _mm256_add_ps(s0, _mm256_loadu_ps(a + i));
+    }
+    float tmp[8];
+    _mm256_storeu_ps(tmp, _mm256_add_ps(s0, s1));
+    float acc = ((tmp[0] + tmp[1]) + (tmp[2] + tmp[3])) + ((tmp[4] + tmp[5]) + (tmp[6] + tmp[7]));
+    for(; i < n; ++i) acc += a[i];
+    return acc;
+}
+
+// R rows of C[n,m] = A[n,k] * B[k,m], built 16 columns at a time in registers so each load of B
+// is shared by R rows of A
+template<int R>
+TENSOR_AVX2_FN static inline void tensor_gemm_avx2_rows(long long k, long long m, const float *a, long long lda, const float *b, long long ldb, float *c, long long ldc) {
+    long long j = 0;
+    for(; j + 16 <= m; j += 16) {
+        __m256 acc[R][2];
+        for(int r = 0; r < R; ++r) acc[r][0] = acc[r][1] = _mm256_setzero_ps();
+        const float *bp = b + j;
+        for(long long p = 0; p < k; ++p, bp += ldb) {
+            __m256 b0 = _mm256_loadu_ps(bp), b1 = _mm256_loadu_ps(bp + 8);
+            for(int r = 0; r < R; ++r) {
+                __m256 av = _mm256_set1_ps(a[r*lda + p]);
+                acc[r][0] = _mm256_fmadd_ps(av, b0, acc[r][0]);
+                acc[r][1] = _mm256_fmadd_ps(av, b1, acc[r][1]);
+            }
+        }
+        for(int r = 0; r < R; ++r) {
+            _mm256_storeu_ps(c + r*ldc + j, acc[r][0]);
+            _mm256_storeu_ps(c + r*ldc + j + 8, acc[r][1]);
+        }
+    }
+    for(; j + 8 <= m; j += 8) {
+        __m256 acc[R];
+        for(int r = 0; r < R; ++r) acc[r] = _mm256_setzero_ps();
+        const float *bp = b + j;
+        for(long long p = 0; p < k; ++p, bp += ldb) {
+            __m256 b0 = _mm256_loadu_ps(bp);
+            for(int r = 0; r < R; ++r) acc[r] = _mm256_fmadd_ps(_mm256_set1_ps(a[r*lda + p]), b0, acc[r]);
+        }
+        for(int r = 0; r < R; ++r) _mm256_storeu_ps(c + r*ldc + j, acc[r]);
+    }
+    for(; j < m; ++j) {
+        for(int r = 0; r < R; ++r) {
+            float sum = 0;
+            for(long long p = 0; p < k; ++p) sum += a[r*lda + p] * b[p*ldb + j];
+            c[r*ldc + j] = sum;
+        }
+    }
+}
+
+// Same, accumulating in float64: 8 columns at a time as two registers of 4 doubles
+template<int R>
+TENSOR_AVX2_FN static inline void tensor_gemm_avx2_rows_acc64(long long k, long long m, const float *a, long long lda, const float *b, long long ldb, float *c, long long ldc) {
+    long long j = 0;
+    for(; j + 8 <= m; j += 8) {
+        __m256d acc[R][2];
+        for(int r = 0; r < R; ++r) acc[r][0] = acc[r][1] = _mm256_setzero_pd();
+        const float *bp = b + j;
+        for(long long p = 0; p < k; ++p, bp += ldb) {
+            __m256 bv = _mm256_loadu_ps(bp);
+            __m256d b0 = _mm256_cvtps_pd(_mm256_castps256_ps128(bv)), b1 = _mm256_cvtps_pd(_mm256_extractf128_ps(bv, 1));
+            for(int r = 0; r < R; ++r) {
+                __m256d av = _mm256_set1_pd(a[r*lda + p]);
+                acc[r][0] = _mm256_fmadd_pd(av, b0, acc[r][0]);
+                acc[r][1] = _mm256_fmadd_pd(av, b1, acc[r][1]);
+            }
+        }
+        for(int r = 0; r < R; ++r) {
+            _mm_storeu_ps(c + r*ldc + j, _mm256_cvtpd_ps(acc[r][0]));
+            _mm_storeu_ps(c + r*ldc + j + 4, _mm256_cvtpd_ps(acc[r][1]));
+        }
+    }
+    for(; j < m; ++j) {
+        for(int r = 0; r < R; ++r) {
+            double sum = 0;
+            for(long long p = 0; p < k; ++p) sum += (double)a[r*lda + p] * b[p*ldb + j];
+            c[r*ldc + j] = (float)sum;
+        }
+    }
+}
+
+// C[n,m] = A[n,k] * B[k,m] for float32, four rows at a time
+TENSOR_AVX2_FN static void tensor_gemm_avx2(long long n, long long k, long long m, const float *a, long long lda, const float *b, long long ldb, float *c, long long ldc, bool acc64) {
+    long long i = 0;
+    for(; i + 4 <= n; i += 4) {
+        if(acc64) tensor_gemm_avx2_rows_acc64<4>(k, m, a + i*lda, lda, b, ldb, c + i*ldc, ldc);
+        else tensor_gemm_avx2_rows<4>(k, m, a + i*lda, lda, b, ldb, c + i*ldc, ldc);
+    }
+    for(; i < n; ++i) {
+        if(acc64) tensor_gemm_avx2_rows_acc64<1>(k, m, a + i*lda, lda, b, ldb, c + i*ldc, ldc);
+        else tensor_gemm_avx2_rows<1>(k, m, a + i*lda, lda, b, ldb, c + i*ldc, ldc);
+    }
+}
+#endif
+
+template<typename T, typename F>
+static inline void tensor_binary_row(const T *a, long long sa, const T *b, long long sb, T *c, long long n, F f) {
+    if(sa == 1 && sb == 1) {
+        for(long long i = 0; i < n; ++i) c[i] = f(a[i], b[i]);
+    } else if(sa == 1 && sb == 0) {
+        T bv = *b;
+        for(long long i = 0; i < n; ++i) c[i] = f(a[i], bv);
+    } else if(sa == 0 && sb == 1) {
+        T av = *a;
+        for(long long i = 0; i < n; ++i) c[i] = f(av, b[i]);
+    } else {
+        for(long long i = 0; i < n; ++i) c[i] = f(a[i*sa], b[i*sb]);
+    }
+}
+
+template<typename T>
+static void tensor_binary_kernel(tensor_op_t op, const jo_clojure_tensor_ptr_t &A, const jo_clojure_tensor_ptr_t &B, const jo_clojure_tensor_ptr_t &C, int nd, const long long *sa, const long long *sb) {
+    long long isa = nd ? sa[nd-1] : 0, isb = nd ? sb[nd-1] : 0;
+    const T *a = A->data<T>();
+    const T *b = B->data<T>();
+    T *c = C->data<T>();
+#ifdef TENSOR_AVX2
+    if(sizeof(T) == sizeof(float) && (isa == 0 || isa == 1) && (isb == 0 || isb == 1) && tensor_has_avx2()) {
+        const float *af = (const float*)a, *bf = (const float*)b;
+        float *cf = (float*)c;
+        tensor_walk(nd, C->shape, sa, sb, C->strides, [&](long long oa, long long ob, long long oc, long long n) {
+            switch(op) {
+            case TENSOR_ADD: tensor_binary_row_avx2<TENSOR_ADD>(af+oa, isa, bf+ob, isb, cf+oc, n); break;
+            case TENSOR_SUB: tensor_binary_row_avx2<TENSOR_SUB>(af+oa, isa, bf+ob, isb, cf+oc, n); break;
+            case TENSOR_MUL: tensor_binary_row_avx2<TENSOR_MUL>(af+oa, isa, bf+ob, isb, cf+oc, n); break;
+            case TENSOR_DIV: tensor_binary_row_avx2<TENSOR_DIV>(af+oa, isa, bf+ob, isb, cf+oc, n); break;
+            case TENSOR_MAX: tensor_binary_row_avx2<TENSOR_MAX>(af+oa, isa, bf+ob, isb, cf+oc, n); break;
+            case TENSOR_MIN: tensor_binary_row_avx2<TENSOR_MIN>(af+oa, isa, bf+ob, isb, cf+oc, n); break;
+            }
+        });
+        return;
+    }
+#endif
+    tensor_walk(nd, C->shape, sa, sb, C->strides, [&](long long oa, long long ob, long long oc, long long n) {
+        switch(op) {
+        case TENSOR_ADD: tensor_binary_row(a+oa, isa, b+ob, isb, c+oc, n, [](T x, T y) { return x + y; }); break;
+        case TENSOR_SUB: tensor_binary_row(a+oa, isa, b+ob, isb, c+oc, n, [](T x, T y) { return x - y; }); break;
+        case TENSOR_MUL: tensor_binary_row(a+oa, isa, b+ob, isb, c+oc, n, [](T x, T y) { return x * y; }); break;
+        case TENSOR_DIV: tensor_binary_row(a+oa, isa, b+ob, isb, c+oc, n, [](T x, T y) { return x / y; }); break;
+        case TENSOR_MAX: tensor_binary_row(a+oa, isa, b+ob, isb, c+oc, n, [](T x, T y) { return x > y ? x : y; }); break;
+        case TENSOR_MIN: tensor_binary_row(a+oa, isa, b+ob, isb, c+oc, n, [](T x, T y) { return x < y ? x : y; }); break;
+        }
+    });
+}
+
+// Scalars (0-d tensors) take on the other operand's dtype, otherwise float32 op float64 is float64.
+static array_type_t tensor_result_dtype(const jo_clojure_tensor_ptr_t &A, const jo_clojure_tensor_ptr_t &B) {
+    if(A->ndim == 0 && B->ndim != 0) return B->dtype;
+    if(B->ndim == 0 && A->ndim != 0) return A->dtype;
+    return (A->dtype == TYPE_DOUBLE || B->dtype == TYPE_DOUBLE) ? TYPE_DOUBLE : TYPE_FLOAT;
+}
+
+static jo_clojure_tensor_ptr_t tensor_binary(const jo_clojure_tensor_ptr_t &A_in, const jo_clojure_tensor_ptr_t &B_in, tensor_op_t op) {
+    array_type_t dtype = tensor_result_dtype(A_in, B_in);
+    jo_clojure_tensor_ptr_t A = tensor_astype(A_in, dtype);
+    jo_clojure_tensor_ptr_t B = tensor_astype(B_in, dtype);
+    int nd;
+    long long shape[TENSOR_MAX_DIMS], sa[TENSOR_MAX_DIMS], sb[TENSOR_MAX_DIMS];
+    if(!tensor_broadcast(*A, *B, nd, shape, sa, sb)) {
+        return NULL;
+    }
+    jo_clojure_tensor_ptr_t C = new_tensor(dtype, nd, shape, false);
+    if(dtype == TYPE_FLOAT) {
+        tensor_binary_kernel<float>(op, A, B, C, nd, sa, sb);
+    } else {
+        tensor_binary_kernel<double>(op, A, B, C, nd, sa, sb);
+    }
+    return C;
+}
+
+// Applies f elementwise. f is called with float or double depending on the tensor's dtype.
+template<typename F>
+static jo_clojure_tensor_ptr_t tensor_map(const jo_clojure_tensor_ptr_t &A, F f) {
+    jo_clojure_tensor_ptr_t C = new_tensor_like(A, false);
+    int nd = A->ndim;
+    long long isa = nd ? A->strides[nd-1] : 0;
+    auto run = [&](auto *a, auto *c) {
+        tensor_walk(nd, A->shape, A->strides, C->strides, C->strides, [&](long long oa, long long oc, long long, long long n) {
+            auto *aa = a + oa;
+            auto *cc = c + oc;
+            if(isa == 1) {
+                for(long long i = 0; i < n; ++i) cc[i] = f(aa[i]);
+            } else {
+                for(long long i = 0; i < n; ++i) cc[i] = f(aa[i*isa]);
+            }
+        });
+    };
+    if(A->dtype == TYPE_FLOAT) {
+        run(A->data<float>(), C->data<float>());
+    } else {
+        run(A->data<double>(), C->data<double>());
+    }
+    return C;
+}
+
+// Normalizes a possibly negative axis. Returns -1 if out of range.
+static int tensor_axis(const jo_clojure_tensor_t &t, int axis) {
+    if(axis < 0) axis += t.ndim;
+    return (axis < 0 || axis >= t.ndim) ? -1 : axis;
+}
+
+static jo_clojure_tensor_ptr_t tensor_permute(const jo_clojure_tensor_ptr_t &A, const int *axes) {
+    jo_clojure_tensor_ptr_t r = new_tensor(*A);
+    for(int i = 0; i < A->ndim; ++i) {
+        r->shape[i] = A->shape[axes[i]];
+        r->strides[i] = A->strides[axes[i]];
+    }
+    return r;
+}
+
+// swaps the last two dimensions
+static jo_clojure_tensor_ptr_t tensor_transpose(const jo_clojure_tensor_ptr_t &A) {
+    if(A->ndim < 2) return A;
+    int axes[TENSOR_MAX_DIMS];
+    for(int i = 0; i < A->ndim; ++i) axes[i] = i;
+    jo_swap(axes[A->ndim-1], axes[A->ndim-2]);
+    return tensor_permute(A, axes);
+}
+
+// A dimension of -1 is inferred from the remaining ones. Returns a view when A is contiguous.
+static jo_clojure_tensor_ptr_t tensor_reshape(const jo_clojure_tensor_ptr_t &A, int nd, const long long *dims_in) {
+    long long dims[TENSOR_MAX_DIMS];
+    long long known = 1;
+    int infer = -1;
+    for(int i = 0; i < nd; ++i) {
+        dims[i] = dims_in[i];
+        if(dims[i] < 0) {
+            if(infer >= 0) return NULL;
+            infer = i;
+        } else {
+            known *= dims[i];
+        }
+    }
+    long long total = A->size();
+    if(infer >= 0) {
+        if(known == 0 || total % known) return NULL;
+        dims[infer] = total / known;
+    } else if(known != total) {
+        return NULL;
+    }
+    jo_clojure_tensor_ptr_t r = new_tensor(*tensor_contiguous(A));
+    r->ndim = nd;
+    long long n = 1;
+    for(int i = nd-1; i >= 0; --i) {
+        r->shape[i] = dims[i];
+        r->strides[i] = n;
+        n *= dims[i];
+    }
+    return r;
+}
+
+// view of [start, end) along axis
+static jo_clojure_tensor_ptr_t tensor_slice(const jo_clojure_tensor_ptr_t &A, int axis, long long start, long long end) {
+    axis = tensor_axis(*A, axis);
+    if(axis < 0) return NULL;
+    start = jo_max(0ll, jo_min(start, A->shape[axis]));
+    end = jo_max(start, jo_min(end, A->shape[axis]));
+    jo_clojure_tensor_ptr_t r = new_tensor(*A);
+    r->offset += start * A->strides[axis];
+    r->shape[axis] = end - start;
+    return r;
+}
+
+static double tensor_reduce_row(tensor_reduce_t op, const jo_clojure_tensor_ptr_t &A, long long off, long long n, long long stride) {
+    double acc = op == TENSOR_RMAX ? -INFINITY : (op == TENSOR_RMIN ? INFINITY : 0.0);
+    if(A->dtype == TYPE_FLOAT && (op == TENSOR_SUM || op == TENSOR_MEAN) && (stride == 1 || !A->acc_f64)) {
+        const float *a = A->data<float>() + off;
+#ifdef TENSOR_AVX2
+        if(stride == 1 && tensor_has_avx2()) {
+            acc = tensor_sum_avx2(a, n, A->acc_f64);
+        } else
+#endif
+        if(A->acc_f64) {
+            for(long long i = 0; i < n; ++i) acc += a[i];
+        } else {
+            float facc = 0;
+            for(long long i = 0; i < n; ++i) facc += a[i*stride];
+            acc = facc;
+        }
+        if(op == TENSOR_MEAN && n > 0) acc /= n;
+        return acc;
+    }
+    auto run = [&](auto *a) {
+        a += off;
+        for(long long i = 0; i < n; ++i) {
+            double v = a[i*stride];
+            if(op == TENSOR_RMAX) acc = v > acc ? v : acc;
+            else if(op == TENSOR_RMIN) acc = v < acc ? v : acc;
+            else acc += v;
+        }
+    };
+    if(A->dtype == TYPE_FLOAT) run(A->data<float>());
+    else run(A->data<double>());
+    if(op == TENSOR_MEAN && n > 0) acc /= n;
+    return acc;
+}
+
+// Reduces along axis (or every axis with TENSOR_ALL_AXES). Accumulates in double.
+static jo_clojure_tensor_ptr_t tensor_reduce(const jo_clojure_tensor_ptr_t &A_in, tensor_reduce_t op, int axis = TENSOR_ALL_AXES, bool keepdims = false) {
+    if(axis == TENSOR_ALL_AXES) {
+        jo_clojure_tensor_ptr_t A = tensor_contiguous(A_in);
+        long long dims[TENSOR_MAX_DIMS];
+        for(int i = 0; i < A->ndim; ++i) dims[i] = 1;
+        jo_clojure_tensor_ptr_t r = tensor_full(A->dtype, keepdims ? A->ndim : 0, dims, tensor_reduce_row(op, A, 0, A->size(), 1));
+        r->acc_f64 = A->acc_f64;
+        return r;
+    }
+    axis = tensor_axis(*A_in, axis);
+    if(axis < 0) return NULL;
+    // move the reduced axis last so each output element is one strided row
+    int axes[TENSOR_MAX_DIMS], j = 0;
+    for(int i = 0; i < A_in->ndim; ++i) if(i != axis) axes[j++] = i;
+    axes[j] = axis;
+    jo_clojure_tensor_ptr_t P = tensor_permute(A_in, axes);
+    long long len = A_in->shape[axis];
+    long long dims[TENSOR_MAX_DIMS];
+    int nd = 0;
+    for(int i = 0; i < A_in->ndim; ++i) {
+        if(i != axis) dims[nd++] = A_in->shape[i];
+        else if(keepdims) dims[nd++] = 1;
+    }
+    jo_clojure_tensor_ptr_t r = new_tensor(A_in->dtype, nd, dims, false);
+    r->acc_f64 = A_in->acc_f64;
+    long long outer = r->size();
+    long long stride = P->strides[P->ndim-1];
+    for(long long o = 0; o < outer; ++o) {
+        double v = tensor_reduce_row(op, P, P->offset_of(o * len), len, stride);
+        if(r->dtype == TYPE_FLOAT) r->data<float>()[o] = (float)v;
+        else r->data<double>()[o] = v;
+    }
+    return r;
+}
+
+// C[n,m] = A[n,k] * B[k,m], all row-major with leading dimensions lda/ldb/ldc.
+// acc_f64 only matters for the float32 overload below
+template<typename T>
+static void tensor_gemm(long long n, long long k, long long m, const T *a, long long lda, const T *b, long long ldb, T *c, long long ldc, bool acc_f64 = true) {
+    for(long long i = 0; i < n; ++i) {
+        T *ci = c + i*ldc;
+        for(long long j = 0; j < m; ++j) ci[j] = 0;
+        const T *ai = a + i*lda;
+        for(long long p = 0; p < k; ++p) {
+            T aip = ai[p];
+            if(aip == 0) continue;
+            const T *bp = b + p*ldb;
+            for(long long j = 0; j < m; ++j) ci[j] += aip * bp[j];
+        }
+    }
+}
+
+// float32 picks the AVX2 kernel when it can, and accumulates in float64 if acc_f64 is set
+static void tensor_gemm(long long n, long long k, long long m, const float *a, long long lda, const float *b, long long ldb, float *c, long long ldc, bool acc_f64) {
+#ifdef TENSOR_AVX2
+    if(tensor_has_avx2()) {
+        tensor_gemm_avx2(n, k, m, a, lda, b, ldb, c, ldc, acc_f64);
+        return;
+    }
+#endif
+    if(!acc_f64) {
+        tensor_gemm<float>(n, k, m, a, lda, b, ldb, c, ldc, false);
+        return;
+    }
+    jo_vector<double> acc(m);
+    for(long long i = 0; i < n; ++i) {
+        for(long long j = 0; j < m; ++j) acc[j] = 0;
+        const float *ai = a + i*lda;
+        for(long long p = 0; p < k; ++p) {
+            double aip = ai[p];
+            if(aip == 0) continue;
+            const float *bp = b + p*ldb;
+            for(long long j = 0; j < m; ++j) acc[j] += aip * bp[j];
+        }
+        float *ci = c + i*ldc;
+        for(long long j = 0; j < m; ++j) ci[j] = (float)acc[j];
+    }
+}
+
+// Batched matrix multiply over the last two dimensions; leading (batch) dimensions broadcast.
+// 1-d operands are treated as a row (left) or column (right) vector and squeezed from the result.
+static jo_clojure_tensor_ptr_t tensor_matmul(const jo_clojure_tensor_ptr_t &A_in, const jo_clojure_tensor_ptr_t &B_in) {
+    if(A_in->ndim == 0 || B_in->ndim == 0) {
+        return tensor_binary(A_in, B_in, TENSOR_MUL);
+    }
+    array_type_t dtype = tensor_result_dtype(A_in, B_in);
+    // float32 accumulation only when neither operand asks for float64
+    bool acc_f64 = A_in->acc_f64 || B_in->acc_f64;
+    jo_clojure_tensor_ptr_t A = tensor_contiguous(tensor_astype(A_in, dtype));
+    jo_clojure_tensor_ptr_t B = tensor_contiguous(tensor_astype(B_in, dtype));
+    bool squeeze_a = A->ndim == 1, squeeze_b = B->ndim == 1;
+    if(squeeze_a) {
+        long long dims[2] = {1, A->shape[0]};
+        A = tensor_reshape(A, 2, dims);
+    }
+    if(squeeze_b) {
+        long long dims[2] = {B->shape[0], 1};
+        B = tensor_reshape(B, 2, dims);
+    }
+    long long n = A->shape[A->ndim-2], k = A->shape[A->ndim-1];
+    long long k2 = B->shape[B->ndim-2], m = B->shape[B->ndim-1];
+    if(k != k2) {
+        return NULL;
+    }
+
+    // broadcast the batch dimensions
+    jo_clojure_tensor_t Ab(*A), Bb(*B);
+    Ab.ndim -= 2;
+    Bb.ndim -= 2;
+    int nb;
+    long long bshape[TENSOR_MAX_DIMS], sa[TENSOR_MAX_DIMS], sb[TENSOR_MAX_DIMS];
+    if(!tensor_broadcast(Ab, Bb, nb, bshape, sa, sb) || nb + 2 > TENSOR_MAX_DIMS) {
+        return NULL;
+    }
+    long long dims[TENSOR_MAX_DIMS];
+    for(int i = 0; i < nb; ++i) dims[i] = bshape[i];
+    dims[nb] = n;
+    dims[nb+1] = m;
+    jo_clojure_tensor_ptr_t C = new_tensor(dtype, nb+2, dims, false);
+    C->acc_f64 = acc_f64;
+    long long batches = 1;
+    for(int i = 0; i < nb; ++i) batches *= bshape[i];
+    for(long long bi = 0; bi < batches; ++bi) {
+        long long oa = 0, ob = 0, rem = bi;
+        for(int d = nb-1; d >= 0; --d) {
+            long long id = rem % bshape[d];
+            rem /= bshape[d];
+            oa += id * sa[d];
+            ob += id * sb[d];
+        }
+        if(dtype == TYPE_FLOAT) {
+            tensor_gemm(n, k, m, A->data<float>() + oa, k, B->data<float>() + ob, m, C->data<float>() + bi*n*m, m, acc_f64);
+        } else {
+            tensor_gemm(n, k, m, A->data<double>() + oa, k, B->data<double>() + ob, m, C->data<double>() + bi*n*m, m);
+        }
+    }
+    if(squeeze_a || squeeze_b) {
+        int nd = 0;
+        for(int i = 0; i < nb; ++i) dims[nd++] = bshape[i];
+        if(!squeeze_a) dims[nd++] = n;
+        if(!squeeze_b) dims[nd++] = m;
+        C = tensor_reshape(C, nd, dims);
+    }
+    return C;
+}
+
+// Infers the shape of nested sequences, e.g. [[1 2 3] [4 5 6]] -> [2 3]
+static int tensor_seq_shape(node_idx_t idx, long long *dims) {
+    int nd = 0;
+    node_t *n = get_node(idx);
+    while((n->is_vector() || n->is_list() || n->is_lazy_list()) && nd < TENSOR_MAX_DIMS) {
+        dims[nd++] = n->seq_size();
+        if(n->seq_empty()) break;
+        n = get_node(n->seq_first().first);
+    }
+    return nd;
+}
+
+template<typename T>
+static void tensor_fill_from_seq(node_idx_t idx, T *&out, T *end) {
+    node_t *n = get_node(idx);
+    if(n->is_vector() || n->is_list() || n->is_lazy_list()) {
+        seq_iterate(idx, [&](node_idx_t v) {
+            tensor_fill_from_seq(v, out, end);
+            return out < end;
+        });
+    } else if(out < end) {
+        *out++ = (T)n->as_float();
+    }
+}
+
+static jo_clojure_tensor_ptr_t tensor_from_matrix(const matrix_ptr_t &M, array_type_t dtype) {
+    jo_clojure_tensor_ptr_t t = new_tensor_2d(dtype, M->height, M->width, false);
+    long long W = M->width, H = M->height;
+    node_idx_t block[8*8];
+    for(long long y = 0; y < H; y += 8) {
+        for(long long x = 0; x < W; x += 8) {
+            M->get_block(x, y, block);
+            for(long long dy = 0; dy < 8 && y+dy < H; ++dy) {
+                for(long long dx = 0; dx < 8 && x+dx < W; ++dx) {
+                    double v = get_node_float(block[dy*8+dx]);
+                    if(dtype == TYPE_FLOAT) t->data<float>()[(y+dy)*W + x+dx] = (float)v;
+                    else t->data<double>()[(y+dy)*W + x+dx] = v;
+                }
+            }
+        }
+    }
+    return t;
+}
+
+// Converts numbers, nested seqs, matrices and float/double arrays to a tensor. Tensors pass through untouched.
+static jo_clojure_tensor_ptr_t tensor_from_node(node_idx_t idx, array_type_t dtype = TYPE_DOUBLE) {
+    node_t *n = get_node(idx);
+    if(n->is_tensor()) {
+        return n->t_object.cast<jo_clojure_tensor_t>();
+    }
+    if(n->is_int() || n->is_float()) {
+        return tensor_scalar(n->as_float(), dtype);
+    }
+    if(n->is_matrix()) {
+        return tensor_from_matrix(n->as_matrix(), dtype);
+    }
+    if(n->type == NODE_ARRAY) {
+        jo_clojure_array_ptr_t arr = n->t_object.cast<jo_clojure_array_t>();
+        long long len = arr->num_elements;
+        jo_clojure_tensor_ptr_t t = new_tensor(dtype, 1, &len, false);
+        for(long long i = 0; i < len; ++i) {
+            double v = get_node_float(arr->peek_node(i));
+            if(dtype == TYPE_FLOAT) t->data<float>()[i] = (float)v;
+            else t->data<double>()[i] = v;
+        }
+        return t;
+    }
+    if(n->is_vector() || n->is_list() || n->is_lazy_list()) {
+        long long dims[TENSOR_MAX_DIMS];
+        int nd = tensor_seq_shape(idx, dims);
+        jo_clojure_tensor_ptr_t t = new_tensor(dtype, nd, dims, true);
+        if(dtype == TYPE_FLOAT) {
+            float *out = t->data<float>();
+            tensor_fill_from_seq(idx, out, out + t->size());
+        } else {
+            double *out = t->data<double>();
+            tensor_fill_from_seq(idx, out, out + t->size());
+        }
+        return t;
+    }
+    return NULL;
+}
+
+// 2-d tensor [rows cols] -> matrix(width=cols, height=rows). 1-d becomes a single row.
+static matrix_ptr_t tensor_to_matrix(const jo_clojure_tensor_ptr_t &t_in) {
+    jo_clojure_tensor_ptr_t t = tensor_contiguous(t_in);
+    long long H = t->ndim >= 2 ? t->shape[t->ndim-2] : 1;
+    long long W = t->ndim >= 1 ? t->shape[t->ndim-1] : 1;
+    matrix_ptr_t M = new_matrix(W, H);
+    node_idx_t block[8*8];
+    for(long long y = 0; y < H; y += 8) {
+        for(long long x = 0; x < W; x += 8) {
+            for(int i = 0; i < 8*8; ++i) {
+                long long xx = x + (i & 7), yy = y + (i >> 3);
+                block[i] = (xx < W && yy < H) ? new_node_float(t->get_flat(yy*W + xx)) : NIL_NODE;
+            }
+            M->set_block(x, y, block);
+        }
+    }
+    return M;
+}
+
+static node_idx_t tensor_to_vector_node(const jo_clojure_tensor_ptr_t &t, int dim, long long off) {
+    if(dim == t->ndim) {
+        return new_node_float(t->dtype == TYPE_FLOAT ? t->data<float>()[off] : t->data<double>()[off]);
+    }
+    vector_ptr_t v = new_vector();
+    for(long long i = 0; i < t->shape[dim]; ++i) {
+        v->push_back_inplace(tensor_to_vector_node(t, dim+1, off + i*t->strides[dim]));
+    }
+    return new_node_vector(v);
+}
+
+static void tensor_append_string(jo_string &s, const jo_clojure_tensor_t *t, int dim, long long off) {
+    if(dim == t->ndim) {
+        double v = t->dtype == TYPE_FLOAT ? t->data<float>()[off] : t->data<double>()[off];
+        s += (fabs(v) < 0.0001 && v != 0.0) ? va("%.10e", v) : va("%g", v);
+        return;
+    }
+    s += '[';
+    for(long long i = 0; i < t->shape[dim]; ++i) {
+        if(i) s += ' ';
+        tensor_append_string(s, t, dim+1, off + i*t->strides[dim]);
+    }
+    s += ']';
+}
+
+static jo_string tensor_as_string(const node_t *n) {
+    const jo_clojure_tensor_t *t = n->t_object.cast<jo_clojure_tensor_t>().ptr;
+    jo_string s = "(tensor ";
+    tensor_append_string(s, t, 0, 0);
+    if(t->dtype == TYPE_FLOAT) {
+        s += " :float32";
+    }
+    s += ')';
+    return s;
+}
+
+static array_type_t tensor_parse_dtype(node_idx_t idx, array_type_t def) {
+    node_t *n = get_node(idx);
+    if(!n->is_keyword() && !n->is_string()) return def;
+    if(n->t_string == "float32" || n->t_string == "float" || n->t_string == "f32") return TYPE_FLOAT;
+    if(n->t_string == "float64" || n->t_string == "double" || n->t_string == "f64") return TYPE_DOUBLE;
+    warnf("tensor: unknown dtype %s\n", n->t_string.c_str());
+    return def;
+}
+
+// shape from an int or a seq of ints. Returns the number of dimensions, or -1.
+static int tensor_parse_shape(node_idx_t idx, long long *dims) {
+    node_t *n = get_node(idx);
+    if(n->is_int()) {
+        dims[0] = n->t_int;
+        return 1;
+    }
+    if(!n->is_seq()) return -1;
+    int nd = 0;
+    seq_iterate(idx, [&](node_idx_t d) {
+        if(nd >= TENSOR_MAX_DIMS) return false;
+        dims[nd++] = get_node_int(d);
+        return true;
+    });
+    return nd;
+}
+
+// A shape that came from outside (a script or a file) before anything is allocated for it:
+// no negative dims, and neither the element count nor the byte count may overflow.
+static bool tensor_shape_ok(const char *who, array_type_t dtype, int nd, const long long *dims) {
+    long long n = 1;
+    for(int i = 0; i < nd; ++i) {
+        if(dims[i] < 0) {
+            warnf("%s: negative dimension %lld\n", who, dims[i]);
+            return false;
+        }
+        if(dims[i] > 0 && n > LLONG_MAX / dims[i]) {
+            warnf("%s: shape is too large\n", who);
+            return false;
+        }
+        n *= dims[i];
+    }
+    long long esize = dtype == TYPE_FLOAT ? sizeof(float) : sizeof(double);
+    if(n > LLONG_MAX / esize || (unsigned long long)(n * esize) > (unsigned long long)SIZE_MAX) {
+        warnf("%s: shape is too large\n", who);
+        return false;
+    }
+    return true;
+}
+
+static inline jo_clojure_tensor_ptr_t get_node_tensor(node_idx_t idx) { return tensor_from_node(idx); }
+
+// (tensor data)
+// (tensor data dtype)
+// data can be nested seqs of numbers, a matrix, a float/double array or a tensor
+static node_idx_t native_tensor(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    node_idx_t data_idx = *it++;
+    array_type_t dtype = tensor_parse_dtype(it ? *it++ : NIL_NODE, TYPE_DOUBLE);
+    jo_clojure_tensor_ptr_t t = tensor_from_node(data_idx, dtype);
+    if(!t) {
+        warnf("tensor: can't make a tensor from a %s\n", get_node_type_string(data_idx));
+        return NIL_NODE;
+    }
+    return new_node_tensor(tensor_astype(t, dtype));
+}
+
+static node_idx_t native_tensor_full_common(list_ptr_t args, double value, bool has_value) {
+    list_t::iterator it(args);
+    long long dims[TENSOR_MAX_DIMS];
+    int nd = tensor_parse_shape(*it++, dims);
+    if(nd < 0) {
+        warnf("tensor: invalid shape\n");
+        return NIL_NODE;
+    }
+    if(has_value) value = get_node_float(*it++);
+    array_type_t dtype = tensor_parse_dtype(it ? *it++ : NIL_NODE, TYPE_DOUBLE);
+    if(!tensor_shape_ok("tensor", dtype, nd, dims)) {
+        return NIL_NODE;
+    }
+    jo_clojure_tensor_ptr_t t = tensor_full(dtype, nd, dims, value);
+    return t ? new_node_tensor(t) : NIL_NODE;
+}
+
+// (tensor/zeros shape dtype?)
+static node_idx_t native_tensor_zeros(env_ptr_t env, list_ptr_t args) { return native_tensor_full_common(args, 0, false); }
+// (tensor/ones shape dtype?)
+static node_idx_t native_tensor_ones(env_ptr_t env, list_ptr_t args) { return native_tensor_full_common(args, 1, false); }
+// (tensor/full shape value dtype?)
+static node_idx_t native_tensor_full(env_ptr_t env, list_ptr_t args) { return native_tensor_full_common(args, 0, true); }
+
+// (tensor/rand shape scale dtype?)
+// uniform in [-scale, scale], scale defaults to 1
+static node_idx_t native_tensor_rand(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    long long dims[TENSOR_MAX_DIMS];
+    int nd = tensor_parse_shape(*it++, dims);
+    if(nd < 0) {
+        warnf("tensor/rand: invalid shape\n");
+        return NIL_NODE;
+    }
+    double scale = it ? get_node_float(*it++) : 1.0;
+    array_type_t dtype = tensor_parse_dtype(it ? *it++ : NIL_NODE, TYPE_DOUBLE);
+    if(!tensor_shape_ok("tensor/rand", dtype, nd, dims)) {
+        return NIL_NODE;
+    }
+    jo_clojure_tensor_ptr_t t = new_tensor(dtype, nd, dims, false);
+    if(!t->storage->data) {
+        return NIL_NODE;
+    }
+    long long n = t->size();
+    for(long long i = 0; i < n; ++i) {
+        double rnd = (jo_pcg32(&jo_rnd_state) / (double)UINT32_MAX * 2.0 - 1.0) * scale;
+        if(dtype == TYPE_FLOAT) t->data<float>()[i] = (float)rnd;
+        else t->data<double>()[i] = rnd;
+    }
+    return new_node_tensor(t);
+}
+
+// (tensor/arange n dtype?)
+static node_idx_t native_tensor_arange(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    long long n = get_node_int(*it++);
+    array_type_t dtype = tensor_parse_dtype(it ? *it++ : NIL_NODE, TYPE_DOUBLE);
+    if(!tensor_shape_ok("tensor/arange", dtype, 1, &n)) {
+        return NIL_NODE;
+    }
+    jo_clojure_tensor_ptr_t t = new_tensor(dtype, 1, &n, false);
+    if(!t->storage->data) {
+        return NIL_NODE;
+    }
+    for(long long i = 0; i < n; ++i) {
+        if(dtype == TYPE_FLOAT) t->data<float>()[i] = (float)i;
+        else t->data<double>()[i] = (double)i;
+    }
+    return new_node_tensor(t);
+}
+
+static node_idx_t native_tensor_binary_common(const char *name, list_ptr_t args, tensor_op_t op) {
+    list_t::iterator it(args);
+    jo_clojure_tensor_ptr_t acc = tensor_from_node(*it++);
+    while(acc && it) {
+        jo_clojure_tensor_ptr_t rhs = tensor_from_node(*it++);
+        if(!rhs) {
+            acc = NULL;
+            break;
+        }
+        acc = tensor_binary(acc, rhs, op);
+        if(!acc) {
+            warnf("%s: shapes can't be broadcast together\n", name);
+            return NIL_NODE;
+        }
+    }
+    if(!acc) {
+        warnf("%s: arguments must be tensors, matrices, seqs or numbers\n", name);
+        return NIL_NODE;
+    }
+    return new_node_tensor(acc);
+}
+
+// (tensor/add a b & more)
+static node_idx_t native_tensor_add(env_ptr_t env, list_ptr_t args) { return native_tensor_binary_common("tensor/add", args, TENSOR_ADD); }
+// (tensor/sub a b & more)
+static node_idx_t native_tensor_sub(env_ptr_t env, list_ptr_t args) { return native_tensor_binary_common("tensor/sub", args, TENSOR_SUB); }
+// (tensor/mul a b & more) -- elementwise
+static node_idx_t native_tensor_mul(env_ptr_t env, list_ptr_t args) { return native_tensor_binary_common("tensor/mul", args, TENSOR_MUL); }
+// (tensor/div a b & more)
+static node_idx_t native_tensor_div(env_ptr_t env, list_ptr_t args) { return native_tensor_binary_common("tensor/div", args, TENSOR_DIV); }
+// (tensor/maximum a b & more)
+static node_idx_t native_tensor_maximum(env_ptr_t env, list_ptr_t args) { return native_tensor_binary_common("tensor/maximum", args, TENSOR_MAX); }
+// (tensor/minimum a b & more)
+static node_idx_t native_tensor_minimum(env_ptr_t env, list_ptr_t args) { return native_tensor_binary_common("tensor/minimum", args, TENSOR_MIN); }
+
+template<typename F>
+static node_idx_t native_tensor_map_common(const char *name, list_ptr_t args, F f) {
+    jo_clojure_tensor_ptr_t t = tensor_from_node(args->first_value());
+    if(!t) {
+        warnf("%s: argument must be a tensor\n", name);
+        return NIL_NODE;
+    }
+    return new_node_tensor(tensor_map(t, f));
+}
+
+static node_idx_t native_tensor_neg(env_ptr_t env, list_ptr_t args) { return native_tensor_map_common("tensor/neg", args, [](auto x) { return -x; }); }
+static node_idx_t native_tensor_abs(env_ptr_t env, list_ptr_t args) { return native_tensor_map_common("tensor/abs", args, [](auto x) { return x < 0 ? -x : x; }); }
+static node_idx_t native_tensor_exp(env_ptr_t env, list_ptr_t args) { return native_tensor_map_common("tensor/exp", args, [](auto x) { return (decltype(x))exp(x); }); }
+static node_idx_t native_tensor_log(env_ptr_t env, list_ptr_t args) { return native_tensor_map_common("tensor/log", args, [](auto x) { return (decltype(x))log(x); }); }
+static node_idx_t native_tensor_sqrt(env_ptr_t env, list_ptr_t args) { return native_tensor_map_common("tensor/sqrt", args, [](auto x) { return (decltype(x))sqrt(x); }); }
+static node_idx_t native_tensor_square(env_ptr_t env, list_ptr_t args) { return native_tensor_map_common("tensor/square", args, [](auto x) { return x * x; }); }
+
+// (tensor/sum t)  (tensor/sum t axis)  (tensor/sum t axis keepdims)
+static node_idx_t native_tensor_reduce_common(const char *name, list_ptr_t args, tensor_reduce_t op) {
+    list_t::iterator it(args);
+    jo_clojure_tensor_ptr_t t = tensor_from_node(*it++);
+    if(!t) {
+        warnf("%s: argument must be a tensor\n", name);
+        return NIL_NODE;
+    }
+    int axis = it && *it != NIL_NODE ? (int)get_node_int(*it) : TENSOR_ALL_AXES;
+    if(it) it++;
+    bool keepdims = it ? get_node_bool(*it++) : false;
+    jo_clojure_tensor_ptr_t r = tensor_reduce(t, op, axis, keepdims);
+    if(!r) {
+        warnf("%s: axis out of range\n", name);
+        return NIL_NODE;
+    }
+    return new_node_tensor(r);
+}
+
+static node_idx_t native_tensor_sum(env_ptr_t env, list_ptr_t args) { return native_tensor_reduce_common("tensor/sum", args, TENSOR_SUM); }
+static node_idx_t native_tensor_mean(env_ptr_t env, list_ptr_t args) { return native_tensor_reduce_common("tensor/mean", args, TENSOR_MEAN); }
+static node_idx_t native_tensor_max(env_ptr_t env, list_ptr_t args) { return native_tensor_reduce_common("tensor/max", args, TENSOR_RMAX); }
+static node_idx_t native_tensor_min(env_ptr_t env, list_ptr_t args) { return native_tensor_reduce_common("tensor/min", args, TENSOR_RMIN); }
+
+// Precision a float32 tensor's sums and matmuls accumulate in. Matmuls accumulate in float32 only
+// when both operands ask for it, and results carry the setting on.
+// Arguments: (t) returns :float32 or :float64, (t :float32 | :float64) returns a view of t with that setting
+static node_idx_t native_tensor_accumulator(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    jo_clojure_tensor_ptr_t t = tensor_from_node(*it++);
+    if(!t) {
+        warnf("tensor/accumulator: expected a tensor\n");
+        return NIL_NODE;
+    }
+    if(!it) {
+        return new_node_keyword(t->acc_f64 ? "float64" : "float32");
+    }
+    jo_clojure_tensor_ptr_t r = new_tensor(*t);
+    r->acc_f64 = tensor_parse_dtype(*it, TYPE_DOUBLE) == TYPE_DOUBLE;
+    return new_node_tensor(r);
+}
+
+// (tensor/matmul a b)
+static node_idx_t native_tensor_matmul(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    jo_clojure_tensor_ptr_t a = tensor_from_node(*it++);
+    jo_clojure_tensor_ptr_t b = tensor_from_node(*it++);
+    if(!a || !b) {
+        warnf("tensor/matmul: arguments must be tensors\n");
+        return NIL_NODE;
+    }
+    jo_clojure_tensor_ptr_t c = tensor_matmul(a, b);
+    if(!c) {
+        warnf("tensor/matmul: incompatible shapes\n");
+        return NIL_NODE;
+    }
+    return new_node_tensor(c);
+}
+
+// (tensor/reshape t shape) -- one dimension may be -1
+static node_idx_t native_tensor_reshape(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    jo_clojure_tensor_ptr_t t = tensor_from_node(*it++);
+    long long dims[TENSOR_MAX_DIMS];
+    int nd = tensor_parse_shape(*it++, dims);
+    if(!t || nd < 0) {
+        warnf("tensor/reshape: expected a tensor and a shape\n");
+        return NIL_NODE;
+    }
+    jo_clojure_tensor_ptr_t r = tensor_reshape(t, nd, dims);
+    if(!r) {
+        warnf("tensor/reshape: can't reshape %lld elements to the requested shape\n", t->size());
+        return NIL_NODE;
+    }
+    return new_node_tensor(r);
+}
+
+// (tensor/transpose t)       -- swaps the last two dimensions
+// (tensor/transpose t axes)  -- arbitrary permutation
+static node_idx_t native_tensor_transpose(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    jo_clojure_tensor_ptr_t t = tensor_from_node(*it++);
+    if(!t) {
+        warnf("tensor/transpose: argument must be a tensor\n");
+        return NIL_NODE;
+    }
+    if(!it) {
+        return new_node_tensor(tensor_transpose(t));
+    }
+    long long dims[TENSOR_MAX_DIMS];
+    int nd = tensor_parse_shape(*it++, dims);
+    if(nd != t->ndim) {
+        warnf("tensor/transpose: axes don't match the tensor's dimensions\n");
+        return NIL_NODE;
+    }
+    int axes[TENSOR_MAX_DIMS];
+    bool seen[TENSOR_MAX_DIMS] = {};
+    for(int i = 0; i < nd; ++i) {
+        axes[i] = tensor_axis(*t, (int)dims[i]);
+        if(axes[i] < 0 || seen[axes[i]]) {
+            warnf("tensor/transpose: invalid axes\n");
+            return NIL_NODE;
+        }
+        seen[axes[i]] = true;
+    }
+    return new_node_tensor(tensor_permute(t, axes));
+}
+
+// (tensor/slice t axis start end)
+static node_idx_t native_tensor_slice(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    jo_clojure_tensor_ptr_t t = tensor_from_node(*it++);
+    int axis = get_node_int(*it++);
+    long long start = get_node_int(*it++);
+    long long end = it ? get_node_int(*it++) : LLONG_MAX;
+    jo_clojure_tensor_ptr_t r;
+    if(t) r = tensor_slice(t, axis, start, end);
+    if(!r) {
+        warnf("tensor/slice: invalid arguments\n");
+        return NIL_NODE;
+    }
+    return new_node_tensor(r);
+}
+
+// (tensor/shape t)
+static node_idx_t native_tensor_shape(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_tensor_ptr_t t = tensor_from_node(args->first_value());
+    if(!t) return NIL_NODE;
+    vector_ptr_t v = new_vector();
+    for(int i = 0; i < t->ndim; ++i) v->push_back_inplace(new_node_int(t->shape[i]));
+    return new_node_vector(v);
+}
+
+// (tensor/ndim t)
+static node_idx_t native_tensor_ndim(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_tensor_ptr_t t = tensor_from_node(args->first_value());
+    return t ? new_node_int(t->ndim) : NIL_NODE;
+}
+
+// (tensor/size t)
+static node_idx_t native_tensor_size(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_tensor_ptr_t t = tensor_from_node(args->first_value());
+    return t ? new_node_int(t->size()) : NIL_NODE;
+}
+
+// (tensor/dtype t)
+static node_idx_t native_tensor_dtype(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_tensor_ptr_t t = tensor_from_node(args->first_value());
+    return t ? new_node_keyword(tensor_dtype_name(t->dtype)) : NIL_NODE;
+}
+
+// (tensor/astype t dtype)
+static node_idx_t native_tensor_astype(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    jo_clojure_tensor_ptr_t t = tensor_from_node(*it++);
+    if(!t) return NIL_NODE;
+    return new_node_tensor(tensor_astype(t, tensor_parse_dtype(*it++, t->dtype)));
+}
+
+// (tensor/get t [i j ...])
+static node_idx_t native_tensor_get(env_ptr_t env, list_ptr_t args) {
+    list_t::iterator it(args);
+    jo_clojure_tensor_ptr_t t = tensor_from_node(*it++);
+    long long idx[TENSOR_MAX_DIMS];
+    int nd = it ? tensor_parse_shape(*it++, idx) : 0;
+    if(!t || nd != t->ndim) {
+        warnf("tensor/get: expected one index per dimension\n");
+        return NIL_NODE;
+    }
+    long long off = 0;
+    for(int i = 0; i < nd; ++i) {
+        if(idx[i] < 0) idx[i] += t->shape[i];
+        if(idx[i] < 0 || idx[i] >= t->shape[i]) return NIL_NODE;
+        off += idx[i] * t->strides[i];
+    }
+    return new_node_float(t->dtype == TYPE_FLOAT ? t->data<float>()[off] : t->data<double>()[off]);
+}
+
+// (tensor/->vec t) -- nested vectors of floats (a 0-d tensor becomes a float)
+static node_idx_t native_tensor_to_vec(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_tensor_ptr_t t = tensor_from_node(args->first_value());
+    return t ? tensor_to_vector_node(t, 0, 0) : NIL_NODE;
+}
+
+// (tensor/->matrix t) -- [rows cols] -> (matrix cols rows)
+static node_idx_t native_tensor_to_matrix(env_ptr_t env, list_ptr_t args) {
+    jo_clojure_tensor_ptr_t t = tensor_from_node(args->first_value());
+    if(!t || t->ndim > 2) {
+        warnf("tensor/->matrix: expected a tensor with at most 2 dimensions\n");
+        return NIL_NODE;
+    }
+    return new_node_matrix(tensor_to_matrix(t));
+}
+
+// (tensor? x)
+static node_idx_t native_is_tensor(env_ptr_t env, list_ptr_t args) {
+    return new_node_bool(get_node(args->first_value())->is_tensor());
+}
+
+void jo_clojure_tensor_init(env_ptr_t env) {
+    env->set("tensor", new_node_native_function("tensor", &native_tensor, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor?", new_node_native_function("tensor?", &native_is_tensor, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/zeros", new_node_native_function("tensor/zeros", &native_tensor_zeros, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/ones", new_node_native_function("tensor/ones", &native_tensor_ones, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/full", new_node_native_function("tensor/full", &native_tensor_full, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/rand", new_node_native_function("tensor/rand", &native_tensor_rand, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/arange", new_node_native_function("tensor/arange", &native_tensor_arange, false, NODE_FLAG_PRERESOLVE));
+
+    // elementwise, broadcasting
+    env->set("tensor/add", new_node_native_function("tensor/add", &native_tensor_add, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/sub", new_node_native_function("tensor/sub", &native_tensor_sub, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/mul", new_node_native_function("tensor/mul", &native_tensor_mul, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/div", new_node_native_function("tensor/div", &native_tensor_div, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/maximum", new_node_native_function("tensor/maximum", &native_tensor_maximum, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/minimum", new_node_native_function("tensor/minimum", &native_tensor_minimum, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/neg", new_node_native_function("tensor/neg", &native_tensor_neg, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/abs", new_node_native_function("tensor/abs", &native_tensor_abs, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/exp", new_node_native_function("tensor/exp", &native_tensor_exp, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/log", new_node_native_function("tensor/log", &native_tensor_log, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/sqrt", new_node_native_function("tensor/sqrt", &native_tensor_sqrt, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/square", new_node_native_function("tensor/square", &native_tensor_square, false, NODE_FLAG_PRERESOLVE));
+
+    // reductions
+    env->set("tensor/sum", new_node_native_function("tensor/sum", &native_tensor_sum, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/mean", new_node_native_function("tensor/mean", &native_tensor_mean, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/max", new_node_native_function("tensor/max", &native_tensor_max, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/min", new_node_native_function("tensor/min", &native_tensor_min, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/accumulator", new_node_native_function("tensor/accumulator", &native_tensor_accumulator, false, NODE_FLAG_PRERESOLVE));
+
+    env->set("tensor/matmul", new_node_native_function("tensor/matmul", &native_tensor_matmul, false, NODE_FLAG_PRERESOLVE));
+
+    // views
+    env->set("tensor/reshape", new_node_native_function("tensor/reshape", &native_tensor_reshape, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/transpose", new_node_native_function("tensor/transpose", &native_tensor_transpose, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/slice", new_node_native_function("tensor/slice", &native_tensor_slice, false, NODE_FLAG_PRERESOLVE));
+
+    // info & conversion
+    env->set("tensor/shape", new_node_native_function("tensor/shape", &native_tensor_shape, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/ndim", new_node_native_function("tensor/ndim", &native_tensor_ndim, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/size", new_node_native_function("tensor/size", &native_tensor_size, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/dtype", new_node_native_function("tensor/dtype", &native_tensor_dtype, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/astype", new_node_native_function("tensor/astype", &native_tensor_astype, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/get", new_node_native_function("tensor/get", &native_tensor_get, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/->vec", new_node_native_function("tensor/->vec", &native_tensor_to_vec, false, NODE_FLAG_PRERESOLVE));
+    env->set("tensor/->matrix", new_node_native_function("tensor/->matrix", &native_tensor_to_matrix, false, NODE_FLAG_PRERESOLVE));
+}
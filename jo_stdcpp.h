@@ -49,7 +49,9 @@
 #define jo_chdir _chdir
 #define jo_alloca _alloca
 #define jo_ftell64 _ftelli64
+#define jo_fseek64 _fseeki64
 #define jo_popen _popen
+#define jo_getc_unlocked _getc_nolock
 #define jo_pclose _pclose
 #pragma warning(push)
 #pragma warning(disable : 4345)
@@ -58,13 +60,17 @@
 #include <unistd.h>
 #include <termios.h>
 #define jo_ftell64 ftello
+#define jo_fseek64 fseeko
 #define jo_popen popen
+#define jo_getc_unlocked getc_unlocked
 #define jo_pclose pclose
 #else
 #include <unistd.h>
 #include <termios.h>
 #define jo_ftell64 ftello64
+#define jo_fseek64 fseeko64
 #define jo_popen popen
+#define jo_getc_unlocked getc_unlocked
 #define jo_pclose pclose
 #endif
 
@@ -139,6 +145,15 @@ static int jo_setenv(const char *name, const char *value, int overwrite) {
 #define jo_setenv setenv
 #endif
 
+#ifdef _WIN32
+#include <process.h>
+#define jo_mkdir(path) _mkdir(path)
+#define jo_getpid _getpid
+#else
+#define jo_mkdir(path) mkdir(path, 0755)
+#define jo_getpid getpid
+#endif
+
 static bool jo_file_exists(const char *path) {
     FILE *f = fopen(path, "r");
     if(f) {
@@ -271,6 +286,27 @@ static bool jo_dir_exists(const char *path) {
 #undef max
 #endif
 
+// alignment must be a power of two
+static void *jo_aligned_malloc(size_t size, size_t alignment) {
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    void *ptr = NULL;
+    if(posix_memalign(&ptr, alignment < sizeof(void*) ? sizeof(void*) : alignment, size)) {
+        return NULL;
+    }
+    return ptr;
+#endif
+}
+
+static void jo_aligned_free(void *ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
 // always adds a 0 terminator
 static void *jo_slurp_file(const char *path, size_t *size) {
     FILE *f = fopen(path, "rb");
@@ -315,6 +351,55 @@ static int jo_spit_file(const char *path, const char *data) {
     return jo_spit_file(path, data, strlen(data));
 }
 
+// Maps a whole file copy-on-write: writes through the pointer are private and never reach the file.
+// With writable false the pages are read-only instead. Returns NULL on failure or for an empty file.
+// Release with jo_munmap_file.
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
+static void *jo_mmap_file(const char *path, size_t *size, bool writable = true) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE) return NULL;
+    LARGE_INTEGER fsize;
+    if(!GetFileSizeEx(file, &fsize) || fsize.QuadPart == 0) {
+        CloseHandle(file);
+        return NULL;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, writable ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if(!mapping) return NULL;
+    void *data = MapViewOfFile(mapping, writable ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if(!data) return NULL;
+    if(size) *size = (size_t)fsize.QuadPart;
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return NULL;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) return NULL;
+    if(size) *size = st.st_size;
+    return data;
+#endif
+}
+
+static void jo_munmap_file(void *data, size_t size) {
+    if(!data) return;
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap(data, size);
+#endif
+}
+
 static int jo_tolower(int c) {
     if(c >= 'A' && c <= 'Z') return c + 32;
     return c;
@@ -586,6 +671,8 @@ inline void jo_swap(T &a, T &b) {
 }
 
 static uint64_t thread_local jo_rnd_state = 0x4d595df4d0f33173; 
+// for the allocators' sector picks, so how much got allocated never shifts the jo_rnd_state sequence
+static uint64_t thread_local jo_alloc_rnd_state = 0x853c49e6748fea9b;
 
 static uint32_t jo_rotr32(uint32_t x, unsigned r) {
 #ifdef _WIN32
@@ -657,41 +744,302 @@ inline long long jo_clz64(long long x) {
 #endif
 }
 
+// count trailing zeros
+inline int jo_ctz32(unsigned x) {
+#ifdef _WIN32
+    unsigned long r = 0;
+    _BitScanForward(&r, x);
+    return (int)r;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+// Byte search kernels used by jo_string and the clojure.string natives. They work on
+// (pointer, length) ranges, so callers can search inside a string without copying it out.
+// x86-64 always has SSE2; the AVX2 substring search is compiled with a target attribute
+// and picked at runtime, so the binary still runs anywhere.
+#if defined(__SSE2__) || defined(_M_X64)
+#define JO_SSE2
+#include <emmintrin.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define JO_AVX2
+#define JO_AVX2_FN __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+static bool jo_has_avx2() {
+#ifdef JO_AVX2
+    static int has = -1;
+    if(has < 0) {
+        __builtin_cpu_init();
+        has = __builtin_cpu_supports("avx2");
+    }
+    return has != 0;
+#else
+    return false;
+#endif
+}
+
+#ifdef JO_AVX2
+// Candidate starts are positions where both the first and the last byte of the needle match,
+// 32 at a time; only those get a memcmp. Leaves p at the first start it did not look at.
+JO_AVX2_FN static const char *jo_memmem_avx2(const char *&p, const char *last, const char *n, size_t nn) {
+    const __m256i first = _mm256_set1_epi8(n[0]), lastc = _mm256_set1_epi8(n[nn-1]);
+    for(; p + 32 <= last + 1; p += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)p);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p + nn - 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, lastc)));
+        while(mask) {
+            int bit = jo_ctz32(mask);
+            if(!memcmp(p + bit + 1, n + 1, nn - 2)) return p + bit;
+            mask &= mask - 1;
+        }
+    }
+    return NULL;
+}
+#endif
+
+// first occurrence of n[0..nn) in h[0..hn), or NULL
+static const char *jo_memmem(const char *h, size_t hn, const char *n, size_t nn) {
+    if(nn == 0) return h;
+    if(nn > hn) return NULL;
+    if(nn == 1) return (const char*)memchr(h, n[0], hn);
+    const char *p = h, *last = h + hn - nn;
+#ifdef JO_AVX2
+    if(jo_has_avx2()) {
+        const char *r = jo_memmem_avx2(p, last, n, nn);
+        if(r) return r;
+    }
+#endif
+#ifdef JO_SSE2
+    const __m128i first = _mm_set1_epi8(n[0]), lastc = _mm_set1_epi8(n[nn-1]);
+    for(; p + 16 <= last + 1; p += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)p);
+        __m128i b = _mm_loadu_si128((const __m128i*)(p + nn - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, lastc)));
+        while(mask) {
+            int bit = jo_ctz32(mask);
+            if(!memcmp(p + bit + 1, n + 1, nn - 2)) return p + bit;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    while(p <= last) {
+        p = (const char*)memchr(p, n[0], last - p + 1);
+        if(!p) return NULL;
+        if(p[nn-1] == n[nn-1] && !memcmp(p + 1, n + 1, nn - 2)) return p;
+        ++p;
+    }
+    return NULL;
+}
+
+// last occurrence of n[0..nn) in h[0..hn), or NULL
+static const char *jo_memrmem(const char *h, size_t hn, const char *n, size_t nn) {
+    if(nn == 0) return h + hn;
+    if(nn > hn) return NULL;
+    size_t end = hn - nn + 1; // candidate starts left to check are [0, end)
+#ifdef JO_SSE2
+    const __m128i first = _mm_set1_epi8(n[0]), lastc = _mm_set1_epi8(n[nn-1]);
+    for(; end >= 16; end -= 16) {
+        const char *p = h + end - 16;
+        __m128i a = _mm_loadu_si128((const __m128i*)p);
+        __m128i b = _mm_loadu_si128((const __m128i*)(p + nn - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, lastc)));
+        while(mask) {
+            int bit = 31 - jo_clz32(mask);
+            if(!memcmp(p + bit, n, nn)) return p + bit;
+            mask &= ~(1u << bit);
+        }
+    }
+#endif
+    while(end > 0) {
+        const char *p = h + --end;
+        if(*p == n[0] && !memcmp(p, n, nn)) return p;
+    }
+    return NULL;
+}
+
+// last occurrence of c in h[0..hn), or NULL
+static const char *jo_memrchr(const char *h, size_t hn, char c) {
+#ifdef JO_SSE2
+    const __m128i cc = _mm_set1_epi8(c);
+    for(; hn >= 16; hn -= 16) {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(h + hn - 16)), cc));
+        if(mask) return h + hn - 16 + (31 - jo_clz32(mask));
+    }
+#endif
+    while(hn > 0) {
+        if(h[--hn] == c) return h + hn;
+    }
+    return NULL;
+}
+
+// first byte in [p, end) that is one of the nset bytes in set, or end
+static const char *jo_memchr_any(const char *p, const char *end, const unsigned char *set, int nset) {
+    if(nset == 1) {
+        const char *r = (const char*)memchr(p, set[0], end - p);
+        return r ? r : end;
+    }
+#ifdef JO_SSE2
+    if(nset <= 8) {
+        __m128i cs[8];
+        for(int i = 0; i < nset; ++i) cs[i] = _mm_set1_epi8((char)set[i]);
+        for(; p + 16 <= end; p += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)p);
+            __m128i m = _mm_cmpeq_epi8(v, cs[0]);
+            for(int i = 1; i < nset; ++i) m = _mm_or_si128(m, _mm_cmpeq_epi8(v, cs[i]));
+            unsigned mask = (unsigned)_mm_movemask_epi8(m);
+            if(mask) return p + jo_ctz32(mask);
+        }
+    }
+#endif
+    bool table[256] = {};
+    for(int i = 0; i < nset; ++i) table[set[i]] = true;
+    for(; p < end; ++p) {
+        if(table[(unsigned char)*p]) break;
+    }
+    return p;
+}
+
+#ifdef JO_SSE2
+// bit i set where v[i] is ' ' or one of \t \n \v \f \r (jo_isspace)
+static inline unsigned jo_space_mask16(__m128i v) {
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8(9));
+    __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t);
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(ctl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))));
+}
+#endif
+
+// first non-whitespace byte in [p, end), or end
+static const char *jo_skip_space(const char *p, const char *end) {
+#ifdef JO_SSE2
+    for(; p + 16 <= end; p += 16) {
+        unsigned mask = ~jo_space_mask16(_mm_loadu_si128((const __m128i*)p)) & 0xFFFF;
+        if(mask) return p + jo_ctz32(mask);
+    }
+#endif
+    while(p < end && jo_isspace(*p)) ++p;
+    return p;
+}
+
+// one past the last non-whitespace byte in [begin, p), or begin
+static const char *jo_skip_space_back(const char *begin, const char *p) {
+#ifdef JO_SSE2
+    for(; p - begin >= 16; p -= 16) {
+        unsigned mask = ~jo_space_mask16(_mm_loadu_si128((const __m128i*)(p - 16))) & 0xFFFF;
+        if(mask) return p - 16 + (31 - jo_clz32(mask)) + 1;
+    }
+#endif
+    while(p > begin && jo_isspace(p[-1])) --p;
+    return p;
+}
+
 struct jo_object {
     virtual ~jo_object() {}
 };
 
+// Immutable-by-default string. The characters live in a reference counted buffer shared by
+// every copy, so copying a string (get_node_string, passing strings around by value) is a
+// counter bump rather than a strdup. Anything that writes first calls make_unique, which
+// only copies when the buffer is shared. Appends grow the buffer geometrically. A substring
+// that runs to the end of the string is already NUL terminated, so it shares the buffer too.
 struct jo_string {
+    struct buf_t {
+        std::atomic<int> refs;
+        size_t cap;
+        char data[1];
+    };
+
     char *str;
     size_t size;
-    
-    jo_string() { str = jo_strdup(""); size = 1; }
-    jo_string(const char *ss) { str = jo_strdup(ss); size = strlen(ss) + 1; }
-    jo_string(char c) { str = jo_strdup(" "); str[0] = c; size = 2; }
-    jo_string(const jo_string *other) { str = jo_strdup(other->str); size = other->size; }
-    jo_string(const jo_string &other) { str = jo_strdup(other.str); size = other.size; }
-    jo_string(jo_string &&other) {
+    buf_t *buf;
+
+    static char *empty_str() { static char e[1] = {0}; return e; }
+
+    static buf_t *buf_alloc(size_t cap) {
+        buf_t *b = (buf_t*)malloc(offsetof(buf_t, data) + cap);
+        new(&b->refs) std::atomic<int>(1);
+        b->cap = cap;
+        return b;
+    }
+
+    void buf_retain() { if(buf) buf->refs.fetch_add(1, std::memory_order_relaxed); }
+    void buf_release() {
+        if(buf && buf->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) free(buf);
+        buf = 0;
+    }
+
+    void init(const char *s, size_t len) {
+        buf = buf_alloc(len + 1);
+        str = buf->data;
+        if(len) jo_memcpy(str, s, len);
+        str[len] = 0;
+        size = len + 1;
+    }
+
+    void share(const jo_string &other) {
         str = other.str;
         size = other.size;
-        other.str = NULL;
-        other.size = 0;
+        buf = other.buf;
+        buf_retain();
+    }
+
+    // Makes the buffer private to this string with room for n bytes including the terminator.
+    void make_unique(size_t n) {
+        if(buf && buf->refs.load(std::memory_order_acquire) == 1 && (size_t)(buf->data + buf->cap - str) >= n) return;
+        size_t cap = n > size ? jo_max(n, size * 2) : n;
+        buf_t *b = buf_alloc(cap);
+        size_t keep = jo_min(size, n);
+        if(keep) jo_memcpy(b->data, str, keep);
+        if(size == 0) {
+            b->data[0] = 0;
+            size = 1;
+        }
+        buf_release();
+        buf = b;
+        str = b->data;
+    }
+    void reserve(size_t n) { make_unique(jo_max(n + 1, size)); }
+
+    // Narrows the string to [start, start+len) without copying when it can.
+    jo_string &keep(size_t start, size_t len) {
+        if(start + len + 1 < size) {
+            if(!buf || buf->refs.load(std::memory_order_acquire) != 1) {
+                jo_string tmp(str + start, len);
+                swap(tmp);
+                return *this;
+            }
+            str[start + len] = 0;
+        }
+        str += start;
+        size = len + 1;
+        return *this;
     }
-    jo_string(const char *a, size_t s) {
-        size = s+1;
-        str = (char*)malloc(size);
-        jo_memcpy(str, a, s);
-        str[s] = 0;
+
+    void swap(jo_string &other) {
+        char *s = str; str = other.str; other.str = s;
+        size_t z = size; size = other.size; other.size = z;
+        buf_t *b = buf; buf = other.buf; other.buf = b;
     }
-    jo_string(const char *a, const char *b) {
-        ptrdiff_t s = b - a;
-        size = s + 1;
-        str = (char*)malloc(size);
-        jo_memcpy(str, a, s);
-        str[s] = 0;
+
+    jo_string() : str(empty_str()), size(1), buf(0) {}
+    jo_string(const char *ss) { init(ss, strlen(ss)); }
+    jo_string(char c) { init(&c, 1); }
+    jo_string(const jo_string *other) { share(*other); }
+    jo_string(const jo_string &other) { share(other); }
+    jo_string(jo_string &&other) : str(other.str), size(other.size), buf(other.buf) {
+        other.str = empty_str();
+        other.size = 1;
+        other.buf = 0;
     }
+    jo_string(const char *a, size_t s) { init(a, s); }
+    jo_string(const char *a, const char *b) { init(a, (size_t)(b - a)); }
 
     ~jo_string() {
-        free(str);
+        buf_release();
         str = 0;
         size = 0;
     }
@@ -701,100 +1049,70 @@ struct jo_string {
     size_t length() const { return size-1; }
 
     jo_string &operator=(const char *s) {
-        size = strlen(s) + 1;
-        char *tmp = (char*)malloc(size);
-        jo_memcpy(tmp, s, size);
-        free(str);
-        str = tmp;
+        jo_string tmp(s);
+        swap(tmp);
         return *this;
     }
 
     jo_string &operator=(const jo_string &s) {
-        char *tmp = (char*)malloc(s.size);
-        size = s.size;
-        jo_memcpy(tmp, s.str, size);
-        free(str);
-        str = tmp;
+        if(this != &s) {
+            jo_string tmp(s);
+            swap(tmp);
+        }
         return *this;
     }
 
-    jo_string &operator+=(const char *s) {
-        size_t l0 = size-1;
-        size_t l1 = strlen(s);
-        char *new_str = (char*)realloc(str, l0 + l1 + 1);
-        if(!new_str) {
-            // malloc failed!
-            return *this;
-        }
-        str = new_str;
-        size = l0 + l1 + 1;
-        jo_memcpy(str+l0, s, l1);
-        str[l0+l1] = 0;
+    jo_string &operator=(jo_string &&s) {
+        swap(s);
         return *this;
     }
 
-    jo_string &operator+=(const jo_string &s) { 
-        size_t l0 = size-1;
-        size_t l1 = s.size-1;
-        char *new_str = (char*)realloc(str, l0 + l1 + 1);
-        if(!new_str) {
-            // malloc failed!
-            return *this;
+    jo_string &append(const char *s, size_t l1) {
+        if(s >= str && s < str + size) {
+            jo_string tmp(s, l1);
+            return append(tmp.str, l1);
         }
-        str = new_str;
-        size = l0 + l1 + 1;
-        jo_memcpy(str+l0, s.str, l1);
+        size_t l0 = size-1;
+        make_unique(l0 + l1 + 1);
+        jo_memcpy(str+l0, s, l1);
         str[l0+l1] = 0;
+        size = l0 + l1 + 1;
         return *this;
     }
 
-    jo_string &operator+=(char c) {
-        size_t l0 = size-1;
-        char *new_str = (char*)realloc(str, l0 + 2);
-        if(!new_str) {
-            // malloc failed!
-            return *this;
-        }
-        str = new_str;
-        str[l0] = c;
-        str[l0+1] = 0;
-        size = l0 + 2;
-        return *this;
-    }
+    jo_string &operator+=(const char *s) { return append(s, strlen(s)); }
+    jo_string &operator+=(const jo_string &s) { return append(s.str, s.size-1); }
+    jo_string &operator+=(char c) { return append(&c, 1); }
 
-    char &operator[](size_t n) { return str[n]; }
     const char &operator[](size_t n) const { return str[n]; }
 
     size_t find_last_of(char c) const {
-        for(long long i = size - 2; i >= 0; --i) {
-            if(str[i] == c) return i;
-        }
-        return jo_npos;
+        const char *tmp = jo_memrchr(str, size-1, c);
+        if(!tmp) return jo_npos;
+        return (size_t)(tmp - str);
     }
 
-    size_t find_last_of(const char *s) const {
-        size_t l = strlen(s);
+    size_t find_last_of(const char *s, size_t l) const {
         if(l == 1) return find_last_of(s[0]);
-        for(long long i = size - l - 2; i >= 0; --i) {
-            size_t j = 0;
-            for(; j < l; ++j) {
-                if(str[i+j] != s[j]) break;
-            }
-            if(j == l) return i;
-        }
-        return jo_npos;
+        const char *tmp = jo_memrmem(str, size-1, s, l);
+        if(!tmp) return jo_npos;
+        return (size_t)(tmp - str);
     }
+    size_t find_last_of(const char *s) const { return find_last_of(s, strlen(s)); }
+    size_t find_last_of(const jo_string &s) const { return find_last_of(s.str, s.size-1); }
 
     jo_string &erase(size_t n) {
-        str[n] = 0;
-        size = n+1;
-        return *this;
+        if(n >= size) return *this;
+        return keep(0, n);
     }
 
     jo_string &erase(size_t n, size_t m) {
         size_t l = size-1;
         if(n >= l) return *this;
         if(m > l) m = l;
+        if(m == l) return keep(0, n);
+        if(n == 0) return keep(m, l-m);
+        make_unique(size);
         jo_memmove(str+n, str+m, l-m+1);
         size = l - m + n + 1;
         return *this;
@@ -804,39 +1122,42 @@ struct jo_string {
         size_t l0 = size-1;
         size_t l1 = strlen(s);
         if(n > l0) n = l0;
-        char *new_str = (char*)malloc(l0 + l1 + 1);
-        if(!new_str) {
-            // malloc failed!
-            return *this;
-        }
-        jo_memcpy(new_str, str, n);
-        jo_memcpy(new_str+n, s, l1);
-        jo_memcpy(new_str+n+l1, str+n, l0-n+1);
-        free(str);
-        str = new_str;
-        size = l0 + l1 + 1;
+        jo_string tmp;
+        tmp.make_unique(l0 + l1 + 1);
+        jo_memcpy(tmp.str, str, n);
+        jo_memcpy(tmp.str+n, s, l1);
+        jo_memcpy(tmp.str+n+l1, str+n, l0-n+1);
+        tmp.size = l0 + l1 + 1;
+        swap(tmp);
         return *this;
     }
 
     jo_string substr(size_t pos = 0, size_t len = jo_npos) const {
-        if(len == jo_npos) {
-            len = size - 1 - pos;
-        }
         if(pos >= size - 1) return jo_string();
+        if(len > size - 1 - pos) len = size - 1 - pos;
+        if(pos + len == size - 1) {
+            jo_string ret(*this);
+            ret.str += pos;
+            ret.size -= pos;
+            return ret;
+        }
         return jo_string(str + pos, len);
     }
 
     size_t find(char c, size_t pos = 0) const {
-        const char *tmp = strchr(str+pos, c);
+        if(pos >= size-1) return jo_npos;
+        const char *tmp = (const char*)memchr(str+pos, c, size-1-pos);
         if(!tmp) return jo_npos;
         return (size_t)(tmp - str);
     }
-    size_t find(const char *s, size_t pos = 0) const {
-        const char *tmp = strstr(str+pos, s);
+    size_t find(const char *s, size_t l, size_t pos) const {
+        if(pos > size-1) return jo_npos;
+        const char *tmp = jo_memmem(str+pos, size-1-pos, s, l);
         if(!tmp) return jo_npos;
         return (size_t)(tmp - str);
     }
-    size_t find(const jo_string &s, size_t pos = 0) const { return find(s.c_str(), pos); }
+    size_t find(const char *s, size_t pos = 0) const { return find(s, strlen(s), pos); }
+    size_t find(const jo_string &s, size_t pos = 0) const { return find(s.str, s.size-1, pos); }
 
     static jo_string format(const char *fmt, ...) {
         va_list args;
@@ -847,20 +1168,19 @@ struct jo_string {
             // error
             return jo_string();
         }
-        char *tmp = (char*)malloc(len+1);
-        if(!tmp) {
-            // malloc failed!
-            return jo_string();
-        }
+        jo_string ret;
+        ret.make_unique(len+1);
         va_start(args, fmt);
-        vsnprintf(tmp, len+1, fmt, args);
+        vsnprintf(ret.str, len+1, fmt, args);
         va_end(args);
-        return jo_string(tmp);
+        ret.size = len+1;
+        return ret;
     }
 
     int compare(const char *s) const { return strcmp(str, s); }
 
     jo_string &lower() {
+        make_unique(size);
         for(size_t i = 0; i < size-1; i++) {
             str[i] = (char)jo_tolower(str[i]);
         }
@@ -868,6 +1188,7 @@ struct jo_string {
     }
 
     jo_string &upper() {
+        make_unique(size);
         for(size_t i = 0; i < size-1; i++) {
             str[i] = (char)jo_toupper(str[i]);
         }
@@ -875,8 +1196,10 @@ struct jo_string {
     }
 
     jo_string &reverse() {
+        if(size <= 2) return *this;
+        make_unique(size);
         char *tmp = str;
-        char *end = str + length();
+        char *end = str + length() - 1;
         while(tmp < end) {
             char c = *tmp;
             *tmp = *end;
@@ -898,6 +1221,7 @@ struct jo_string {
     // Converts first character of the string to upper-case, all other characters to lower-case.
     jo_string &capitalize() {
         if(size-1 == 0) return *this;
+        make_unique(size);
         str[0] = (char)jo_toupper(str[0]);
         for(size_t i = 1; i < size-1; i++) {
             str[i] = (char)jo_tolower(str[i]);
@@ -905,140 +1229,73 @@ struct jo_string {
         return *this;
     }
 
-    bool ends_with(const char *s) const {
-        size_t l1 = strlen(s);
+    bool ends_with(const char *s, size_t l1) const {
         size_t l2 = size-1;
         if(l1 > l2) return false;
-        return strcmp(str+l2-l1, s) == 0;
+        return memcmp(str+l2-l1, s, l1) == 0;
     }
+    bool ends_with(const char *s) const { return ends_with(s, strlen(s)); }
+    bool ends_with(const jo_string &s) const { return ends_with(s.str, s.size-1); }
 
-    bool starts_with(const char *s) const {
-        size_t l1 = strlen(s);
+    bool starts_with(const char *s, size_t l1) const {
         size_t l2 = size-1;
         if(l1 > l2) return false;
-        return strncmp(str, s, l1) == 0;
+        return memcmp(str, s, l1) == 0;
     }
+    bool starts_with(const char *s) const { return starts_with(s, strlen(s)); }
+    bool starts_with(const jo_string &s) const { return starts_with(s.str, s.size-1); }
 
-    bool includes(const char *s) const {
-        return find(s) != jo_npos;
-    }
-
-    int index_of(char c) const {
-        for(size_t i = 0; i < size-1; i++) {
-            if(str[i] == c) return (int)i;
-        }
-        return -1;
-    }
-
-    int index_of(const char *s) const {
-        size_t pos = find(s);
-        if(pos == jo_npos) return -1;
-        return (int)pos;
-    }
+    bool includes(const char *s) const { return find(s) != jo_npos; }
+    bool includes(const jo_string &s) const { return find(s) != jo_npos; }
 
-    int last_index_of(char c) const {
-        for(int i = (int)size-1; i >= 0; i--) {
-            if(str[i] == c) return i;
-        }
-        return -1;
-    }
+    int index_of(char c) const { return (int)find(c); }
+    int index_of(const char *s) const { return (int)find(s); }
+    int index_of(const jo_string &s) const { return (int)find(s); }
 
-    int last_index_of(const char *s) const {
-        size_t pos = find_last_of(s);
-        if(pos == jo_npos) return -1;
-        return (int)pos;
-    }
+    int last_index_of(char c) const { return (int)find_last_of(c); }
+    int last_index_of(const char *s) const { return (int)find_last_of(s); }
+    int last_index_of(const jo_string &s) const { return (int)find_last_of(s); }
 
     jo_string &trim() {
-        size_t start = 0;
-        while(start < size-1 && jo_isspace(str[start])) {
-            start++;
-        }
-        size_t end = size-1;
-        while(end > start && jo_isspace(str[end])) {
-            end--;
-        }
-        if(start > 0 || end < size-1) {
-            char *tmp = (char*)malloc(end-start+2);
-            if(!tmp) {
-                // malloc failed!
-                return *this;
-            }
-            jo_memcpy(tmp, str+start, end-start+1);
-            tmp[end-start+1] = 0;
-            free(str);
-            str = tmp;
-            size = end-start+2;
-        }
-        return *this;
+        const char *b = jo_skip_space(str, str+size-1);
+        const char *e = jo_skip_space_back(b, str+size-1);
+        return keep(b - str, e - b);
     }
 
     jo_string &ltrim() {
-        size_t start = 0;
-        while(start < size-1 && jo_isspace(str[start])) {
-            start++;
-        }
-        if(start > 0) {
-            char *tmp = (char*)malloc(size-1-start+1);
-            if(!tmp) {
-                // malloc failed!
-                return *this;
-            }
-            jo_memcpy(tmp, str+start, size-1-start);
-            tmp[size-1-start] = 0;
-            free(str);
-            str = tmp;
-            size = size-1-start+1;
-        }
-        return *this;
+        const char *b = jo_skip_space(str, str+size-1);
+        return keep(b - str, str+size-1 - b);
     }
 
     jo_string &rtrim() {
-        size_t end = size-2;
-        while(end > 0 && jo_isspace(str[end])) {
-            end--;
-        }
-        if(end < size-2) {
-            char *tmp = (char*)malloc(end+2);
-            if(!tmp) {
-                // malloc failed!
-                return *this;
-            }
-            jo_memcpy(tmp, str, end+1);
-            tmp[end+1] = 0;
-            free(str);
-            str = tmp;
-            size = end+2;
-        }
-        return *this;
+        return keep(0, jo_skip_space_back(str, str+size-1) - str);
     }
 
     jo_string &chomp() {
-        if(size-1 == 0) return *this;
-        if(str[size-2] == '\n') {
-            str[size-2] = 0;
-            size = size-2;
-            if(size-1 > 0 && str[size-2] == '\r') {
-                str[size-2] = 0;
-                size = size-2;
-            }
-        }
-        return *this;
-    }
-
-    jo_string &replace(const char *s, const char *r) {
-        size_t pos = 0;
-        while(pos < size-1) {
-            size_t pos2 = find(s, pos);
-            if(pos2 == jo_npos) {
-                break;
-            }
-            erase(pos2, pos2+strlen(s));
-            insert(pos2, r);
-            pos = pos2 + strlen(r);
-        }
+        size_t end = size-1;
+        while(end > 0 && (str[end-1] == '\n' || str[end-1] == '\r')) end--;
+        return keep(0, end);
+    }
+
+    // Replaces every occurrence of s with r in one pass.
+    jo_string &replace(const char *s, size_t ls, const char *r, size_t lr) {
+        if(!ls) return *this;
+        size_t pos = find(s, ls, 0);
+        if(pos == jo_npos) return *this;
+        jo_string out;
+        out.reserve(size-1);
+        size_t prev = 0;
+        for(; pos != jo_npos; pos = find(s, ls, prev)) {
+            out.append(str+prev, pos-prev);
+            out.append(r, lr);
+            prev = pos + ls;
+        }
+        out.append(str+prev, size-1-prev);
+        swap(out);
         return *this;
     }
+    jo_string &replace(const char *s, const char *r) { return replace(s, strlen(s), r, strlen(r)); }
+    jo_string &replace(const jo_string &s, const jo_string &r) { return replace(s.str, s.size-1, r.str, r.size-1); }
 
     jo_string &replace_first(const char *s, const char *r) {
         size_t pos = find(s);
@@ -1055,17 +1312,7 @@ struct jo_string {
         if(n > l) {
             n = l;
         }
-        char *tmp = (char*)malloc(n+1);
-        if(!tmp) {
-            // malloc failed!
-            return *this;
-        }
-        jo_memcpy(tmp, str, n);
-        tmp[n] = 0;
-        free(str);
-        str = tmp;
-        size = n+1;
-        return *this;
+        return keep(0, n);
     }
 
     jo_string &drop(size_t n) {
@@ -1073,17 +1320,7 @@ struct jo_string {
         if(n > l) {
             n = l;
         }
-        char *tmp = (char*)malloc(l-n+1);
-        if(!tmp) {
-            // malloc failed!
-            return *this;
-        }
-        jo_memcpy(tmp, str+n, l-n);
-        tmp[l-n] = 0;
-        free(str);
-        str = tmp;
-        size = l-n+1;
-        return *this;
+        return keep(n, l-n);
     }
 
     int count(char c) const {
@@ -1130,11 +1367,12 @@ struct jo_string {
     }
 };
 
-static inline jo_string operator+(const jo_string &lhs, const jo_string &rhs) { jo_string ret(lhs); ret += rhs; return ret; }
-static inline jo_string operator+(const jo_string &lhs, const char *rhs) { jo_string ret(lhs); ret += rhs; return ret; }
-static inline jo_string operator+(const char *lhs, const jo_string &rhs) { jo_string ret(lhs); ret += rhs; return ret; }
-static inline jo_string operator+(const jo_string &lhs, char rhs) { jo_string ret(lhs); ret += rhs; return ret; }
-static inline jo_string operator+(char lhs, const jo_string &rhs) { jo_string ret(lhs); ret += rhs; return ret; }
+static inline jo_string jo_string_concat(const char *a, size_t na, const char *b, size_t nb) { jo_string ret; ret.reserve(na + nb); ret.append(a, na); ret.append(b, nb); return ret; }
+static inline jo_string operator+(const jo_string &lhs, const jo_string &rhs) { return jo_string_concat(lhs.c_str(), lhs.length(), rhs.c_str(), rhs.length()); }
+static inline jo_string operator+(const jo_string &lhs, const char *rhs) { return jo_string_concat(lhs.c_str(), lhs.length(), rhs, strlen(rhs)); }
+static inline jo_string operator+(const char *lhs, const jo_string &rhs) { return jo_string_concat(lhs, strlen(lhs), rhs.c_str(), rhs.length()); }
+static inline jo_string operator+(const jo_string &lhs, char rhs) { return jo_string_concat(lhs.c_str(), lhs.length(), &rhs, 1); }
+static inline jo_string operator+(char lhs, const jo_string &rhs) { return jo_string_concat(&lhs, 1, rhs.c_str(), rhs.length()); }
 static inline bool operator==(const jo_string &lhs, const jo_string &rhs) { return !strcmp(lhs.c_str(), rhs.c_str()); }
 static inline bool operator==(const char *lhs, const jo_string &rhs) { return !strcmp(lhs, rhs.c_str()); }
 static inline bool operator==(const jo_string &lhs, const char *rhs) { return !strcmp(lhs.c_str(), rhs); }
@@ -1177,6 +1415,70 @@ struct jo_stringstream {
     }
 };
 
+// Growable output buffer. Appends to memory, and when given a file, flushes to it whenever it fills.
+struct jo_text_writer_t {
+    char *buf;
+    size_t size, cap;
+    FILE *fp;
+
+    jo_text_writer_t(FILE *f = NULL, size_t initial_cap = 1 << 16) : buf((char*)malloc(initial_cap)), size(0), cap(initial_cap), fp(f) {}
+    jo_text_writer_t(const jo_text_writer_t &) = delete;
+    ~jo_text_writer_t() {
+        flush();
+        free(buf);
+    }
+
+    void flush() {
+        if(fp && size) {
+            fwrite(buf, 1, size, fp);
+            size = 0;
+        }
+    }
+    void reserve(size_t n) {
+        if(size + n <= cap) return;
+        if(fp) {
+            flush();
+            if(n <= cap) return;
+        }
+        while(cap < size + n) cap *= 2;
+        buf = (char*)realloc(buf, cap);
+    }
+    inline void put(char c) {
+        if(size == cap) reserve(1);
+        buf[size++] = c;
+    }
+    inline void put(const char *s, size_t n) {
+        reserve(n);
+        memcpy(buf + size, s, n);
+        size += n;
+    }
+    inline void put(const char *s) { put(s, strlen(s)); }
+    void putf(const char *fmt, ...) {
+        reserve(64);
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(buf + size, cap - size, fmt, args);
+        va_end(args);
+        if(n >= (int)(cap - size)) {
+            reserve(n + 1);
+            va_start(args, fmt);
+            vsnprintf(buf + size, cap - size, fmt, args);
+            va_end(args);
+        }
+        size += n;
+    }
+    // shortest %g that reads back as the same double
+    void put_double(double d) {
+        char tmp[32];
+        for(int prec = 15; prec <= 17; ++prec) {
+            snprintf(tmp, sizeof(tmp), "%.*g", prec, d);
+            if(strtod(tmp, NULL) == d) break;
+        }
+        put(tmp);
+    }
+    jo_string str() const { return jo_string(buf, size); }
+};
+
 
 #if !defined(__PLACEMENT_NEW_INLINE) && !defined(_WIN32)
 //inline void *operator new(size_t, void *p) { return p; }
@@ -1509,7 +1811,9 @@ struct jo_fastsemaphore {
 // https://cbloomrants.blogspot.com/2011/07/07-09-11-lockfree-thomasson-simple-mpmc.html
 template <typename T, T invalid_value, int T_depth>
 struct jo_mpmcq {
-    std::atomic<T> slots[T_depth];
+    // On the heap rather than inline: a zero invalid_value then comes straight from calloc, so
+    // a deep queue costs nothing until it's used instead of touching every slot at startup.
+    std::atomic<T> *slots;
     char pad1[64];
     std::atomic<size_t> push_idx;
     char pad2[64];
@@ -1523,10 +1827,17 @@ struct jo_mpmcq {
     char pad6[64];
 
     jo_mpmcq() : push_idx(T_depth), pop_idx(0), push_sem(T_depth), pop_sem(0), closing(false) {
-        for (size_t i = 0; i < T_depth; ++i) {
-            slots[i].store(invalid_value);
+        if (invalid_value == T()) {
+            slots = (std::atomic<T> *)calloc(T_depth, sizeof(std::atomic<T>));
+        } else {
+            slots = (std::atomic<T> *)malloc(T_depth * sizeof(std::atomic<T>));
+            for (size_t i = 0; i < T_depth; ++i) {
+                slots[i].store(invalid_value);
+            }
         }
     }
+    jo_mpmcq(const jo_mpmcq &) = delete;
+    ~jo_mpmcq() { free(slots); }
 
     void push(T ptr) {
         push_sem.wait();
@@ -2077,6 +2388,13 @@ struct jo_hash_map {
         return *this;
     }
 
+    // Multiplies the hash through before taking the slot: string hashes differ mostly in their
+    // high bits, and with linear probing the low ones decide how long the clusters get.
+    static size_t slot_of(const K &key, size_t n) {
+        unsigned long long h = (unsigned long long)jo_hash_value(key) * 0x9E3779B97F4A7C15ull;
+        return (size_t)(h ^ (h >> 32)) % n;
+    }
+
     size_t size() const { return length; }
     bool empty() const { return !length; }
 
@@ -2125,7 +2443,7 @@ struct jo_hash_map {
         jo_vector<entry_t,32> nv(new_size);
         for(iterator it = begin(); it; ++it) {
             auto &entry = *it;
-            int index = jo_hash_value(entry.first) % new_size;
+            int index = slot_of(entry.first, new_size);
             while(nv[index].third) {
                 index = (index + 1) % new_size;
             }
@@ -2139,7 +2457,7 @@ struct jo_hash_map {
         if(vec.size() - length < vec.size() / 8) {
             resize(vec.size() * 2);
         }
-        int index = jo_hash_value(key) % vec.size();
+        int index = slot_of(key, vec.size());
         entry_t e = vec[index];
         while(e.third) {
             if(e.first == key) {
@@ -2160,7 +2478,7 @@ struct jo_hash_map {
         if(vec.size() - length < vec.size() / 8) {
             resize(vec.size() * 2);
         }
-        int index = jo_hash_value(key) % vec.size();
+        int index = slot_of(key, vec.size());
         entry_t e = vec[index];
         while(e.third) {
             if(eq(e.first, key)) {
@@ -2178,7 +2496,7 @@ struct jo_hash_map {
     // dissoc_inplace
     template<typename F>
     void dissoc(const K &key, F eq) {
-        int index = jo_hash_value(key) % vec.size();
+        int index = slot_of(key, vec.size());
         entry_t e = vec[index];
         while(e.third) {
             if(eq(e.first, key)) {
@@ -2194,7 +2512,7 @@ struct jo_hash_map {
                         break;
                     }
                     entry_t next_entry = vec[j];
-                    if(jo_hash_value(next_entry.first) % vec.size() <= i) {
+                    if(slot_of(next_entry.first, vec.size()) <= i) {
                         vec[i] = next_entry;
                         vec[j] = entry_t();
                         i = j;
@@ -2209,7 +2527,7 @@ struct jo_hash_map {
 
     // find using lambda
     entry_t find(const K &key) const {
-        size_t index = jo_hash_value(key) % vec.size();
+        size_t index = slot_of(key, vec.size());
         entry_t e = vec[index];
         while(e.third) {
             if(e.first == key) {
@@ -2224,7 +2542,7 @@ struct jo_hash_map {
     // find using lambda
     template<typename F>
     entry_t find(const K &key, const F &f) const {
-        size_t index = jo_hash_value(key) % vec.size();
+        size_t index = slot_of(key, vec.size());
         entry_t e = vec[index];
         while(e.third) {
             if(f(e.first, key)) {
@@ -2243,7 +2561,7 @@ struct jo_hash_map {
     }
 
     V &get(const K &key) {
-        size_t index = jo_hash_value(key) % vec.size();
+        size_t index = slot_of(key, vec.size());
         entry_t e = vec[index];
         while(e.third) {
             if(e.first == key) {
@@ -2258,7 +2576,7 @@ struct jo_hash_map {
 
     template<typename F>
     V &get(const K &key, const F &f) {
-        size_t index = jo_hash_value(key) % vec.size();
+        size_t index = slot_of(key, vec.size());
         entry_t e = vec[index];
         while(e.third) {
             if(f(e.first, key)) {
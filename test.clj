@@ -418,7 +418,16 @@
   ;(is (= 0.5       1/2)) ; don't support ratios yet
   ;(is (= 0.33333   1/3)) ; don't support ratios yet
   (is (= 3501      0xDAD))
-  (is (= 2748      0xABC)))
+  (is (= 2748      0xABC))
+  (is (= 254       0xFE))
+  (is (= 30        0x1E))
+  (is (= 224       0xE0))
+  (is (= -16       -0x10))
+  (is (= 5         0b101))
+  (is (= 15        017))
+  (is (= 0x7FFFFFFFFFFFFFFF (read-string "9223372036854775807")))
+  (is (= 4294967296 0x100000000))
+  (is (= 1.8446744073709552e19 (read-string "0x10000000000000000"))))
 (defn zero?-test []
   (is (= true  (zero? 0)))
   (is (= false (zero? 10)))
@@ -567,10 +576,370 @@
               (cons x (recursive-range (inc x) y))))
           5 10))))
 
+(defn tensor-test []
+  (let [a (tensor [[1 2 3] [4 5 6]])]
+    (is (= [2 3]                 (tensor/shape a)))
+    (is (= [[11 22 33] [14 25 36]] (tensor/->vec (tensor/add a [10 20 30]))))
+    (is (= [[14 32] [32 77]]     (tensor/->vec (tensor/matmul a (tensor/transpose a)))))
+    (is (= [5 7 9]               (tensor/->vec (tensor/sum a 0))))
+    (is (= [[2 3] [5 6]]         (tensor/->vec (tensor/slice a 1 1 3))))
+    (is (= [3 2]                 (tensor/shape (tensor/reshape a [3 -1]))))
+    (is (= [4 2 5]               (tensor/shape (tensor/matmul (tensor/ones [4 2 3]) (tensor/ones [3 5]))))))
+  (is (= nil                     (tensor/zeros [-5])))
+  (is (= nil                     (tensor/ones [100000000000 100000000000])))
+  (is (= nil                     (tensor/rand [2000000000000000000])))
+  (is (= nil                     (tensor/arange -1)))
+  (is (= [0]                     (tensor/shape (tensor/zeros [0]))))
+  (let [f (tensor/astype (tensor [[1 2 3] [4 5 6]]) :float32)]
+    (is (= :float32              (tensor/dtype f)))
+    (is (= [[14 32] [32 77]]     (tensor/->vec (tensor/matmul f (tensor/transpose f)))))
+    (is (= 21                    (tensor/->vec (tensor/sum f)))))
+  ; odd sizes so the AVX2 kernels run their 4-row, 16/8-column and scalar tails; small integers are exact in float32
+  (let [a  (tensor/reshape (tensor/arange (* 7 19)) [7 19])
+        b  (tensor/reshape (tensor/arange (* 19 29)) [19 29])
+        a32 (tensor/astype a :float32)
+        b32 (tensor/astype b :float32)
+        lo (fn [t] (tensor/accumulator t :float32))
+        s  (tensor/astype (tensor/arange 1003) :float32)]
+    (is (= (tensor/->vec (tensor/matmul a b)) (tensor/->vec (tensor/matmul a32 b32))))
+    (is (= (tensor/->vec (tensor/matmul a b)) (tensor/->vec (tensor/matmul (lo a32) (lo b32)))))
+    (is (= 502503                (tensor/->vec (tensor/sum s))))
+    (is (= 502503                (tensor/->vec (tensor/sum (lo s)))))
+    (is (= :float64              (tensor/accumulator a32)))
+    (is (= :float32              (tensor/accumulator (tensor/matmul (lo a32) (lo b32)))))
+    (is (= :float64              (tensor/accumulator (tensor/matmul (lo a32) b32))))))
+
+(defn backward-test []
+  (let [lin  {:type :linear :weights (tensor [[1] [1]]) :bias (tensor [0])}
+        X    (tensor [[1 2]])
+        grad (fn [m y loss] (let [g (:layer1 (nn/backward m X (tensor [[y]]) loss))]
+                              [(tensor/->vec (:weights g)) (tensor/->vec (:bias g))]))]
+    (is (= [[[3] [6]] [3]]       (grad {:layer1 lin} 0 nil)))
+    (is (= [[[3] [6]] [3]]       (grad {:layer1 lin :layer2 {:type :dropout :drop-prob 0 :scale 1}} 0 nil)))
+    (is (= [[[3] [6]] [3]]       (grad {:layer1 lin :layer2 {:type :dropout :drop-prob 0 :scale 1}} 0 :mse)))
+    (is (= [[[2] [4]] [2]]       (grad {:layer1 lin} 1 nil)))
+    (is (> 1e-6 (Math/abs (+ 0.0474259 (first (second (grad {:layer1 (assoc lin :activation :sigmoid)} 1 nil)))))))))
+
+(defn optimizer-test []
+  ; float32 parameters are stepped in float32 and match a float64 step to float precision
+  (let [model (fn [] {:layer1 {:type :linear :weights (tensor [[1] [1]]) :bias (tensor [0])}})
+        grads (nn/backward (model) (tensor [[1 2]]) (tensor [[0]]))
+        close (fn [a b] (> 1e-6 (Math/abs (- a b))))
+        check (fn [make step]
+                (let [w64 (-> (step (make (model)) grads) :model :layer1 :weights)
+                      w32 (-> (step (make (nn/astype (model) :float32)) (nn/astype grads :float32)) :model :layer1 :weights)]
+                  (and (= :float32 (tensor/dtype w32))
+                       (close (tensor/get w64 [0 0]) (tensor/get w32 [0 0]))
+                       (close (tensor/get w64 [1 0]) (tensor/get w32 [1 0])))))]
+    (is (check #(nn/adam % 0.1 0.9 0.999 1e-8) nn/adam-step))
+    (is (check #(nn/rmsprop % 0.1 0.9 1e-8) nn/rmsprop-step))
+    (is (check #(nn/adamw % 0.1 0.9 0.999 1e-8 0.01) nn/adamw-step))))
+
+(defn model-file-test []
+  (let [model {:layer1 {:type :linear :weights (tensor [[1 2] [3 4]] :float32) :bias (tensor [0.5 -0.5]) :units 2}}]
+    (is (= true                  (nn/save-model model "tmp-model.bin")))
+    (let [loaded (nn/load-model "tmp-model.bin")]
+      (is (= [[1 2] [3 4]]       (tensor/->vec (-> loaded :layer1 :weights))))
+      ; the loaded tensors are mapped from the file being replaced
+      (is (= true                (nn/save-model (assoc-in loaded [:layer1 :units] 3) "tmp-model.bin")))
+      (is (= [0.5 -0.5]          (tensor/->vec (-> loaded :layer1 :bias))))
+      (is (= 3                   (-> (nn/load-model "tmp-model.bin") :layer1 :units)))
+      (is (= true                (nn/save-model loaded "tmp-model.bin" :text)))
+      (is (= [[1 2] [3 4]]       (tensor/->vec (-> (nn/load-model "tmp-model.bin") :layer1 :weights))))))
+  (spit "tmp-model.bin" "LAYER layer1\nTENSOR weights float64 1 -5\nEND_LAYER\n")
+  (is (= nil                     (nn/load-model "tmp-model.bin")))
+  (spit "tmp-model.bin" "LAYER layer1\nTENSOR weights float64 2 100000000000 100000000000\nEND_LAYER\n")
+  (is (= nil                     (nn/load-model "tmp-model.bin")))
+  (io/delete-file "tmp-model.bin"))
+
+(defn edn-test []
+  (let [v {:a [1 2.5 "x\ny"] :b #{:k nil} :c (list true false)}]
+    (is (= v                     (edn/read-string (edn/write v))))
+    (is (= [1 2]                 (edn/read-string "#_ :skip [1 #_ 3 2]")))
+    (is (= "2020"                (edn/read-string "#inst \"2020\"")))
+    (is (= :done                 (edn/read-string {:eof :done} "; empty")))))
+
+(defn json-test []
+  (let [v {:a [1 2.5 "x\ny"] :b nil :c true}]
+    (is (= v                     (json/read-str (json/write-str v) :key-fn keyword)))
+    (is (= {"k" [1 {"n" nil}]}   (json/read-str "{\"k\": [1, {\"n\": null}]}")))
+    (is (= "A\tB"                (json/read-str "\"\\u0041\\tB\"")))
+    (is (= "[1,2,3]"             (json/write-str (list 1 2 3)))))
+  (is (= 1234567890123456789     (json/read-str "1234567890123456789")))
+  (is (integer?                  (json/read-str "1234567890123456789")))
+  (is (integer?                  (json/read-str "-9223372036854775808")))
+  (is (= 1e19                    (json/read-str "10000000000000000000")))
+  (is (= [1]                     (json/read-str " [1] \n")))
+  (is (= nil                     (json/read-str "[1] x"))))
+
+(defn csv-test []
+  (spit "tmp.csv" "a,b,c\n1,\"x, \"\"y\"\"\",2.5\n2,z,\n")
+  (is (= [["a" "b" "c"] ["1" "x, \"y\"" "2.5"] ["2" "z" ""]] (vec (csv/read "tmp.csv"))))
+  (let [cols (csv/read-columns "tmp.csv")]
+    (is (= 3                     (+ (aget (:a cols) 0) (aget (:a cols) 1))))
+    (is (= 2.5                   (aget (:c cols) 0)))
+    (is (= ["x, \"y\"" "z"]     (:b cols))))
+  (io/delete-file "tmp.csv"))
+
+(defn data-loader-test []
+  (spit "tmp-loader.csv" "\"x\",\"y, label\"\r\n1,\"2.5\"\r\n\"3\",4\n\n5,\n")
+  (let [[x y] (first (nn/data-loader "tmp-loader.csv" {:batch-size 3 :targets 1 :shuffle false}))]
+    (is (= [[1] [3] [5]]         (tensor/->vec x)))
+    (is (= [[2.5] [4] [0]]       (tensor/->vec y))))
+  (is (= [2 1]                   (mapv #(first (tensor/shape %)) (nn/data-loader "tmp-loader.csv" {:batch-size 2}))))
+  (io/delete-file "tmp-loader.csv"))
+
+(defn form-cache-test []
+  ; big enough to go through the form cache; load-string never does. Runs in a child so the
+  ; entries go to a scratch cache rather than the user's.
+  (let [jclj (first *command-line-args*)
+        src  (str (apply str (map #(str "(def cache-pad-" % " [" % " {:k " % "} \"" % "\"])\n") (range 200))) "(rand-int 1000000)\n")
+        run  (fn [env] (re-seq #"\d+" (sys/exec-output env jclj "tmp-cache-main.clj")))
+        entries (fn [dir] (count (file-seq dir :glob "*.forms")))]
+    (spit "tmp-cache.clj" src)
+    (spit "tmp-cache-main.clj" "(defn roll [f] (Math/srand 7) (f))\n(println (roll #(load-string (slurp \"tmp-cache.clj\"))) (roll #(load-file \"tmp-cache.clj\")) (roll #(load-file \"tmp-cache.clj\")))\n")
+    (is (< 4096 (count src)))
+    (let [[parsed miss hit] (run "XDG_CACHE_HOME=tmp-xdg")]
+      (is (= parsed              miss))
+      (is (= parsed              hit)))
+    (is (= 1                     (entries "tmp-xdg/jclj")))
+    (run "XDG_CACHE_HOME=tmp-xdg-off JCLJ_FORM_CACHE=0")
+    (is (= nil                   (file-seq "tmp-xdg-off")))
+    (sys/exec "mkdir -p tmp-forms")
+    (doseq [i (range 300)] (spit (str "tmp-forms/old-" i ".forms") ""))
+    (run "JCLJ_FORM_CACHE=tmp-forms")
+    (is (= 256                   (entries "tmp-forms")))
+    (io/delete-file "tmp-cache.clj")
+    (io/delete-file "tmp-cache-main.clj")
+    (sys/exec "rm -rf tmp-xdg tmp-xdg-off tmp-forms")))
+
+(defn image-test []
+  (let [jclj (first *command-line-args*)]
+    (spit "tmp-image-lib.clj" "(def img-v {:a [1 2] :b \"x\"})\n(defn img-f [x] (* x (count (:a img-v))))\n")
+    (spit "tmp-image-main.clj" "(println (img-f 4) (:b img-v))\n")
+    (sys/exec-output jclj "--save-image" "tmp-image.img" "tmp-image-lib.clj")
+    (is (= "8 x"                 (trim (sys/exec-output jclj "--load-image" "tmp-image.img" "tmp-image-main.clj"))))
+    ; a vector shared between a set, a map key and another vector has to be complete before it's hashed
+    (spit "tmp-image-lib.clj" "(def img-v [1 2])\n(def img-s #{img-v [3]})\n(def img-m {img-v :x #{img-v} :y})\n(def img-w [img-v img-s])\n")
+    (spit "tmp-image-main.clj" "(println (contains? img-s [1 2]) (img-m [1 2]) (img-m #{[1 2]}) (= img-w [[1 2] #{[1 2] [3]}]))\n")
+    (sys/exec-output jclj "--save-image" "tmp-image.img" "tmp-image-lib.clj")
+    (is (= "true :x :y true"     (trim (sys/exec-output jclj "--load-image" "tmp-image.img" "tmp-image-main.clj"))))
+    (io/delete-file "tmp-image-lib.clj")
+    (io/delete-file "tmp-image-main.clj")
+    (io/delete-file "tmp-image.img")))
+
+(defn flush-test []
+  (let [f (io/open-file "w" "tmp-flush.txt")]
+    (let [*out* f]
+      (print "a")
+      (flush))
+    (is (= "a"                   (slurp "tmp-flush.txt")))
+    (io/close-file f))
+  ; stdout unbuffered in C, so the order only depends on when the print buffer is handed over
+  (spit "tmp-flush.clj" "(print \"a\") (let [*out* *err*] (println \"e\")) (println \"b\") (let [*out* *err*] (print \"f\")) (flush)")
+  (is (= ["e" "ab" "f"]          (re-seq #"\w+" (sys/exec-output "stdbuf -o0" (first *command-line-args*) "tmp-flush.clj" "2>&1"))))
+  (io/delete-file "tmp-flush.clj")
+  (io/delete-file "tmp-flush.txt"))
+
+(defn regex-test []
+  ; split and replace follow Java, including its empty-match rules
+  (is (= ["a" "b" "" "c"]        (split "a,b,,c,," #",")))
+  (is (= ["" "a" "b"]            (split ",a,b" #",")))
+  (is (= ["a" "b" "c"]           (split "abc" #"")))
+  (is (= ["a" "b" "c"]           (split "a1b22c" #"\d+")))
+  (is (= "a-b-c"                 (String/replace "a.b.c" #"\." "-")))
+  (is (= "_x__y__"               (String/replace "x1y22" #"\d*" "_")))
+  (is (= "baa"                   (String/replace-first "aaa" #"a" "b")))
+  (is (= "smith john"            (String/replace "john smith" #"(\w+) (\w+)" "$2 $1")))
+  (is (= "a[b]c"                 (String/replace "abc" #"b" #(str "[" % "]"))))
+  (is (= ["" "aaa" "" ""]        (re-seq #"a*" "baaac")))
+  ; alternation is leftmost-first, not longest
+  (is (= "cat"                   (re-find #"cat|category" "category")))
+  (is (= "dogs"                  (re-find #"(?:cat|dog)s?" "hotdogs")))
+  (is (= ["abcd" "a" "bcd"]      (re-matches #"(a|ab)(c|bcd)" "abcd")))
+  (is (= nil                     (re-matches #"a|b" "ab")))
+  (is (= ["10-20" "10" "20"]     (re-find #"(\d+)-(\d+)" "x 10-20 y")))
+  (is (= nil                     (re-find #"(a+)+$" (str (apply str (repeat 40 "a")) "b"))))
+  ; no linear-time match for these, so they're refused up front
+  (is (= nil                     (re-pattern "a(?=b)")))
+  (is (= nil                     (re-pattern "(?<=a)b")))
+  (is (= nil                     (re-pattern "(a)\\1"))))
+
+(defn reactor-test []
+  (let [port 18741
+        r (net/reactor)
+        srv (net/socket)]
+    (net/bind srv "127.0.0.1" port)
+    (net/listen srv 16)
+    ; echo server that says bye when the client is done
+    (net/watch-accept r srv (fn [fd] (net/watch r fd (fn [fd data] (net/write r fd data)) (fn [fd] (net/write r fd "bye")))))
+    (let [c (net/connect (net/socket) "127.0.0.1" port)
+          s (net/stream c)]
+      (net/send c "hello\n")
+      (is (= "hello"             (net/read-line s)))
+      (net/shutdown c)
+      (is (= "bye"               (net/read s)))
+      (is (= nil                 (net/read s)))
+      (net/close c))
+    ; more than the server buffers before pausing, sent before anything is read back
+    (let [c (net/connect (net/socket) "127.0.0.1" port)
+          s (net/stream c)
+          big (nth (iterate #(str % %) "0123456789") 18)]
+      (net/send c big)
+      (net/shutdown c)
+      (is (= big                 (net/read-bytes s (count big))))
+      (is (= "bye"               (net/read s)))
+      (net/close c))
+    (net/reactor-stop r)
+    (net/close srv)))
+
+(defn frame-test []
+  (let [port 18742
+        srv (net/socket)]
+    (net/bind srv "127.0.0.1" port)
+    (net/listen srv 4)
+    (let [c (net/connect (net/socket) "127.0.0.1" port)
+          a (net/accept srv)
+          out (net/stream c)
+          in (net/stream a)]
+      (net/write-frame out "hello")
+      (net/write-frame out "")
+      (net/write-frame out "0123456789")
+      (net/flush out)
+      (is (= "hello"             (net/read-frame in)))
+      (is (= ""                  (net/read-frame in)))
+      (is (= nil                 (net/read-frame in 4)))
+      (net/close out)
+      (net/close in))
+    (net/close srv)))
+
+(defn send-file-test []
+  (let [port 18743
+        srv (net/socket)]
+    (spit "tmp-send.txt" "0123456789abcdef")
+    (net/bind srv "127.0.0.1" port)
+    (net/listen srv 4)
+    (let [c (net/connect (net/socket) "127.0.0.1" port)
+          a (net/accept srv)
+          in (net/stream a)]
+      (is (= 16                  (net/send-file c "tmp-send.txt")))
+      (is (= 4                   (net/send-file c "tmp-send.txt" 10 4)))
+      (is (= "0123456789abcdef"  (net/read-bytes in 16)))
+      (is (= "abcd"              (net/read-bytes in 4)))
+      (net/close c)
+      (net/close a))
+    (net/close srv)
+    (io/delete-file "tmp-send.txt")))
+
+(defn http-test []
+  (let [server (http/serve [[:get #"/hello/(\w+)" (fn [req] (str "hi " (first (:route-params req))))]
+                            [:post #"/echo" (fn [req] {:status 201 :headers {"X-Len" (str (count (:body req)))} :body (:body req)})]]
+                           {:host "127.0.0.1" :port 0 :join? false})
+        url (str "http://127.0.0.1:" (http/port server))]
+    (let [r (http/request {:url (str url "/hello/bob") :as :string})]
+      (is (= 200                 (:status r)))
+      (is (= "hi bob"            (:body r))))
+    (let [r (http/request {:url (str url "/echo") :method :post :body "payload" :as :string})]
+      (is (= 201                 (:status r)))
+      (is (= "7"                 (get (:headers r) "x-len")))
+      (is (= "payload"           (:body r))))
+    (is (= 404                   (:status (http/request {:url (str url "/nope")}))))
+    (http/stop server)))
+
+(defn http-request-test []
+  (let [server (http/serve (fn [req] (str (:query-string req))) {:host "127.0.0.1" :port 0 :join? false})
+        url (str "http://127.0.0.1:" (http/port server))]
+    (is (= ["i=0" "i=1" "i=2"]   (mapv #(:body (deref %)) (mapv (fn [i] (http/request-async {:url url :query-params {:i i} :as :string})) (range 3)))))
+    (is (= "a=b"                 (:body (http/request {:url (str url "/x?a=b") :as :string}))))
+    (http/stop server))
+  (is (contains?                 (http/request {:url "http://127.0.0.1:1/"}) :error)))
+
+(defn chunk-seq-test []
+  (let [s (apply str (map str (range 1000)))]
+    (spit "tmp-chunks.txt" (map str (range 1000)))
+    (is (= s                     (slurp "tmp-chunks.txt")))
+    (is (= 29                    (count (io/chunk-seq "tmp-chunks.txt" 100))))
+    (is (= 2890                  (reduce + (map alength (io/chunk-seq "tmp-chunks.txt" 100)))))
+    (spit "tmp-chunks.txt" "x" :append true)
+    (is (= (str s "x")           (slurp "tmp-chunks.txt"))))
+  (let [w (io/writer "tmp-chunks.txt" :buffer-size 16)]
+    (spit w (repeat 10 "abc"))
+    (io/close-file w))
+  (let [r (io/reader "tmp-chunks.txt" :buffer-size 16)]
+    (is (= 30                    (alength (first (io/chunk-seq r)))))
+    (io/close-file r))
+  (io/delete-file "tmp-chunks.txt"))
+
+(defn mmap-test []
+  (spit "tmp-mmap.bin" "hello")
+  (let [m (io/mmap "tmp-mmap.bin")]
+    (is (= 5                     (alength m)))
+    (is (= 104                   (aget m 0))))
+  (let [m (io/mmap "tmp-mmap.bin" :copy-on-write true)]
+    (aset m 0 74)
+    (is (= 74                    (aget m 0)))
+    (is (= "hello"               (slurp "tmp-mmap.bin"))))
+  (io/delete-file "tmp-mmap.bin"))
+
+(defn line-seq-test []
+  (let [big (nth (iterate #(str % %) "0123456789") 18)]
+    (spit "tmp-lines.txt" (str "a\r\n" big "\r\nb\n\nc"))
+    (let [f  (io/reader "tmp-lines.txt")
+          ls (doall (line-seq f))]
+      (is (= 5                     (count ls)))
+      (is (= ["a" "b" "" "c"]      (remove #(= big %) ls)))
+      (is (= true                  (= big (second ls))))
+      (io/close-file f))
+    (io/delete-file "tmp-lines.txt"))
+  (let [p  (io/open-proc "echo first; sleep 2; printf 'second\\r\\n'" "r")
+        t  (time/now)
+        at (atom [])
+        ls (doall (map (fn [l] (swap! at conj (- (time/now) t)) l) (line-seq p)))]
+    (is (= ["first" "second"]    ls))
+    (is (= true                  (< (first @at) 1.5)))
+    (io/close-proc p)))
+
+(defn file-seq-test []
+  (sys/exec "mkdir -p tmp-walk/a/b")
+  (spit "tmp-walk/a/b/x.txt" "x")
+  (spit "tmp-walk/a/y.txt" "y")
+  (spit "tmp-walk/z.txt" "z")
+  (let [fs (doall (file-seq "tmp-walk"))]
+    (is (= "tmp-walk"              (first fs)))
+    (is (= 6                       (count fs)))
+    (is (= #{"tmp-walk" "tmp-walk/a" "tmp-walk/a/b" "tmp-walk/a/b/x.txt" "tmp-walk/a/y.txt" "tmp-walk/z.txt"} (set fs))))
+  (is (= ["tmp-walk/z.txt"]      (doall (file-seq "tmp-walk" :glob "z*"))))
+  (is (= ["tmp-walk/z.txt"]      (doall (file-seq "tmp-walk" {:glob "z*"}))))
+  (is (= 3                       (count (file-seq "tmp-walk" {:dirs false :threads 1}))))
+  (is (= nil                     (file-seq "tmp-walk" :glob)))
+  (is (= nil                     (file-seq "tmp-walk" :pattern "z*")))
+  (is (= 3                       (count (file-seq "tmp-walk" :dirs false :threads 1))))
+  (let [w (doall (file-seq "tmp-walk" :threads 1))]
+    (is (= "tmp-walk"              (first w))))
+  (is (= 6                       @(future (count (file-seq "tmp-walk")))))
+  (let [fs (doall (map (fn [_] (future (count (file-seq "tmp-walk")))) (range 64)))]
+    (is (= #{6}                    (set (map deref fs)))))
+  (sys/exec "rm -rf tmp-walk"))
+
+(defn aio-test []
+  (let [ws (doall (map (fn [i] (io/write-async (str "tmp-aio" i ".txt") (str "file " i))) (range 8)))]
+    (is (= 48                    (reduce + (map deref ws))))
+    (is (= ["file 0" "file 7"]   (mapv #(deref (io/read-async (str "tmp-aio" % ".txt") :as :string)) [0 7]))))
+  (is (= 5                       @(io/write-async "tmp-aio0.txt" " more" :append true)))
+  (is (= "0 m"                   @(io/read-async "tmp-aio0.txt" :offset 5 :length 3 :as :string)))
+  (is (= 11                      (alength @(io/read-async "tmp-aio0.txt"))))
+  (is (= true                    @(io/fsync-async "tmp-aio0.txt")))
+  (is (= nil                     @(io/read-async "tmp-aio-missing.txt")))
+  (dotimes [i 8] (io/delete-file (str "tmp-aio" i ".txt"))))
+
 (def fib-seq-iterate (map first (iterate (fn [[a b]] [b (+ a b)]) [0 1])))
 (is (= (take 5 fib-seq-iterate) (list 0 1 1 2 3)))
 
 (is (= (as-> 0 n (inc n) (inc n)) 2))
+(is (= -9223372036854775808 (dec (read-string "-9223372036854775807"))))
+(is (= 9223372036854775807 (read-string "9223372036854775807")))
+(is (= 1e19 (read-string "10000000000000000000")))
+(is (= 1e150 (read-string (str "1" (apply str (repeat 150 "0")) ".0"))))
 (is (= (array-map :a 1 :b 2) {:a 1 :b 2}))
 (is (= (cond-> 1, true inc, false (* 42), (= 2 2) (* 3)) 6))
 (is (= (cond->> 1, true inc, false (* 42), (= 2 2) (* 3)) 6))
@@ -1162,6 +1531,28 @@
 (to-degrees-radians-test)
 (random-test)
 (fn-test)
+(tensor-test)
+(backward-test)
+(optimizer-test)
+(model-file-test)
+(edn-test)
+(json-test)
+(csv-test)
+(data-loader-test)
+(form-cache-test)
+(image-test)
+(flush-test)
+(regex-test)
+(reactor-test)
+(frame-test)
+(send-file-test)
+(http-test)
+(http-request-test)
+(chunk-seq-test)
+(mmap-test)
+(line-seq-test)
+(file-seq-test)
+(aio-test)
 
 ;(println "All done!")
 ;(while (not (sys/kbhit)) (Thread/sleep 100))